@@ -91,6 +91,74 @@ void rootdev_get_device_slave(char *slave, size_t size, dev_t *dev,
 int rootdev_get_path(char *path, size_t size, const char *device, dev_t dev,
                      const char *dev_path);
 
+/**
+ * rootdev_ctx: the sysfs and dev trees to look devices up in, kept open,
+ * and the names found in them so far.  The functions above each set one up
+ * and tear it down again; programs asking repeatedly can keep their own.
+ * A context must not be used by several threads at once.
+ */
+struct rootdev_ctx;
+
+/**
+ * rootdev_ctx_new: opens @search (NULL for /sys/block) and @dev_path (NULL
+ * for /dev).  Trees that don't exist are not an error, nothing is found in
+ * them.  Returns NULL if out of memory.
+ */
+struct rootdev_ctx *rootdev_ctx_new(const char *search, const char *dev_path);
+void rootdev_ctx_free(struct rootdev_ctx *ctx);
+/**
+ * rootdev_ctx_flush: forgets the names found so far, e.g. after a hotplug
+ * event renamed devices.
+ */
+void rootdev_ctx_flush(struct rootdev_ctx *ctx);
+
+/* The functions above, against a context. */
+int rootdev_ctx_wrapper(struct rootdev_ctx *ctx, char *path, size_t size,
+                        bool full, bool strip, dev_t *dev);
+int rootdev_ctx_get_device(struct rootdev_ctx *ctx, char *dst, size_t size,
+                           dev_t dev);
+void rootdev_ctx_get_device_slave(struct rootdev_ctx *ctx, char *slave,
+                                  size_t size, dev_t *dev,
+                                  const char *device);
+int rootdev_ctx_get_path(struct rootdev_ctx *ctx, char *path, size_t size,
+                         const char *device, dev_t dev);
+
+/**
+ * rootdev_node: one device in the stack under a root device.
+ * @dev: its dev_t
+ * @name: its kernel name, like "sda1" or "dm-0"
+ * @partition: its partition number, 0 for whole devices
+ * @disk: for partitions, the name of the disk holding it if known
+ * @parent: index of the node it backs, -1 for the device asked about
+ * @depth: levels below the device asked about
+ * @num_slaves: devices it is built on, 0 for disks and their partitions
+ */
+struct rootdev_node {
+  dev_t dev;
+  char name[256];
+  int partition;
+  char disk[256];
+  int parent;
+  int depth;
+  int num_slaves;
+};
+
+/**
+ * rootdev_get_topology: walks the devices @dev is built on, e.g. the
+ * mirrors of an md RAID under dm-verity, in one pass over sysfs.
+ * @nodes: array to fill, @dev first, then its slaves level by level
+ * @max_nodes: size of @nodes
+ * @search: path to search under. NULL for default.
+ *
+ * Each device is listed once even if several others are built on it.
+ * Returns the number of nodes, or -1 with errno set: ENOENT if @dev isn't
+ * found, ENOBUFS if @nodes is too small.
+ */
+int rootdev_get_topology(dev_t dev, struct rootdev_node *nodes, int max_nodes,
+                         const char *search);
+int rootdev_ctx_get_topology(struct rootdev_ctx *ctx, dev_t dev,
+                             struct rootdev_node *nodes, int max_nodes);
+
 const char *rootdev_get_partition(const char *dst, size_t len);
 void rootdev_strip_partition(char *dst, size_t len);
 int rootdev_symlink_active(const char *path);
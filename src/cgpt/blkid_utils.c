@@ -2,8 +2,12 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#ifndef CGPT_MINI
 #include <blkid/blkid.h>
+#endif
+#include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,6 +19,7 @@
 #include "cgpt.h"
 #include "vboot_host.h"
 
+#ifndef CGPT_MINI
 /* Find the device id for a given blkid_dev.
  * FIXME: libblkid already has this info but lacks a function to expose it.
  */
@@ -45,6 +50,8 @@ char * dev_to_wholedevname(blkid_dev dev) {
   return blkid_devno_to_devname(whole);
 }
 
+#endif
+
 static int devno_to_partno(dev_t devno) {
   char sys_path[512];
   FILE *sys_fd;
@@ -65,6 +72,7 @@ static int devno_to_partno(dev_t devno) {
   return partno;
 }
 
+#ifndef CGPT_MINI
 /* Find the partition number for a given partition. */
 int dev_to_partno(blkid_dev dev) {
   dev_t devno;
@@ -74,6 +82,102 @@ int dev_to_partno(blkid_dev dev) {
 
   return devno_to_partno(devno);
 }
+#endif
+
+/* Reads the "major:minor" in sysfs file path. */
+static int read_sysfs_devno(const char *path, dev_t *devno) {
+  FILE *fp;
+  unsigned int ma, mi;
+  int ok;
+
+  if ((fp = fopen(path, "r")) == NULL)
+    return -1;
+  ok = fscanf(fp, "%u:%u", &ma, &mi) == 2;
+  fclose(fp);
+  if (!ok)
+    return -1;
+  *devno = makedev(ma, mi);
+  return 0;
+}
+
+/* Finds the /dev path of the disk holding partition devno, by way of its
+ * parent directory in sysfs.  The resulting string must be freed. */
+static char *sysfs_wholedevname(dev_t devno) {
+  char sys_path[512];
+  char parent[PATH_MAX];
+  char *name, *c, *devname;
+  struct stat dev_stat;
+  dev_t whole;
+
+  if (snprintf(sys_path, sizeof(sys_path), "/sys/dev/block/%u:%u/..",
+               major(devno), minor(devno)) >= sizeof(sys_path) ||
+      !realpath(sys_path, parent))
+    return NULL;
+  if (strlen(parent) + sizeof("/dev") > sizeof(sys_path))
+    return NULL;
+  snprintf(sys_path, sizeof(sys_path), "%s/dev", parent);
+  if (read_sysfs_devno(sys_path, &whole) < 0)
+    return NULL;
+
+  // sysfs spells cciss/c0d0 as cciss!c0d0
+  name = strrchr(parent, '/') + 1;
+  for (c = name; *c; c++) {
+    if (*c == '!')
+      *c = '/';
+  }
+  if (asprintf(&devname, "/dev/%s", name) < 0)
+    return NULL;
+
+  // Only trust the name if it really is that disk.
+  if (stat(devname, &dev_stat) < 0 || !S_ISBLK(dev_stat.st_mode) ||
+      dev_stat.st_rdev != whole) {
+    free(devname);
+    return NULL;
+  }
+  return devname;
+}
+
+#define BY_PARTUUID_DIR "/dev/disk/by-partuuid"
+#define BY_PARTLABEL_DIR "/dev/disk/by-partlabel"
+
+int sysfs_resolve_partition(const char *desc, char **devname,
+                            char **whole_devname, int *partno) {
+  struct stat dev_stat;
+  char *path;
+  int r;
+
+  if (!strncmp(desc, "PARTUUID=", 9)) {
+    char *c;
+
+    if (asprintf(&path, BY_PARTUUID_DIR "/%s", desc + 9) < 0)
+      return CGPT_FAILED;
+    // udev names the links after the lower case GUID.
+    for (c = path + sizeof(BY_PARTUUID_DIR); *c; c++)
+      *c = tolower(*c);
+  } else if (!strncmp(desc, "PARTLABEL=", 10)) {
+    if (asprintf(&path, BY_PARTLABEL_DIR "/%s", desc + 10) < 0)
+      return CGPT_FAILED;
+  } else if (strchr(desc, '=')) {
+    return CGPT_FAILED;           // some other tag, ask libblkid
+  } else if ((path = strdup(desc)) == NULL) {
+    return CGPT_FAILED;
+  }
+
+  r = CGPT_FAILED;
+  if (stat(path, &dev_stat) < 0 || !S_ISBLK(dev_stat.st_mode))
+    goto out;
+  if ((*partno = devno_to_partno(dev_stat.st_rdev)) <= 0)
+    goto out;
+  if ((*whole_devname = sysfs_wholedevname(dev_stat.st_rdev)) == NULL)
+    goto out;
+  *devname = path;
+  path = NULL;
+  r = CGPT_OK;
+
+out:
+  free(path);
+  return r;
+}
 
 /* Utility for easily accepting whole disk or partition devices.
  * If drive path is set but partition is 0 the drive path will be checked
@@ -82,7 +186,9 @@ int dev_to_partno(blkid_dev dev) {
  * number is filled in. */
 int translate_partition_dev(char **devname, uint32_t *partition) {
   struct stat dev_stat;
+#ifndef CGPT_MINI
   dev_t whole_devno;
+#endif
   char *whole_devname;
   int partno;
 
@@ -102,6 +208,11 @@ int translate_partition_dev(char **devname, uint32_t *partition) {
   if (!S_ISBLK(dev_stat.st_mode))
     return CGPT_OK;
 
+#ifdef CGPT_MINI
+  /* Without libblkid, a partition is whatever sysfs numbers as one */
+  if ((partno = devno_to_partno(dev_stat.st_rdev)) <= 0)
+    return CGPT_OK;
+#else
   if (blkid_devno_to_wholedisk(dev_stat.st_rdev, NULL, 0, &whole_devno) < 0) {
     Error("unable to map %s to a whole disk device\n", *devname);
     return CGPT_FAILED;
@@ -115,6 +226,7 @@ int translate_partition_dev(char **devname, uint32_t *partition) {
     Error("unable to look up partition number for %s\n", *devname);
     return CGPT_FAILED;
   }
+#endif
 
   if (*partition && *partition != partno) {
     Error("device %s is partition %d but %d was specified\n",
@@ -122,7 +234,11 @@ int translate_partition_dev(char **devname, uint32_t *partition) {
     return CGPT_FAILED;
   }
 
+#ifdef CGPT_MINI
+  if ((whole_devname = sysfs_wholedevname(dev_stat.st_rdev)) == NULL) {
+#else
   if ((whole_devname = blkid_devno_to_devname(whole_devno)) == NULL) {
+#endif
     Error("unable to map %s to a whole disk device name\n", *devname);
     return CGPT_FAILED;
   }
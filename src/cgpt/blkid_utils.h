@@ -2,8 +2,19 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <stdint.h>
+
+#ifndef CGPT_MINI
 #include <blkid/blkid.h>
 
 char * dev_to_wholedevname(blkid_dev dev);
 int dev_to_partno(blkid_dev dev);
+#endif
 int translate_partition_dev(char **devname, uint32_t *partition);
+
+/* Maps a partition given as a device path, PARTUUID= or PARTLABEL= to its
+ * device path, whole disk device path (both to be freed) and number, with
+ * nothing but stat() and sysfs.  Returns CGPT_FAILED, reporting nothing,
+ * where that isn't enough, leaving the caller to ask libblkid. */
+int sysfs_resolve_partition(const char *desc, char **devname,
+                            char **whole_devname, int *partno);
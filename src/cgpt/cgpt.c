@@ -7,33 +7,41 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <uuid/uuid.h>
 
 #include "cgpt.h"
 #include "vboot_host.h"
 
-const char* progname;
-const char* command;
-void (*uuid_generator)(uint8_t* buffer);
-
 struct {
   const char *name;
   int (*fp)(int argc, char *argv[]);
   const char *comment;
 } cmds[] = {
+#ifndef CGPT_MINI
   {"create", cmd_create, "Create or reset GPT headers and tables"},
+#endif
   {"add", cmd_add, "Add, edit or remove a partition entry"},
   {"show", cmd_show, "Show partition table and entries"},
+#ifndef CGPT_MINI
   {"repair", cmd_repair, "Repair damaged GPT headers and tables"},
   {"boot", cmd_boot, "Edit the PMBR sector for legacy BIOSes"},
+#endif
   {"next", cmd_next, "Get the next root GUID to boot"},
   {"find", cmd_find, "Locate a partition by its GUID"},
   {"prioritize", cmd_prioritize,
    "Reorder the priority of all kernel partitions"},
+#ifndef CGPT_MINI
   {"legacy", cmd_legacy, "Switch between GPT and Legacy GPT"},
   {"resize", cmd_resize, "Find and resize a partition"},
+  {"batch", cmd_batch, "Apply a list of commands to a drive at once"},
+  {"copy", cmd_copy, "Copy a partition's data to another partition"},
+  {"diff", cmd_diff, "List what changed in a partition between images"},
+  {"verify", cmd_verify, "Check a partition's data against its hashes"},
+  {"serve", cmd_serve, "Answer show and find queries from a drive cache"},
+  {"query", cmd_query, "Run show or find in a running cgpt serve"},
+#endif
 };
 
 void Usage(void) {
@@ -46,17 +54,30 @@ void Usage(void) {
   for (i = 0; i < sizeof(cmds)/sizeof(cmds[0]); ++i) {
     printf("    %-15s  %s\n", cmds[i].name, cmds[i].comment);
   }
-  printf("\nFor more detailed usage, use %s COMMAND -h\n\n", progname);
+  printf("\nFor more detailed usage, use %s COMMAND -h\n", progname);
+  printf("Set CGPT_SYNC=defer or none to delay or skip flushing writes\n");
+  printf("Set CGPT_STATS=1 to print timings and I/O counts to stderr\n");
+  printf("Set CGPT_CACHE=DIR to keep the GPTs read in DIR for later runs, "
+         "e.g. /run/cgpt\n");
+  printf("Set CGPT_TYPES=FILE to read extra partition types from FILE "
+         "instead of\n/etc/cgpt/types, one \"NAME GUID [DESCRIPTION]\" "
+         "per line\n");
+  printf("Set CGPT_SYSROOT=DIR to look for disks in DIR/proc, DIR/sys and "
+         "DIR/dev\n\n");
 }
 
 
 
+static char output_buffer[64 * 1024];
+
+int serving;
+
 int main(int argc, char *argv[]) {
   int i;
   int match_count = 0;
   int match_index = 0;
-
-  uuid_generator = uuid_generate;
+  int sync_policy;
+  const char *sync_env, *stats_env;
 
   progname = strrchr(argv[0], '/');
   if (progname)
@@ -69,6 +90,11 @@ int main(int argc, char *argv[]) {
     return CGPT_FAILED;
   }
 
+  // First, so that the wall time covers everything.
+  stats_env = getenv("CGPT_STATS");
+  if (stats_env && *stats_env && strcmp(stats_env, "0"))
+    StatsEnable();
+
   // increment optind now, so that getopt skips argv[0] in command function
   command = argv[optind++];
 
@@ -87,8 +113,30 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (match_count == 1)
-    return cmds[match_index].fp(argc, argv);
+  sync_env = getenv("CGPT_SYNC");
+  if (sync_env) {
+    if (CGPT_OK != DriveParseSyncPolicy(sync_env, &sync_policy)) {
+      fprintf(stderr, "%s: invalid CGPT_SYNC: %s\n", progname, sync_env);
+      return CGPT_FAILED;
+    }
+    DriveSetSyncPolicy(sync_policy);
+  }
+  DriveSetMetadataCache(getenv("CGPT_CACHE"));
+
+  // Listings of many drives and partitions are a lot of small writes; when
+  // nobody is watching, pass them on in large ones.
+  if (!isatty(STDOUT_FILENO))
+    setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+
+  if (match_count == 1) {
+    int retval = cmds[match_index].fp(argc, argv);
+
+    if (CGPT_OK != DriveSyncDeferred())
+      retval = CGPT_FAILED;
+    fflush(stdout);
+    StatsPrint(stderr);
+    return retval;
+  }
 
   // Couldn't find a single matching command.
   Usage();
@@ -42,7 +42,63 @@ struct pmbr {
 } __attribute__((packed));
 
 void PMBRToStr(struct pmbr *pmbr, char *str, unsigned int buflen);
-char *IsWholeDev(const char *basename);
+// Finds the whole disk named basename, such as "sda", and returns its path
+// in pathname, or NULL if there's none.
+char *IsWholeDev(const char *basename, char *pathname, size_t size);
+
+// Where the disk scans find /proc, /sys and /dev: $CGPT_SYSROOT, or "" for
+// the real ones.
+const char *SysRoot(void);
+
+// Calls fn(arg, i) once for each i in [0, count) from a small pool of
+// threads and returns when all calls are done. Callers should record results
+// per index and merge them in index order to keep output deterministic.
+void ParallelFor(int count, void (*fn)(void *arg, int index), void *arg);
+
+// Returns true if pathname has a plausible primary GPT header at LBA 1,
+// looking at nothing but that one sector.
+int ProbeGpt(const char *pathname);
+
+// Lists the whole disks in /proc/partitions that pass ProbeGpt(), in the
+// order they appear there. Returns the count and stores the list in *devs,
+// which the caller releases with FreeDriveList().
+int ScanGptDrives(char ***devs);
+void FreeDriveList(char **devs, int count);
+
+// The kernel's block device uevents, for commands that watch drives come
+// and go.  UeventOpen() returns a socket receiving them, or -1.
+#define UEVENT_BYTES 8192
+struct uevent {
+  const char *action;             // "add", "change", "remove", ...
+  const char *devpath;            // "/devices/...", always set
+  const char *devname;            // "sda1", under /dev; may be NULL
+  const char *devtype;            // "disk" or "partition"; may be NULL
+};
+int UeventOpen(void);
+// Receives the next block device uevent waiting on fd into buf, of
+// UEVENT_BYTES + 1, pointing ev into it.  Returns 1 if there was one, 0 if
+// none is left and -1 if some were lost.
+int UeventRecv(int fd, char *buf, struct uevent *ev);
+
+/* Classes of entries kept in struct entry_index. */
+#define ENTRY_CLASS_USED 0
+#define ENTRY_CLASS_ROOT 1
+#define ENTRY_CLASS_KERNEL 2
+#define ENTRY_CLASSES 3
+
+// Per-entry classes and attributes of one entries table, unpacked so the
+// accessors and the commands walking all entries needn't decode them again.
+struct entry_index {
+  const uint8_t *table;  /* the entries described, or NULL if not built */
+  uint32_t num_entries;
+  uint32_t stride;
+  uint8_t flags[GPT_MAX_TABLE_ENTRIES];  /* 1 << ENTRY_CLASS_* */
+  uint8_t priority[GPT_MAX_TABLE_ENTRIES];
+  uint8_t tries[GPT_MAX_TABLE_ENTRIES];
+  uint8_t successful[GPT_MAX_TABLE_ENTRIES];
+  uint32_t count[ENTRY_CLASSES];
+  uint16_t list[ENTRY_CLASSES][GPT_MAX_TABLE_ENTRIES];  /* ascending */
+};
 
 // Handle to the drive storing the GPT.
 struct drive {
@@ -50,14 +106,159 @@ struct drive {
   uint64_t size;    /* total size (in bytes) */
   GptData gpt;
   struct pmbr pmbr;
+  uint8_t *gpt_buf; /* sector 0 plus both GPTs; gpt.* buffers point here */
+  size_t gpt_buf_size; /* bytes allocated, maybe more than they need */
+  uint8_t *map[2];  /* or: mmap()ed GPT regions of an image file */
+  size_t map_len[2];
+  uint8_t *pmbr_sector; /* sector 0 in gpt_buf or map[0] */
+  int is_file;      /* regular file rather than a block device */
+  int direct;       /* opened with O_DIRECT, I/O must be sector aligned */
+  int written;      /* something was written and needs syncing */
+  int batch;        /* lent out by DriveBatchBegin(), written at the end */
+  int lock_fd;      /* holding a block device locked for udev, or -1 */
+  struct cached_drive *cache; /* lent out by the drive cache, read-only */
+  struct entry_index index; /* built on first use, see GetEntriesOfClass() */
 };
 
 
+/* DriveOpen() flags */
+/* Only read the secondary GPT if the primary header or entries are bad.
+ * Ignored for O_RDWR.  The secondary is then flagged in gpt.unverified. */
+#define DRIVE_LAZY_SECONDARY 0x1
+/* Bypass the page cache with O_DIRECT where the drive supports it, so that
+ * scanning many devices doesn't evict other data. */
+#define DRIVE_DIRECT_IO 0x2
+
 /* mode should be O_RDONLY or O_RDWR */
 int DriveOpen(const char *drive_path, struct drive *drive,
-              off_t min_size, int mode);
+              off_t min_size, int mode, int flags);
 int DriveClose(struct drive *drive, int update_as_needed);
+/* DriveClose() keeps the buffer of the drive it closes for the next
+ * DriveOpen() in the same thread, so a scan of many drives allocates it
+ * once per thread.  It is freed when the thread exits, or by this call
+ * for the calling thread if that is too late. */
+void DriveFreeSpareBuffer(void);
+
+/* Drive cache, for long running processes such as cgpt serve: once enabled,
+ * read-only DriveOpen()s get a copy of the drive as the first one loaded
+ * it, until the file behind it changes or DriveCacheInvalidate() drops it.
+ * Writes to block devices go unnoticed, so whoever enables the cache has
+ * to watch their uevents. */
+void DriveCacheEnable(void);
+/* Drops the drive of a sysfs device path as uevents give it, "/devices/...",
+ * or of the disk if it is a partition's.  NULL drops every drive. */
+void DriveCacheInvalidate(const char *devpath);
+/* ProbeGpt() results kept along with the drives, -1 if there is none. */
+int DriveCacheProbe(const char *drive_path);
+void DriveCacheSetProbe(const char *drive_path, int found);
+/* Swaps the read-only descriptor of a drive from DriveOpen() for an O_RDWR
+ * one on the same device, keeping the GPT already loaded.  A secondary that
+ * DRIVE_LAZY_SECONDARY skipped is read in now, so run GptSanityCheck() again
+ * before changing anything. */
+int DriveMakeWritable(struct drive *drive, const char *drive_path);
+
+/* Batches: between DriveBatchBegin() and DriveBatchCommit() or
+ * DriveBatchAbort(), DriveOpen() of drive_path hands out the drive loaded
+ * by DriveBatchBegin() and DriveClose() and WritePMBR() only keep the
+ * changes in memory.  DriveBatchCommit() writes them all out and syncs
+ * once; DriveBatchAbort() drops them. */
+int DriveBatchBegin(const char *drive_path);
+int DriveBatchCommit(void);
+void DriveBatchAbort(void);
 int CheckValid(const struct drive *drive);
+/* Reads 'count' bytes at byte 'offset' of the drive, whatever its alignment.
+ * Returns CGPT_OK if all were read. */
+int DriveRead(struct drive *drive, void *buf, uint64_t offset, size_t count);
+/* Adds, removes or resizes (BLKPG_*_PARTITION) partition partno of the
+ * block device fd in the kernel; start and size are in bytes. */
+int BlkpgPartition(int fd, int op, int partno, uint64_t start,
+                   uint64_t size);
+
+/* Parses "discard" or "zero" into a PROVISION_*.  Returns CGPT_FAILED if
+ * unknown. */
+int DriveParseProvision(const char *name, int *provision);
+/* Prepares 'count' bytes of fd from byte 'offset' on for new data as the
+ * PROVISION_* 'provision' says: punches a hole in an image file, or issues
+ * BLKDISCARD or BLKZEROOUT to a block device.  Zeroing falls back to
+ * writing zeros; a discard the device can't do is skipped. */
+int ProvisionRange(int fd, const char *path, uint64_t offset, uint64_t count,
+                   int provision);
+/* ProvisionRange() of 'count' sectors of the drive from 'lba' on.  Fails
+ * within a batch, whose steps must not touch the drive until it commits. */
+int DriveProvision(struct drive *drive, const char *drive_path,
+                   uint64_t lba, uint64_t count, int provision);
+
+/* Sector size DriveOpen() uses for image files, 512 or 4096.  0 (the
+ * default) detects it from an existing GPT and falls back to 512. */
+void DriveSetImageSectorSize(uint32_t sector_bytes);
+/* Size of the entries tables DriveOpen() loads, for a GPT about to be
+ * written from scratch.  0 (the default) takes the size the headers give,
+ * or TOTAL_ENTRIES_SIZE if neither is valid. */
+void DriveSetEntriesSize(uint32_t entries_bytes);
+
+/* How DriveClose() makes the writes to a drive durable.  Drives that were
+ * not written to are never synced. */
+enum {
+  DRIVE_SYNC_AUTO,   /* fdatasync() image files, fsync() block devices */
+  DRIVE_SYNC_DEFER,  /* like AUTO, but only once DriveSyncDeferred() runs */
+  DRIVE_SYNC_NONE,   /* leave it to the caller, e.g. a final sync(1) */
+};
+void DriveSetSyncPolicy(int policy);
+/* Parses "auto", "defer" or "none".  Returns CGPT_FAILED if unknown. */
+int DriveParseSyncPolicy(const char *name, int *policy);
+/* Syncs and releases the drives deferred by DRIVE_SYNC_DEFER. */
+int DriveSyncDeferred(void);
+
+/* Metadata cache, for many cgpt runs reading the same drives: read-only
+ * DriveOpen()s keep a copy of each GPT they load in a file in 'dir' and
+ * take it from there the next time, once a read of the PMBR and primary
+ * header confirms it.  DriveClose() of a drive written to drops its copy.
+ * NULL (the default) turns it off. */
+void DriveSetMetadataCache(const char *dir);
+
+/* Counters of the time and I/O of the drive functions above, kept once
+ * StatsEnable() has been called (cgpt does for CGPT_STATS).  Times are in
+ * microseconds, phases include the ones nested in them. */
+enum {
+  STATS_SCAN_US,        /* ScanGptDrives(), probes included */
+  STATS_OPEN_US,        /* DriveOpen() */
+  STATS_LOAD_US,        /* reading or mapping the GPT within DriveOpen() */
+  STATS_CHECK_US,       /* CheckHeader() and CheckEntries() calls */
+  STATS_CLOSE_US,       /* DriveClose() */
+  STATS_SYNC_US,        /* fsync() and fdatasync(), deferred ones too */
+  STATS_DEVICES_LISTED, /* whole disks ScanGptDrives() found */
+  STATS_DEVICES_PROBED, /* ProbeGpt() calls */
+  STATS_DRIVES_OPENED,  /* DriveOpen() successes, batch steps aside */
+  STATS_BUFFERS_ALLOCATED, /* GPT buffers allocated rather than reused */
+  STATS_DRIVES_CACHED,  /* DriveOpen()s served by the drive cache */
+  STATS_GPTS_CACHED,    /* DriveOpen()s served by the metadata cache */
+  STATS_HEADER_CHECKS,  /* from GptCheckStats, counted at DriveClose() */
+  STATS_ENTRIES_CHECKS,
+  STATS_ENTRIES_CHECKS_SKIPPED,
+  STATS_OPEN_CALLS,     /* system calls */
+  STATS_IOCTL_CALLS,
+  STATS_READ_CALLS,
+  STATS_MMAP_CALLS,
+  STATS_WRITE_CALLS,
+  STATS_SYNC_CALLS,
+  STATS_URING_CALLS,    /* io_uring_enter(), for batched probes */
+  STATS_READ_PRIMARY,   /* bytes: PMBR, primary header and entries */
+  STATS_READ_SECONDARY, /* bytes: secondary entries and header */
+  STATS_READ_OTHER,     /* bytes: probes, DriveRead() and the like */
+  STATS_MAPPED,         /* bytes of GPT mmap()ed rather than read */
+  STATS_WRITE_PMBR,     /* bytes */
+  STATS_WRITE_PRIMARY,
+  STATS_WRITE_SECONDARY,
+  STATS_COUNTERS
+};
+void StatsEnable(void);
+/* A start time for StatsAddTime(), or 0 if stats are off. */
+uint64_t StatsClock(void);
+void StatsAdd(int counter, uint64_t n);
+void StatsAddTime(int counter, uint64_t start);
+void StatsAddChecks(const GptCheckStats *check);
+/* Prints all counters as one line of key=value pairs, if enabled. */
+void StatsPrint(FILE *fp);
 
 /* Constant global type values to compare against */
 extern const Guid guid_chromeos_firmware;
@@ -89,6 +290,10 @@ void UpdatePMBR(struct drive *drive, int secondary);
 int ReadPMBR(struct drive *drive);
 int WritePMBR(struct drive *drive);
 
+/* Parses the first 2 * len characters of str as hex digits into buf.
+ * Returns CGPT_FAILED if any of them isn't one. */
+int HexToBytes(const char *str, uint8_t *buf, size_t len);
+
 /* Convert possibly unterminated UTF16 string to UTF8.
  * Caller must prepare enough space for UTF8, which could be up to
  * twice the byte length of UTF16 string plus the terminating '\0'.
@@ -113,9 +318,18 @@ int ResolveType(const Guid *type, char *buf, size_t len);
 int SupportedType(const char *name, Guid *type);
 void PrintTypes(void);
 void EntryDetails(GptEntry *entry, uint32_t index, int raw);
+/* Converts a comma-separated list of show query field names, or "all", to
+ * CgptShowParams.fields.  Reports errors itself. */
+int ParseShowFields(const char *list, char *fields, size_t size);
 
+GptHeader *GetGptHeader(const GptData *gpt);
 uint32_t GetNumberOfEntries(const struct drive *drive);
 GptEntry *GetEntry(GptData *gpt, int secondary, uint32_t entry_index);
+/* Like GetEntry(), for callers about to modify the entry.  Keeps the
+ * incremental entries CRC (see GptEntriesTrackCrc()) up to date and drops
+ * the drive's entry index, which is rebuilt when next needed. */
+GptEntry *GetEntryForWrite(struct drive *drive, int secondary,
+                           uint32_t entry_index);
 void SetLegacyBootable(struct drive *drive, int secondary,
                        uint32_t entry_index, int bootable);
 int GetLegacyBootable(struct drive *drive, int secondary, uint32_t entry_index);
@@ -142,18 +356,84 @@ int IsSynonymous(const GptHeader* a, const GptHeader* b);
 int IsUnused(struct drive *drive, int secondary, uint32_t index);
 int IsKernel(struct drive *drive, int secondary, uint32_t index);
 int IsRoot(struct drive *drive, int secondary, uint32_t index);
+/* Points *list at the ascending indices of the entries of ENTRY_CLASS_*
+ * entry_class and returns how many there are.  The list is valid until the
+ * entries are next modified other than through the Set*() accessors. */
+uint32_t GetEntriesOfClass(struct drive *drive, int secondary,
+                           int entry_class, const uint16_t **list);
+
+/* An inclusive range of LBAs. */
+struct extent {
+  uint64_t first;
+  uint64_t last;
+};
+
+/* The used entries of the primary table and the gaps between them, each in
+ * ascending order.  The gaps cover the rest of the usable area. */
+struct extent_map {
+  uint32_t num_used;
+  struct extent used[GPT_MAX_TABLE_ENTRIES];
+  uint32_t num_free;
+  struct extent free[GPT_MAX_TABLE_ENTRIES + 1];
+};
+void BuildExtentMap(struct drive *drive, struct extent_map *map);
+
+/* Parses "first" or "best".  Returns CGPT_FAILED if unknown. */
+int ParseExtentFit(const char *name, int *fit);
+
+#define EXTENT_DEFAULT_ALIGN_BYTES (1024 * 1024)
+/* The start alignment for new partitions, in sectors: 1 MiB, or a multiple
+ * of it that is also a multiple of the device's optimal I/O size. */
+uint64_t DriveAlignment(struct drive *drive);
+/* Finds a gap with room for 'size' sectors from a multiple of 'align' on.
+ * A size of 0 takes the whole of the largest such gap instead.  Sets *begin
+ * and *found_size and returns CGPT_OK; reports an error and returns
+ * CGPT_FAILED if nothing fits. */
+int AllocateExtent(const struct extent_map *map, uint64_t size,
+                   uint64_t align, int fit, uint64_t *begin,
+                   uint64_t *found_size);
+
+/* SHA-256, for cgpt verify. */
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+struct sha256_ctx {
+  uint32_t state[8];
+  uint64_t bytes;
+  uint8_t buf[SHA256_BLOCK_SIZE];
+};
+void Sha256Init(struct sha256_ctx *ctx);
+void Sha256Update(struct sha256_ctx *ctx, const void *data, size_t len);
+void Sha256Final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+/* The SHA-256 implementations, the fastest supported one used above. */
+enum {
+  SHA256_BACKEND_GENERIC = 0,     /* Portable C. */
+  SHA256_BACKEND_SHANI,           /* x86-64 SHA extensions. */
+  SHA256_BACKEND_COUNT,
+};
+/* Returns non-zero if the backend was built and the CPU supports it. */
+int Sha256BackendSupported(int backend);
+/* Hashes data with a specific backend, for testing.  Returns CGPT_FAILED
+ * if the backend isn't supported. */
+int Sha256Backend(int backend, const void *data, size_t len,
+                  uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/* Grows the ext2/3/4 filesystem on partition device devname, which must be
+ * mounted, to fill partition_bytes with the online resize ioctl.  Does
+ * nothing if it already does. */
+int GrowMountedExt4(const char *devname, uint64_t partition_bytes);
 
 // For usage and error messages.
 extern const char* progname;
 extern const char* command;
 void Error(const char *format, ...);
 
-// The code paths that require uuid_generate are not used currently in
-// libcgpt-cc.a so using this method would create an unnecessary dependency
-// on libuuid which then requires us to build it for 32-bit for the static
-// post-installer. So, we just expose this function pointer which should be
-// set to uuid_generate in case of the cgpt binary and can be null or some
-// no-op method in case of ilbcgpt-cc.a.
+// Set while a command answers a query in "cgpt serve", which answers one
+// at a time: nothing may block then.
+extern int serving;
+
+// Generates the GUIDs of new partitions and disks; uuid_generate() unless
+// set otherwise, e.g. to get reproducible images.  NULL in cgpt-mini, which
+// has no libuuid, so GUIDs must be given there.
 extern void (*uuid_generator)(uint8_t* buffer);
 
 // Command functions.
@@ -167,6 +447,12 @@ int cmd_prioritize(int argc, char *argv[]);
 int cmd_legacy(int argc, char *argv[]);
 int cmd_next(int argc, char *argv[]);
 int cmd_resize(int argc, char *argv[]);
+int cmd_batch(int argc, char *argv[]);
+int cmd_copy(int argc, char *argv[]);
+int cmd_diff(int argc, char *argv[]);
+int cmd_verify(int argc, char *argv[]);
+int cmd_serve(int argc, char *argv[]);
+int cmd_query(int argc, char *argv[]);
 
 #define ARRAY_COUNT(array) (sizeof(array)/sizeof((array)[0]))
 const char *GptError(int errnum);
@@ -175,12 +461,16 @@ const char *GptError(int errnum);
 #define GPT_PARTNAME_LEN 72
 
 /* The standard "assert" macro goes away when NDEBUG is defined. This doesn't.
+ * It guards against bugs, not bad input or I/O errors, which are reported
+ * through Error() and CGPT_FAILED.  It aborts rather than exit()s, so that
+ * a program using libcgpt doesn't have its atexit() handlers run midway
+ * through an operation.
  */
+void RequireFailed(const char *condition, const char *file, int line)
+    __attribute__((noreturn));
 #define require(A) do { \
-  if (!(A)) { \
-    fprintf(stderr, "condition (%s) failed at %s:%d\n", \
-            #A, __FILE__, __LINE__); \
-    exit(1); } \
+  if (!(A)) \
+    RequireFailed(#A, __FILE__, __LINE__); \
   } while (0)
 
 #endif  // VBOOT_REFERENCE_UTILITY_CGPT_CGPT_H_
@@ -16,7 +16,7 @@
 #include "vboot_host.h"
 
 static const char* DumpCgptAddParams(const CgptAddParams *params) {
-  static char buf[256];
+  static __thread char buf[256];      // libcgpt may run in any thread
   char tmp[64];
 
   buf[0] = 0;
@@ -77,7 +77,7 @@ static int GptSetEntryAttributes(struct drive *drive,
                                  CgptAddParams *params) {
   GptEntry *entry;
 
-  entry = GetEntry(&drive->gpt, PRIMARY, index);
+  entry = GetEntryForWrite(drive, PRIMARY, index);
   if (params->set_begin)
     entry->starting_lba = params->begin;
   if (params->set_size)
@@ -105,11 +105,70 @@ static int GptSetEntryAttributes(struct drive *drive,
   return 0;
 }
 
+// Chooses begin, and size unless given, for a new partition.
+static int CgptPlacePartition(struct drive *drive, CgptAddParams *params) {
+  struct extent_map map;
+  uint64_t align = params->align ? params->align : DriveAlignment(drive);
+
+  if (params->set_size && !params->size) {
+    Error("partitions can't be empty\n");
+    return -1;
+  }
+  BuildExtentMap(drive, &map);
+  if (CGPT_OK != AllocateExtent(&map, params->set_size ? params->size : 0,
+                                align, params->fit, &params->begin,
+                                &params->size))
+    return -1;
+  params->set_begin = 1;
+  params->set_size = 1;
+  return 0;
+}
+
+// Discards or zeroes the sectors 'entry' covers that 'old' didn't.
+static int ProvisionNewSectors(struct drive *drive, CgptAddParams *params,
+                               const GptEntry *old, const GptEntry *entry) {
+  uint64_t first = entry->starting_lba, last = entry->ending_lba;
+
+  if (params->provision == PROVISION_NONE)
+    return CGPT_OK;
+  if (GuidIsZero(&old->type) || old->ending_lba < first ||
+      old->starting_lba > last)
+    return DriveProvision(drive, params->drive_name, first,
+                          last - first + 1, params->provision);
+
+  if (first < old->starting_lba &&
+      CGPT_OK != DriveProvision(drive, params->drive_name, first,
+                                old->starting_lba - first,
+                                params->provision))
+    return CGPT_FAILED;
+  if (last > old->ending_lba &&
+      CGPT_OK != DriveProvision(drive, params->drive_name,
+                                old->ending_lba + 1, last - old->ending_lba,
+                                params->provision))
+    return CGPT_FAILED;
+  return CGPT_OK;
+}
+
 // This is an internal helper function which assumes no NULL args are passed.
 // It sets the given attribute values for a single entry at the given index.
 static int SetEntryAttributes(struct drive *drive,
                               uint32_t index,
                               CgptAddParams *params) {
+  // cmd_add() checks these already, but library callers may not have.
+  if ((params->set_legacy_bootable &&
+       (params->legacy_bootable < 0 || params->legacy_bootable > 1)) ||
+      (params->set_successful &&
+       (params->successful < 0 ||
+        params->successful > CGPT_ATTRIBUTE_MAX_SUCCESSFUL)) ||
+      (params->set_tries &&
+       (params->tries < 0 || params->tries > CGPT_ATTRIBUTE_MAX_TRIES)) ||
+      (params->set_priority &&
+       (params->priority < 0 ||
+        params->priority > CGPT_ATTRIBUTE_MAX_PRIORITY))) {
+    Error("attribute value out of range\n");
+    return -1;
+  }
+
   if (params->set_raw) {
     SetRaw(drive, PRIMARY, index, params->raw_value);
   } else {
@@ -123,10 +182,16 @@ static int SetEntryAttributes(struct drive *drive,
       SetPriority(drive, PRIMARY, index, params->priority);
   }
 
-  // New partitions must specify type, begin, and size.
+  // New partitions must specify type, and are placed if begin isn't given.
   if (IsUnused(drive, PRIMARY, index)) {
-    if (!params->set_begin || !params->set_size || !params->set_type) {
-      Error("-t, -b, and -s options are required for new partitions\n");
+    if (!params->set_type) {
+      Error("the -t option is required for new partitions\n");
+      return -1;
+    }
+    if (!params->set_begin && CgptPlacePartition(drive, params))
+      return -1;
+    if (!params->set_size) {
+      Error("-s is required for new partitions given -b\n");
       return -1;
     }
     if (GuidIsZero(&params->type_guid)) {
@@ -152,6 +217,9 @@ static int CgptCheckAddValidity(struct drive *drive) {
           "please run 'cgpt repair' before adding anything.\n");
     return -1;
   }
+
+  // Only one entry changes, so avoid rehashing the whole table.
+  GptEntriesTrackCrc(&drive->gpt, MASK_BOTH);
   return 0;
 }
 
@@ -186,7 +254,7 @@ int CgptSetAttributes(CgptAddParams *params) {
   if (params == NULL)
     return CGPT_FAILED;
 
-  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDWR))
+  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDWR, 0))
     return CGPT_FAILED;
 
   if (CgptCheckAddValidity(&drive)) {
@@ -223,7 +291,7 @@ int CgptGetPartitionDetails(CgptAddParams *params) {
   if (params == NULL)
     return CGPT_FAILED;
 
-  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDWR))
+  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDWR, 0))
     return CGPT_FAILED;
 
   if (CgptCheckAddValidity(&drive)) {
@@ -286,7 +354,7 @@ int CgptAdd(CgptAddParams *params) {
   if (params == NULL)
     return CGPT_FAILED;
 
-  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDWR))
+  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDWR, 0))
     return CGPT_FAILED;
 
   if (CGPT_OK != ReadPMBR(&drive)) {
@@ -302,7 +370,7 @@ int CgptAdd(CgptAddParams *params) {
     goto bad;
   }
 
-  entry = GetEntry(&drive.gpt, PRIMARY, index);
+  entry = GetEntryForWrite(&drive, PRIMARY, index);
   memcpy(&backup, entry, sizeof(backup));
 
   if (SetEntryAttributes(&drive, index, params) ||
@@ -318,12 +386,21 @@ int CgptAdd(CgptAddParams *params) {
 
   if (0 != rv) {
     // If the modified entry is illegal, recover it and return error.
+    entry = GetEntryForWrite(&drive, PRIMARY, index);
     memcpy(entry, &backup, sizeof(*entry));
     Error("%s\n", GptErrorText(rv));
     Error(DumpCgptAddParams(params));
     goto bad;
   }
 
+  // Only once the new layout is known to be good.
+  if (CGPT_OK != ProvisionNewSectors(&drive, params, &backup,
+                                     GetEntry(&drive.gpt, PRIMARY, index))) {
+    entry = GetEntryForWrite(&drive, PRIMARY, index);
+    memcpy(entry, &backup, sizeof(*entry));
+    goto bad;
+  }
+
   UpdatePMBR(&drive, PRIMARY);
   if (WritePMBR(&drive) != CGPT_OK) {
     Error("Failed to write legacy MBR.\n");
@@ -21,7 +21,7 @@ int CgptGetBootPartitionNumber(CgptBootParams *params) {
   if (params == NULL)
     return CGPT_FAILED;
 
-  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDONLY))
+  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDONLY, 0))
     return CGPT_FAILED;
 
   if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive.gpt))) {
@@ -74,7 +74,7 @@ int CgptBoot(CgptBootParams *params) {
   if (params->create_pmbr || params->partition || params->bootfile)
     mode = O_RDWR;
 
-  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, mode)) {
+  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, mode, 0)) {
     return CGPT_FAILED;
   }
 
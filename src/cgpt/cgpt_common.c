@@ -6,37 +6,96 @@
  * files for more details.
  */
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <linux/blkpg.h>
+#include <linux/falloc.h>
+#include <pthread.h>
+#include <limits.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#ifndef CGPT_MINI
+#include <uuid/uuid.h>
+#endif
 
 #include "cgpt.h"
 #include "cgptlib_internal.h"
 #include "crc32.h"
 #include "vboot_host.h"
 
+/* For building with linux headers < 3.6 */
+#ifndef BLKPG_RESIZE_PARTITION
+# define BLKPG_RESIZE_PARTITION 3
+#endif
+
+/* For building with linux headers that lack them */
+#ifndef BLKDISCARD
+# define BLKDISCARD _IO(0x12, 119)
+#endif
+#ifndef BLKZEROOUT
+# define BLKZEROOUT _IO(0x12, 127)
+#endif
+
+// Set by the cgpt front end; libcgpt users get errors without a command.
+const char* progname = "libcgpt";
+const char* command;
+#ifdef CGPT_MINI
+void (*uuid_generator)(uint8_t* buffer) = NULL;
+#else
+void (*uuid_generator)(uint8_t* buffer) = uuid_generate;
+#endif
+
+static __thread CgptErrorHandler error_handler;
+static __thread void *error_handler_ctx;
+
+void CgptSetErrorHandler(CgptErrorHandler handler, void *ctx) {
+  error_handler = handler;
+  error_handler_ctx = ctx;
+}
+
 void Error(const char *format, ...) {
+  char message[1024];
   va_list ap;
+
   va_start(ap, format);
-  fprintf(stderr, "ERROR: %s %s: ", progname, command);
-  vfprintf(stderr, format, ap);
+  if (error_handler) {
+    vsnprintf(message, sizeof(message), format, ap);
+    error_handler(error_handler_ctx, message);
+  } else {
+    if (command)
+      fprintf(stderr, "ERROR: %s %s: ", progname, command);
+    else
+      fprintf(stderr, "ERROR: %s: ", progname);
+    vfprintf(stderr, format, ap);
+  }
   va_end(ap);
 }
 
+void RequireFailed(const char *condition, const char *file, int line) {
+  fprintf(stderr, "condition (%s) failed at %s:%d\n", condition, file, line);
+  abort();
+}
+
 
 int CheckValid(const struct drive *drive) {
-  if ((drive->gpt.valid_headers != MASK_BOTH) ||
-      (drive->gpt.valid_entries != MASK_BOTH)) {
+  // A copy skipped by a lazy DriveOpen() isn't known to be bad.
+  if (((drive->gpt.valid_headers | drive->gpt.unverified) != MASK_BOTH) ||
+      ((drive->gpt.valid_entries | drive->gpt.unverified) != MASK_BOTH)) {
     fprintf(stderr, "\nWARNING: one of the GPT header/entries is invalid, "
            "please run '%s repair'\n", progname);
     return CGPT_FAILED;
@@ -44,113 +103,1146 @@ int CheckValid(const struct drive *drive) {
   return CGPT_OK;
 }
 
-/* Loads sectors from 'fd'.
- * *buf is pointed to an allocated memory when returned, and should be
- * freed by cgpt_close().
+/* Reads 'iovcnt' buffers from 'fd' with a single vectored read starting
+ * at byte 'offset', counted in 'counter' (STATS_READ_*).
+ *
+ * Returns CGPT_OK for successful, CGPT_FAILED if the read fails or is short.
+ */
+static int ReadSectors(const int fd, const struct iovec *iov, int iovcnt,
+                       const uint64_t offset, int counter) {
+  ssize_t count = 0;  /* byte count to read */
+  ssize_t nread;
+  int i;
+
+  for (i = 0; i < iovcnt; i++)
+    count += iov[i].iov_len;
+
+  nread = preadv(fd, iov, iovcnt, offset);
+  StatsAdd(STATS_READ_CALLS, 1);
+  if (nread < 0) {
+    Error("Can't read at offset %llu: %s\n",
+          (long long unsigned int)offset, strerror(errno));
+    return CGPT_FAILED;
+  }
+  if (nread < count) {
+    Error("Can't read enough: %zd, not %zd\n", nread, count);
+    return CGPT_FAILED;
+  }
+  StatsAdd(counter, nread);
+
+  return CGPT_OK;
+}
+
+
+// The drive of the batch in progress on this thread, if any.
+static __thread struct {
+  char *path;
+  struct drive drive;
+  uint8_t modified;     /* GPT_MODIFIED_* of every step so far */
+  int pmbr_modified;
+} batch;
+
+
+/* Saves sectors to 'fd'.
  *
  *   fd -- file descriptot.
- *   buf -- pointer to buffer pointer
- *   sector -- offset of starting sector (in sectors)
+ *   buf -- pointer to buffer
+ *   sector -- starting sector offset
  *   sector_bytes -- bytes per sector
- *   sector_count -- number of sectors to load
+ *   sector_count -- number of sector to save
+ *   counter -- STATS_WRITE_* counter of the region
  *
- * Returns CGPT_OK for successful. Aborts if any error occurs.
+ * Returns CGPT_OK for successful, CGPT_FAILED for failed.
  */
-static int Load(const int fd, uint8_t **buf,
+static int Save(const int fd, const uint8_t *buf,
                 const uint64_t sector,
                 const uint64_t sector_bytes,
-                const uint64_t sector_count) {
-  int count;  /* byte count to read */
-  int nread;
+                const uint64_t sector_count, int counter) {
+  int count;  /* byte count to write */
+  int nwrote;
 
   require(buf);
-  if (!sector_count || !sector_bytes) {
-    Error("%s() failed at line %d: sector_count=%d, sector_bytes=%d\n",
-          __FUNCTION__, __LINE__, sector_count, sector_bytes);
+  count = sector_bytes * sector_count;
+
+  nwrote = pwrite(fd, buf, count, sector * sector_bytes);
+  StatsAdd(STATS_WRITE_CALLS, 1);
+  if (nwrote < count)
     return CGPT_FAILED;
-  }
-  /* Make sure that sector_bytes * sector_count doesn't roll over. */
-  if (sector_bytes > (UINT64_MAX / sector_count)) {
-    Error("%s() failed at line %d: sector_count=%d, sector_bytes=%d\n",
-          __FUNCTION__, __LINE__, sector_count, sector_bytes);
+  StatsAdd(counter, nwrote);
+
+  return CGPT_OK;
+}
+
+
+int ReadPMBR(struct drive *drive) {
+  // DriveOpen() already read sector 0 along with the primary GPT.
+  if (!drive->pmbr_sector)
     return CGPT_FAILED;
+
+  memcpy(&drive->pmbr, drive->pmbr_sector, sizeof(struct pmbr));
+  return CGPT_OK;
+}
+
+int WritePMBR(struct drive *drive) {
+  if (!drive->pmbr_sector)
+    return CGPT_FAILED;
+
+  // Write the whole cached sector 0 so the I/O stays sector aligned; this
+  // also keeps the copy served by ReadPMBR() in sync with the disk.
+  memcpy(drive->pmbr_sector, &drive->pmbr, sizeof(struct pmbr));
+  if (drive->batch) {
+    batch.pmbr_modified = 1;
+    return CGPT_OK;
   }
-  count = sector_bytes * sector_count;
-  *buf = malloc(count);
-  require(*buf);
+  drive->written = 1;
+  return Save(drive->fd, drive->pmbr_sector, 0, drive->gpt.sector_bytes,
+              GPT_PMBR_SECTOR, STATS_WRITE_PMBR);
+}
 
-  if (-1 == lseek(fd, sector * sector_bytes, SEEK_SET)) {
-    Error("Can't lseek: %s\n", strerror(errno));
-    goto error_free;
+// Aligned allocation suitable for O_DIRECT I/O.
+static void *AllocAligned(size_t size) {
+  void *buf;
+
+  if (posix_memalign(&buf, sysconf(_SC_PAGESIZE), size))
+    return NULL;
+  return buf;
+}
+
+int DriveRead(struct drive *drive, void *buf, uint64_t offset, size_t count) {
+  uint64_t start = offset, end = offset + count;
+  uint8_t *bounce = buf;
+  uint8_t *ptr;
+  ssize_t nread;
+  int retval = CGPT_FAILED;
+
+  // O_DIRECT needs sector aligned offsets, lengths and buffers.
+  if (drive->direct) {
+    start = offset - offset % drive->gpt.sector_bytes;
+    end = (end + drive->gpt.sector_bytes - 1) /
+          drive->gpt.sector_bytes * drive->gpt.sector_bytes;
+    bounce = AllocAligned(end - start);
+    require(bounce);
   }
 
-  nread = read(fd, *buf, count);
-  if (nread < count) {
-    Error("Can't read enough: %d, not %d\n", nread, count);
-    goto error_free;
+  for (ptr = bounce; start < end; start += nread, ptr += nread) {
+    nread = pread(drive->fd, ptr, end - start, start);
+    StatsAdd(STATS_READ_CALLS, 1);
+    // negative means error, 0 means (unexpected) EOF
+    if (nread <= 0)
+      goto done;
+    StatsAdd(STATS_READ_OTHER, nread);
   }
+  retval = CGPT_OK;
 
+done:
+  if (bounce != buf) {
+    if (retval == CGPT_OK)
+      memcpy(buf, bounce + offset % drive->gpt.sector_bytes, count);
+    free(bounce);
+  }
+  return retval;
+}
+
+int DriveParseProvision(const char *name, int *provision) {
+  if (!strcmp(name, "discard"))
+    *provision = PROVISION_DISCARD;
+  else if (!strcmp(name, "zero"))
+    *provision = PROVISION_ZERO;
+  else
+    return CGPT_FAILED;
   return CGPT_OK;
+}
 
-error_free:
-  free(*buf);
-  *buf = 0;
-  return CGPT_FAILED;
+int ProvisionRange(int fd, const char *path, uint64_t offset, uint64_t count,
+                   int provision) {
+  const size_t zeros_bytes = 64 * 1024;
+  uint64_t range[2] = { offset, count };
+  uint8_t *zeros;
+  struct stat st;
+  ssize_t n;
+
+  if (provision == PROVISION_NONE || !count)
+    return CGPT_OK;
+  if (fstat(fd, &st) == -1) {
+    Error("Can't fstat %s: %s\n", path, strerror(errno));
+    return CGPT_FAILED;
+  }
+
+  // A hole reads back as zeros, so it does for both.
+  if (S_ISREG(st.st_mode)) {
+    if (!fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                   offset, count))
+      return CGPT_OK;
+  } else if (S_ISBLK(st.st_mode)) {
+    StatsAdd(STATS_IOCTL_CALLS, 1);
+    if (!ioctl(fd, provision == PROVISION_ZERO ? BLKZEROOUT : BLKDISCARD,
+               range))
+      return CGPT_OK;
+  }
+  // Discarding is only ever a hint.
+  if (provision == PROVISION_DISCARD)
+    return CGPT_OK;
+
+  // The drive may be open with O_DIRECT.
+  zeros = AllocAligned(zeros_bytes);
+  require(zeros);
+  memset(zeros, 0, zeros_bytes);
+  while (count) {
+    n = pwrite(fd, zeros, count < zeros_bytes ? count : zeros_bytes, offset);
+    StatsAdd(STATS_WRITE_CALLS, 1);
+    if (n <= 0) {
+      Error("Can't zero %s: %s\n", path, strerror(errno));
+      free(zeros);
+      return CGPT_FAILED;
+    }
+    offset += n;
+    count -= n;
+  }
+  free(zeros);
+  return CGPT_OK;
+}
+
+int DriveProvision(struct drive *drive, const char *drive_path,
+                   uint64_t lba, uint64_t count, int provision) {
+  if (provision == PROVISION_NONE || !count)
+    return CGPT_OK;
+  // An abort must leave the drive as it was.
+  if (drive->batch) {
+    Error("Can't discard or zero sectors of %s within a batch\n",
+          drive_path);
+    return CGPT_FAILED;
+  }
+  return ProvisionRange(drive->fd, drive_path,
+                        lba * drive->gpt.sector_bytes,
+                        count * drive->gpt.sector_bytes, provision);
 }
 
 
-int ReadPMBR(struct drive *drive) {
-  if (-1 == lseek(drive->fd, 0, SEEK_SET))
+static int sync_policy = DRIVE_SYNC_AUTO;
+static __thread uint32_t image_sector_bytes;
+static __thread uint32_t new_entries_bytes;
+// The gpt_buf of the last drive this thread closed, for the next one.  It
+// is also the value of spare_buf_key, whose destructor frees it when the
+// thread exits: threads of libcgpt callers don't know to.
+static __thread uint8_t *spare_buf;
+static __thread size_t spare_buf_size;
+static pthread_key_t spare_buf_key;
+static pthread_once_t spare_buf_once = PTHREAD_ONCE_INIT;
+static int spare_buf_keyed;
+
+void DriveSetImageSectorSize(uint32_t sector_bytes) {
+  image_sector_bytes = sector_bytes;
+}
+
+void DriveSetEntriesSize(uint32_t entries_bytes) {
+  new_entries_bytes = entries_bytes;
+}
+
+// Image files don't carry a sector size, so unless one was set with
+// DriveSetImageSectorSize() look for the primary GPT header at LBA 1 of a
+// 4Kn layout.  Anything else, including a blank file, is taken as 512.
+static int IsGptSignature(const uint8_t *sig) {
+  return !memcmp(sig, GPT_HEADER_SIGNATURE, GPT_HEADER_SIGNATURE_SIZE) ||
+         !memcmp(sig, GPT_HEADER_SIGNATURE2, GPT_HEADER_SIGNATURE_SIZE);
+}
+
+static uint32_t DetectImageSectorSize(int fd) {
+  // One aligned read covering LBA 1 of both layouts, fine for O_DIRECT too.
+  size_t len = 2 * GPT_MAX_SECTOR_BYTES;
+  uint32_t sector_bytes = GPT_MIN_SECTOR_BYTES;
+  uint8_t *buf = AllocAligned(len);
+  ssize_t nread;
+
+  require(buf);
+  nread = pread(fd, buf, len, 0);
+  StatsAdd(STATS_READ_CALLS, 1);
+  if (nread > 0)
+    StatsAdd(STATS_READ_OTHER, nread);
+  if (nread >= GPT_MAX_SECTOR_BYTES + GPT_HEADER_SIGNATURE_SIZE &&
+      !IsGptSignature(buf + GPT_MIN_SECTOR_BYTES) &&
+      IsGptSignature(buf + GPT_MAX_SECTOR_BYTES))
+    sector_bytes = GPT_MAX_SECTOR_BYTES;
+  free(buf);
+  return sector_bytes;
+}
+
+// Drives waiting for DriveSyncDeferred(), kept open through a dup()ed fd.
+#define MAX_DEFERRED_SYNCS 32
+static struct {
+  int fd;
+  int is_file;
+  dev_t dev;
+  ino_t ino;
+} deferred_syncs[MAX_DEFERRED_SYNCS];
+static int num_deferred_syncs;
+static pthread_mutex_t deferred_syncs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void DriveSetSyncPolicy(int policy) {
+  sync_policy = policy;
+}
+
+int DriveParseSyncPolicy(const char *name, int *policy) {
+  if (!strcmp(name, "auto"))
+    *policy = DRIVE_SYNC_AUTO;
+  else if (!strcmp(name, "defer"))
+    *policy = DRIVE_SYNC_DEFER;
+  else if (!strcmp(name, "none"))
+    *policy = DRIVE_SYNC_NONE;
+  else
     return CGPT_FAILED;
+  return CGPT_OK;
+}
 
-  int nread = read(drive->fd, &drive->pmbr, sizeof(struct pmbr));
-  if (nread != sizeof(struct pmbr))
+// Image files only need their data (and size) on disk; block devices get a
+// full fsync() so the device cache is flushed too.
+static int SyncFd(int fd, int is_file) {
+  uint64_t start = StatsClock();
+  int ret = is_file ? fdatasync(fd) : fsync(fd);
+
+  StatsAdd(STATS_SYNC_CALLS, 1);
+  StatsAddTime(STATS_SYNC_US, start);
+  return ret < 0 ? CGPT_FAILED : CGPT_OK;
+}
+
+// Queues the drive for DriveSyncDeferred(), once per underlying file.
+// Returns CGPT_FAILED if it has to be synced right away instead.
+static int DeferSync(struct drive *drive) {
+  struct stat stat;
+  int retval = CGPT_FAILED;
+  int i;
+
+  if (fstat(drive->fd, &stat) < 0)
     return CGPT_FAILED;
+  pthread_mutex_lock(&deferred_syncs_lock);
+  for (i = 0; i < num_deferred_syncs; i++) {
+    if (deferred_syncs[i].dev == stat.st_dev &&
+        deferred_syncs[i].ino == stat.st_ino) {
+      retval = CGPT_OK;
+      goto out;
+    }
+  }
+  if (num_deferred_syncs == MAX_DEFERRED_SYNCS)
+    goto out;
+
+  deferred_syncs[i].fd = dup(drive->fd);
+  if (deferred_syncs[i].fd < 0)
+    goto out;
+  deferred_syncs[i].is_file = drive->is_file;
+  deferred_syncs[i].dev = stat.st_dev;
+  deferred_syncs[i].ino = stat.st_ino;
+  num_deferred_syncs++;
+  retval = CGPT_OK;
+out:
+  pthread_mutex_unlock(&deferred_syncs_lock);
+  return retval;
+}
+
+static int SyncDrive(struct drive *drive) {
+  switch (sync_policy) {
+  case DRIVE_SYNC_NONE:
+    return CGPT_OK;
+  case DRIVE_SYNC_DEFER:
+    if (CGPT_OK == DeferSync(drive))
+      return CGPT_OK;
+    break;
+  }
+  return SyncFd(drive->fd, drive->is_file);
+}
+
+int DriveSyncDeferred(void) {
+  int errors = 0;
+  int i;
+
+  pthread_mutex_lock(&deferred_syncs_lock);
+  for (i = 0; i < num_deferred_syncs; i++) {
+    if (CGPT_OK != SyncFd(deferred_syncs[i].fd, deferred_syncs[i].is_file)) {
+      errors++;
+      Error("Cannot sync drive: %s\n", strerror(errno));
+    }
+    close(deferred_syncs[i].fd);
+  }
+  num_deferred_syncs = 0;
+  pthread_mutex_unlock(&deferred_syncs_lock);
+
+  return errors ? CGPT_FAILED : CGPT_OK;
+}
 
+// Returns true if any entry slot stored in 'sector' (relative to the start of
+// the entries table) is flagged in the 'dirty' bitmap.
+static int EntriesSectorDirty(const uint8_t *dirty, uint32_t sector,
+                              uint32_t slots_per_sector) {
+  uint32_t slot;
+
+  for (slot = sector * slots_per_sector;
+       slot < (sector + 1) * slots_per_sector; slot++) {
+    if (dirty[slot / 8] & (1 << (slot % 8)))
+      return 1;
+  }
+  return 0;
+}
+
+// Saves the entries table 'table' (0 primary, 1 secondary) at 'sector'.
+// A tracked table (see GptEntriesTrackCrc()) still matches the disk except
+// for the slots flagged in gpt.write_dirty, so only the sectors holding
+// those are written, one write per contiguous run.
+static int SaveEntries(struct drive *drive, int table, uint64_t sector) {
+  GptData *gpt = &drive->gpt;
+  uint8_t *entries = table ? gpt->secondary_entries : gpt->primary_entries;
+  uint32_t slots_per_sector = gpt->sector_bytes / GPT_CRC_SLOT_SIZE;
+  int counter = table ? STATS_WRITE_SECONDARY : STATS_WRITE_PRIMARY;
+  uint32_t nsectors = GptEntriesSectors(GptEntriesBytes(gpt),
+                                        gpt->sector_bytes);
+  uint32_t first, last;
+
+  if (!(gpt->crc_tracked & (table ? MASK_SECONDARY : MASK_PRIMARY)))
+    return Save(drive->fd, entries, sector, gpt->sector_bytes, nsectors,
+                counter);
+
+  for (first = 0; first < nsectors; first++) {
+    if (!EntriesSectorDirty(gpt->write_dirty[table], first, slots_per_sector))
+      continue;
+    for (last = first + 1; last < nsectors; last++) {
+      if (!EntriesSectorDirty(gpt->write_dirty[table], last,
+                              slots_per_sector))
+        break;
+    }
+    if (CGPT_OK != Save(drive->fd, entries + first * gpt->sector_bytes,
+                        sector + first, gpt->sector_bytes, last - first,
+                        counter))
+      return CGPT_FAILED;
+    first = last;
+  }
+  memset(gpt->write_dirty[table], 0, sizeof(gpt->write_dirty[table]));
   return CGPT_OK;
 }
 
-int WritePMBR(struct drive *drive) {
-  if (-1 == lseek(drive->fd, 0, SEEK_SET))
+// Returns true if the primary header and entries pass the library checks.
+static int PrimaryGptSane(GptData *gpt) {
+  GptHeader *header = (GptHeader *)gpt->primary_header;
+
+  return 0 == CheckHeader(header, 0, gpt->drive_sectors, gpt->sector_bytes) &&
+         GptHeaderEntriesBytes(header) == GptEntriesBytes(gpt) &&
+         0 == CheckEntries((GptEntry *)gpt->primary_entries, header);
+}
+
+// Returns the size of the entries table a header passing CheckHeader()
+// describes, or 0 for any other header.
+static uint32_t HeaderTableBytes(struct drive *drive, const uint8_t *header,
+                                 int is_secondary) {
+  GptHeader *h = (GptHeader *)header;
+
+  if (CheckHeader(h, is_secondary, drive->gpt.drive_sectors,
+                  drive->gpt.sector_bytes))
+    return 0;
+  return GptHeaderEntriesBytes(h);
+}
+
+// Read backend: everything cgpt needs lives in two contiguous regions,
+// PMBR + primary header + primary entries at the start of the drive and
+// secondary entries + secondary header at the end, so load them into a
+// single (O_DIRECT aligned) allocation with one vectored read each.  If
+// 'lazy' is set, the secondary is only read when the primary is not sane.
+// Tables larger than TOTAL_ENTRIES_SIZE take one more read.
+
+// Size of drive->gpt_buf for tables of 'entries_bytes'.
+static uint64_t GptBufBytes(uint64_t sector_bytes, uint32_t entries_bytes) {
+  return sector_bytes * (GPT_PMBR_SECTOR + 2 * GPT_HEADER_SECTOR +
+                         2 * GptEntriesSectors(entries_bytes, sector_bytes));
+}
+
+static void CreateSpareBufKey(void) {
+  spare_buf_keyed = !pthread_key_create(&spare_buf_key, free);
+}
+
+static void SetSpareBuf(uint8_t *buf, size_t size) {
+  spare_buf = buf;
+  spare_buf_size = size;
+  pthread_once(&spare_buf_once, CreateSpareBufKey);
+  if (spare_buf_keyed)
+    pthread_setspecific(spare_buf_key, buf);
+}
+
+// Gives the drive a gpt_buf of at least 'size' bytes, the thread's spare
+// one if it is large enough.  The contents are left to the caller.
+static void AllocGptBuf(struct drive *drive, size_t size) {
+  if (spare_buf && spare_buf_size >= size) {
+    drive->gpt_buf = spare_buf;
+    drive->gpt_buf_size = spare_buf_size;
+    SetSpareBuf(NULL, 0);
+    return;
+  }
+  drive->gpt_buf = AllocAligned(size);
+  require(drive->gpt_buf);
+  drive->gpt_buf_size = size;
+  StatsAdd(STATS_BUFFERS_ALLOCATED, 1);
+}
+
+// Keeps the larger of 'buf' and the thread's spare buffer as the spare.
+static void FreeGptBuf(uint8_t *buf, size_t size) {
+  if (!buf)
+    return;
+  if (spare_buf && spare_buf_size >= size) {
+    free(buf);
+    return;
+  }
+  free(spare_buf);
+  SetSpareBuf(buf, size);
+}
+
+void DriveFreeSpareBuffer(void) {
+  free(spare_buf);
+  SetSpareBuf(NULL, 0);
+}
+
+// Points the GptData buffers into drive->gpt_buf, laid out for tables of
+// 'entries_bytes'.
+static void LayoutGptBuf(struct drive *drive, uint32_t entries_bytes) {
+  uint64_t sector_bytes = drive->gpt.sector_bytes;
+  uint64_t header_bytes = sector_bytes * GPT_HEADER_SECTOR;
+  uint64_t table_bytes = sector_bytes *
+                         GptEntriesSectors(entries_bytes, sector_bytes);
+
+  drive->gpt.entries_bytes = entries_bytes;
+  drive->pmbr_sector = drive->gpt_buf;
+  drive->gpt.primary_header = drive->gpt_buf + sector_bytes * GPT_PMBR_SECTOR;
+  drive->gpt.primary_entries = drive->gpt.primary_header + header_bytes;
+  drive->gpt.secondary_entries = drive->gpt.primary_entries + table_bytes;
+  drive->gpt.secondary_header = drive->gpt.secondary_entries + table_bytes;
+}
+
+// Reads the secondary entries and header into the buffers set up by
+// LoadGpt().
+static int LoadSecondaryGpt(struct drive *drive) {
+  uint64_t sector_bytes = drive->gpt.sector_bytes;
+  uint32_t entries_sectors = GptEntriesSectors(GptEntriesBytes(&drive->gpt),
+                                               sector_bytes);
+  struct iovec iov[2];
+
+  iov[0].iov_base = drive->gpt.secondary_entries;
+  iov[0].iov_len = sector_bytes * entries_sectors;
+  iov[1].iov_base = drive->gpt.secondary_header;
+  iov[1].iov_len = sector_bytes * GPT_HEADER_SECTOR;
+  return ReadSectors(drive->fd, iov, 2,
+                     (drive->gpt.drive_sectors - GPT_HEADER_SECTOR -
+                      entries_sectors) * sector_bytes, STATS_READ_SECONDARY);
+}
+
+// Moves the primary GPT read for tables of the current size into a buffer
+// for 'entries_bytes' ones and reads the rest of its entries.
+static int GrowPrimaryGpt(struct drive *drive, uint32_t entries_bytes) {
+  uint64_t sector_bytes = drive->gpt.sector_bytes;
+  uint32_t old_sectors = GptEntriesSectors(GptEntriesBytes(&drive->gpt),
+                                           sector_bytes);
+  uint32_t new_sectors = GptEntriesSectors(entries_bytes, sector_bytes);
+  size_t size = GptBufBytes(sector_bytes, entries_bytes);
+  uint8_t *old_buf = drive->gpt_buf;
+  size_t old_size = drive->gpt_buf_size;
+  struct iovec iov;
+
+  // Only the secondary moves within a buffer that is large enough already.
+  if (old_size < size) {
+    AllocGptBuf(drive, size);
+    memcpy(drive->gpt_buf, old_buf, sector_bytes *
+           (GPT_PMBR_SECTOR + GPT_HEADER_SECTOR + old_sectors));
+    FreeGptBuf(old_buf, old_size);
+  }
+  LayoutGptBuf(drive, entries_bytes);
+
+  iov.iov_base = drive->gpt.primary_entries + sector_bytes * old_sectors;
+  iov.iov_len = sector_bytes * (new_sectors - old_sectors);
+  return ReadSectors(drive->fd, &iov, 1, sector_bytes *
+                     (GPT_PMBR_SECTOR + GPT_HEADER_SECTOR + old_sectors),
+                     STATS_READ_PRIMARY);
+}
+
+static int LoadGpt(struct drive *drive, int lazy) {
+  uint64_t sector_bytes = drive->gpt.sector_bytes;
+  uint32_t entries_bytes = new_entries_bytes ? new_entries_bytes :
+                           TOTAL_ENTRIES_SIZE;
+  struct iovec iov[3];
+
+  AllocGptBuf(drive, GptBufBytes(sector_bytes, entries_bytes));
+  LayoutGptBuf(drive, entries_bytes);
+
+  iov[0].iov_base = drive->gpt_buf;
+  iov[0].iov_len = sector_bytes * GPT_PMBR_SECTOR;
+  iov[1].iov_base = drive->gpt.primary_header;
+  iov[1].iov_len = sector_bytes * GPT_HEADER_SECTOR;
+  iov[2].iov_base = drive->gpt.primary_entries;
+  iov[2].iov_len = sector_bytes * GptEntriesSectors(entries_bytes,
+                                                    sector_bytes);
+  if (CGPT_OK != ReadSectors(drive->fd, iov, 3, 0, STATS_READ_PRIMARY))
     return CGPT_FAILED;
 
-  int nwrote = write(drive->fd, &drive->pmbr, sizeof(struct pmbr));
-  if (nwrote != sizeof(struct pmbr))
+  // Otherwise the tables are as large as the headers say, going by the
+  // secondary one only if the primary is no good.
+  if (!new_entries_bytes) {
+    entries_bytes = HeaderTableBytes(drive, drive->gpt.primary_header, 0);
+    if (!entries_bytes) {
+      iov[0].iov_base = drive->gpt.secondary_header;
+      iov[0].iov_len = sector_bytes * GPT_HEADER_SECTOR;
+      if (CGPT_OK != ReadSectors(drive->fd, iov, 1,
+                                 (drive->gpt.drive_sectors -
+                                  GPT_HEADER_SECTOR) * sector_bytes,
+                                 STATS_READ_SECONDARY))
+        return CGPT_FAILED;
+      entries_bytes = HeaderTableBytes(drive, drive->gpt.secondary_header, 1);
+    }
+    if (entries_bytes > GptEntriesBytes(&drive->gpt) &&
+        CGPT_OK != GrowPrimaryGpt(drive, entries_bytes))
+      return CGPT_FAILED;
+  }
+
+  if (lazy && PrimaryGptSane(&drive->gpt)) {
+    memset(drive->gpt.secondary_entries, 0, sector_bytes *
+           (GptEntriesSectors(GptEntriesBytes(&drive->gpt), sector_bytes) +
+            GPT_HEADER_SECTOR));
+    drive->gpt.unverified = MASK_SECONDARY;
+    return CGPT_OK;
+  }
+
+  return LoadSecondaryGpt(drive);
+}
+
+// Maps 'len' bytes of 'fd' at byte 'offset' into map slot 'i' of the drive
+// and returns a pointer to the first byte, or NULL on failure.
+static uint8_t *MapRegion(struct drive *drive, int i, uint64_t offset,
+                          size_t len) {
+  uint64_t page_mask = (uint64_t)sysconf(_SC_PAGESIZE) - 1;
+  uint64_t delta = offset & page_mask;
+  void *map;
+
+  map = mmap(NULL, len + delta, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+             drive->fd, offset - delta);
+  StatsAdd(STATS_MMAP_CALLS, 1);
+  if (map == MAP_FAILED)
+    return NULL;
+  StatsAdd(STATS_MAPPED, len);
+  drive->map[i] = map;
+  drive->map_len[i] = len + delta;
+  return (uint8_t *)map + delta;
+}
+
+// Mmap backend for image files: the GptData buffers point straight into
+// private mappings of the two GPT regions, so nothing is read or copied up
+// front and untouched sectors are never faulted in.  The mappings are
+// copy-on-write, so changes only reach the file through DriveClose()'s
+// usual writes and an abandoned DriveClose(drive, 0) leaves it untouched.
+// Returns CGPT_FAILED if the file can't be mapped; the drive is then left
+// for the read backend.
+static int MapGpt(struct drive *drive) {
+  uint64_t sector_bytes = drive->gpt.sector_bytes;
+  uint64_t drive_sectors = drive->gpt.drive_sectors;
+  uint32_t entries_bytes = new_entries_bytes;
+  uint64_t primary_sectors, secondary_sectors;
+  uint8_t *primary, *secondary;
+
+  // Map room for the largest tables, short of the size of the file; what
+  // isn't used costs nothing.
+  primary_sectors = GPT_PMBR_SECTOR + GPT_HEADER_SECTOR +
+      GptEntriesSectors(new_entries_bytes ? new_entries_bytes :
+                        GPT_MAX_ENTRIES_SIZE, sector_bytes);
+  secondary_sectors = primary_sectors - GPT_PMBR_SECTOR;
+  if (primary_sectors > drive_sectors)
+    primary_sectors = drive_sectors;
+  if (secondary_sectors > drive_sectors)
+    secondary_sectors = drive_sectors;
+
+  primary = MapRegion(drive, 0, 0, sector_bytes * primary_sectors);
+  if (!primary)
+    return CGPT_FAILED;
+  secondary = MapRegion(drive, 1, (drive_sectors - secondary_sectors) *
+                        sector_bytes, sector_bytes * secondary_sectors);
+  if (!secondary) {
+    munmap(drive->map[0], drive->map_len[0]);
+    drive->map[0] = 0;
     return CGPT_FAILED;
+  }
 
+  drive->pmbr_sector = primary;
+  drive->gpt.primary_header = primary + sector_bytes * GPT_PMBR_SECTOR;
+  drive->gpt.primary_entries = drive->gpt.primary_header +
+                               sector_bytes * GPT_HEADER_SECTOR;
+  drive->gpt.secondary_header = secondary + sector_bytes *
+                                (secondary_sectors - GPT_HEADER_SECTOR);
+
+  // The tables are as large as the headers say, like LoadGpt() finds.
+  if (!entries_bytes)
+    entries_bytes = HeaderTableBytes(drive, drive->gpt.primary_header, 0);
+  if (!entries_bytes)
+    entries_bytes = HeaderTableBytes(drive, drive->gpt.secondary_header, 1);
+  if (!entries_bytes)
+    entries_bytes = TOTAL_ENTRIES_SIZE;
+  drive->gpt.entries_bytes = entries_bytes;
+  drive->gpt.secondary_entries = drive->gpt.secondary_header - sector_bytes *
+                                 GptEntriesSectors(entries_bytes, sector_bytes);
   return CGPT_OK;
 }
 
-/* Saves sectors to 'fd'.
- *
- *   fd -- file descriptot.
- *   buf -- pointer to buffer
- *   sector -- starting sector offset
- *   sector_bytes -- bytes per sector
- *   sector_count -- number of sector to save
- *
- * Returns CGPT_OK for successful, CGPT_FAILED for failed.
- */
-static int Save(const int fd, const uint8_t *buf,
-                const uint64_t sector,
-                const uint64_t sector_bytes,
-                const uint64_t sector_count) {
-  int count;  /* byte count to write */
-  int nwrote;
 
-  require(buf);
-  count = sector_bytes * sector_count;
-
-  if (-1 == lseek(fd, sector * sector_bytes, SEEK_SET))
+// DriveOpen() within a batch: a copy of the batch's drive, which the
+// caller's DriveClose() hands back.
+static int DriveBatchLend(const char *drive_path, struct drive *drive,
+                          off_t min_size) {
+  if (strcmp(drive_path, batch.path)) {
+    Error("%s is not the drive of this batch (%s)\n", drive_path, batch.path);
+    return CGPT_FAILED;
+  }
+  if (image_sector_bytes &&
+      image_sector_bytes != batch.drive.gpt.sector_bytes) {
+    Error("Can't change the sector size of %s within a batch\n", drive_path);
+    return CGPT_FAILED;
+  }
+  if (new_entries_bytes &&
+      new_entries_bytes != GptEntriesBytes(&batch.drive.gpt)) {
+    Error("Can't change the table size of %s within a batch\n", drive_path);
+    return CGPT_FAILED;
+  }
+  if (batch.drive.size < (min_size * batch.drive.gpt.sector_bytes)) {
+    Error("Drive %s is smaller than minimum: %d\n", drive_path, min_size);
     return CGPT_FAILED;
+  }
 
-  nwrote = write(fd, buf, count);
-  if (nwrote < count)
+  *drive = batch.drive;
+  drive->batch = 1;
+  // Each step starts out like a fresh DriveOpen(): earlier steps may have
+  // changed entries behind the incremental CRC and the index.  The whole
+  // tables are written at the end instead.
+  GptEntriesUntrackCrc(&drive->gpt, MASK_BOTH);
+  drive->index.table = 0;
+  return CGPT_OK;
+}
+
+int DriveBatchBegin(const char *drive_path) {
+  require(!batch.path);
+  if (CGPT_OK != DriveOpen(drive_path, &batch.drive, 0, O_RDWR, 0))
     return CGPT_FAILED;
+  batch.path = strdup(drive_path);
+  if (!batch.path) {
+    Error("unable to allocate memory\n");
+    (void) DriveClose(&batch.drive, 0);
+    return CGPT_FAILED;
+  }
+  batch.modified = 0;
+  batch.pmbr_modified = 0;
+  return CGPT_OK;
+}
+
+static void DriveBatchEnd(void) {
+  free(batch.path);
+  batch.path = 0;
+}
 
+int DriveBatchCommit(void) {
+  int retval = CGPT_OK;
+
+  require(batch.path);
+  DriveBatchEnd();
+  batch.drive.gpt.modified = batch.modified;
+  GptEntriesUntrackCrc(&batch.drive.gpt, MASK_BOTH);
+  if (batch.pmbr_modified && CGPT_OK != WritePMBR(&batch.drive)) {
+    Error("Cannot write PMBR: %s\n", strerror(errno));
+    retval = CGPT_FAILED;
+  }
+  if (CGPT_OK != DriveClose(&batch.drive, 1))
+    retval = CGPT_FAILED;
+  return retval;
+}
+
+void DriveBatchAbort(void) {
+  require(batch.path);
+  DriveBatchEnd();
+  (void) DriveClose(&batch.drive, 0);
+}
+
+// Drives kept loaded by the drive cache, see DriveCacheEnable().  Lent
+// copies share the buffers and fd of their entry, which is only freed once
+// the last one is handed back.
+struct cached_drive {
+  struct cached_drive *next;
+  char *path;
+  char *devpath;          /* sysfs path of a block device, without /sys */
+  struct stat st;         /* of path, to notice it changed */
+  int probe;              /* ProbeGpt() result, -1 if not probed */
+  int loaded;             /* drive holds what DriveOpen() loaded */
+  int primary_sane;       /* whether a lazy DriveOpen() skips the secondary */
+  uint8_t *zeros;         /* the secondary such a DriveOpen() reads */
+  int users;              /* copies lent out */
+  int dropped;            /* no longer in the list, free once unused */
+  struct drive drive;
+};
+
+static int drive_cache_enabled;
+static struct cached_drive *drive_cache;
+static pthread_mutex_t drive_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void DriveCacheEnable(void) {
+  drive_cache_enabled = 1;
+}
+
+static int LoadDrive(const char *drive_path, struct drive *drive,
+                     off_t min_size, int mode, int flags);
+
+static void FreeCachedDrive(struct cached_drive *e) {
+  if (e->loaded)
+    (void) DriveClose(&e->drive, 0);
+  free(e->zeros);
+  free(e->devpath);
+  free(e->path);
+  free(e);
+}
+
+// Unlinks *link from the cache, freeing it unless it is lent out.
+static void DropCachedDrive(struct cached_drive **link) {
+  struct cached_drive *e = *link;
+
+  *link = e->next;
+  e->dropped = 1;
+  if (!e->users)
+    FreeCachedDrive(e);
+}
+
+static int SameFile(const struct stat *a, const struct stat *b) {
+  if (a->st_dev != b->st_dev || a->st_ino != b->st_ino ||
+      a->st_rdev != b->st_rdev || a->st_mode != b->st_mode)
+    return 0;
+  // Writes to a block device don't touch its node; uevents cover those.
+  if (!S_ISREG(a->st_mode))
+    return 1;
+  return a->st_size == b->st_size &&
+         a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+         a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+         a->st_ctim.tv_sec == b->st_ctim.tv_sec &&
+         a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+// Returns the entry for drive_path, a new one if there was none or the
+// file changed, or NULL if drive_path can't be looked at.  Called locked.
+static struct cached_drive *FindCachedDrive(const char *drive_path) {
+  struct cached_drive **link, *e;
+  char sysname[64], *real;
+  struct stat st;
+
+  if (stat(drive_path, &st))
+    return NULL;
+  for (link = &drive_cache; (e = *link); link = &e->next) {
+    if (strcmp(e->path, drive_path))
+      continue;
+    if (SameFile(&e->st, &st))
+      return e;
+    DropCachedDrive(link);
+    break;
+  }
+
+  e = calloc(1, sizeof(*e));
+  if (!e || !(e->path = strdup(drive_path))) {
+    free(e);
+    return NULL;
+  }
+  e->st = st;
+  e->probe = -1;
+  if (S_ISBLK(st.st_mode)) {
+    snprintf(sysname, sizeof(sysname), "/sys/dev/block/%u:%u",
+             major(st.st_rdev), minor(st.st_rdev));
+    real = realpath(sysname, NULL);
+    if (real && !strncmp(real, "/sys/", 5))
+      e->devpath = strdup(real + 4);
+    free(real);
+  }
+  e->next = drive_cache;
+  drive_cache = e;
+  return e;
+}
+
+// Hands out a copy of the cached drive, loading it first if need be.
+static int DriveCacheLend(const char *drive_path, struct drive *drive,
+                          off_t min_size, int flags) {
+  struct cached_drive *e;
+  struct drive loaded;
+  uint64_t sector_bytes;
+
+  pthread_mutex_lock(&drive_cache_lock);
+  e = FindCachedDrive(drive_path);
+  if (e && !e->loaded) {
+    // Load without the lock, so that scans still overlap their I/O, and
+    // all of it, so that lazy and full DriveOpen()s can share it.
+    e->users++;
+    pthread_mutex_unlock(&drive_cache_lock);
+    if (CGPT_OK != LoadDrive(drive_path, &loaded, 0, O_RDONLY,
+                             flags & DRIVE_DIRECT_IO)) {
+      pthread_mutex_lock(&drive_cache_lock);
+      if (!--e->users && e->dropped)
+        FreeCachedDrive(e);
+      pthread_mutex_unlock(&drive_cache_lock);
+      return CGPT_FAILED;
+    }
+    sector_bytes = loaded.gpt.sector_bytes;
+    pthread_mutex_lock(&drive_cache_lock);
+    if (e->loaded || e->dropped) {
+      (void) DriveClose(&loaded, 0);
+    } else {
+      e->drive = loaded;
+      e->primary_sane = PrimaryGptSane(&loaded.gpt);
+      e->zeros = calloc(GPT_HEADER_SECTOR + GptEntriesSectors(
+                            GptEntriesBytes(&loaded.gpt), sector_bytes),
+                        sector_bytes);
+      require(e->zeros);
+      e->loaded = 1;
+    }
+    if (!--e->users && e->dropped) {
+      FreeCachedDrive(e);
+      e = NULL;
+    }
+  }
+  if (!e || !e->loaded) {
+    pthread_mutex_unlock(&drive_cache_lock);
+    return LoadDrive(drive_path, drive, min_size, O_RDONLY, flags);
+  }
+  e->users++;
+  *drive = e->drive;
+  drive->cache = e;
+  pthread_mutex_unlock(&drive_cache_lock);
+
+  // What a lazy DriveOpen() would have found, down to the zeroed secondary
+  // of the read backend.
+  if ((flags & DRIVE_LAZY_SECONDARY) && e->primary_sane) {
+    drive->gpt.unverified = MASK_SECONDARY;
+    if (!drive->map[1]) {
+      drive->gpt.secondary_entries = e->zeros;
+      drive->gpt.secondary_header = e->zeros + drive->gpt.sector_bytes *
+          GptEntriesSectors(GptEntriesBytes(&drive->gpt),
+                            drive->gpt.sector_bytes);
+    }
+  }
+  if (drive->size < (min_size * drive->gpt.sector_bytes)) {
+    Error("Drive %s is smaller than minimum: %d\n", drive_path, min_size);
+    (void) DriveClose(drive, 0);
+    return CGPT_FAILED;
+  }
+  StatsAdd(STATS_DRIVES_CACHED, 1);
   return CGPT_OK;
 }
 
+static void DriveCacheReturn(struct cached_drive *e) {
+  pthread_mutex_lock(&drive_cache_lock);
+  if (!--e->users && e->dropped)
+    FreeCachedDrive(e);
+  pthread_mutex_unlock(&drive_cache_lock);
+}
+
+void DriveCacheInvalidate(const char *devpath) {
+  struct cached_drive **link = &drive_cache, *e;
+  size_t len;
+
+  pthread_mutex_lock(&drive_cache_lock);
+  while ((e = *link)) {
+    len = e->devpath ? strlen(e->devpath) : 0;
+    // The device itself or one of its partitions.
+    if (!devpath || (len && !strncmp(devpath, e->devpath, len) &&
+                     (!devpath[len] || devpath[len] == '/')))
+      DropCachedDrive(link);
+    else
+      link = &e->next;
+  }
+  pthread_mutex_unlock(&drive_cache_lock);
+}
+
+int DriveCacheProbe(const char *drive_path) {
+  struct cached_drive *e;
+  int probe = -1;
+
+  if (!drive_cache_enabled)
+    return -1;
+  pthread_mutex_lock(&drive_cache_lock);
+  if ((e = FindCachedDrive(drive_path)))
+    probe = e->probe;
+  pthread_mutex_unlock(&drive_cache_lock);
+  return probe;
+}
+
+void DriveCacheSetProbe(const char *drive_path, int found) {
+  struct cached_drive *e;
+
+  if (!drive_cache_enabled)
+    return;
+  pthread_mutex_lock(&drive_cache_lock);
+  if ((e = FindCachedDrive(drive_path)))
+    e->probe = found;
+  pthread_mutex_unlock(&drive_cache_lock);
+}
+
+// Metadata cache, see DriveSetMetadataCache(): a file per drive holding a
+// gpt_cache_record and then the GPT sectors in the order LayoutGptBuf()
+// lays them out.  The PMBR and primary header are read back from the drive
+// before a record is used, which covers its disk GUID and header CRC.
+#define GPT_CACHE_MAGIC "CGPTMC01"
+
+struct gpt_cache_record {
+  char magic[8];
+  uint64_t dev;             /* st_rdev of a block device, st_dev of a file */
+  uint64_t ino;             /* and the rest only for files */
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t size;
+  uint32_t sector_bytes;
+  uint32_t entries_bytes;   /* the rest isn't part of the key */
+  uint32_t unverified;
+  uint32_t reserved;
+};
+
+static const char *metadata_cache_dir;
+
+void DriveSetMetadataCache(const char *dir) {
+  metadata_cache_dir = dir && *dir ? dir : NULL;
+}
+
+// Names the cache file of the drive st describes.  Returns 0 if it won't fit.
+static int GptCachePath(const struct stat *st, char *path, size_t len) {
+  int n;
+
+  if (S_ISBLK(st->st_mode))
+    n = snprintf(path, len, "%s/b%u:%u", metadata_cache_dir,
+                 major(st->st_rdev), minor(st->st_rdev));
+  else
+    n = snprintf(path, len, "%s/f%llx:%llx", metadata_cache_dir,
+                 (unsigned long long)st->st_dev,
+                 (unsigned long long)st->st_ino);
+  return n > 0 && (size_t)n < len;
+}
+
+static void GptCacheKey(const struct drive *drive, const struct stat *st,
+                        struct gpt_cache_record *rec) {
+  memset(rec, 0, sizeof(*rec));
+  memcpy(rec->magic, GPT_CACHE_MAGIC, sizeof(rec->magic));
+  if (S_ISBLK(st->st_mode)) {
+    rec->dev = st->st_rdev;
+  } else {
+    // Image files are written behind our back all the time.
+    rec->dev = st->st_dev;
+    rec->ino = st->st_ino;
+    rec->mtime_sec = st->st_mtim.tv_sec;
+    rec->mtime_nsec = st->st_mtim.tv_nsec;
+  }
+  rec->size = drive->size;
+  rec->sector_bytes = drive->gpt.sector_bytes;
+}
+
+// Loads the GPT of the drive from its cache file if that is still good:
+// for the same device or file of the same size, with the same PMBR and
+// primary header on the drive now.  Returns CGPT_FAILED if not, to load it
+// from the drive.
+static int LoadCachedGpt(struct drive *drive, const struct stat *st,
+                         int lazy) {
+  struct gpt_cache_record key, rec;
+  char path[PATH_MAX];
+  uint64_t sector_bytes = drive->gpt.sector_bytes;
+  uint64_t head_bytes = sector_bytes * (GPT_PMBR_SECTOR + GPT_HEADER_SECTOR);
+  uint8_t *head = NULL;
+  struct stat cst;
+  struct iovec iov;
+  size_t size;
+  int fd, r = CGPT_FAILED;
+
+  if (!GptCachePath(st, path, sizeof(path)))
+    return CGPT_FAILED;
+  fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  StatsAdd(STATS_OPEN_CALLS, 1);
+  if (fd < 0)
+    return CGPT_FAILED;
+
+  // Only ever trust what we wrote ourselves.
+  GptCacheKey(drive, st, &key);
+  StatsAdd(STATS_READ_CALLS, 1);
+  if (fstat(fd, &cst) || !S_ISREG(cst.st_mode) || cst.st_uid != geteuid() ||
+      read(fd, &rec, sizeof(rec)) != sizeof(rec) ||
+      memcmp(&rec, &key, offsetof(struct gpt_cache_record, entries_bytes)) ||
+      rec.entries_bytes < MIN_NUMBER_OF_ENTRIES * sizeof(GptEntry) ||
+      rec.entries_bytes > GPT_MAX_ENTRIES_SIZE ||
+      (rec.unverified & ~MASK_SECONDARY) || (rec.unverified && !lazy))
+    goto done;
+
+  head = AllocAligned(head_bytes);
+  require(head);
+  iov.iov_base = head;
+  iov.iov_len = head_bytes;
+  if (CGPT_OK != ReadSectors(drive->fd, &iov, 1, 0, STATS_READ_PRIMARY))
+    goto done;
+
+  size = GptBufBytes(sector_bytes, rec.entries_bytes);
+  AllocGptBuf(drive, size);
+  LayoutGptBuf(drive, rec.entries_bytes);
+  StatsAdd(STATS_READ_CALLS, 1);
+  if (read(fd, drive->gpt_buf, size) != size ||
+      memcmp(drive->gpt_buf, head, head_bytes)) {
+    FreeGptBuf(drive->gpt_buf, drive->gpt_buf_size);
+    drive->gpt_buf = 0;
+    drive->gpt_buf_size = 0;
+    goto done;
+  }
+  drive->gpt.unverified = rec.unverified;
+  StatsAdd(STATS_GPTS_CACHED, 1);
+  r = CGPT_OK;
+
+done:
+  free(head);
+  close(fd);
+  return r;
+}
+
+// Writes the GPT just loaded into the drive's cache file, if its primary
+// is sane.  Nothing here is worth failing the command over.
+static void SaveCachedGpt(struct drive *drive, const struct stat *st) {
+  struct gpt_cache_record rec;
+  char path[PATH_MAX], tmp[PATH_MAX + 8];
+  uint64_t sector_bytes = drive->gpt.sector_bytes;
+  uint64_t table_bytes = sector_bytes *
+      GptEntriesSectors(GptEntriesBytes(&drive->gpt), sector_bytes);
+  struct iovec iov[6];
+  ssize_t count = 0;
+  int fd, i;
+
+  if (!PrimaryGptSane(&drive->gpt) || !GptCachePath(st, path, sizeof(path)))
+    return;
+  GptCacheKey(drive, st, &rec);
+  rec.entries_bytes = GptEntriesBytes(&drive->gpt);
+  rec.unverified = drive->gpt.unverified;
+
+  iov[0].iov_base = &rec;
+  iov[0].iov_len = sizeof(rec);
+  iov[1].iov_base = drive->pmbr_sector;
+  iov[1].iov_len = sector_bytes * GPT_PMBR_SECTOR;
+  iov[2].iov_base = drive->gpt.primary_header;
+  iov[2].iov_len = sector_bytes * GPT_HEADER_SECTOR;
+  iov[3].iov_base = drive->gpt.primary_entries;
+  iov[3].iov_len = table_bytes;
+  iov[4].iov_base = drive->gpt.secondary_entries;
+  iov[4].iov_len = table_bytes;
+  iov[5].iov_base = drive->gpt.secondary_header;
+  iov[5].iov_len = sector_bytes * GPT_HEADER_SECTOR;
+  for (i = 0; i < 6; i++)
+    count += iov[i].iov_len;
+
+  // Written aside and renamed into place, for cgpts running side by side.
+  (void) mkdir(metadata_cache_dir, 0700);
+  snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+  fd = mkstemp(tmp);
+  StatsAdd(STATS_OPEN_CALLS, 1);
+  if (fd < 0)
+    return;
+  StatsAdd(STATS_WRITE_CALLS, 1);
+  if (writev(fd, iov, 6) != count || rename(tmp, path))
+    unlink(tmp);
+  close(fd);
+}
+
+// Drops the cache file of a drive that was just written to.
+static void DropCachedGpt(struct drive *drive) {
+  char path[PATH_MAX];
+  struct stat st;
+
+  if (!fstat(drive->fd, &st) && GptCachePath(&st, path, sizeof(path)))
+    (void) unlink(path);
+}
 
 // Opens a block device or file, loads raw GPT data from it.
 // If the drive is a file or doesn't exist and min_size is not zero then
@@ -159,13 +1251,12 @@ static int Save(const int fd, const uint8_t *buf,
 // min_size is specified in sectors
 // mode should be O_RDONLY or O_RDWR
 // min_size is required if mode includes O_CREAT
+// flags is a combination of DRIVE_* load flags, see cgpt.h
 //
 // Returns CGPT_FAILED if any error happens.
 // Returns CGPT_OK if success and information are stored in 'drive'. */
 int DriveOpen(const char *drive_path, struct drive *drive,
-              off_t min_size, int mode) {
-  struct stat stat;
-
+              off_t min_size, int mode, int flags) {
   require(drive_path);
   require(drive);
   if (mode & O_CREAT) {
@@ -173,12 +1264,71 @@ int DriveOpen(const char *drive_path, struct drive *drive,
     require(mode & O_RDWR);
   }
 
+  if (batch.path)
+    return DriveBatchLend(drive_path, drive, min_size);
+  if (drive_cache_enabled && !(mode & (O_WRONLY | O_RDWR)) &&
+      !image_sector_bytes && !new_entries_bytes)
+    return DriveCacheLend(drive_path, drive, min_size, flags);
+  return LoadDrive(drive_path, drive, min_size, mode, flags);
+}
+
+// How long to wait for whoever else holds the lock of a disk to write.
+#define DRIVE_LOCK_TIMEOUT_MS 10000
+
+// Takes the lock udev honors on a whole disk, LOCK_EX on the device, as
+// sfdisk --lock and systemd-repart do.  udev then neither probes the disk
+// while its GPT is half written nor rereads the whole table once the fd
+// written through is closed, DriveClose() having told the kernel what
+// changed.  So that it is still held then, it is on a descriptor of its own.
+static int LockDrive(struct drive *drive, const char *drive_path) {
+  int waited;
+
+  drive->lock_fd = open(drive_path, O_RDONLY | O_CLOEXEC);
+  StatsAdd(STATS_OPEN_CALLS, 1);
+  if (drive->lock_fd == -1) {
+    Error("Can't open %s: %s\n", drive_path, strerror(errno));
+    return CGPT_FAILED;
+  }
+  // udev only holds it for a moment, but never wait for good.
+  for (waited = 0; flock(drive->lock_fd, LOCK_EX | LOCK_NB); waited += 100) {
+    if (errno != EWOULDBLOCK && errno != EINTR) {
+      Error("Can't lock %s: %s\n", drive_path, strerror(errno));
+      return CGPT_FAILED;
+    }
+    if (waited >= DRIVE_LOCK_TIMEOUT_MS) {
+      Error("%s is locked by another program\n", drive_path);
+      return CGPT_FAILED;
+    }
+    usleep(100 * 1000);
+  }
+  return CGPT_OK;
+}
+
+// DriveOpen() of a drive nobody has loaded yet.
+static int LoadDrive(const char *drive_path, struct drive *drive,
+                     off_t min_size, int mode, int flags) {
+  uint64_t start, load_start;
+  struct stat stat;
+  int lazy, cacheable;
+
   // Clear struct for proper error handling.
   memset(drive, 0, sizeof(struct drive));
+  drive->lock_fd = -1;
+  start = StatsClock();
 
-  drive->fd = open(drive_path, mode | O_LARGEFILE, 0666);
+  if (flags & DRIVE_DIRECT_IO) {
+    drive->fd = open(drive_path, mode | O_LARGEFILE | O_DIRECT, 0666);
+    drive->direct = drive->fd != -1;
+    StatsAdd(STATS_OPEN_CALLS, 1);
+  }
+  // Not every file system supports O_DIRECT; go through the page cache then.
+  if (!drive->direct) {
+    drive->fd = open(drive_path, mode | O_LARGEFILE, 0666);
+    StatsAdd(STATS_OPEN_CALLS, 1);
+  }
   if (drive->fd == -1) {
     Error("Can't open %s: %s\n", drive_path, strerror(errno));
+    StatsAddTime(STATS_OPEN_US, start);
     return CGPT_FAILED;
   }
 
@@ -186,7 +1336,12 @@ int DriveOpen(const char *drive_path, struct drive *drive,
     Error("Can't fstat %s: %s\n", drive_path, strerror(errno));
     goto error_close;
   }
-  if ((stat.st_mode & S_IFMT) != S_IFREG) {
+  drive->is_file = (stat.st_mode & S_IFMT) == S_IFREG;
+  if (!drive->is_file && (mode & O_RDWR) &&
+      CGPT_OK != LockDrive(drive, drive_path))
+    goto error_close;
+  if (!drive->is_file) {
+    StatsAdd(STATS_IOCTL_CALLS, 2);
     if (ioctl(drive->fd, BLKGETSIZE64, &drive->size) < 0) {
       Error("Can't read drive size from %s: %s\n", drive_path, strerror(errno));
       goto error_close;
@@ -197,16 +1352,25 @@ int DriveOpen(const char *drive_path, struct drive *drive,
       goto error_close;
     }
   } else {
-    drive->gpt.sector_bytes = 512;  /* bytes */
+    drive->gpt.sector_bytes = image_sector_bytes ? image_sector_bytes :
+                              DetectImageSectorSize(drive->fd);
     drive->size = stat.st_size;
-    if ((drive->size < (min_size * 512)) && (mode & O_RDWR)) {
-      drive->size = (min_size * 512);
+    if ((drive->size < (min_size * drive->gpt.sector_bytes)) &&
+        (mode & O_RDWR)) {
+      drive->size = (min_size * drive->gpt.sector_bytes);
       if (ftruncate(drive->fd, drive->size) < 0) {
         Error("Can't extend %s: %s\n", drive_path, strerror(errno));
         goto error_close;
       }
+      drive->written = 1;
     }
   }
+  if (drive->gpt.sector_bytes != GPT_MIN_SECTOR_BYTES &&
+      drive->gpt.sector_bytes != GPT_MAX_SECTOR_BYTES) {
+    Error("Unsupported sector size %u of %s\n", drive->gpt.sector_bytes,
+          drive_path);
+    goto error_close;
+  }
   if (drive->size < (min_size * drive->gpt.sector_bytes)) {
     Error("Drive %s is smaller than minimum: %d\n", drive_path, min_size);
     goto error_close;
@@ -218,74 +1382,333 @@ int DriveOpen(const char *drive_path, struct drive *drive,
   }
   drive->gpt.drive_sectors = drive->size / drive->gpt.sector_bytes;
 
-  // Read the data.
-  if (CGPT_OK != Load(drive->fd, &drive->gpt.primary_header,
-                      GPT_PMBR_SECTOR,
-                      drive->gpt.sector_bytes, GPT_HEADER_SECTOR)) {
+  if (drive->gpt.drive_sectors < GPT_PMBR_SECTOR + GPT_HEADER_SECTOR +
+      GptEntriesSectors(new_entries_bytes ? new_entries_bytes :
+                        TOTAL_ENTRIES_SIZE, drive->gpt.sector_bytes)) {
+    Error("Drive %s is too small to hold a GPT\n", drive_path);
     goto error_close;
   }
-  if (CGPT_OK != Load(drive->fd, &drive->gpt.secondary_header,
-                      drive->gpt.drive_sectors - GPT_PMBR_SECTOR,
-                      drive->gpt.sector_bytes, GPT_HEADER_SECTOR)) {
-    goto error_close;
-  }
-  if (CGPT_OK != Load(drive->fd, &drive->gpt.primary_entries,
-                      GPT_PMBR_SECTOR + GPT_HEADER_SECTOR,
-                      drive->gpt.sector_bytes, GPT_ENTRIES_SECTORS)) {
-        goto error_close;
-  }
-  if (CGPT_OK != Load(drive->fd, &drive->gpt.secondary_entries,
-                      drive->gpt.drive_sectors - GPT_HEADER_SECTOR
-                      - GPT_ENTRIES_SECTORS,
-                      drive->gpt.sector_bytes, GPT_ENTRIES_SECTORS)) {
+
+  // In lazy mode a sane primary GPT is all a reader needs, so skip the
+  // secondary and leave it to GptSanityCheck() to report it unverified.
+  lazy = (flags & DRIVE_LAZY_SECONDARY) && !(mode & O_RDWR);
+  cacheable = metadata_cache_dir && !(mode & (O_WRONLY | O_RDWR)) &&
+              !new_entries_bytes;
+  load_start = StatsClock();
+  if (cacheable && CGPT_OK == LoadCachedGpt(drive, &stat, lazy)) {
+    cacheable = 0;
+  } else if (drive->is_file && !drive->direct && CGPT_OK == MapGpt(drive)) {
+    // The secondary mapping costs nothing until it is touched.
+    if (lazy && PrimaryGptSane(&drive->gpt))
+      drive->gpt.unverified = MASK_SECONDARY;
+  } else if (CGPT_OK != LoadGpt(drive, lazy)) {
     goto error_close;
   }
+  if (cacheable)
+    SaveCachedGpt(drive, &stat);
+  StatsAddTime(STATS_LOAD_US, load_start);
+  memcpy(&drive->pmbr, drive->pmbr_sector, sizeof(struct pmbr));
 
   // We just load the data. Caller must validate it.
+  StatsAdd(STATS_DRIVES_OPENED, 1);
+  StatsAddTime(STATS_OPEN_US, start);
   return CGPT_OK;
 
 error_close:
   (void) DriveClose(drive, 0);
+  StatsAddTime(STATS_OPEN_US, start);
   return CGPT_FAILED;
 }
 
 
+int DriveMakeWritable(struct drive *drive, const char *drive_path) {
+  struct stat old_stat, new_stat;
+  int fd = -1;
+
+  if (drive->cache) {
+    Error("%s is read-only here\n", drive_path);
+    return CGPT_FAILED;
+  }
+  if (fstat(drive->fd, &old_stat) == -1) {
+    Error("Can't fstat %s: %s\n", drive_path, strerror(errno));
+    return CGPT_FAILED;
+  }
+
+  if (drive->direct) {
+    fd = open(drive_path, O_RDWR | O_LARGEFILE | O_DIRECT);
+    StatsAdd(STATS_OPEN_CALLS, 1);
+  }
+  if (fd == -1) {
+    fd = open(drive_path, O_RDWR | O_LARGEFILE);
+    StatsAdd(STATS_OPEN_CALLS, 1);
+    drive->direct = 0;
+  }
+  if (fd == -1) {
+    Error("Can't open %s: %s\n", drive_path, strerror(errno));
+    return CGPT_FAILED;
+  }
+
+  // The GPT we hold must be the one we are about to write.
+  if (fstat(fd, &new_stat) == -1 ||
+      new_stat.st_dev != old_stat.st_dev ||
+      new_stat.st_ino != old_stat.st_ino ||
+      new_stat.st_rdev != old_stat.st_rdev) {
+    Error("%s changed while it was open\n", drive_path);
+    close(fd);
+    return CGPT_FAILED;
+  }
+  if (!drive->is_file && drive->lock_fd == -1 &&
+      CGPT_OK != LockDrive(drive, drive_path)) {
+    close(fd);
+    return CGPT_FAILED;
+  }
+
+  close(drive->fd);
+  drive->fd = fd;
+
+  // A mapped secondary is already there to be read; a loaded one isn't.
+  if (drive->gpt.unverified & MASK_SECONDARY) {
+    if (!drive->map[1] && CGPT_OK != LoadSecondaryGpt(drive))
+      return CGPT_FAILED;
+    drive->gpt.unverified = 0;
+    if (drive->index.table == drive->gpt.secondary_entries)
+      drive->index.table = 0;
+  }
+  return CGPT_OK;
+}
+
+int BlkpgPartition(int fd, int op, int partno, uint64_t start,
+                   uint64_t size) {
+  struct blkpg_ioctl_arg arg;
+  struct blkpg_partition part;
+
+  memset(&part, 0, sizeof(part));
+  part.pno = partno;
+  part.start = start;
+  part.length = size;
+  arg.op = op;
+  arg.flags = 0;
+  arg.datalen = sizeof(part);
+  arg.data = &part;
+
+  StatsAdd(STATS_IOCTL_CALLS, 1);
+  return ioctl(fd, BLKPG, &arg);
+}
+
+// A partition as the kernel has it, in bytes.
+struct kernel_part {
+  int partno;
+  uint64_t start;
+  uint64_t size;
+  int busy;               // couldn't be removed, leave it be
+};
+
+// Reads a number from a sysfs attribute.
+static int ReadSysfsNumber(const char *dir, const char *name,
+                           uint64_t *value) {
+  char path[PATH_MAX];
+  unsigned long long n;
+  FILE *fp;
+  int ok;
+
+  if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= sizeof(path))
+    return 0;
+  if (!(fp = fopen(path, "r")))
+    return 0;
+  ok = fscanf(fp, "%llu", &n) == 1;
+  fclose(fp);
+  *value = n;
+  return ok;
+}
+
+// Lists the partitions the kernel has of the disk behind fd, from sysfs.
+// Returns their count, or -1 if fd isn't a disk that has partitions.
+static int ListKernelPartitions(int fd, struct kernel_part **parts) {
+  char dir[PATH_MAX], path[PATH_MAX];
+  struct kernel_part *more;
+  struct dirent *de;
+  struct stat st;
+  uint64_t value;
+  int count = 0;
+  DIR *d;
+
+  *parts = NULL;
+  if (fstat(fd, &st) || !S_ISBLK(st.st_mode))
+    return -1;
+  snprintf(dir, sizeof(dir), "/sys/dev/block/%u:%u",
+           major(st.st_rdev), minor(st.st_rdev));
+  // A partition has no partitions of its own.
+  if (ReadSysfsNumber(dir, "partition", &value) || !(d = opendir(dir)))
+    return -1;
+
+  while ((de = readdir(d))) {
+    struct kernel_part part;
+    uint64_t start, size;
+
+    if (de->d_name[0] == '.' ||
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >=
+        sizeof(path) ||
+        !ReadSysfsNumber(path, "partition", &value) ||
+        !ReadSysfsNumber(path, "start", &start) ||
+        !ReadSysfsNumber(path, "size", &size))
+      continue;
+    // sysfs counts 512 byte sectors whatever the disk's are.
+    part.partno = value;
+    part.start = start * 512;
+    part.size = size * 512;
+    part.busy = 0;
+    more = realloc(*parts, (count + 1) * sizeof(*more));
+    require(more);
+    *parts = more;
+    (*parts)[count++] = part;
+  }
+  closedir(d);
+  return count;
+}
+
+// The entry the kernel should have as partition partno, or NULL if none.
+static GptEntry *KernelEntry(struct drive *drive, int partno) {
+  GptEntry *entry;
+
+  if (partno < 1 || partno > GetNumberOfEntries(drive))
+    return NULL;
+  entry = GetEntry(&drive->gpt, ANY_VALID, partno - 1);
+  // The kernel skips these too.
+  if (IsUnusedEntry(entry) || entry->starting_lba > entry->ending_lba ||
+      entry->ending_lba >= drive->gpt.drive_sectors)
+    return NULL;
+  return entry;
+}
+
+static void WarnKernelPartition(int partno, const char *what) {
+  fprintf(stderr, "WARNING: the kernel's partition %d is out of date, "
+          "%s failed: %s\n", partno, what, strerror(errno));
+}
+
+// Brings the kernel's partitions of a block device in line with the entries
+// just written, with a BLKPG call for each that differs, rather than leaving
+// it to udev to reread the whole table, which drops and adds every
+// partition and probes each of them again.  Partitions in use can't be
+// changed; the kernel keeps the old ones then, as a reread would have.
+static void DriveUpdateKernel(struct drive *drive) {
+  uint32_t sector_bytes = drive->gpt.sector_bytes;
+  uint32_t num_entries = GetNumberOfEntries(drive);
+  struct kernel_part *parts;
+  uint64_t size;
+  GptEntry *entry;
+  int count, i, k;
+
+  count = ListKernelPartitions(drive->fd, &parts);
+  if (count < 0)
+    return;
+
+  // What goes away or shrinks first, so that nothing grows or is added on
+  // top of a partition the kernel still has.
+  for (k = 0; k < count; k++) {
+    entry = KernelEntry(drive, parts[k].partno);
+    if (entry && entry->starting_lba * sector_bytes == parts[k].start) {
+      size = (entry->ending_lba - entry->starting_lba + 1) * sector_bytes;
+      if (size < parts[k].size &&
+          BlkpgPartition(drive->fd, BLKPG_RESIZE_PARTITION, parts[k].partno,
+                         parts[k].start, size) < 0)
+        WarnKernelPartition(parts[k].partno, "shrinking it");
+      continue;
+    }
+    if (BlkpgPartition(drive->fd, BLKPG_DEL_PARTITION, parts[k].partno,
+                       0, 0) < 0) {
+      WarnKernelPartition(parts[k].partno, "removing it");
+      parts[k].busy = 1;
+    } else {
+      parts[k].partno = 0;
+    }
+  }
+
+  for (i = 1; i <= num_entries; i++) {
+    if (!(entry = KernelEntry(drive, i)))
+      continue;
+    size = (entry->ending_lba - entry->starting_lba + 1) * sector_bytes;
+    for (k = 0; k < count && parts[k].partno != i; k++)
+      ;
+    if (k == count) {
+      if (BlkpgPartition(drive->fd, BLKPG_ADD_PARTITION, i,
+                         entry->starting_lba * sector_bytes, size) < 0)
+        WarnKernelPartition(i, "adding it");
+    } else if (!parts[k].busy && size > parts[k].size &&
+               BlkpgPartition(drive->fd, BLKPG_RESIZE_PARTITION, i,
+                              parts[k].start, size) < 0) {
+      WarnKernelPartition(i, "growing it");
+    }
+  }
+  free(parts);
+}
+
 int DriveClose(struct drive *drive, int update_as_needed) {
+  uint64_t start;
   int errors = 0;
+  int i;
+
+  // Hand a lent drive back to the batch, changes and all.
+  if (drive->batch) {
+    batch.modified |= drive->gpt.modified;
+    batch.drive = *drive;
+    batch.drive.batch = 0;
+    memset(drive, 0, sizeof(*drive));
+    drive->fd = -1;
+    return CGPT_OK;
+  }
+  // A cached drive is only ever read.
+  if (drive->cache) {
+    require(!(update_as_needed && drive->gpt.modified));
+    DriveCacheReturn(drive->cache);
+    memset(drive, 0, sizeof(*drive));
+    drive->fd = -1;
+    return CGPT_OK;
+  }
+
+  start = StatsClock();
+  StatsAddChecks(&drive->gpt.stats);
+  memset(&drive->gpt.stats, 0, sizeof(drive->gpt.stats));
+  if (update_as_needed && drive->gpt.modified)
+    drive->written = 1;
 
   if (update_as_needed) {
-    if (drive->gpt.modified & GPT_MODIFIED_HEADER1) {
-      if (CGPT_OK != Save(drive->fd, drive->gpt.primary_header,
-                          GPT_PMBR_SECTOR,
-                          drive->gpt.sector_bytes, GPT_HEADER_SECTOR)) {
+    uint32_t entries_sectors =
+        GptEntriesSectors(GptEntriesBytes(&drive->gpt),
+                          drive->gpt.sector_bytes);
+
+    // Secondary first, and each table's entries before the header that
+    // covers them with its CRC.
+    if (drive->gpt.modified & GPT_MODIFIED_ENTRIES2) {
+      if (CGPT_OK != SaveEntries(drive, 1,
+                                 drive->gpt.drive_sectors - GPT_HEADER_SECTOR
+                                 - entries_sectors)) {
         errors++;
-        Error("Cannot write primary header: %s\n", strerror(errno));
+        Error("Cannot write secondary entries: %s\n", strerror(errno));
       }
     }
-
     if (drive->gpt.modified & GPT_MODIFIED_HEADER2) {
       if(CGPT_OK != Save(drive->fd, drive->gpt.secondary_header,
                          drive->gpt.drive_sectors - GPT_PMBR_SECTOR,
-                         drive->gpt.sector_bytes, GPT_HEADER_SECTOR)) {
+                         drive->gpt.sector_bytes, GPT_HEADER_SECTOR,
+                         STATS_WRITE_SECONDARY)) {
         errors++;
         Error("Cannot write secondary header: %s\n", strerror(errno));
       }
     }
     if (drive->gpt.modified & GPT_MODIFIED_ENTRIES1) {
-      if (CGPT_OK != Save(drive->fd, drive->gpt.primary_entries,
-                          GPT_PMBR_SECTOR + GPT_HEADER_SECTOR,
-                          drive->gpt.sector_bytes, GPT_ENTRIES_SECTORS)) {
+      if (CGPT_OK != SaveEntries(drive, 0,
+                                 GPT_PMBR_SECTOR + GPT_HEADER_SECTOR)) {
         errors++;
         Error("Cannot write primary entries: %s\n", strerror(errno));
       }
     }
-    if (drive->gpt.modified & GPT_MODIFIED_ENTRIES2) {
-      if (CGPT_OK != Save(drive->fd, drive->gpt.secondary_entries,
-                          drive->gpt.drive_sectors - GPT_HEADER_SECTOR
-                          - GPT_ENTRIES_SECTORS,
-                          drive->gpt.sector_bytes, GPT_ENTRIES_SECTORS)) {
+    if (drive->gpt.modified & GPT_MODIFIED_HEADER1) {
+      if (CGPT_OK != Save(drive->fd, drive->gpt.primary_header,
+                          GPT_PMBR_SECTOR,
+                          drive->gpt.sector_bytes, GPT_HEADER_SECTOR,
+                          STATS_WRITE_PRIMARY)) {
         errors++;
-        Error("Cannot write secondary entries: %s\n", strerror(errno));
+        Error("Cannot write primary header: %s\n", strerror(errno));
       }
     }
   }
@@ -293,23 +1716,41 @@ int DriveClose(struct drive *drive, int update_as_needed) {
   // Sync early! Only sync file descriptor here, and leave the whole system sync
   // outside cgpt because whole system sync would trigger tons of disk accesses
   // and timeout tests.
-  fsync(drive->fd);
-
+  if (drive->written && CGPT_OK != SyncDrive(drive)) {
+    errors++;
+    Error("Cannot sync drive: %s\n", strerror(errno));
+  }
+  if (drive->written && metadata_cache_dir)
+    DropCachedGpt(drive);
+  if (!errors && !drive->is_file && update_as_needed &&
+      (drive->gpt.modified & (GPT_MODIFIED_ENTRIES1 | GPT_MODIFIED_ENTRIES2)))
+    DriveUpdateKernel(drive);
+
+  // The fd written through first, so that udev sees it closed while the
+  // disk is still locked.
   close(drive->fd);
-
-  if (drive->gpt.primary_header)
-    free(drive->gpt.primary_header);
+  if (drive->lock_fd != -1)
+    close(drive->lock_fd);
+  drive->lock_fd = -1;
+
+  // All four GPT buffers point into the single DriveOpen() allocation, or
+  // into the two mappings of an image file.  The allocation is kept for the
+  // next drive this thread opens.
+  FreeGptBuf(drive->gpt_buf, drive->gpt_buf_size);
+  drive->gpt_buf = 0;
+  drive->gpt_buf_size = 0;
+  for (i = 0; i < 2; i++) {
+    if (drive->map[i])
+      munmap(drive->map[i], drive->map_len[i]);
+    drive->map[i] = 0;
+  }
+  drive->pmbr_sector = 0;
   drive->gpt.primary_header = 0;
-  if (drive->gpt.primary_entries)
-    free(drive->gpt.primary_entries);
   drive->gpt.primary_entries = 0;
-  if (drive->gpt.secondary_header)
-    free(drive->gpt.secondary_header);
   drive->gpt.secondary_header = 0;
-  if (drive->gpt.secondary_entries)
-    free(drive->gpt.secondary_entries);
   drive->gpt.secondary_entries = 0;
 
+  StatsAddTime(STATS_CLOSE_US, start);
   return errors ? CGPT_FAILED : CGPT_OK;
 }
 
@@ -321,13 +1762,52 @@ int DriveClose(struct drive *drive, int update_as_needed) {
  * Returns CGPT_OK if parsing is successful; otherwise CGPT_FAILED.
  */
 #define GUID_FMT_UPPER "%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X"
-#define GUID_FMT_LOWER "%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x"
+
+// Digit values plus one, so that anything else reads as zero.
+static const uint8_t hex_values[256] = {
+  ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+  ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+  ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+  ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+};
+
+// Offsets of the GUID's bytes, in the order they're spelled out.
+static const uint8_t guid_str_bytes[16] = {
+  3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15
+};
+#define GUID_STR_DASH(i) ((i) == 4 || (i) == 6 || (i) == 8 || (i) == 10)
+
+// Parses exactly the canonical form, which is what we're almost always given.
+// Leaves guid alone unless it succeeds.
+static int StrToGuidCanonical(const char *str, Guid *guid) {
+  const unsigned char *c = (const unsigned char *)str;
+  Guid parsed;
+  uint8_t *bytes = (uint8_t *)&parsed;
+  uint8_t hi, lo;
+  int i;
+
+  for (i = 0; i < 16; i++) {
+    if (GUID_STR_DASH(i) && *c++ != '-')
+      return CGPT_FAILED;
+    if (!(hi = hex_values[c[0]]) || !(lo = hex_values[c[1]]))
+      return CGPT_FAILED;
+    bytes[guid_str_bytes[i]] = (hi - 1) << 4 | (lo - 1);
+    c += 2;
+  }
+  memcpy(guid, &parsed, sizeof(parsed));
+  return CGPT_OK;
+}
+
 int StrToGuid(const char *str, Guid *guid) {
   uint32_t time_low;
   uint16_t time_mid;
   uint16_t time_high_and_version;
   unsigned int chunk[11];
 
+  if (CGPT_OK == StrToGuidCanonical(str, guid))
+    return CGPT_OK;
+
+  // Anything else sscanf() makes sense of.
   if (11 != sscanf(str, GUID_FMT_UPPER,
                    chunk+0,
                    chunk+1,
@@ -363,24 +1843,37 @@ int StrToGuid(const char *str, Guid *guid) {
 
   return CGPT_OK;
 }
-static void GuidToStrGeneric(const char *fmt, const Guid *guid,
+static void GuidToStrGeneric(const char *digits, const Guid *guid,
                              char *str, unsigned int buflen) {
+  const uint8_t *bytes = (const uint8_t *)guid;
+  int i;
+
   require(buflen >= GUID_STRLEN);
-  require(snprintf(str, buflen, fmt,
-                  le32toh(guid->u.Uuid.time_low),
-                  le16toh(guid->u.Uuid.time_mid),
-                  le16toh(guid->u.Uuid.time_high_and_version),
-                  guid->u.Uuid.clock_seq_high_and_reserved,
-                  guid->u.Uuid.clock_seq_low,
-                  guid->u.Uuid.node[0], guid->u.Uuid.node[1],
-                  guid->u.Uuid.node[2], guid->u.Uuid.node[3],
-                  guid->u.Uuid.node[4], guid->u.Uuid.node[5]) == GUID_STRLEN-1);
+  for (i = 0; i < 16; i++) {
+    if (GUID_STR_DASH(i))
+      *str++ = '-';
+    *str++ = digits[bytes[guid_str_bytes[i]] >> 4];
+    *str++ = digits[bytes[guid_str_bytes[i]] & 0xf];
+  }
+  *str = '\0';
 }
 void GuidToStrUpper(const Guid *guid, char *str, unsigned int buflen) {
-  GuidToStrGeneric(GUID_FMT_UPPER, guid, str, buflen);
+  GuidToStrGeneric("0123456789ABCDEF", guid, str, buflen);
 }
 void GuidToStrLower(const Guid *guid, char *str, unsigned int buflen) {
-  GuidToStrGeneric(GUID_FMT_LOWER, guid, str, buflen);
+  GuidToStrGeneric("0123456789abcdef", guid, str, buflen);
+}
+
+int HexToBytes(const char *str, uint8_t *buf, size_t len) {
+  const unsigned char *c = (const unsigned char *)str;
+  size_t i;
+
+  for (i = 0; i < len; i++, c += 2) {
+    if (!hex_values[c[0]] || !hex_values[c[1]])
+      return CGPT_FAILED;
+    buf[i] = (hex_values[c[0]] - 1) << 4 | (hex_values[c[1]] - 1);
+  }
+  return CGPT_OK;
 }
 
 /* Convert possibly unterminated UTF16 string to UTF8.
@@ -617,89 +2110,6 @@ const Guid guid_flatcar_rootfs =    GPT_ENT_TYPE_FLATCAR_ROOTFS;
 const Guid guid_flatcar_root_raid = GPT_ENT_TYPE_FLATCAR_ROOT_RAID;
 const Guid guid_mswin_data =        GPT_ENT_TYPE_MSWIN_DATA;
 
-static struct {
-  const Guid *type;
-  char *name;
-  char *description;
-} supported_types[] = {
-  // ChromeOS (prefix-less names for backwards compatibility)
-  {&guid_chromeos_firmware, "firmware", "ChromeOS firmware"},
-  {&guid_chromeos_kernel, "kernel", "ChromeOS kernel"},
-  {&guid_chromeos_rootfs, "rootfs", "ChromeOS rootfs"},
-  {&guid_linux_data, "data", "Alias for linux-data"},
-  {&guid_mswin_data, "chromeos-data", "Alias for mswin-data"},
-  {&guid_chromeos_reserved, "reserved", "ChromeOS reserved"},
-
-  // MS Windows (data used to use this GUID instead of linux-data)
-  {&guid_mswin_data, "mswin-data", "MS Windows data"},
-
-  // GPT/UEFI standard types
-  {&guid_efi, "efi", "EFI System Partition"},
-  {&guid_bios, "bios", "BIOS Boot Partition"},
-  {&guid_unused, "unused", "Unused (nonexistent) partition"},
-
-  // General Linux
-  {&guid_linux_data, "linux-data", "Linux data"},
-  {&guid_linux_swap, "linux-swap", "Linux swap"},
-  {&guid_linux_boot, "linux-boot", "Linux /boot"},
-  {&guid_linux_home, "linux-home", "Linux /home"},
-  {&guid_linux_lvm, "linux-lvm", "Linux LVM"},
-  {&guid_linux_raid, "linux-raid", "Linux RAID"},
-  {&guid_linux_reserved, "linux-reserved", "Linux reserved"},
-
-  // CoreOS
-  {&guid_coreos_rootfs, "coreos-usr", "Alias for coreos-rootfs"},
-  {&guid_coreos_rootfs, "coreos-rootfs", "CoreOS rootfs"},
-  {&guid_coreos_resize, "coreos-resize", "CoreOS auto-resize"},
-  {&guid_coreos_reserved, "coreos-reserved", "CoreOS reserved"},
-  {&guid_coreos_root_raid, "coreos-root-raid", "CoreOS RAID containing root"},
-
-  // Flatcar
-  {&guid_flatcar_rootfs, "flatcar-usr", "Alias for flatcar-rootfs"},
-  {&guid_flatcar_rootfs, "flatcar-rootfs", "Flatcar Container Linux rootfs"},
-  {&guid_flatcar_resize, "flatcar-resize", "Flatcar Container Linux auto-resize"},
-  {&guid_flatcar_reserved, "flatcar-reserved", "Flatcar Container Linux reserved"},
-  {&guid_flatcar_root_raid, "flatcar-root-raid", "Flatcar Container Linux RAID containing root"},
-};
-
-/* Resolves human-readable GPT type.
- * Returns CGPT_OK if found.
- * Returns CGPT_FAILED if no known type found. */
-int ResolveType(const Guid *type, char *buf, size_t len) {
-  int i;
-  for (i = 0; i < ARRAY_COUNT(supported_types); ++i) {
-    if (!memcmp(type, supported_types[i].type, sizeof(Guid))) {
-      strncpy(buf, supported_types[i].description, len);
-      if (len > 0) {
-        buf[len-1] = '\0';
-      }
-      return CGPT_OK;
-    }
-  }
-  return CGPT_FAILED;
-}
-
-int SupportedType(const char *name, Guid *type) {
-  int i;
-  for (i = 0; i < ARRAY_COUNT(supported_types); ++i) {
-    if (!strcmp(name, supported_types[i].name)) {
-      memcpy(type, supported_types[i].type, sizeof(Guid));
-      return CGPT_OK;
-    }
-  }
-  return CGPT_FAILED;
-}
-
-void PrintTypes(void) {
-  int i;
-  printf("The partition type may also be given as one of these aliases:\n\n");
-  for (i = 0; i < ARRAY_COUNT(supported_types); ++i) {
-    printf("    %-16s  %s\n", supported_types[i].name,
-                          supported_types[i].description);
-  }
-  printf("\n");
-}
-
 GptHeader* GetGptHeader(const GptData *gpt) {
   if (gpt->valid_headers & MASK_PRIMARY)
     return (GptHeader*)gpt->primary_header;
@@ -717,36 +2127,127 @@ uint32_t GetNumberOfEntries(const struct drive *drive) {
 }
 
 
+static uint8_t *EntriesTable(GptData *gpt, int secondary) {
+  if (secondary == PRIMARY)
+    return gpt->primary_entries;
+  if (secondary == SECONDARY)
+    return gpt->secondary_entries;
+  require(secondary == ANY_VALID);
+  if (gpt->valid_entries & MASK_PRIMARY)
+    return gpt->primary_entries;
+  require(gpt->valid_entries & MASK_SECONDARY);
+  return gpt->secondary_entries;
+}
+
 GptEntry *GetEntry(GptData *gpt, int secondary, uint32_t entry_index) {
   GptHeader *header = GetGptHeader(gpt);
-  uint8_t *entries;
   uint32_t stride = header->size_of_entry;
   require(stride);
   require(entry_index < header->number_of_entries);
 
-  if (secondary == PRIMARY) {
-    entries = gpt->primary_entries;
-  } else if (secondary == SECONDARY) {
+  return (GptEntry*)(&EntriesTable(gpt, secondary)[stride * entry_index]);
+}
+
+static void IndexEntry(struct entry_index *index, uint32_t i,
+                       const GptEntry *entry) {
+  uint8_t flags = 0;
+
+  if (!GuidIsZero(&entry->type)) {
+    flags |= 1 << ENTRY_CLASS_USED;
+    if (GuidEqual(&entry->type, &guid_coreos_rootfs) ||
+        GuidEqual(&entry->type, &guid_flatcar_rootfs))
+      flags |= 1 << ENTRY_CLASS_ROOT;
+    if (GuidEqual(&entry->type, &guid_chromeos_kernel))
+      flags |= 1 << ENTRY_CLASS_KERNEL;
+  }
+  index->flags[i] = flags;
+  index->priority[i] = GetEntryPriority(entry);
+  index->tries[i] = GetEntryTries(entry);
+  index->successful[i] = GetEntrySuccessful(entry);
+}
+
+// Attribute writes never change an entry's class, so the lists only need
+// building along with the rest of the index.
+static void IndexLists(struct entry_index *index) {
+  uint32_t i, c;
+
+  memset(index->count, 0, sizeof(index->count));
+  for (i = 0; i < index->num_entries; i++)
+    for (c = 0; c < ENTRY_CLASSES; c++)
+      if (index->flags[i] & (1 << c))
+        index->list[c][index->count[c]++] = i;
+}
+
+// Returns the index of the table 'secondary' refers to, building it first
+// if what we have describes something else.
+static struct entry_index *GetEntryIndex(struct drive *drive, int secondary) {
+  struct entry_index *index = &drive->index;
+  GptHeader *header = GetGptHeader(&drive->gpt);
+  uint8_t *table;
+  uint32_t i;
+
+  require(header && header->size_of_entry);
+  require(header->number_of_entries <= GPT_MAX_TABLE_ENTRIES);
+  table = EntriesTable(&drive->gpt, secondary);
+  if (index->table == table &&
+      index->num_entries == header->number_of_entries &&
+      index->stride == header->size_of_entry)
+    return index;
+
+  index->table = table;
+  index->num_entries = header->number_of_entries;
+  index->stride = header->size_of_entry;
+  for (i = 0; i < index->num_entries; i++)
+    IndexEntry(index, i, (GptEntry *)(table + i * index->stride));
+  IndexLists(index);
+  return index;
+}
+
+GptEntry *GetEntryForWrite(struct drive *drive, int secondary,
+                           uint32_t entry_index) {
+  GptData *gpt = &drive->gpt;
+  GptEntry *entry = GetEntry(gpt, secondary, entry_index);
+  uint8_t *entries = gpt->primary_entries;
+  uint32_t mask = MASK_PRIMARY;
+
+  if (secondary == SECONDARY ||
+      (secondary == ANY_VALID && !(gpt->valid_entries & MASK_PRIMARY))) {
     entries = gpt->secondary_entries;
-  } else {  /* ANY_VALID */
-    require(secondary == ANY_VALID);
-    if (gpt->valid_entries & MASK_PRIMARY) {
-      entries = gpt->primary_entries;
-    } else {
-      require(gpt->valid_entries & MASK_SECONDARY);
-      entries = gpt->secondary_entries;
-    }
+    mask = MASK_SECONDARY;
   }
+  GptEntriesModified(gpt, mask, (uint8_t *)entry - entries,
+                     GetGptHeader(gpt)->size_of_entry);
+  // We can't tell what the caller is going to change.
+  if (drive->index.table == entries)
+    drive->index.table = 0;
+  return entry;
+}
+
+// Writes made through the Set*() accessors below keep the index current.
+static GptEntry *GetAttributesForWrite(struct drive *drive, int secondary,
+                                       uint32_t entry_index) {
+  const uint8_t *indexed = drive->index.table;
+  GptEntry *entry = GetEntryForWrite(drive, secondary, entry_index);
+
+  drive->index.table = indexed;
+  return entry;
+}
+
+static void AttributesWritten(struct drive *drive, int secondary,
+                              uint32_t entry_index, const GptEntry *entry) {
+  struct entry_index *index = &drive->index;
 
-  return (GptEntry*)(&entries[stride * entry_index]);
+  if (index->table == EntriesTable(&drive->gpt, secondary))
+    IndexEntry(index, entry_index, entry);
 }
 
 void SetLegacyBootable(struct drive *drive, int secondary,
                        uint32_t entry_index, int bootable) {
   GptEntry *entry;
-  entry = GetEntry(&drive->gpt, secondary, entry_index);
+  entry = GetAttributesForWrite(drive, secondary, entry_index);
   require(bootable >= 0 && bootable <= 1);
   SetEntryLegacyBootable(entry, bootable);
+  AttributesWritten(drive, secondary, entry_index, entry);
 }
 
 int GetLegacyBootable(struct drive *drive, int secondary,
@@ -759,54 +2260,70 @@ int GetLegacyBootable(struct drive *drive, int secondary,
 void SetPriority(struct drive *drive, int secondary, uint32_t entry_index,
                  int priority) {
   GptEntry *entry;
-  entry = GetEntry(&drive->gpt, secondary, entry_index);
+  entry = GetAttributesForWrite(drive, secondary, entry_index);
   require(priority >= 0 && priority <= CGPT_ATTRIBUTE_MAX_PRIORITY);
   SetEntryPriority(entry, priority);
+  AttributesWritten(drive, secondary, entry_index, entry);
 }
 
 int GetPriority(struct drive *drive, int secondary, uint32_t entry_index) {
-  GptEntry *entry;
-  entry = GetEntry(&drive->gpt, secondary, entry_index);
-  return GetEntryPriority(entry);
+  struct entry_index *index = GetEntryIndex(drive, secondary);
+  require(entry_index < index->num_entries);
+  return index->priority[entry_index];
 }
 
 void SetTries(struct drive *drive, int secondary, uint32_t entry_index,
               int tries) {
   GptEntry *entry;
-  entry = GetEntry(&drive->gpt, secondary, entry_index);
+  entry = GetAttributesForWrite(drive, secondary, entry_index);
   require(tries >= 0 && tries <= CGPT_ATTRIBUTE_MAX_TRIES);
   SetEntryTries(entry, tries);
+  AttributesWritten(drive, secondary, entry_index, entry);
 }
 
 int GetTries(struct drive *drive, int secondary, uint32_t entry_index) {
-  GptEntry *entry;
-  entry = GetEntry(&drive->gpt, secondary, entry_index);
-  return GetEntryTries(entry);
+  struct entry_index *index = GetEntryIndex(drive, secondary);
+  require(entry_index < index->num_entries);
+  return index->tries[entry_index];
 }
 
 void SetSuccessful(struct drive *drive, int secondary, uint32_t entry_index,
                    int success) {
   GptEntry *entry;
-  entry = GetEntry(&drive->gpt, secondary, entry_index);
+  entry = GetAttributesForWrite(drive, secondary, entry_index);
 
   require(success >= 0 && success <= CGPT_ATTRIBUTE_MAX_SUCCESSFUL);
   SetEntrySuccessful(entry, success);
+  AttributesWritten(drive, secondary, entry_index, entry);
 }
 
 int GetSuccessful(struct drive *drive, int secondary, uint32_t entry_index) {
-  GptEntry *entry;
-  entry = GetEntry(&drive->gpt, secondary, entry_index);
-  return GetEntrySuccessful(entry);
+  struct entry_index *index = GetEntryIndex(drive, secondary);
+  require(entry_index < index->num_entries);
+  return index->successful[entry_index];
 }
 
 void SetRaw(struct drive *drive, int secondary, uint32_t entry_index,
            uint64_t raw) {
   GptEntry *entry;
-  entry = GetEntry(&drive->gpt, secondary, entry_index);
+  entry = GetAttributesForWrite(drive, secondary, entry_index);
   entry->attrs.whole = raw;
+  EntryAttributesChanged();
+  AttributesWritten(drive, secondary, entry_index, entry);
+}
+
+uint32_t GetEntriesOfClass(struct drive *drive, int secondary,
+                           int entry_class, const uint16_t **list) {
+  struct entry_index *index = GetEntryIndex(drive, secondary);
+  require(entry_class >= 0 && entry_class < ENTRY_CLASSES);
+  *list = index->list[entry_class];
+  return index->count[entry_class];
 }
 
 void UpdateAllEntries(struct drive *drive) {
+  // This rewrites the secondary from the primary.
+  if (drive->index.table == drive->gpt.secondary_entries)
+    drive->index.table = 0;
   RepairEntries(&drive->gpt, MASK_PRIMARY);
   RepairHeader(&drive->gpt, MASK_PRIMARY);
 
@@ -815,23 +2332,23 @@ void UpdateAllEntries(struct drive *drive) {
   UpdateCrc(&drive->gpt);
 }
 
+static int IsEntryOfClass(struct drive *drive, int secondary, uint32_t i,
+                          int entry_class) {
+  struct entry_index *index = GetEntryIndex(drive, secondary);
+  require(i < index->num_entries);
+  return !!(index->flags[i] & (1 << entry_class));
+}
+
 int IsUnused(struct drive *drive, int secondary, uint32_t index) {
-  GptEntry *entry;
-  entry = GetEntry(&drive->gpt, secondary, index);
-  return GuidIsZero(&entry->type);
+  return !IsEntryOfClass(drive, secondary, index, ENTRY_CLASS_USED);
 }
 
 int IsKernel(struct drive *drive, int secondary, uint32_t index) {
-  GptEntry *entry;
-  entry = GetEntry(&drive->gpt, secondary, index);
-  return GuidEqual(&entry->type, &guid_chromeos_kernel);
+  return IsEntryOfClass(drive, secondary, index, ENTRY_CLASS_KERNEL);
 }
 
 int IsRoot(struct drive *drive, int secondary, uint32_t index) {
-  GptEntry *entry;
-  entry = GetEntry(&drive->gpt, secondary, index);
-  return GuidEqual(&entry->type, &guid_coreos_rootfs) ||
-         GuidEqual(&entry->type, &guid_flatcar_rootfs);
+  return IsEntryOfClass(drive, secondary, index, ENTRY_CLASS_ROOT);
 }
 
 
@@ -854,6 +2371,7 @@ const char *GptError(int errnum) {
 /*  Update CRC value if necessary.  */
 void UpdateCrc(GptData *gpt) {
   GptHeader *primary_header, *secondary_header;
+  uint32_t entries_mask = 0;
 
   primary_header = (GptHeader*)gpt->primary_header;
   secondary_header = (GptHeader*)gpt->secondary_header;
@@ -861,13 +2379,13 @@ void UpdateCrc(GptData *gpt) {
   if (gpt->modified & GPT_MODIFIED_ENTRIES1 &&
       memcmp(primary_header, GPT_HEADER_SIGNATURE2,
              GPT_HEADER_SIGNATURE_SIZE)) {
-    primary_header->entries_crc32 =
-        Crc32(gpt->primary_entries, TOTAL_ENTRIES_SIZE);
+    entries_mask |= MASK_PRIMARY;
   }
   if (gpt->modified & GPT_MODIFIED_ENTRIES2) {
-    secondary_header->entries_crc32 =
-        Crc32(gpt->secondary_entries, TOTAL_ENTRIES_SIZE);
+    entries_mask |= MASK_SECONDARY;
   }
+  // Only rehashes the entries that changed if tracking was enabled.
+  GptUpdateEntriesCrc(gpt, entries_mask);
   if (gpt->modified & GPT_MODIFIED_HEADER1) {
     primary_header->header_crc32 = 0;
     primary_header->header_crc32 = Crc32(
@@ -922,15 +2440,15 @@ uint8_t RepairEntries(GptData *gpt, const uint32_t valid_entries) {
 
   if (valid_entries == MASK_BOTH) {
     if (memcmp(gpt->primary_entries, gpt->secondary_entries,
-               TOTAL_ENTRIES_SIZE)) {
-      memcpy(gpt->secondary_entries, gpt->primary_entries, TOTAL_ENTRIES_SIZE);
+               GptEntriesBytes(gpt))) {
+      GptCopyEntries(gpt, MASK_SECONDARY);
       return GPT_MODIFIED_ENTRIES2;
     }
   } else if (valid_entries == MASK_PRIMARY) {
-    memcpy(gpt->secondary_entries, gpt->primary_entries, TOTAL_ENTRIES_SIZE);
+    GptCopyEntries(gpt, MASK_SECONDARY);
     return GPT_MODIFIED_ENTRIES2;
   } else if (valid_entries == MASK_SECONDARY) {
-    memcpy(gpt->primary_entries, gpt->secondary_entries, TOTAL_ENTRIES_SIZE);
+    GptCopyEntries(gpt, MASK_PRIMARY);
     return GPT_MODIFIED_ENTRIES1;
   }
 
@@ -975,11 +2493,11 @@ uint8_t RepairHeader(GptData *gpt, const uint32_t valid_headers) {
     secondary_header->my_lba = gpt->drive_sectors - 1;  /* the last sector */
     secondary_header->alternate_lba = primary_header->my_lba;
     secondary_header->entries_lba = secondary_header->my_lba -
-        GPT_ENTRIES_SECTORS;
+        GptEntriesSectors(GptEntriesBytes(gpt), gpt->sector_bytes);
     return GPT_MODIFIED_HEADER2;
   } else if (valid_headers == MASK_SECONDARY) {
     memcpy(primary_header, secondary_header, sizeof(GptHeader));
-    primary_header->my_lba = GPT_PMBR_SECTOR;  /* the second sector on drive */
+    primary_header->my_lba = GPT_PRIMARY_HEADER_LBA;
     primary_header->alternate_lba = secondary_header->my_lba;
     primary_header->entries_lba = primary_header->my_lba + GPT_HEADER_SECTOR;
     return GPT_MODIFIED_HEADER1;
@@ -1142,53 +2660,3 @@ void PMBRToStr(struct pmbr *pmbr, char *str, unsigned int buflen) {
       snprintf(str, buflen, "PMBR (SYSLINUX3, Boot GUID: %s)", buf) < buflen);
   }
 }
-
-#define DEV_DIR "/dev"
-#define SYS_BLOCK_DIR "/sys/block"
-#define BUFSIZE 1024
-
-static const char *devdirs[] = { "/dev", "/devices", "/devfs", 0 };
-
-// Given basename "foo", see if we can find a whole, real device by that name.
-// This is copied from the logic in the linux utility 'findfs', although that
-// does more exhaustive searching.
-char *IsWholeDev(const char *basename) {
-  int i,j,len;
-  struct stat statbuf;
-  static char pathname[BUFSIZE];        // we'll return this.
-  char tmpname[BUFSIZE + 18];           // add sizeof(SYS_BLOCK_DIR"//device")
-  char tbasename[BUFSIZE];
-
-  // It should be a block device under /dev/,
-  for (i = 0; devdirs[i]; i++) {
-    snprintf(pathname, BUFSIZE, "%s/%s", devdirs[i], basename);
-
-    if (0 != stat(pathname, &statbuf))
-      continue;
-
-    if (!S_ISBLK(statbuf.st_mode))
-      continue;
-
-    // It should have a symlink called /sys/block/*/device
-    // but devices containing '/' (like cciss ones) must
-    // be changed to use "!" instead
-    len = strlen(basename);
-    for (j = 0; j < len && j < BUFSIZE - 1; j++) {
-        tbasename[j] = basename[j] == '/' ? '!' : basename[j];
-    }
-    tbasename[j] = 0;
-    snprintf(tmpname, sizeof(tmpname),
-             "%s/%s/device", SYS_BLOCK_DIR, tbasename);
-
-    if (0 != lstat(tmpname, &statbuf))
-      continue;
-
-    if (!S_ISLNK(statbuf.st_mode))
-      continue;
-
-    // found it
-    return pathname;
-  }
-
-  return 0;
-}
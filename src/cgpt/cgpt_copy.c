@@ -0,0 +1,292 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Copying the data of a partition to another one, without pushing it
+// through user space where the kernel can avoid it: a reflink when both
+// sides are on a filesystem that shares extents, copy_file_range() of the
+// parts holding data otherwise, leaving the holes in between as holes.
+
+#include <errno.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cgpt.h"
+#include "cgptlib_internal.h"
+#include "vboot_host.h"
+
+#define COPY_BUFFER_BYTES (1024 * 1024)
+
+// Where a partition's data lives, in bytes.
+struct copy_side {
+  const char *drive_name;
+  uint32_t partition;
+  uint32_t sector_bytes;
+  uint64_t offset;
+  uint64_t size;
+  int fd;
+  struct stat st;
+};
+
+// Looks up side->partition of side->drive_name.
+static int FindPartition(struct copy_side *side) {
+  struct drive drive;
+  GptEntry *entry;
+  int gpt_retval;
+  int r = CGPT_FAILED;
+
+  if (CGPT_OK != DriveOpen(side->drive_name, &drive, 0, O_RDONLY, 0))
+    return CGPT_FAILED;
+  if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive.gpt))) {
+    Error("GptSanityCheck() returned %d: %s\n",
+          gpt_retval, GptError(gpt_retval));
+    goto done;
+  }
+  if (side->partition == 0 ||
+      side->partition > GetNumberOfEntries(&drive) ||
+      IsUnused(&drive, ANY_VALID, side->partition - 1)) {
+    Error("invalid partition number: %d\n", side->partition);
+    goto done;
+  }
+
+  entry = GetEntry(&drive.gpt, ANY_VALID, side->partition - 1);
+  side->sector_bytes = drive.gpt.sector_bytes;
+  side->offset = entry->starting_lba * side->sector_bytes;
+  side->size = (entry->ending_lba - entry->starting_lba + 1) *
+               side->sector_bytes;
+  if (side->offset + side->size > drive.size) {
+    Error("partition %d runs past the end of %s\n", side->partition,
+          side->drive_name);
+    goto done;
+  }
+  r = CGPT_OK;
+
+done:
+  (void) DriveClose(&drive, 0);
+  return r;
+}
+
+static int SameFile(const struct stat *a, const struct stat *b) {
+  if (S_ISBLK(a->st_mode) && S_ISBLK(b->st_mode))
+    return a->st_rdev == b->st_rdev;
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino;
+}
+
+// Shares the whole partition with FICLONERANGE.  Returns CGPT_NOOP if the
+// filesystem can't, leaving the copy to CopyData().
+static int CloneRange(struct copy_side *src, struct copy_side *dst) {
+  struct file_clone_range range;
+
+  // Only whole filesystem blocks can be shared.
+  if (!S_ISREG(src->st.st_mode) || !S_ISREG(dst->st.st_mode) ||
+      src->st.st_dev != dst->st.st_dev ||
+      (src->offset | dst->offset | src->size) % dst->st.st_blksize)
+    return CGPT_NOOP;
+
+  memset(&range, 0, sizeof(range));
+  range.src_fd = src->fd;
+  range.src_offset = src->offset;
+  range.src_length = src->size;
+  range.dest_offset = dst->offset;
+  StatsAdd(STATS_IOCTL_CALLS, 1);
+  if (ioctl(dst->fd, FICLONERANGE, &range) == 0)
+    return CGPT_OK;
+  switch (errno) {
+    case EOPNOTSUPP:
+    case ENOTTY:
+    case EINVAL:
+    case EXDEV:
+      return CGPT_NOOP;
+  }
+  Error("Can't clone %s to %s: %s\n", src->drive_name, dst->drive_name,
+        strerror(errno));
+  return CGPT_FAILED;
+}
+
+// Copies count bytes from src_off to dst_off by reading and writing them.
+static int ReadWriteRange(struct copy_side *src, struct copy_side *dst,
+                          uint64_t src_off, uint64_t dst_off,
+                          uint64_t count) {
+  uint8_t *buf = malloc(COPY_BUFFER_BYTES);
+  ssize_t n;
+  int r = CGPT_FAILED;
+
+  if (!buf)
+    return CGPT_FAILED;
+  while (count) {
+    n = pread(src->fd, buf, count < COPY_BUFFER_BYTES ?
+                            count : COPY_BUFFER_BYTES, src_off);
+    StatsAdd(STATS_READ_CALLS, 1);
+    if (n <= 0) {
+      Error("Can't read %s: %s\n", src->drive_name,
+            n ? strerror(errno) : "unexpected end of file");
+      goto done;
+    }
+    StatsAdd(STATS_READ_OTHER, n);
+    if (pwrite(dst->fd, buf, n, dst_off) != n) {
+      Error("Can't write %s: %s\n", dst->drive_name, strerror(errno));
+      goto done;
+    }
+    StatsAdd(STATS_WRITE_CALLS, 1);
+    src_off += n;
+    dst_off += n;
+    count -= n;
+  }
+  r = CGPT_OK;
+
+done:
+  free(buf);
+  return r;
+}
+
+// Copies count bytes from src_off to dst_off, in the kernel if it will.
+static int CopyRange(struct copy_side *src, struct copy_side *dst,
+                     uint64_t src_off, uint64_t dst_off, uint64_t count,
+                     int *in_kernel) {
+  loff_t in = src_off, out = dst_off;
+  ssize_t n;
+
+  while (count && *in_kernel) {
+    n = copy_file_range(src->fd, &in, dst->fd, &out, count, 0);
+    if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                  errno == EOPNOTSUPP)) {
+      // Not between these two, e.g. block devices on older kernels.
+      *in_kernel = 0;
+      break;
+    }
+    if (n <= 0) {
+      Error("Can't copy %s to %s: %s\n", src->drive_name, dst->drive_name,
+            n ? strerror(errno) : "unexpected end of file");
+      return CGPT_FAILED;
+    }
+    count -= n;
+  }
+  if (!count)
+    return CGPT_OK;
+  return ReadWriteRange(src, dst, in, out, count);
+}
+
+// Copies the source partition run by run of data, zeroing the holes.
+static int CopyData(struct copy_side *src, struct copy_side *dst,
+                    uint64_t *data_bytes) {
+  uint64_t end = src->offset + src->size;
+  uint64_t pos = src->offset;
+  off_t data, hole;
+  int in_kernel = 1;
+
+  *data_bytes = 0;
+  while (pos < end) {
+    // Block devices and filesystems without SEEK_DATA are all data.
+    hole = end;
+    data = lseek(src->fd, pos, SEEK_DATA);
+    if (data < 0 && errno == ENXIO)
+      data = end;
+    else if (data < 0)
+      data = pos;
+    else if ((hole = lseek(src->fd, data, SEEK_HOLE)) < 0)
+      hole = end;
+    if (data > end)
+      data = end;
+    if (hole > end)
+      hole = end;
+
+    if (data > pos &&
+        CGPT_OK != ProvisionRange(dst->fd, dst->drive_name,
+                                  dst->offset + (pos - src->offset),
+                                  data - pos, PROVISION_ZERO))
+      return CGPT_FAILED;
+    if (data < end) {
+      if (CGPT_OK != CopyRange(src, dst, data,
+                               dst->offset + (data - src->offset),
+                               hole - data, &in_kernel))
+        return CGPT_FAILED;
+      *data_bytes += hole - data;
+      pos = hole;
+    } else {
+      pos = end;
+    }
+  }
+  return CGPT_OK;
+}
+
+int CgptCopy(CgptCopyParams *params) {
+  struct copy_side src, dst;
+  uint64_t data_bytes;
+  int r = CGPT_FAILED;
+
+  if (params == NULL)
+    return CGPT_FAILED;
+
+  memset(&src, 0, sizeof(src));
+  memset(&dst, 0, sizeof(dst));
+  src.fd = dst.fd = -1;
+  src.drive_name = params->src_drive_name;
+  src.partition = params->src_partition;
+  dst.drive_name = params->dst_drive_name;
+  dst.partition = params->dst_partition ? params->dst_partition :
+                                          params->src_partition;
+  if (CGPT_OK != FindPartition(&src) || CGPT_OK != FindPartition(&dst))
+    return CGPT_FAILED;
+
+  if (dst.size < src.size) {
+    Error("partition %d of %s is %llu bytes, too small for %llu\n",
+          dst.partition, dst.drive_name, (unsigned long long)dst.size,
+          (unsigned long long)src.size);
+    return CGPT_FAILED;
+  }
+  // The destination can't address a part of one of its sectors.
+  if (src.size % dst.sector_bytes) {
+    Error("partition %d of %s isn't a multiple of the %u byte sectors "
+          "of %s\n", src.partition, src.drive_name, dst.sector_bytes,
+          dst.drive_name);
+    return CGPT_FAILED;
+  }
+
+  src.fd = open(src.drive_name, O_RDONLY | O_CLOEXEC);
+  if (src.fd < 0 || fstat(src.fd, &src.st)) {
+    Error("Can't open %s: %s\n", src.drive_name, strerror(errno));
+    goto done;
+  }
+  dst.fd = open(dst.drive_name, O_WRONLY | O_CLOEXEC);
+  if (dst.fd < 0 || fstat(dst.fd, &dst.st)) {
+    Error("Can't open %s: %s\n", dst.drive_name, strerror(errno));
+    goto done;
+  }
+  StatsAdd(STATS_OPEN_CALLS, 2);
+  if (SameFile(&src.st, &dst.st) && src.offset < dst.offset + src.size &&
+      dst.offset < src.offset + src.size) {
+    Error("partitions %d and %d of %s overlap\n", src.partition,
+          dst.partition, src.drive_name);
+    goto done;
+  }
+
+  r = CloneRange(&src, &dst);
+  if (r == CGPT_OK) {
+    if (params->verbose)
+      printf("cloned %llu bytes\n", (unsigned long long)src.size);
+  } else if (r == CGPT_NOOP) {
+    r = CopyData(&src, &dst, &data_bytes);
+    if (r == CGPT_OK && params->verbose)
+      printf("copied %llu bytes, %llu bytes of holes\n",
+             (unsigned long long)data_bytes,
+             (unsigned long long)(src.size - data_bytes));
+  }
+  if (r != CGPT_OK)
+    goto done;
+
+  StatsAdd(STATS_SYNC_CALLS, 1);
+  if (S_ISBLK(dst.st.st_mode) ? fsync(dst.fd) : fdatasync(dst.fd)) {
+    Error("Can't sync %s: %s\n", dst.drive_name, strerror(errno));
+    r = CGPT_FAILED;
+  }
+
+done:
+  if (src.fd >= 0)
+    close(src.fd);
+  if (dst.fd >= 0)
+    close(dst.fd);
+  return r;
+}
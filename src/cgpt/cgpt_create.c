@@ -11,13 +11,17 @@
 
 static int initialize_gpt(struct drive *drive, const char *guid) {
   GptHeader *h = (GptHeader *)drive->gpt.primary_header;
+  uint32_t entries_bytes = GptEntriesBytes(&drive->gpt);
+  uint32_t entries_sectors = GptEntriesSectors(entries_bytes,
+                                               drive->gpt.sector_bytes);
+
   memcpy(h->signature, GPT_HEADER_SIGNATURE, GPT_HEADER_SIGNATURE_SIZE);
   h->revision = GPT_HEADER_REVISION;
   h->size = sizeof(GptHeader);
   h->my_lba = 1;
   h->alternate_lba = drive->gpt.drive_sectors - 1;
-  h->first_usable_lba = 1 + 1 + GPT_ENTRIES_SECTORS;
-  h->last_usable_lba = drive->gpt.drive_sectors - 1 - GPT_ENTRIES_SECTORS - 1;
+  h->first_usable_lba = 1 + 1 + entries_sectors;
+  h->last_usable_lba = drive->gpt.drive_sectors - 1 - entries_sectors - 1;
   if (guid) {
     if (StrToGuid(guid, &h->disk_uuid) != CGPT_OK) {
       Error("Provided GUID is invalid: \"%s\"\n", guid);
@@ -31,7 +35,7 @@ static int initialize_gpt(struct drive *drive, const char *guid) {
     (*uuid_generator)((uint8_t *)&h->disk_uuid);
   }
   h->entries_lba = 2;
-  h->number_of_entries = 128;
+  h->number_of_entries = entries_bytes / sizeof(GptEntry);
   h->size_of_entry = sizeof(GptEntry);
 
   // Copy to secondary
@@ -44,7 +48,10 @@ static int initialize_gpt(struct drive *drive, const char *guid) {
 
 int CgptCreate(CgptCreateParams *params) {
   struct drive drive;
+  uint32_t entries_sectors;
+  uint64_t first_usable, last_usable;
   int mode = O_RDWR;
+  int ret;
 
   if (params == NULL)
     return CGPT_FAILED;
@@ -52,18 +59,38 @@ int CgptCreate(CgptCreateParams *params) {
   if (params->create)
     mode |= O_CREAT;
 
-  if (CGPT_OK != DriveOpen(params->drive_name, &drive, params->min_size, mode))
+  if (params->num_entries &&
+      (params->num_entries < TOTAL_ENTRIES_SIZE / sizeof(GptEntry) ||
+       params->num_entries > GPT_MAX_TABLE_ENTRIES)) {
+    Error("number of entries must be from %zu to %d\n",
+          TOTAL_ENTRIES_SIZE / sizeof(GptEntry), GPT_MAX_TABLE_ENTRIES);
+    return CGPT_FAILED;
+  }
+
+  // A new GPT gets a default table unless told otherwise; zapping one
+  // clears the table it has.
+  DriveSetImageSectorSize(params->sector_bytes);
+  if (params->num_entries)
+    DriveSetEntriesSize(params->num_entries * sizeof(GptEntry));
+  else if (!params->zap)
+    DriveSetEntriesSize(TOTAL_ENTRIES_SIZE);
+  ret = DriveOpen(params->drive_name, &drive, params->min_size, mode, 0);
+  DriveSetImageSectorSize(0);
+  DriveSetEntriesSize(0);
+  if (CGPT_OK != ret)
     return CGPT_FAILED;
 
   // Erase the data
+  entries_sectors = GptEntriesSectors(GptEntriesBytes(&drive.gpt),
+                                      drive.gpt.sector_bytes);
   memset(drive.gpt.primary_header, 0,
          drive.gpt.sector_bytes * GPT_HEADER_SECTOR);
   memset(drive.gpt.secondary_header, 0,
          drive.gpt.sector_bytes * GPT_HEADER_SECTOR);
   memset(drive.gpt.primary_entries, 0,
-         drive.gpt.sector_bytes * GPT_ENTRIES_SECTORS);
+         drive.gpt.sector_bytes * entries_sectors);
   memset(drive.gpt.secondary_entries, 0,
-         drive.gpt.sector_bytes * GPT_ENTRIES_SECTORS);
+         drive.gpt.sector_bytes * entries_sectors);
   memset(&drive.pmbr, 0, sizeof(drive.pmbr));
 
   drive.gpt.modified |= (GPT_MODIFIED_HEADER1 | GPT_MODIFIED_ENTRIES1 |
@@ -78,6 +105,16 @@ int CgptCreate(CgptCreateParams *params) {
     InitPMBR(&drive, PRIMARY);
   }
 
+  // The old partitions are gone, and so is what they held: prepare the
+  // usable area initialize_gpt() sets up for new ones.
+  first_usable = 1 + 1 + entries_sectors;
+  last_usable = drive.gpt.drive_sectors - 1 - entries_sectors - 1;
+  if (drive.gpt.drive_sectors >= 2 * first_usable &&
+      CGPT_OK != DriveProvision(&drive, params->drive_name, first_usable,
+                                last_usable - first_usable + 1,
+                                params->provision))
+    goto bad;
+
   if (CGPT_OK != WritePMBR(&drive))
     goto bad;
 
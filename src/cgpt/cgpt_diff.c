@@ -0,0 +1,332 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Finding what changed in a partition between two images, for delta
+// updates.  Partitions are paired up by CgptFind() on each image, then
+// compared chunk by chunk from a pool of threads.  Chunks that are holes
+// in both images are equal without reading them.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cgpt.h"
+#include "cgptlib_internal.h"
+#include "vboot_host.h"
+
+#define DEFAULT_CHUNK_BYTES (1024 * 1024)
+// Chunks compared by one ParallelFor() call, sharing its buffers.
+#define STRIPE_CHUNKS 16
+
+// One partition of one image, in bytes.
+struct diff_part {
+  int partnum;
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct diff_image {
+  char *drive_name;
+  int fd;
+  int num_parts;
+  struct diff_part *parts;
+  int failed;                   // a match couldn't be kept
+};
+
+// A partition of the new image and the one of the old image it replaces.
+struct diff_pair {
+  const struct diff_part *old_part;
+  const struct diff_part *new_part;
+  uint64_t num_chunks;
+  uint8_t *changed;             // per chunk
+  uint64_t first_stripe;        // of the stripes numbered across all pairs
+};
+
+struct diff_job {
+  struct diff_image *old_image;
+  struct diff_image *new_image;
+  struct diff_pair *pairs;
+  int num_pairs;
+  uint64_t chunk_bytes;
+  int failed;                   // set by any thread, atomically
+};
+
+// Collects the matches CgptFind() reports into a struct diff_image.
+static void CollectMatch(void *ctx, const char *drive_name, int partnum,
+                         const GptEntry *entry) {
+  struct diff_image *image = ctx;
+  struct diff_part *parts;
+
+  parts = realloc(image->parts, (image->num_parts + 1) * sizeof(*parts));
+  if (!parts) {
+    Error("unable to allocate memory for matches\n");
+    image->failed = 1;
+    return;
+  }
+  // In sectors for now, FindParts() knows their size.
+  parts[image->num_parts].partnum = partnum;
+  parts[image->num_parts].offset = entry->starting_lba;
+  parts[image->num_parts].size = entry->ending_lba - entry->starting_lba + 1;
+  image->parts = parts;
+  image->num_parts++;
+}
+
+// Finds the partitions of image that params asks for, in partition order.
+static int FindParts(CgptDiffParams *params, struct diff_image *image) {
+  CgptFindParams find;
+  struct drive drive;
+  uint32_t sector_bytes;
+  uint64_t size;
+  int i;
+
+  memset(&find, 0, sizeof(find));
+  find.drive_name = image->drive_name;
+  find.set_label = !!params->label;
+  find.label = params->label;
+  find.set_type = params->set_type;
+  memcpy(&find.type_guid, &params->type_guid, sizeof(Guid));
+  find.match_fn = CollectMatch;
+  find.match_ctx = image;
+  CgptFind(&find);
+  if (image->failed)
+    return CGPT_FAILED;
+
+  if (CGPT_OK != DriveOpen(image->drive_name, &drive, 0, O_RDONLY, 0))
+    return CGPT_FAILED;
+  sector_bytes = drive.gpt.sector_bytes;
+  size = drive.size;
+  (void) DriveClose(&drive, 0);
+
+  for (i = 0; i < image->num_parts; i++) {
+    struct diff_part *part = &image->parts[i];
+
+    part->offset *= sector_bytes;
+    part->size *= sector_bytes;
+    if (part->offset + part->size > size) {
+      Error("partition %d runs past the end of %s\n", part->partnum,
+            image->drive_name);
+      return CGPT_FAILED;
+    }
+  }
+  return CGPT_OK;
+}
+
+// True if [offset, offset + count) of fd is all hole.  Block devices and
+// filesystems without SEEK_DATA have none.
+static int IsHole(int fd, uint64_t offset, uint64_t count) {
+  off_t data = lseek(fd, offset, SEEK_DATA);
+
+  if (data < 0)
+    return errno == ENXIO;
+  return (uint64_t)data >= offset + count;
+}
+
+static int ReadFull(struct diff_image *image, uint8_t *buf, uint64_t offset,
+                    size_t count) {
+  ssize_t n;
+
+  while (count) {
+    n = pread(image->fd, buf, count, offset);
+    StatsAdd(STATS_READ_CALLS, 1);
+    if (n <= 0) {
+      Error("Can't read %s: %s\n", image->drive_name,
+            n ? strerror(errno) : "unexpected end of file");
+      return CGPT_FAILED;
+    }
+    StatsAdd(STATS_READ_OTHER, n);
+    buf += n;
+    offset += n;
+    count -= n;
+  }
+  return CGPT_OK;
+}
+
+static int IsZero(const uint8_t *buf, size_t count) {
+  return !count || (!buf[0] && !memcmp(buf, buf + 1, count - 1));
+}
+
+// Compares chunk c of pair, returning 1 if it differs, 0 if not and -1 if
+// it couldn't be read.
+static int ChunkChanged(struct diff_job *job, struct diff_pair *pair,
+                        uint64_t c, uint8_t *old_buf, uint8_t *new_buf) {
+  uint64_t pos = c * job->chunk_bytes;
+  uint64_t count = pair->new_part->size - pos;
+  uint64_t old_off = pair->old_part->offset + pos;
+  uint64_t new_off = pair->new_part->offset + pos;
+  int old_hole, new_hole;
+
+  if (count > job->chunk_bytes)
+    count = job->chunk_bytes;
+  // Whatever the new partition has past the end of the old one is new.
+  if (pos + count > pair->old_part->size)
+    return 1;
+
+  old_hole = IsHole(job->old_image->fd, old_off, count);
+  new_hole = IsHole(job->new_image->fd, new_off, count);
+  if (old_hole && new_hole)
+    return 0;
+  if (!old_hole &&
+      CGPT_OK != ReadFull(job->old_image, old_buf, old_off, count))
+    return -1;
+  if (!new_hole &&
+      CGPT_OK != ReadFull(job->new_image, new_buf, new_off, count))
+    return -1;
+  if (old_hole)
+    return !IsZero(new_buf, count);
+  if (new_hole)
+    return !IsZero(old_buf, count);
+  return memcmp(old_buf, new_buf, count) != 0;
+}
+
+static void DiffStripe(void *arg, int stripe) {
+  struct diff_job *job = arg;
+  struct diff_pair *pair = job->pairs;
+  uint8_t *old_buf, *new_buf;
+  uint64_t c, end;
+  int i, r;
+
+  for (i = 1; i < job->num_pairs && job->pairs[i].first_stripe <= stripe; i++)
+    pair = &job->pairs[i];
+  c = (stripe - pair->first_stripe) * STRIPE_CHUNKS;
+  end = c + STRIPE_CHUNKS;
+  if (end > pair->num_chunks)
+    end = pair->num_chunks;
+
+  old_buf = malloc(job->chunk_bytes);
+  new_buf = malloc(job->chunk_bytes);
+  if (!old_buf || !new_buf) {
+    Error("unable to allocate memory for chunks\n");
+    __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    goto done;
+  }
+  for (; c < end && !__atomic_load_n(&job->failed, __ATOMIC_RELAXED); c++) {
+    r = ChunkChanged(job, pair, c, old_buf, new_buf);
+    if (r < 0)
+      __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    else
+      pair->changed[c] = r;
+  }
+
+done:
+  free(old_buf);
+  free(new_buf);
+}
+
+// Prints the runs of changed chunks of pair as PARTITION OFFSET LENGTH.
+static void PrintExtents(struct diff_job *job, struct diff_pair *pair) {
+  uint64_t c, start, end;
+
+  for (c = 0; c < pair->num_chunks; c++) {
+    if (!pair->changed[c])
+      continue;
+    start = c;
+    while (c + 1 < pair->num_chunks && pair->changed[c + 1])
+      c++;
+    end = (c + 1) * job->chunk_bytes;
+    if (end > pair->new_part->size)
+      end = pair->new_part->size;
+    printf("%d %" PRIu64 " %" PRIu64 "\n", pair->new_part->partnum,
+           start * job->chunk_bytes, end - start * job->chunk_bytes);
+  }
+}
+
+int CgptDiff(CgptDiffParams *params) {
+  struct diff_image old_image, new_image;
+  struct diff_job job;
+  uint64_t num_stripes = 0;
+  int i, r = CGPT_FAILED;
+
+  if (params == NULL)
+    return CGPT_FAILED;
+
+  memset(&old_image, 0, sizeof(old_image));
+  memset(&new_image, 0, sizeof(new_image));
+  memset(&job, 0, sizeof(job));
+  old_image.drive_name = params->old_drive_name;
+  new_image.drive_name = params->new_drive_name;
+  old_image.fd = new_image.fd = -1;
+  job.old_image = &old_image;
+  job.new_image = &new_image;
+  job.chunk_bytes = params->chunk_bytes ? params->chunk_bytes :
+                                          DEFAULT_CHUNK_BYTES;
+
+  if (!params->label && !params->set_type) {
+    Error("a label or type to pair partitions by is required\n");
+    return CGPT_FAILED;
+  }
+  if (job.chunk_bytes % GPT_MIN_SECTOR_BYTES) {
+    Error("chunk size must be a multiple of %d\n", GPT_MIN_SECTOR_BYTES);
+    return CGPT_FAILED;
+  }
+
+  if (CGPT_OK != FindParts(params, &old_image) ||
+      CGPT_OK != FindParts(params, &new_image))
+    goto done;
+  if (!new_image.num_parts) {
+    Error("no matching partition in %s\n", new_image.drive_name);
+    goto done;
+  }
+  if (old_image.num_parts != new_image.num_parts) {
+    Error("%d partitions of %s match, but %d of %s\n", old_image.num_parts,
+          old_image.drive_name, new_image.num_parts, new_image.drive_name);
+    goto done;
+  }
+
+  old_image.fd = open(old_image.drive_name, O_RDONLY | O_CLOEXEC);
+  if (old_image.fd < 0) {
+    Error("Can't open %s: %s\n", old_image.drive_name, strerror(errno));
+    goto done;
+  }
+  new_image.fd = open(new_image.drive_name, O_RDONLY | O_CLOEXEC);
+  if (new_image.fd < 0) {
+    Error("Can't open %s: %s\n", new_image.drive_name, strerror(errno));
+    goto done;
+  }
+  StatsAdd(STATS_OPEN_CALLS, 2);
+
+  // The nth match of one image goes with the nth of the other.
+  job.num_pairs = new_image.num_parts;
+  job.pairs = calloc(job.num_pairs, sizeof(*job.pairs));
+  if (!job.pairs)
+    goto done;
+  for (i = 0; i < job.num_pairs; i++) {
+    struct diff_pair *pair = &job.pairs[i];
+
+    pair->old_part = &old_image.parts[i];
+    pair->new_part = &new_image.parts[i];
+    pair->num_chunks = (pair->new_part->size + job.chunk_bytes - 1) /
+                       job.chunk_bytes;
+    pair->changed = calloc(pair->num_chunks, 1);
+    if (!pair->changed)
+      goto done;
+    pair->first_stripe = num_stripes;
+    num_stripes += (pair->num_chunks + STRIPE_CHUNKS - 1) / STRIPE_CHUNKS;
+  }
+  if (num_stripes > INT32_MAX) {
+    Error("too many chunks, use larger ones\n");
+    goto done;
+  }
+
+  ParallelFor(num_stripes, DiffStripe, &job);
+  if (job.failed)
+    goto done;
+  for (i = 0; i < job.num_pairs; i++)
+    PrintExtents(&job, &job.pairs[i]);
+  r = CGPT_OK;
+
+done:
+  if (job.pairs) {
+    for (i = 0; i < job.num_pairs; i++)
+      free(job.pairs[i].changed);
+    free(job.pairs);
+  }
+  if (old_image.fd >= 0)
+    close(old_image.fd);
+  if (new_image.fd >= 0)
+    close(new_image.fd);
+  free(old_image.parts);
+  free(new_image.parts);
+  return r;
+}
@@ -2,71 +2,185 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <errno.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "blkid_utils.h"
 #include "cgpt.h"
 #include "cgptlib_internal.h"
+#include "rootdev/rootdev.h"
 #include "vboot_host.h"
 
 #define BUFSIZE 1024
-// FIXME: currently we only support 512-byte sectors.
-#define LBA_SIZE 512
 
+// One partition that matched, kept until the results are reported.
+struct find_match {
+  int partnum;                          // 1-based
+  GptEntry entry;
+};
+
+// Everything one drive contributed to a search.
+struct find_result {
+  char *filename;
+  int num_matches;
+  struct find_match *matches;
+};
+
+// -M patterns no further apart than this are checked against a single read
+// spanning all of them; otherwise each gets its own read.
+#define MAX_COALESCED_READ (1024 * 1024)
+
+// How the content patterns get read from each candidate partition.
+struct content_plan {
+  uint64_t start;                       // lowest pattern offset
+  uint64_t end;                         // highest pattern end
+  int coalesce;                         // one read covers [start, end)
+  uint64_t bufsize;
+};
+
+static void plan_content(CgptFindParams *params, struct content_plan *plan) {
+  uint64_t largest = 0;
+  int i;
 
-// fill comparebuf with the data to be examined, returning true on success.
-static int FillBuffer(CgptFindParams *params, int fd, uint64_t pos,
-                       uint64_t count) {
-  uint8_t *bufptr = params->comparebuf;
-
-  if (-1 == lseek(fd, pos, SEEK_SET))
-    return 0;
-
-  // keep reading until done or error
-  while (count) {
-    ssize_t bytes_read = read(fd, bufptr, count);
-    // negative means error, 0 means (unexpected) EOF
-    if (bytes_read <= 0)
-      return 0;
-    count -= bytes_read;
-    bufptr += bytes_read;
+  plan->start = UINT64_MAX;
+  plan->end = 0;
+  for (i = 0; i < params->num_content; i++) {
+    CgptFindContent *c = &params->content[i];
+    if (c->matchoffset < plan->start)
+      plan->start = c->matchoffset;
+    if (c->matchoffset + c->matchlen > plan->end)
+      plan->end = c->matchoffset + c->matchlen;
+    if (c->matchlen > largest)
+      largest = c->matchlen;
   }
-
-  return 1;
+  if (!params->num_content)
+    plan->start = 0;
+  plan->coalesce = params->num_content == 1 ||
+                   plan->end - plan->start <= MAX_COALESCED_READ;
+  plan->bufsize = plan->coalesce ? plan->end - plan->start : largest;
 }
 
 // check partition data content. return true for match, 0 for no match or error
-static int match_content(CgptFindParams *params, struct drive *drive,
-                             GptEntry *entry) {
-  uint64_t part_size;
+static int match_content(CgptFindParams *params,
+                         const struct content_plan *plan,
+                         uint8_t *comparebuf, struct drive *drive,
+                         GptEntry *entry) {
+  uint64_t part_size, part_start;
+  CgptFindContent *c;
+  int i;
 
-  if (!params->matchlen)
+  if (!params->num_content)
     return 1;
 
-  // Ensure that the region we want to match against is inside the partition.
-  part_size = LBA_SIZE * (entry->ending_lba - entry->starting_lba + 1);
-  if (params->matchoffset + params->matchlen > part_size) {
+  // Ensure that the regions we want to match against are inside the
+  // partition.
+  part_size = (uint64_t)drive->gpt.sector_bytes *
+              (entry->ending_lba - entry->starting_lba + 1);
+  if (plan->end > part_size) {
     return 0;
   }
+  part_start = drive->gpt.sector_bytes * entry->starting_lba;
 
-  // Read the partition data.
-  if (!FillBuffer(params,
-                  drive->fd,
-                  (LBA_SIZE * entry->starting_lba) + params->matchoffset,
-                  params->matchlen)) {
+  // Read the partition data, all at once if the patterns are close.
+  if (plan->coalesce &&
+      CGPT_OK != DriveRead(drive, comparebuf, part_start + plan->start,
+                           plan->end - plan->start)) {
     Error("unable to read partition data\n");
     return 0;
   }
 
-  // Compare it
-  if (0 == memcmp(params->matchbuf, params->comparebuf, params->matchlen)) {
-    return 1;
+  // Compare it; every pattern has to be there.
+  for (i = 0; i < params->num_content; i++) {
+    c = &params->content[i];
+    if (plan->coalesce) {
+      if (memcmp(c->matchbuf, comparebuf + (c->matchoffset - plan->start),
+                 c->matchlen))
+        return 0;
+      continue;
+    }
+    if (CGPT_OK != DriveRead(drive, comparebuf, part_start + c->matchoffset,
+                             c->matchlen)) {
+      Error("unable to read partition data\n");
+      return 0;
+    }
+    if (memcmp(c->matchbuf, comparebuf, c->matchlen))
+      return 0;
   }
 
-  // Nope.
-  return 0;
+  return 1;
+}
+
+// The search criteria, turned into what the per-entry loop compares
+// against, so that nothing needs converting or parsing per entry.
+struct find_query {
+  int set_unique;
+  int set_type;
+  int set_label;
+  uint64_t unique[2];
+  uint64_t type[2];
+  uint16_t label[GPT_PARTNAME_LEN / sizeof(uint16_t)];
+  int label_len;                        // UTF-16 units, -1 if none can match
+  struct content_plan plan;
+};
+
+static void compile_query(CgptFindParams *params, struct find_query *query) {
+  uint16_t label[GPT_PARTNAME_LEN / sizeof(uint16_t) + 1];
+  char check[GPT_PARTNAME_LEN];
+
+  memset(query, 0, sizeof(*query));
+  query->set_unique = params->set_unique;
+  query->set_type = params->set_type;
+  query->set_label = params->set_label;
+  memcpy(query->unique, &params->unique_guid, sizeof(query->unique));
+  memcpy(query->type, &params->type_guid, sizeof(query->type));
+
+  // Entry names hold 36 UTF-16 units. A label that doesn't survive the
+  // round trip through them can't equal any name we'd have decoded.
+  query->label_len = -1;
+  if (params->set_label &&
+      CGPT_OK == UTF8ToUTF16((const uint8_t *)params->label, label,
+                             sizeof(label) / sizeof(label[0])) &&
+      CGPT_OK == UTF16ToUTF8(label, sizeof(label) / sizeof(label[0]),
+                             (uint8_t *)check, sizeof(check)) &&
+      !strcmp(check, params->label)) {
+    for (query->label_len = 0; label[query->label_len]; query->label_len++)
+      ;
+    memcpy(query->label, label, query->label_len * sizeof(uint16_t));
+  }
+
+  plan_content(params, &query->plan);
+}
+
+static int guid_is(const uint64_t *want, const Guid *guid) {
+  uint64_t words[2];
+
+  memcpy(words, guid, sizeof(words));
+  return words[0] == want[0] && words[1] == want[1];
+}
+
+// True if the name is exactly the label, up to its terminator or the end.
+static int name_is(const struct find_query *query, const GptEntry *entry) {
+  if (query->label_len < 0 ||
+      memcmp(entry->name, query->label, query->label_len * sizeof(uint16_t)))
+    return 0;
+  return query->label_len == sizeof(entry->name) / sizeof(entry->name[0]) ||
+         !entry->name[query->label_len];
+}
+
+static int entry_matches(const struct find_query *query,
+                         const GptEntry *entry) {
+  return (query->set_unique && guid_is(query->unique, &entry->unique)) ||
+         (query->set_type && guid_is(query->type, &entry->type)) ||
+         (query->set_label && name_is(query, entry));
 }
 
 // This needs to handle /dev/mmcblk0 -> /dev/mmcblk0p3, /dev/sda -> /dev/sda3
@@ -83,104 +197,642 @@ static void showmatch(CgptFindParams *params, char *filename,
     EntryDetails(entry, partnum - 1, params->numeric);
 }
 
-// This returns true if a GPT partition matches the search criteria. If a match
-// isn't found (or if the file doesn't contain a GPT), it returns false. The
-// filename and partition number that matched is left in a global, since we
-// could have multiple hits.
-static int do_search(CgptFindParams *params, char *fileName) {
-  int retval = 0;
-  int i;
+// This collects every GPT partition in fileName that matches the search
+// criteria into result, without printing anything, so that it can run on
+// several drives at once. It returns the number of matches; a file that
+// doesn't contain a GPT simply has none.
+static int search_drive(CgptFindParams *params,
+                        const struct find_query *query, char *fileName,
+                        int flags, struct find_result *result) {
+  uint32_t i, u, num_entries, num_used, stride;
+  const uint16_t *used;
   struct drive drive;
+  uint8_t *entries;
   GptEntry *entry;
-  char partlabel[GPT_PARTNAME_LEN];
+  uint8_t *comparebuf = NULL;
 
-  if (CGPT_OK != DriveOpen(fileName, &drive, 0, O_RDONLY))
+  result->filename = fileName;
+  result->num_matches = 0;
+  result->matches = NULL;
+
+  if (params->num_content) {
+    comparebuf = malloc(query->plan.bufsize);
+    if (!comparebuf) {
+      Error("Unable to allocate %" PRIu64 "bytes for comparison buffer\n",
+            query->plan.bufsize);
+      return 0;
+    }
+  }
+
+  if (CGPT_OK != DriveOpen(fileName, &drive, 0, O_RDONLY,
+                           DRIVE_LAZY_SECONDARY | flags)) {
+    free(comparebuf);
     return 0;
+  }
 
-  if (GPT_SUCCESS != GptSanityCheck(&drive.gpt)) {
+  if (GPT_SUCCESS != GptSanityCheck(&drive.gpt) ||
+      !(num_entries = GetNumberOfEntries(&drive))) {
     (void) DriveClose(&drive, 0);
+    free(comparebuf);
     return 0;
   }
 
-  for (i = 0; i < GetNumberOfEntries(&drive); ++i) {
-    entry = GetEntry(&drive.gpt, ANY_VALID, i);
+  entries = (uint8_t *)GetEntry(&drive.gpt, ANY_VALID, 0);
+  stride = GetGptHeader(&drive.gpt)->size_of_entry;
+  num_used = GetEntriesOfClass(&drive, ANY_VALID, ENTRY_CLASS_USED, &used);
+  for (u = 0; u < num_used; ++u) {
+    i = used[u];
+    entry = (GptEntry *)(entries + i * stride);
 
-    if (GuidIsZero(&entry->type))
+    if (!entry_matches(query, entry))
       continue;
 
-    int found = 0;
-    if ((params->set_unique && GuidEqual(&params->unique_guid, &entry->unique))
-        || (params->set_type && GuidEqual(&params->type_guid, &entry->type))) {
-      found = 1;
-    } else if (params->set_label) {
-      uint16_t name[36];
-      memcpy(name, entry->name, sizeof(uint16_t)*36);
-      if (CGPT_OK != UTF16ToUTF8(name,
-                                 sizeof(entry->name) / sizeof(entry->name[0]),
-                                 (uint8_t *)partlabel, sizeof(partlabel))) {
-        Error("The label cannot be converted from UTF16, so abort.\n");
-        return 0;
+    if (match_content(params, &query->plan, comparebuf, &drive, entry)) {
+      struct find_match *matches = realloc(result->matches,
+          (result->num_matches + 1) * sizeof(*matches));
+      if (!matches) {
+        Error("unable to allocate memory for matches\n");
+        break;
       }
-      if (!strncmp(params->label, partlabel, sizeof(partlabel)))
-        found = 1;
-    }
-    if (found && match_content(params, &drive, entry)) {
-      params->hits++;
-      retval++;
-      showmatch(params, fileName, i+1, entry);
-      if (!params->match_partnum)
-        params->match_partnum = i+1;
+      matches[result->num_matches].partnum = i+1;
+      matches[result->num_matches].entry = *entry;
+      result->matches = matches;
+      result->num_matches++;
     }
   }
 
   (void) DriveClose(&drive, 0);
+  free(comparebuf);
+
+  return result->num_matches;
+}
+
+// Prints one drive's matches and folds them into the search totals. The
+// first partition reported is left in params->match_partnum, since we
+// could have multiple hits.
+static void report_matches(CgptFindParams *params, struct find_result *result) {
+  int i;
+
+  for (i = 0; i < result->num_matches; i++) {
+    if (params->first && params->hits)
+      break;
+    params->hits++;
+    if (params->match_fn)
+      params->match_fn(params->match_ctx, result->filename,
+                       result->matches[i].partnum, &result->matches[i].entry);
+    else
+      showmatch(params, result->filename, result->matches[i].partnum,
+                &result->matches[i].entry);
+    if (!params->match_partnum)
+      params->match_partnum = result->matches[i].partnum;
+  }
+  free(result->matches);
+  result->matches = NULL;
+}
 
+// This returns true if a GPT partition matches the search criteria. If a match
+// isn't found (or if the file doesn't contain a GPT), it returns false.
+static int do_search(CgptFindParams *params, const struct find_query *query,
+                     char *fileName, int flags) {
+  struct find_result result;
+  int retval;
+
+  retval = search_drive(params, query, fileName, flags, &result);
+  report_matches(params, &result);
   return retval;
 }
 
 
-#define PROC_PARTITIONS "/proc/partitions"
+struct find_scan {
+  CgptFindParams *params;
+  const struct find_query *query;
+  struct find_result *results;
+};
+
+static void scan_one_dev(void *arg, int index) {
+  struct find_scan *scan = arg;
+  struct find_result *result = &scan->results[index];
+
+  // Keep the scan of every disk out of the page cache.
+  search_drive(scan->params, scan->query, result->filename, DRIVE_DIRECT_IO,
+               result);
+}
+
+// Finds the whole disk holding the running root filesystem, if we can.
+static int get_root_disk(char *path, size_t size) {
+  return rootdev(path, size, true, true) == 0;
+}
+
+// Moves the disk holding the root filesystem to the front of devs, leaving
+// the others in order.
+static void root_disk_first(char **devs, int num_devs) {
+  char root[PATH_MAX];
+  char *dev;
+  int i;
+
+  if (!get_root_disk(root, sizeof(root)))
+    return;
+
+  for (i = 1; i < num_devs; i++) {
+    if (!strcmp(devs[i], root)) {
+      dev = devs[i];
+      memmove(&devs[1], &devs[0], i * sizeof(*devs));
+      devs[0] = dev;
+      break;
+    }
+  }
+}
+
+// For --first, search one disk at a time, starting with the root disk since
+// that's the usual answer, and stop as soon as something matches.
+static int scan_first(CgptFindParams *params, const struct find_query *query,
+                      char **devs, int num_devs) {
+  int i;
+
+  root_disk_first(devs, num_devs);
+  for (i = 0; i < num_devs; i++) {
+    // Keep the scan of every disk out of the page cache.
+    if (do_search(params, query, devs[i], DRIVE_DIRECT_IO))
+      return 1;
+  }
+  return 0;
+}
 
 // This scans all the physical devices it can find, looking for a match. It
-// returns true if any matches were found, false otherwise.
-static int scan_real_devs(CgptFindParams *params) {
+// returns true if any matches were found, false otherwise. The devices are
+// searched concurrently, but reported in /proc/partitions order.
+static int scan_real_devs(CgptFindParams *params,
+                          const struct find_query *query) {
   int found = 0;
+  char **devs;
+  int num_devs;
+  struct find_scan scan;
+  int i;
+
+  num_devs = ScanGptDrives(&devs);
+
+  if (params->first) {
+    found = scan_first(params, query, devs, num_devs);
+    goto done;
+  }
+
+  scan.params = params;
+  scan.query = query;
+  scan.results = calloc(num_devs ? num_devs : 1, sizeof(*scan.results));
+  if (!scan.results) {
+    Error("unable to allocate memory for search results\n");
+    goto done;
+  }
+  for (i = 0; i < num_devs; i++)
+    scan.results[i].filename = devs[i];
+
+  ParallelFor(num_devs, scan_one_dev, &scan);
+
+  for (i = 0; i < num_devs; i++) {
+    if (scan.results[i].num_matches)
+      found++;
+    report_matches(params, &scan.results[i]);
+  }
+  free(scan.results);
+
+done:
+  FreeDriveList(devs, num_devs);
+  return found;
+}
+
+#define PROC_PARTITIONS "/proc/partitions"
+#define SYS_CLASS_BLOCK_DIR "/sys/class/block"
+
+static void report_metadata_match(CgptFindParams *params, char *wholedev,
+                                  int partnum) {
+  struct find_match match = { partnum };
+  struct find_result result = { wholedev, 1, NULL };
+
+  result.matches = malloc(sizeof(match));
+  if (!result.matches) {
+    Error("unable to allocate memory for matches\n");
+    return;
+  }
+  result.matches[0] = match;
+  report_matches(params, &result);
+}
+
+// The kernel turns GPT names into ASCII by replacing anything past 0xff
+// with '!', so only plain printable labels can be compared against it.
+static int label_is_ascii(const char *label) {
+  size_t len = strlen(label);
+
+  if (!len || len >= GPT_PARTNAME_LEN / sizeof(uint16_t))
+    return 0;
+  for (; *label; label++) {
+    if (*label < 0x20 || *label > 0x7e || *label == '!')
+      return 0;
+  }
+  return 1;
+}
+
+// Reads the partition number and name the kernel reported for a partition
+// in /proc/partitions. Returns false for whole disks and unnamed partitions.
+static int read_partition_uevent(const char *partname, int *partnum,
+                                 char *label, size_t labelsize) {
+  char path[PATH_MAX];
   char line[BUFSIZE];
-  char partname[128];                   // max size for /proc/partition lines?
   FILE *fp;
-  char *pathname;
+  int is_partition = 0;
 
-  fp = fopen(PROC_PARTITIONS, "r");
-  if (!fp) {
-    perror("can't read " PROC_PARTITIONS);
-    return found;
-  }
+  *partnum = 0;
+  label[0] = '\0';
+
+  if (snprintf(path, sizeof(path), "%s" SYS_CLASS_BLOCK_DIR "/%s/uevent",
+               SysRoot(), partname) >= sizeof(path))
+    return 0;
+  if (!(fp = fopen(path, "r")))
+    return 0;
 
   while (fgets(line, sizeof(line), fp)) {
+    line[strcspn(line, "\n")] = '\0';
+    if (!strcmp(line, "DEVTYPE=partition"))
+      is_partition = 1;
+    else if (!strncmp(line, "PARTN=", 6))
+      *partnum = atoi(line + 6);
+    else if (!strncmp(line, "PARTNAME=", 9) && strlen(line + 9) < labelsize)
+      strcpy(label, line + 9);
+  }
+
+  fclose(fp);
+  return is_partition && *partnum > 0 && label[0];
+}
+
+// Finds the disk a partition listed in /proc/partitions belongs to, as the
+// path a full scan would report it under, in wholedev.
+static char *partition_wholedev(const char *partname, char *wholedev,
+                                size_t size) {
+  char path[PATH_MAX];
+  char parent[PATH_MAX];
+
+  if (snprintf(path, sizeof(path), "%s" SYS_CLASS_BLOCK_DIR "/%s/..",
+               SysRoot(), partname) >= sizeof(path))
+    return NULL;
+  if (!realpath(path, parent))
+    return NULL;
+
+  return IsWholeDev(basename(parent), wholedev, size);
+}
+
+// The partitions lookup_label() found, in the order a full scan would
+// report them.
+struct label_matches {
+  int count;
+  struct {
+    char *wholedev;
+    int partnum;
+  } *match;
+};
+
+static int add_label_match(struct label_matches *matches, const char *wholedev,
+                           int partnum) {
+  void *more = realloc(matches->match,
+                       (matches->count + 1) * sizeof(*matches->match));
+  char *dev = strdup(wholedev);
+
+  if (more)
+    matches->match = more;
+  if (!more || !dev) {
+    free(dev);
+    return 0;
+  }
+  matches->match[matches->count].wholedev = dev;
+  matches->match[matches->count].partnum = partnum;
+  matches->count++;
+  return 1;
+}
+
+// A whole disk listed without partitions may still hold a GPT the kernel
+// hasn't read, whose labels sysfs then can't tell us about. partname is
+// spelled the sysfs way.
+static int disk_unaccounted(const char *partname) {
+  char name[128];
+  char wholedev[PATH_MAX];
+  char *c;
+
+  snprintf(name, sizeof(name), "%s", partname);
+  for (c = name; *c; c++) {
+    if (*c == '!')
+      *c = '/';
+  }
+  return IsWholeDev(name, wholedev, sizeof(wholedev)) && ProbeGpt(wholedev);
+}
+
+// Answers -l from the partition names in sysfs. Walking /proc/partitions
+// visits disks and then their partitions in the same order a full scan
+// reports them. That only settles the answer if the kernel knows the
+// partitions of every disk with a GPT, and either one partition has the
+// label or --first only wants one of them; otherwise returns false for the
+// disks to be searched, which also sees any duplicates.
+static int lookup_label(CgptFindParams *params) {
+  char line[BUFSIZE];
+  char partname[128];                   // max size for /proc/partition lines?
+  char disk[128] = "";                  // last whole disk with no partitions
+  char label[GPT_PARTNAME_LEN];
+  char root[PATH_MAX];
+  char wholedev[PATH_MAX];
+  char proc_partitions[PATH_MAX];
+  struct label_matches matches = { 0, NULL };
+  FILE *fp;
+  int partnum;
+  int complete = 1;
+  int answer = -1;                      // which of the matches to report
+  int i;
+
+  if (!label_is_ascii(params->label))
+    return 0;
+
+  if (params->first && !get_root_disk(root, sizeof(root)))
+    root[0] = '\0';
+
+  snprintf(proc_partitions, sizeof(proc_partitions), "%s" PROC_PARTITIONS,
+           SysRoot());
+  if (!(fp = fopen(proc_partitions, "r")))
+    return 0;
+
+  while (complete && fgets(line, sizeof(line), fp)) {
     int ma, mi;
     long long unsigned int sz;
+    char *c;
 
     if (sscanf(line, " %d %d %llu %127[^\n ]", &ma, &mi, &sz, partname) != 4)
       continue;
 
-    if ((pathname = IsWholeDev(partname))) {
-      if (do_search(params, pathname)) {
-        found++;
-      }
+    // sysfs spells cciss/c0d0p1 as cciss!c0d0p1
+    for (c = partname; *c; c++) {
+      if (*c == '/')
+        *c = '!';
+    }
+
+    if (!read_partition_uevent(partname, &partnum, label, sizeof(label))) {
+      // A partition without a name, or the next disk.
+      if (partnum)
+        disk[0] = '\0';
+      else if (disk[0] && disk_unaccounted(disk))
+        complete = 0;
+      else
+        strcpy(disk, partname);
+      continue;
+    }
+    disk[0] = '\0';
+
+    if (strcmp(label, params->label))
+      continue;
+
+    if (!partition_wholedev(partname, wholedev, sizeof(wholedev)))
+      continue;
+
+    if (!add_label_match(&matches, wholedev, partnum)) {
+      Error("unable to allocate memory for matches\n");
+      complete = 0;
     }
   }
+  if (complete && disk[0] && disk_unaccounted(disk))
+    complete = 0;
 
   fclose(fp);
+
+  if (complete && params->first) {
+    // The root disk is searched first, then the rest in this order.
+    for (i = 0; i < matches.count && answer < 0; i++) {
+      if (!strcmp(matches.match[i].wholedev, root))
+        answer = i;
+    }
+    if (answer < 0 && matches.count)
+      answer = 0;
+  } else if (complete && matches.count == 1) {
+    answer = 0;
+  }
+
+  if (answer >= 0)
+    report_metadata_match(params, matches.match[answer].wholedev,
+                          matches.match[answer].partnum);
+  for (i = 0; i < matches.count; i++)
+    free(matches.match[i].wholedev);
+  free(matches.match);
+  return answer >= 0;
+}
+
+// Nothing says which other disks might carry the same GUID, so a partition
+// found for -u is only the answer for --first, and only on the root disk,
+// which that searches before any other.
+static int unique_settled(const char *wholedev) {
+  char root[PATH_MAX];
+
+  return get_root_disk(root, sizeof(root)) && !strcmp(wholedev, root);
+}
+
+#ifdef CGPT_MINI
+// Answers -u from the udev by-partuuid links, as there is no libblkid.
+static int lookup_unique(CgptFindParams *params) {
+  char desc[sizeof("PARTUUID=") + GUID_STRLEN];
+  char *devname, *whole_devname;
+  int partnum;
+  int found = 0;
+
+  strcpy(desc, "PARTUUID=");
+  GuidToStrLower(&params->unique_guid, desc + strlen(desc), GUID_STRLEN);
+  if (CGPT_OK != sysfs_resolve_partition(desc, &devname, &whole_devname,
+                                         &partnum))
+    return 0;
+
+  if (unique_settled(whole_devname)) {
+    report_metadata_match(params, whole_devname, partnum);
+    found = 1;
+  }
+  free(whole_devname);
+  free(devname);
   return found;
 }
+#else
+// Answers -u by asking libblkid, which uses the udev by-partuuid links or
+// its cache, to resolve PARTUUID= the way root= would be.
+static int lookup_unique(CgptFindParams *params) {
+  char guid[GUID_STRLEN];
+  char *devname;
+  uint32_t partnum = 0;
+  int found = 0;
 
+  GuidToStrLower(&params->unique_guid, guid, sizeof(guid));
+  if (!(devname = blkid_evaluate_tag("PARTUUID", guid, NULL)))
+    return 0;
+
+  if (CGPT_OK == translate_partition_dev(&devname, &partnum) && partnum &&
+      unique_settled(devname)) {
+    report_metadata_match(params, devname, partnum);
+    found = 1;
+  }
+
+  free(devname);
+  return found;
+}
+#endif
+
+// Tries to answer the search from what the kernel and libblkid already know
+// about partitions, without reading any GPT. This only covers -u or -l on
+// their own, and never content matching or -v, which need the entries
+// themselves. -u -1 also scans, because it has to notice a duplicated GUID,
+// and so does -u without --first, as libblkid only ever names one partition.
+// Returns true if that settled the answer; otherwise the disks still need to
+// be searched.
+static int lookup_metadata(CgptFindParams *params) {
+  if (params->num_content || params->verbose || params->set_type)
+    return 0;
+
+  if (params->set_label && !params->set_unique)
+    return lookup_label(params);
+  if (params->set_unique && !params->set_label && !params->oneonly &&
+      params->first)
+    return lookup_unique(params);
+  return 0;
+}
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Finds the disk a uevent adds or changes, or one of whose partitions it
+// does, as the path a full scan would report it under. To be freed.
+static char *uevent_wholedev(const struct uevent *ev) {
+  char partname[PATH_MAX];
+  char path[PATH_MAX];
+  char *wholedev = NULL;
+  char *c;
+
+  if (!ev->devname || !ev->devtype ||
+      (strcmp(ev->action, "add") && strcmp(ev->action, "change")))
+    return NULL;
+
+  if (!strcmp(ev->devtype, "disk")) {
+    wholedev = IsWholeDev(ev->devname, path, sizeof(path));
+  } else if (!strcmp(ev->devtype, "partition") &&
+             snprintf(partname, sizeof(partname), "%s", ev->devname) <
+             sizeof(partname)) {
+    // sysfs spells cciss/c0d0p1 as cciss!c0d0p1
+    for (c = partname; *c; c++) {
+      if (*c == '/')
+        *c = '!';
+    }
+    wholedev = partition_wholedev(partname, path, sizeof(path));
+  }
+  return wholedev ? strdup(wholedev) : NULL;
+}
+
+// Adds dev to the list unless it is there already, taking it over.
+static void add_drive(char ***devs, int *num_devs, char *dev) {
+  char **more;
+  int i;
+
+  for (i = 0; i < *num_devs; i++) {
+    if (!strcmp((*devs)[i], dev)) {
+      free(dev);
+      return;
+    }
+  }
+  more = realloc(*devs, (*num_devs + 1) * sizeof(*more));
+  if (!more) {
+    Error("unable to allocate memory for device list\n");
+    free(dev);
+    return;
+  }
+  *devs = more;
+  (*devs)[(*num_devs)++] = dev;
+}
+
+// After a scan that found nothing, searches the disks the kernel announces
+// on uevent_fd as they show up, until one matches or params->wait_ms runs
+// out. Returns true if anything matched.
+static int wait_for_match(CgptFindParams *params,
+                          const struct find_query *query, int uevent_fd) {
+  char buf[UEVENT_BYTES + 1];
+  struct pollfd pfd = { uevent_fd, POLLIN };
+  struct uevent ev;
+  uint64_t deadline = now_ms() + params->wait_ms;
+  uint64_t now;
+  char **devs;
+  int num_devs, lost, found = 0;
+  int timeout, r, i;
+
+  while (!found) {
+    timeout = -1;
+    if (params->wait_ms >= 0) {
+      now = now_ms();
+      if (now >= deadline)
+        break;
+      timeout = deadline - now;
+    }
+    r = poll(&pfd, 1, timeout);
+    if (r < 0 && errno != EINTR) {
+      Error("poll failed: %s\n", strerror(errno));
+      break;
+    }
+    if (r <= 0)
+      continue;
+
+    // Take all the events there are, so that a disk showing up along with
+    // its partitions is searched once.
+    devs = NULL;
+    num_devs = 0;
+    lost = 0;
+    while ((r = UeventRecv(uevent_fd, buf, &ev))) {
+      char *dev;
+
+      if (r < 0)
+        lost = 1;
+      else if ((dev = uevent_wholedev(&ev)))
+        add_drive(&devs, &num_devs, dev);
+    }
+
+    if (lost) {
+      // Events were lost, any disk may have shown up.
+      found = scan_real_devs(params, query);
+    } else {
+      for (i = 0; i < num_devs; i++) {
+        if (params->first && found)
+          break;
+        // Drop the swap, RAID members and raw disks as a scan would.
+        if (ProbeGpt(devs[i]) &&
+            do_search(params, query, devs[i], DRIVE_DIRECT_IO))
+          found++;
+      }
+    }
+    FreeDriveList(devs, num_devs);
+  }
+  return found;
+}
 
 void CgptFind(CgptFindParams *params) {
+  struct find_query query;
+  int uevent_fd = -1;
+
   if (params == NULL)
     return;
 
-  if (params->drive_name != NULL)
-    do_search(params, params->drive_name);
-  else
-    scan_real_devs(params);
+  compile_query(params, &query);
+  if (params->drive_name != NULL) {
+    do_search(params, &query, params->drive_name, 0);
+    return;
+  }
+
+  // Listen before scanning, so that no disk showing up in between is missed.
+  if (params->wait) {
+    uevent_fd = UeventOpen();
+    if (uevent_fd < 0) {
+      Error("Can't listen for uevents: %s\n", strerror(errno));
+      return;
+    }
+  }
+  if (!lookup_metadata(params) && !scan_real_devs(params, &query) &&
+      uevent_fd >= 0)
+    wait_for_match(params, &query, uevent_fd);
+  if (uevent_fd >= 0)
+    close(uevent_fd);
 }
@@ -11,128 +11,194 @@
 
 #define BUFSIZE 1024
 
-char next_file_name[BUFSIZE];
-int next_priority, next_index;
+// The partition to boot next, as found so far by a search. The drive it is
+// on stays open so the winner doesn't have to be read again.
+struct next_search {
+  char file_name[BUFSIZE];
+  int priority;                         // -1 if it isn't bootable
+  int index;                            // -1 until something is found
+  int drive_open;
+  struct drive drive;
+};
+
+static void next_search_init(struct next_search *search) {
+  search->file_name[0] = '\0';
+  search->priority = -1;
+  search->index = -1;
+  search->drive_open = 0;
+}
 
-static int do_search(CgptNextParams *params) {
+static void next_search_release(struct next_search *search) {
+  if (search->drive_open)
+    (void) DriveClose(&search->drive, 0);
+  search->drive_open = 0;
+}
+
+static int do_search(struct next_search *search, const char *drive_name,
+                     int flags) {
   struct drive drive;
-  uint32_t max_part;
+  const uint16_t *roots;
+  uint32_t num_roots, r;
   int gpt_retval;
   int priority, tries, successful;
+  int chosen = 0;
   int i;
 
-  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDONLY))
+  if (CGPT_OK != DriveOpen(drive_name, &drive, 0, O_RDONLY,
+                           DRIVE_LAZY_SECONDARY | flags))
     return CGPT_FAILED;
 
   if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive.gpt))) {
     Error("GptSanityCheck() returned %d: %s\n",
           gpt_retval, GptError(gpt_retval));
+    (void) DriveClose(&drive, 0);
     return CGPT_FAILED;
   }
 
-  max_part = GetNumberOfEntries(&drive);
-
-  for (i = 0; i < max_part; i++) {
-    if (!IsRoot(&drive, PRIMARY, i))
-      continue;
+  num_roots = GetEntriesOfClass(&drive, PRIMARY, ENTRY_CLASS_ROOT, &roots);
 
+  for (r = 0; r < num_roots; r++) {
+    i = roots[r];
     priority = GetPriority(&drive, PRIMARY, i);
     tries = GetTries(&drive, PRIMARY, i);
     successful = GetSuccessful(&drive, PRIMARY, i);
 
-    if (next_index == -1 || ((priority > next_priority) && (successful || tries))) {
-      strncpy(next_file_name, params->drive_name, BUFSIZE);
-      next_file_name[BUFSIZE - 1] = '\0';
+    if (search->index == -1 ||
+        ((priority > search->priority) && (successful || tries))) {
+      strncpy(search->file_name, drive_name, BUFSIZE);
+      search->file_name[BUFSIZE - 1] = '\0';
       if (successful || tries) {
-        next_priority = priority;
+        search->priority = priority;
       } else {
-        next_priority = -1;
+        search->priority = -1;
       }
-      next_index = i;
+      search->index = i;
+      chosen = 1;
     }
   }
 
-  return DriveClose(&drive, 0);
+  if (!chosen)
+    return DriveClose(&drive, 0);
+
+  next_search_release(search);
+  search->drive = drive;
+  search->drive_open = 1;
+  return CGPT_OK;
 }
 
-#define PROC_PARTITIONS "/proc/partitions"
-
-// This scans all the physical devices it can find, looking for a match. It
-// returns true if any matches were found, false otherwise.
-static int scan_real_devs(CgptNextParams *params) {
-  int found = 0;
-  char line[BUFSIZE];
-  char partname[128];                   // max size for /proc/partition lines?
-  FILE *fp;
-  char *pathname;
-
-  fp = fopen(PROC_PARTITIONS, "r");
-  if (!fp) {
-    perror("can't read " PROC_PARTITIONS);
-    return found;
+// Folds the result of searching a later drive into an earlier one. This
+// picks the same partition as running do_search() over both drives in
+// order: the first root partition seen wins until something bootable with
+// a strictly higher priority comes along.
+static void merge_search(struct next_search *search,
+                         struct next_search *later) {
+  if (later->index != -1 &&
+      (search->index == -1 || later->priority > search->priority)) {
+    next_search_release(search);
+    *search = *later;
+  } else {
+    next_search_release(later);
   }
+}
 
-  while (fgets(line, sizeof(line), fp)) {
-    int ma, mi;
-    long long unsigned int sz;
+struct next_scan {
+  char **devs;
+  struct next_search *results;
+};
 
-    if (sscanf(line, " %d %d %llu %127[^\n ]", &ma, &mi, &sz, partname) != 4)
-      continue;
+static void scan_one_dev(void *arg, int index) {
+  struct next_scan *scan = arg;
 
-    if ((pathname = IsWholeDev(partname))) {
-      params->drive_name = pathname;
-      do_search(params);
-    }
+  next_search_init(&scan->results[index]);
+  // Keep the scan of every disk out of the page cache.
+  do_search(&scan->results[index], scan->devs[index], DRIVE_DIRECT_IO);
+}
+
+// This scans all the physical devices it can find, looking for the next
+// partition to boot. The devices are searched concurrently and merged in
+// /proc/partitions order. It returns the number of devices scanned.
+static int scan_real_devs(struct next_search *search) {
+  char **devs;
+  int num_devs;
+  struct next_scan scan;
+  int i;
+
+  num_devs = ScanGptDrives(&devs);
+
+  scan.devs = devs;
+  scan.results = calloc(num_devs ? num_devs : 1, sizeof(*scan.results));
+  if (!scan.results) {
+    Error("unable to allocate memory for search results\n");
+    FreeDriveList(devs, num_devs);
+    return 0;
   }
 
-  fclose(fp);
-  return found;
+  ParallelFor(num_devs, scan_one_dev, &scan);
+
+  for (i = 0; i < num_devs; i++)
+    merge_search(search, &scan.results[i]);
+  free(scan.results);
+
+  FreeDriveList(devs, num_devs);
+  return num_devs;
 }
 
 int CgptNext(CgptNextParams *params) {
-  struct drive drive;
+  struct drive *drive;
   GptEntry *entry;
   char tmp[64];
   int tries;
-  next_index = -1;
   int gpt_retval;
+  struct next_search search;
 
   if (params == NULL)
     return CGPT_FAILED;
 
+  next_search_init(&search);
   if (params->drive_name) {
-    do_search(params);
+    do_search(&search, params->drive_name, 0);
   } else {
-    scan_real_devs(params);
+    scan_real_devs(&search);
   }
 
-  if (strlen(next_file_name) == 0) {
+  if (search.index == -1) {
     return CGPT_FAILED;
   }
 
-  if (DriveOpen(next_file_name, &drive, 0, O_RDWR) == CGPT_OK) {
-    if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive.gpt))) {
-      Error("GptSanityCheck() returned %d: %s\n",
-            gpt_retval, GptError(gpt_retval));
-      return CGPT_FAILED;
-    }
+  // Write through the handle the search left open, rather than loading
+  // the winning drive all over again.
+  drive = &search.drive;
+  if (CGPT_OK != DriveMakeWritable(drive, search.file_name)) {
+    next_search_release(&search);
+    return CGPT_FAILED;
+  }
+  if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive->gpt))) {
+    Error("GptSanityCheck() returned %d: %s\n",
+          gpt_retval, GptError(gpt_retval));
+    next_search_release(&search);
+    return CGPT_FAILED;
+  }
+  GptEntriesTrackCrc(&drive->gpt, MASK_BOTH);
 
-    // Decrement tries if we selected on that criteria
-    tries = GetTries(&drive, PRIMARY, next_index);
-    if (tries > 0) {
-      tries--;
-    }
-    SetTries(&drive, PRIMARY, next_index, tries);
+  // Decrement tries if we selected on that criteria
+  tries = GetTries(drive, PRIMARY, search.index);
+  if (tries > 0) {
+    tries--;
+  }
+  SetTries(drive, PRIMARY, search.index, tries);
 
-    // Print out the next disk to go!
-    entry = GetEntry(&drive.gpt, ANY_VALID, next_index);
+  // Print out the next disk to go!
+  entry = GetEntry(&drive->gpt, ANY_VALID, search.index);
+  memcpy(&params->unique_guid, &entry->unique, sizeof(Guid));
+  params->partition = search.index + 1;
+  if (!params->quiet) {
     GuidToStrLower(&entry->unique, tmp, sizeof(tmp));
     printf("%s\n", tmp);
-
-    // Write it all out
-    UpdateAllEntries(&drive);
-    return DriveClose(&drive, 1);
   }
 
-  return 1;
+  // Only the slot holding the attribute and the headers covering it are
+  // written, since both tables are tracked.
+  UpdateAllEntries(drive);
+  search.drive_open = 0;
+  return DriveClose(drive, 1);
 }
@@ -10,14 +10,19 @@
 
 //////////////////////////////////////////////////////////////////////////////
 // We need a sorted list of priority groups, where each element in the list
-// contains an unordered list of GPT partition numbers.
+// contains an unordered list of GPT partitions, of any of the drives ranked.
 
 #define MAX_GROUPS 17                   // 0-15, plus one "higher"
 
+typedef struct {
+  int drive;                            // index into the drives ranked
+  uint32_t index;                       // entry index on that drive
+} part_t;
+
 typedef struct {
   int priority;                         // priority of this group
   int num_parts;                        // number of partitions in this group
-  uint32_t *part;                       // array of partitions in this group
+  part_t *part;                         // array of partitions in this group
 } group_t;
 
 typedef struct {
@@ -37,7 +42,7 @@ static group_list_t *NewGroupList(int max_p) {
   for (i=0; i<MAX_GROUPS; i++) {
     gl->group[i].priority = -1;
     gl->group[i].num_parts = 0;
-    gl->group[i].part = (uint32_t *)malloc(sizeof(uint32_t) * max_p);
+    gl->group[i].part = (part_t *)malloc(sizeof(part_t) * max_p);
     require(gl->group[i].part);
   }
 
@@ -51,7 +56,8 @@ static void FreeGroups(group_list_t *gl) {
   free(gl);
 }
 
-static void AddToGroup(group_list_t *gl, int priority, int partition) {
+static void AddToGroup(group_list_t *gl, int priority, int drive,
+                       uint32_t index) {
   int i;
   // See if I've already got a group with this priority
   for (i=0; i<gl->num_groups; i++)
@@ -65,7 +71,8 @@ static void AddToGroup(group_list_t *gl, int priority, int partition) {
   }
   // add the partition to it
   int j = gl->group[i].num_parts;
-  gl->group[i].part[j] = partition;
+  gl->group[i].part[j].drive = drive;
+  gl->group[i].part[j].index = index;
   gl->group[i].num_parts++;
 }
 
@@ -91,31 +98,92 @@ static void SortGroups(group_list_t *gl) {
   }
 }
 
-int CgptPrioritize(CgptPrioritizeParams *params) {
+// One of the drives ranked together.
+typedef struct {
+  const char *name;
   struct drive drive;
+  int opened;
+  uint32_t num_root;
+  const uint16_t *roots;
+} prio_drive_t;
+
+int CgptPrioritize(CgptPrioritizeParams *params) {
+  prio_drive_t *drives = NULL;
+  char **names = NULL;
+  char **scanned = NULL;
+  int num_drives, num_scanned = 0;
 
   int priority;
 
   int gpt_retval;
   uint32_t index;
   uint32_t max_part;
-  int num_root;
-  int i,j;
+  uint32_t total_root, r;
+  int d, i, j;
+  int retval = CGPT_FAILED;
   group_list_t *groups;
 
   if (params == NULL)
     return CGPT_FAILED;
 
-  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDWR))
+  if (params->max_priority < 0 ||
+      params->max_priority > CGPT_ATTRIBUTE_MAX_PRIORITY) {
+    Error("invalid maximum priority: %d\n", params->max_priority);
     return CGPT_FAILED;
+  }
 
-  if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive.gpt))) {
-    Error("GptSanityCheck() returned %d: %s\n",
-          gpt_retval, GptError(gpt_retval));
-    return CGPT_FAILED;
+  // The drives to rank as one: the one given, the others along with it, or
+  // every drive with a GPT.
+  if (params->all_drives) {
+    if (params->set_partition) {
+      Error("a partition to raise needs its drive\n");
+      return CGPT_FAILED;
+    }
+    num_scanned = ScanGptDrives(&scanned);
+    names = scanned;
+    num_drives = num_scanned;
+  } else {
+    num_drives = 1 + params->num_other_drives;
+    names = malloc(num_drives * sizeof(*names));
+    require(names);
+    names[0] = params->drive_name;
+    for (d = 1; d < num_drives; d++)
+      names[d] = params->other_drives[d - 1];
+  }
+  if (!num_drives) {
+    Error("no drives with a GPT found\n");
+    goto out;
+  }
+
+  // Open and check them all before changing any.
+  drives = calloc(num_drives, sizeof(*drives));
+  require(drives);
+  total_root = 0;
+  for (d = 0; d < num_drives; d++) {
+    prio_drive_t *pd = &drives[d];
+
+    pd->name = names[d];
+    if (CGPT_OK != DriveOpen(pd->name, &pd->drive, 0, O_RDWR, 0))
+      goto bad;
+    pd->opened = 1;
+
+    if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&pd->drive.gpt))) {
+      Error("GptSanityCheck() returned %d: %s\n",
+            gpt_retval, GptError(gpt_retval));
+      if (num_drives > 1)
+        Error("on %s\n", pd->name);
+      goto bad;
+    }
+    GptEntriesTrackCrc(&pd->drive.gpt, MASK_BOTH);
+
+    // How many kernel partitions do I have?
+    pd->num_root = GetEntriesOfClass(&pd->drive, PRIMARY, ENTRY_CLASS_ROOT,
+                                     &pd->roots);
+    total_root += pd->num_root;
   }
 
-  max_part = GetNumberOfEntries(&drive);
+  // The partition to raise is on the first drive.
+  max_part = GetNumberOfEntries(&drives[0].drive);
 
   if (params->set_partition) {
     if (params->set_partition < 1 || params->set_partition > max_part) {
@@ -125,37 +193,33 @@ int CgptPrioritize(CgptPrioritizeParams *params) {
     }
     index = params->set_partition - 1;
     // it must be a kernel
-    if (!IsRoot(&drive, PRIMARY, index)) {
+    if (!IsRoot(&drives[0].drive, PRIMARY, index)) {
       Error("partition %d is not a Flatcar root\n", params->set_partition);
       goto bad;
     }
   }
 
-  // How many kernel partitions do I have?
-  num_root = 0;
-  for (i = 0; i < max_part; i++) {
-    if (IsRoot(&drive, PRIMARY, i))
-      num_root++;
-  }
-
-  if (num_root) {
-    // Determine the current priority groups
-    groups = NewGroupList(num_root);
-    for (i = 0; i < max_part; i++) {
-      if (!IsRoot(&drive, PRIMARY, i))
-        continue;
-
-      priority = GetPriority(&drive, PRIMARY, i);
-
-      // Is this partition special?
-      if (params->set_partition && (i+1 == params->set_partition)) {
-        params->orig_priority = priority;  // remember the original priority
-        if (params->set_friends)
-          AddToGroup(groups, priority, i); // we'll move them all later
-        else
-          AddToGroup(groups, 99, i);       // move only this one
-      } else {
-        AddToGroup(groups, priority, i);   // just remember
+  if (total_root) {
+    // Determine the current priority groups, across all the drives
+    groups = NewGroupList(total_root);
+    for (d = 0; d < num_drives; d++) {
+      prio_drive_t *pd = &drives[d];
+
+      for (r = 0; r < pd->num_root; r++) {
+        i = pd->roots[r];
+        priority = GetPriority(&pd->drive, PRIMARY, i);
+
+        // Is this partition special?
+        if (params->set_partition && d == 0 &&
+            (i+1 == params->set_partition)) {
+          params->orig_priority = priority;  // remember the original priority
+          if (params->set_friends)
+            AddToGroup(groups, priority, d, i); // we'll move them all later
+          else
+            AddToGroup(groups, 99, d, i);       // move only this one
+        } else {
+          AddToGroup(groups, priority, d, i);   // just remember
+        }
       }
     }
 
@@ -187,21 +251,44 @@ int CgptPrioritize(CgptPrioritizeParams *params) {
         priority--;
     }
 
-    // Now apply the ranking to the GPT
+    // Now apply the ranking to the GPTs
     for (i=0; i<groups->num_groups; i++)
       for (j=0; j<groups->group[i].num_parts; j++)
-        SetPriority(&drive, PRIMARY,
-                    groups->group[i].part[j], groups->group[i].priority);
+        SetPriority(&drives[groups->group[i].part[j].drive].drive, PRIMARY,
+                    groups->group[i].part[j].index,
+                    groups->group[i].priority);
 
     FreeGroups(groups);
   }
 
-  // Write it all out
-  UpdateAllEntries(&drive);
+  // Write it all out, leaving drives without a root alone when there are
+  // several.
+  retval = CGPT_OK;
+  for (d = 0; d < num_drives; d++) {
+    prio_drive_t *pd = &drives[d];
 
-  return DriveClose(&drive, 1);
+    pd->opened = 0;
+    if (num_drives > 1 && !pd->num_root) {
+      (void) DriveClose(&pd->drive, 0);
+      continue;
+    }
+    UpdateAllEntries(&pd->drive);
+    if (CGPT_OK != DriveClose(&pd->drive, 1))
+      retval = CGPT_FAILED;
+  }
+  goto out;
 
 bad:
-  (void) DriveClose(&drive, 0);
-  return CGPT_FAILED;
+  for (d = 0; d < num_drives; d++) {
+    if (drives[d].opened)
+      (void) DriveClose(&drives[d].drive, 0);
+  }
+
+out:
+  free(drives);
+  if (scanned)
+    FreeDriveList(scanned, num_scanned);
+  else
+    free(names);
+  return retval;
 }
@@ -15,7 +15,7 @@ int CgptRepair(CgptRepairParams *params) {
   if (params == NULL)
     return CGPT_FAILED;
 
-  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDWR))
+  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDWR, 0))
     return CGPT_FAILED;
 
   if (CGPT_OK != ReadPMBR(&drive)) {
@@ -30,46 +30,125 @@
  */
 static int blkpg_resize_partition(int fd, int partno,
                                   uint64_t start, uint64_t size) {
-  struct blkpg_ioctl_arg arg;
-  struct blkpg_partition part;
-
-  part.pno = partno;
-  part.start = start;
-  part.length = size;
-  part.devname[0] = '\0';
-  part.volname[0] = '\0';
-  arg.op = BLKPG_RESIZE_PARTITION;
-  arg.flags = 0;
-  arg.datalen = sizeof(part);
-  arg.data = &part;
-
-  return ioctl(fd, BLKPG, &arg);
+  return BlkpgPartition(fd, BLKPG_RESIZE_PARTITION, partno, start, size);
 }
 
-/* Resize the partition and notify the kernel.
+// One partition being grown, and where to.
+struct resize_job {
+  const CgptResizeTarget *target;
+  char *devname;
+  char *disk_devname;
+  int partno;
+  uint64_t starting_lba;
+  uint64_t old_ending_lba;
+  uint64_t new_ending_lba;
+};
+
+/* Returns the sectors after entry that it could grow into. */
+static uint64_t room_after(const struct extent_map *map,
+                           const GptEntry *entry) {
+  uint32_t i;
+
+  for (i = 0; i < map->num_free; i++) {
+    if (map->free[i].first == entry->ending_lba + 1)
+      return map->free[i].last - entry->ending_lba;
+  }
+  return 0;
+}
+
+/* Works out how far the job grows, in sectors.  Returns -1 on error. */
+static int64_t plan_growth(CgptResizeParams *params, struct resize_job *job,
+                           uint64_t room, uint32_t sector_bytes) {
+  const CgptResizeTarget *target = job->target;
+  uint64_t size = job->old_ending_lba - job->starting_lba + 1;
+  uint64_t grow;
+
+  if (target->size) {
+    uint64_t want = target->size / sector_bytes;
+
+    grow = want > size ? want - size : 0;
+    if (grow > room) {
+      Error("%s can only grow to %llu bytes\n", target->partition_desc,
+            (unsigned long long)((size + room) * sector_bytes));
+      return -1;
+    }
+  } else if (target->percent) {
+    grow = room * target->percent / 100;
+  } else {
+    grow = room;
+  }
+
+  // Not worth the trouble, as the original single-partition resize had it.
+  if (grow * sector_bytes < params->min_resize_bytes)
+    grow = 0;
+  return grow;
+}
+
+/* Puts the kernel's idea of the first n jobs back to their old sizes. */
+static void undo_blkpg(int fd, struct resize_job *jobs, int n,
+                       uint32_t sector_bytes) {
+  int i;
+
+  for (i = 0; i < n; i++) {
+    struct resize_job *job = &jobs[i];
+
+    if (job->new_ending_lba == job->old_ending_lba)
+      continue;
+    if (blkpg_resize_partition(fd, job->partno,
+                               job->starting_lba * sector_bytes,
+                               (job->old_ending_lba - job->starting_lba + 1) *
+                               sector_bytes) < 0)
+      Error("Failed to restore the kernel's size of %s: %s\n",
+            job->target->partition_desc, strerror(errno));
+  }
+}
+
+/* Grows the filesystems of the jobs, if asked to. */
+static int grow_filesystems(CgptResizeParams *params, struct resize_job *jobs,
+                            int n, uint32_t sector_bytes) {
+  int r = CGPT_OK;
+  int i;
+
+  if (!params->grow_fs)
+    return CGPT_OK;
+  for (i = 0; i < n; i++) {
+    struct resize_job *job = &jobs[i];
+
+    if (CGPT_OK != GrowMountedExt4(job->devname,
+                                   (job->new_ending_lba - job->starting_lba +
+                                    1) * sector_bytes))
+      r = CGPT_FAILED;
+  }
+  return r;
+}
+
+/* Resize the partitions, all on one disk, and notify the kernel.
+ * The new layout is worked out and checked as a whole, the kernel told of
+ * each change, and the table written once.
  * returns:
  *   CGPT_OK for resize successful or nothing to do
  *   CGPT_FAILED on error
  */
-static int resize_partition(CgptResizeParams *params, blkid_dev dev) {
-  char *disk_devname;
+static int resize_partitions(CgptResizeParams *params,
+                             struct resize_job *jobs, int n) {
   struct drive drive;
-  GptHeader *header;
-  GptEntry *entry;
-  int gpt_retval, entry_index, entry_count;
-  uint64_t free_bytes, last_free_lba, entry_size_lba;
+  struct extent_map map;
+  uint32_t sector_bytes;
+  int gpt_retval, entry_count, changed = 0;
+  int i, j;
 
-  if ((disk_devname = dev_to_wholedevname(dev)) == NULL) {
-    Error("Failed to find whole disk device for %s\n", blkid_dev_devname(dev));
-    return CGPT_FAILED;
+  for (i = 1; i < n; i++) {
+    if (strcmp(jobs[i].disk_devname, jobs[0].disk_devname)) {
+      Error("%s and %s are on different disks\n",
+            jobs[0].target->partition_desc, jobs[i].target->partition_desc);
+      return CGPT_FAILED;
+    }
   }
 
-  if (DriveOpen(disk_devname, &drive, 0, O_RDWR) != CGPT_OK) {
-    free(disk_devname);
+  if (DriveOpen(jobs[0].disk_devname, &drive, 0, O_RDWR, 0) != CGPT_OK)
     return CGPT_FAILED;
-  }
 
-  free(disk_devname);
+  sector_bytes = drive.gpt.sector_bytes;
 
   if (CGPT_OK != ReadPMBR(&drive)) {
     Error("Unable to read PMBR\n");
@@ -89,42 +168,47 @@ static int resize_partition(CgptResizeParams *params, blkid_dev dev) {
     goto nope;
   }
 
-  header = (GptHeader*)drive.gpt.primary_header;
-  last_free_lba = header->last_usable_lba;
+  // Plan the whole layout against the table as it is.
+  BuildExtentMap(&drive, &map);
   entry_count = GetNumberOfEntries(&drive);
-  entry_index = dev_to_partno(dev) - 1;
-  if (entry_index < 0 || entry_index >= entry_count) {
-    Error("Kernel and GPT disagree on the number of partitions!\n");
-    goto nope;
-  }
-  entry = GetEntry(&drive.gpt, PRIMARY, entry_index);
-
-  // Scan entire table to determine if entry can grow.
-  for (int i = 0; i < entry_count; i++) {
-    GptEntry *other = GetEntry(&drive.gpt, PRIMARY, i);
+  for (i = 0; i < n; i++) {
+    struct resize_job *job = &jobs[i];
+    GptEntry *entry;
+    int64_t grow;
 
-    if (GuidIsZero(&other->type))
-      continue;
-
-    if (other->starting_lba > entry->ending_lba &&
-        other->starting_lba - 1 < last_free_lba) {
-      last_free_lba = other->starting_lba - 1;
+    if (job->partno < 1 || job->partno > entry_count) {
+      Error("Kernel and GPT disagree on the number of partitions!\n");
+      goto nope;
+    }
+    for (j = 0; j < i; j++) {
+      if (jobs[j].partno == job->partno) {
+        Error("%s is given more than once\n", job->target->partition_desc);
+        goto nope;
+      }
     }
+    entry = GetEntry(&drive.gpt, PRIMARY, job->partno - 1);
+    job->starting_lba = entry->starting_lba;
+    job->old_ending_lba = entry->ending_lba;
+    grow = plan_growth(params, job, room_after(&map, entry), sector_bytes);
+    if (grow < 0)
+      goto nope;
+    job->new_ending_lba = entry->ending_lba + grow;
+    changed += !!grow;
   }
 
-  // Exit without doing anything if the size is too small
-  free_bytes = (last_free_lba - entry->ending_lba) * drive.gpt.sector_bytes;
-  if (entry->ending_lba >= last_free_lba ||
-      free_bytes < params->min_resize_bytes) {
+  // Exit without touching the table if nothing grows, though the
+  // filesystems may still lag behind partitions grown earlier.
+  if (!changed) {
     if (DriveClose(&drive, 0) != CGPT_OK)
       return CGPT_FAILED;
-    else
-      return CGPT_OK;
+    return grow_filesystems(params, jobs, n, sector_bytes);
   }
 
   // Update and test partition table in memory
-  entry->ending_lba = last_free_lba;
-  entry_size_lba = entry->ending_lba - entry->starting_lba + 1;
+  for (i = 0; i < n; i++) {
+    GptEntry *entry = GetEntryForWrite(&drive, PRIMARY, jobs[i].partno - 1);
+    entry->ending_lba = jobs[i].new_ending_lba;
+  }
   UpdateAllEntries(&drive);
   gpt_retval = CheckEntries((GptEntry*)drive.gpt.primary_entries,
                             (GptHeader*)drive.gpt.primary_header);
@@ -134,53 +218,123 @@ static int resize_partition(CgptResizeParams *params, blkid_dev dev) {
     goto nope;
   }
 
-  // Notify kernel of new partition size via an ioctl.
-  if (blkpg_resize_partition(drive.fd, dev_to_partno(dev),
-                             entry->starting_lba * drive.gpt.sector_bytes,
-                             entry_size_lba * drive.gpt.sector_bytes) < 0) {
-    Error("Failed to notify kernel of new partition size: %s\n"
-          "Leaving existing partition table in place.\n", strerror(errno));
-    goto nope;
+  // Notify kernel of new partition sizes via an ioctl.
+  for (i = 0; i < n; i++) {
+    struct resize_job *job = &jobs[i];
+
+    if (job->new_ending_lba == job->old_ending_lba)
+      continue;
+    if (blkpg_resize_partition(drive.fd, job->partno,
+                               job->starting_lba * sector_bytes,
+                               (job->new_ending_lba - job->starting_lba + 1) *
+                               sector_bytes) < 0) {
+      Error("Failed to notify kernel of new size of %s: %s\n"
+            "Leaving existing partition table in place.\n",
+            job->target->partition_desc, strerror(errno));
+      undo_blkpg(drive.fd, jobs, i, sector_bytes);
+      goto nope;
+    }
   }
 
   UpdatePMBR(&drive, PRIMARY);
   if (WritePMBR(&drive) != CGPT_OK) {
     Error("Failed to write legacy MBR.\n");
+    undo_blkpg(drive.fd, jobs, n, sector_bytes);
     goto nope;
   }
 
   // Whew! we made it! Flush to disk.
-  return DriveClose(&drive, 1);
+  if (DriveClose(&drive, 1) != CGPT_OK)
+    return CGPT_FAILED;
+
+  // With the new sizes both in the kernel and on disk, let the filesystems
+  // have them too.
+  return grow_filesystems(params, jobs, n, sector_bytes);
 
 nope:
   DriveClose(&drive, 0);
   return CGPT_FAILED;
 }
 
-/* Search for a partition to resize and expand it if possible.
- * Both the partition table and the filesytem will be updated.
+/* Search for the partitions to resize and expand them if possible.
+ * The partition table is updated, and with grow_fs the mounted ext4
+ * filesystems on the partitions as well.
  */
 int CgptResize(CgptResizeParams *params) {
   blkid_cache cache = NULL;
-  blkid_dev found_dev = NULL;
+  CgptResizeTarget single;
+  const CgptResizeTarget *targets;
+  struct resize_job *jobs = NULL;
+  int n, i;
   int err = CGPT_FAILED;
 
-  if (params == NULL || params->partition_desc == NULL)
+  if (params == NULL)
     return CGPT_FAILED;
 
-  if (blkid_get_cache(&cache, NULL) < 0)
-    goto exit;
+  if (params->num_targets) {
+    targets = params->targets;
+    n = params->num_targets;
+  } else {
+    memset(&single, 0, sizeof(single));
+    single.partition_desc = params->partition_desc;
+    targets = &single;
+    n = 1;
+  }
+  if (n < 0 || targets == NULL)
+    return CGPT_FAILED;
+  for (i = 0; i < n; i++) {
+    if (targets[i].partition_desc == NULL)
+      return CGPT_FAILED;
+    if (targets[i].percent < 0 || targets[i].percent > 100) {
+      Error("invalid share of free space for %s: %d%%\n",
+            targets[i].partition_desc, targets[i].percent);
+      return CGPT_FAILED;
+    }
+  }
 
-  found_dev = blkid_get_dev(cache, params->partition_desc, BLKID_DEV_NORMAL);
+  jobs = calloc(n, sizeof(*jobs));
+  if (!jobs)
+    return CGPT_FAILED;
 
-  if (!found_dev) {
-    Error("device not found %s\n", params->partition_desc);
-    goto exit;
+  for (i = 0; i < n; i++) {
+    struct resize_job *job = &jobs[i];
+    blkid_dev dev;
+
+    job->target = &targets[i];
+    // sysfs knows all we need without probing anything.
+    if (CGPT_OK == sysfs_resolve_partition(targets[i].partition_desc,
+                                           &job->devname, &job->disk_devname,
+                                           &job->partno))
+      continue;
+
+    // Other tags, or no udev links: let libblkid look.
+    if (!cache && blkid_get_cache(&cache, NULL) < 0)
+      goto exit;
+    dev = blkid_get_dev(cache, targets[i].partition_desc, BLKID_DEV_NORMAL);
+    if (!dev) {
+      Error("device not found %s\n", targets[i].partition_desc);
+      goto exit;
+    }
+    if ((job->disk_devname = dev_to_wholedevname(dev)) == NULL) {
+      Error("Failed to find whole disk device for %s\n",
+            blkid_dev_devname(dev));
+      goto exit;
+    }
+    job->devname = strdup(blkid_dev_devname(dev));
+    job->partno = dev_to_partno(dev);
+    if (!job->devname)
+      goto exit;
   }
 
-  err = resize_partition(params, found_dev);
+  err = resize_partitions(params, jobs, n);
 
 exit:
-  blkid_put_cache(cache);
+  if (cache)
+    blkid_put_cache(cache);
+  for (i = 0; i < n; i++) {
+    free(jobs[i].devname);
+    free(jobs[i].disk_devname);
+  }
+  free(jobs);
   return err;
 }
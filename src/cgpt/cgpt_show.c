@@ -20,22 +20,14 @@
  * Needs (size*3-1+3) bytes of space in 'buf' (included the tailing '\0').
  */
 #define BUFFER_SIZE(size) (size *3 - 1 + 3)
-static short Uint8To2Chars(const uint8_t t) {
-  int h = t >> 4;
-  int l = t & 0xf;
-  h = (h >= 0xA) ? h - 0xA + 'A' : h + '0';
-  l = (l >= 0xA) ? l - 0xA + 'A' : l + '0';
-  return (h << 8) + l;
-}
-
 static void RawDump(const uint8_t *memory, const int size,
                     char *buf, int group) {
+  static const char digits[] = "0123456789ABCDEF";
   int i, outlen = 0;
   buf[outlen++] = '[';
   for (i = 0; i < size; ++i) {
-    short c2 = Uint8To2Chars(memory[i]);
-    buf[outlen++] = c2 >> 8;
-    buf[outlen++] = c2 & 0xff;
+    buf[outlen++] = digits[memory[i] >> 4];
+    buf[outlen++] = digits[memory[i] & 0xf];
     if (i != (size - 1) && ((i + 1) % group) == 0)
       buf[outlen++] = '-';
   }
@@ -52,14 +44,11 @@ static void RawDump(const uint8_t *memory, const int size,
 
 static void HeaderDetails(GptHeader *header, GptEntry *entries,
                           const char *indent, int raw) {
-  int i;
-
   printf("%sSig: ", indent);
   if (!raw) {
-    printf("[");
-    for (i = 0; i < sizeof(header->signature); ++i)
-      printf("%c", header->signature[i]);
-    printf("]");
+    putchar('[');
+    fwrite(header->signature, 1, sizeof(header->signature), stdout);
+    putchar(']');
   } else {
     char buf[BUFFER_SIZE(sizeof(header->signature))];
     RawDump((uint8_t *)header->signature, sizeof(header->signature), buf, 1);
@@ -160,17 +149,12 @@ void EntryDetails(GptEntry *entry, uint32_t index, int raw) {
 
 
 void EntriesDetails(struct drive *drive, const int secondary, int raw) {
-  uint32_t i;
+  const uint16_t *used;
+  uint32_t num_used, i;
 
-  for (i = 0; i < GetNumberOfEntries(drive); ++i) {
-    GptEntry *entry;
-    entry = GetEntry(&drive->gpt, secondary, i);
-
-    if (GuidIsZero(&entry->type))
-      continue;
-
-    EntryDetails(entry, i, raw);
-  }
+  num_used = GetEntriesOfClass(drive, secondary, ENTRY_CLASS_USED, &used);
+  for (i = 0; i < num_used; ++i)
+    EntryDetails(GetEntry(&drive->gpt, secondary, used[i]), used[i], raw);
 }
 
 int CgptGetNumNonEmptyPartitions(CgptShowParams *params) {
@@ -181,7 +165,8 @@ int CgptGetNumNonEmptyPartitions(CgptShowParams *params) {
   if (params == NULL)
     return CGPT_FAILED;
 
-  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDONLY))
+  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDONLY,
+                           DRIVE_LAZY_SECONDARY))
     return CGPT_FAILED;
 
   if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive.gpt))) {
@@ -191,17 +176,68 @@ int CgptGetNumNonEmptyPartitions(CgptShowParams *params) {
     goto done;
   }
 
+  const uint16_t *used;
+  params->num_partitions = GetEntriesOfClass(&drive, ANY_VALID,
+                                             ENTRY_CLASS_USED, &used);
+
+  retval = CGPT_OK;
+
+done:
+  DriveClose(&drive, 0);
+  return retval;
+}
+
+int CgptGetPartitions(CgptShowParams *params) {
+  struct drive drive;
+  const uint16_t *used;
+  uint32_t num_used, i;
+  int gpt_retval;
+  int retval = CGPT_FAILED;
+
+  if (params == NULL)
+    return CGPT_FAILED;
+  params->partitions = NULL;
   params->num_partitions = 0;
-  int numEntries = GetNumberOfEntries(&drive);
-  int i;
-  for(i = 0; i < numEntries; i++) {
-      GptEntry *entry = GetEntry(&drive.gpt, ANY_VALID, i);
-      if (GuidIsZero(&entry->type))
-        continue;
 
-      params->num_partitions++;
+  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDONLY,
+                           DRIVE_LAZY_SECONDARY))
+    return CGPT_FAILED;
+
+  if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive.gpt))) {
+    Error("GptSanityCheck() returned %d: %s\n",
+          gpt_retval, GptError(gpt_retval));
+    goto done;
+  }
+
+  num_used = GetEntriesOfClass(&drive, ANY_VALID, ENTRY_CLASS_USED, &used);
+  // One more, so that no partitions isn't a failed allocation.
+  params->partitions = calloc(num_used + 1, sizeof(*params->partitions));
+  if (!params->partitions) {
+    Error("unable to allocate memory\n");
+    goto done;
   }
 
+  for (i = 0; i < num_used; i++) {
+    CgptPartitionInfo *info = &params->partitions[i];
+    GptEntry *entry = GetEntry(&drive.gpt, ANY_VALID, used[i]);
+    uint16_t name[36];
+
+    info->partition = used[i] + 1;
+    info->begin = entry->starting_lba;
+    info->size = entry->ending_lba - entry->starting_lba + 1;
+    memcpy(&info->type_guid, &entry->type, sizeof(Guid));
+    memcpy(&info->unique_guid, &entry->unique, sizeof(Guid));
+    memcpy(name, entry->name, sizeof(name));
+    UTF16ToUTF8(name, sizeof(name) / sizeof(name[0]),
+                (uint8_t *)info->label, sizeof(info->label));
+    info->legacy_bootable = GetLegacyBootable(&drive, ANY_VALID, used[i]);
+    info->successful = GetSuccessful(&drive, ANY_VALID, used[i]);
+    info->tries = GetTries(&drive, ANY_VALID, used[i]);
+    info->priority = GetPriority(&drive, ANY_VALID, used[i]);
+    info->raw_value = entry->attrs.whole;
+  }
+  params->num_partitions = num_used;
+  params->sector_bytes = drive.gpt.sector_bytes;
   retval = CGPT_OK;
 
 done:
@@ -209,6 +245,179 @@ done:
   return retval;
 }
 
+static const struct {
+  char item;
+  const char *name;
+} query_fields[] = {
+  {'i', "partition"},
+  {'b', "start"},
+  {'s', "size"},
+  {'t', "type"},
+  {'u', "unique"},
+  {'l', "label"},
+  {'S', "successful"},
+  {'T', "tries"},
+  {'P', "priority"},
+  {'A', "attr"},
+};
+#define NUM_QUERY_FIELDS (sizeof(query_fields) / sizeof(query_fields[0]))
+
+int ParseShowFields(const char *list, char *fields, size_t size) {
+  size_t len = 0, n, i;
+
+  if (!strcmp(list, "all")) {
+    require(size > NUM_QUERY_FIELDS);
+    for (i = 0; i < NUM_QUERY_FIELDS; i++)
+      fields[i] = query_fields[i].item;
+    fields[i] = '\0';
+    return CGPT_OK;
+  }
+
+  while (*list) {
+    n = strcspn(list, ",");
+    for (i = 0; i < NUM_QUERY_FIELDS; i++)
+      if (strlen(query_fields[i].name) == n &&
+          !strncmp(list, query_fields[i].name, n))
+        break;
+    if (i == NUM_QUERY_FIELDS) {
+      Error("unknown field \"%.*s\"\n", (int)n, list);
+      return CGPT_FAILED;
+    }
+    if (len + 1 >= size) {
+      Error("too many fields\n");
+      return CGPT_FAILED;
+    }
+    fields[len++] = query_fields[i].item;
+    list += n;
+    if (*list)
+      list++;
+  }
+  if (!len) {
+    Error("no fields given\n");
+    return CGPT_FAILED;
+  }
+  fields[len] = '\0';
+  return CGPT_OK;
+}
+
+static const char *QueryFieldName(char item) {
+  size_t i;
+
+  for (i = 0; i < NUM_QUERY_FIELDS; i++)
+    if (query_fields[i].item == item)
+      return query_fields[i].name;
+  require(0);
+  return NULL;
+}
+
+// Labels are the only free-form values; neither a tab nor a quote may be
+// left to end the value early.
+static void PrintQueryString(const char *str, int json) {
+  const unsigned char *c;
+
+  if (json)
+    putchar('"');
+  for (c = (const unsigned char *)str; *c; c++) {
+    if (*c == '\\' || (json && *c == '"'))
+      printf("\\%c", *c);
+    else if (*c == '\t')
+      fputs("\\t", stdout);
+    else if (*c == '\n')
+      fputs("\\n", stdout);
+    else if (*c < 0x20)
+      printf(json ? "\\u%04x" : "\\x%02x", *c);
+    else
+      putchar(*c);
+  }
+  if (json)
+    putchar('"');
+}
+
+static void ShowQueryRecord(struct drive *drive, CgptShowParams *params,
+                            uint32_t index) {
+  GptEntry *entry = GetEntry(&drive->gpt, ANY_VALID, index);
+  char buf[256];
+  uint16_t name[36];
+  const char *f;
+
+  if (params->json)
+    putchar('{');
+  for (f = params->fields; *f; f++) {
+    if (f != params->fields)
+      putchar(params->json ? ',' : '\t');
+    if (params->json)
+      printf("\"%s\":", QueryFieldName(*f));
+    switch (*f) {
+    case 'i':
+      printf("%u", index + 1);
+      break;
+    case 'b':
+      printf("%" PRIu64, entry->starting_lba);
+      break;
+    case 's':
+      printf("%" PRIu64, entry->ending_lba - entry->starting_lba + 1);
+      break;
+    case 't':
+      GuidToStr(&entry->type, buf, sizeof(buf));
+      PrintQueryString(buf, params->json);
+      break;
+    case 'u':
+      GuidToStr(&entry->unique, buf, sizeof(buf));
+      PrintQueryString(buf, params->json);
+      break;
+    case 'l':
+      memcpy(name, entry->name, sizeof(name));
+      UTF16ToUTF8(name, sizeof(name) / sizeof(name[0]),
+                  (uint8_t *)buf, sizeof(buf));
+      PrintQueryString(buf, params->json);
+      break;
+    case 'S':
+      printf("%d", GetSuccessful(drive, ANY_VALID, index));
+      break;
+    case 'T':
+      printf("%d", GetTries(drive, ANY_VALID, index));
+      break;
+    case 'P':
+      printf("%d", GetPriority(drive, ANY_VALID, index));
+      break;
+    case 'A':
+      // As a string, since JSON readers may hold numbers as doubles.
+      if (params->json)
+        printf("\"0x%016" PRIx64 "\"", entry->attrs.whole);
+      else
+        printf("0x%016" PRIx64, entry->attrs.whole);
+      break;
+    }
+  }
+  puts(params->json ? "}" : "");
+}
+
+// Reports params->fields for each of params->query_parts, or for every
+// partition in use, one line each.
+static int ShowQuery(struct drive *drive, CgptShowParams *params) {
+  uint32_t max_part = GetNumberOfEntries(drive);
+  const uint16_t *used;
+  uint32_t num_used;
+  int i;
+
+  for (i = 0; i < params->num_query_parts; i++) {
+    if (params->query_parts[i] < 1 || params->query_parts[i] > max_part) {
+      Error("invalid partition number: %u\n", params->query_parts[i]);
+      return CGPT_FAILED;
+    }
+  }
+
+  if (params->query_parts) {
+    for (i = 0; i < params->num_query_parts; i++)
+      ShowQueryRecord(drive, params, params->query_parts[i] - 1);
+  } else {
+    num_used = GetEntriesOfClass(drive, ANY_VALID, ENTRY_CLASS_USED, &used);
+    for (i = 0; i < num_used; i++)
+      ShowQueryRecord(drive, params, used[i]);
+  }
+  return CGPT_OK;
+}
+
 int CgptShow(CgptShowParams *params) {
   struct drive drive;
   int gpt_retval;
@@ -216,7 +425,11 @@ int CgptShow(CgptShowParams *params) {
   if (params == NULL)
     return CGPT_FAILED;
 
-  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDONLY))
+  // Only the full listing describes the secondary GPT.
+  if (CGPT_OK != DriveOpen(params->drive_name, &drive, 0, O_RDONLY,
+                           (params->partition || params->quick ||
+                            params->fields[0]) ?
+                           DRIVE_LAZY_SECONDARY : 0))
     return CGPT_FAILED;
 
   if (GPT_SUCCESS != (gpt_retval = GptSanityCheck(&drive.gpt))) {
@@ -225,7 +438,11 @@ int CgptShow(CgptShowParams *params) {
     return CGPT_FAILED;
   }
 
-  if (params->partition) {                      // show single partition
+  if (params->fields[0]) {                      // query mode
+    int retval = ShowQuery(&drive, params);
+    DriveClose(&drive, 0);
+    return retval;
+  } else if (params->partition) {                      // show single partition
 
     if (params->partition > GetNumberOfEntries(&drive)) {
       Error("invalid partition number: %d\n", params->partition);
@@ -278,16 +495,16 @@ int CgptShow(CgptShowParams *params) {
     }
 
   } else if (params->quick) {                   // show all partitions, quickly
-    uint32_t i;
+    const uint16_t *used;
+    uint32_t num_used, u, i;
     GptEntry *entry;
     char type[GUID_STRLEN];
 
-    for (i = 0; i < GetNumberOfEntries(&drive); ++i) {
+    num_used = GetEntriesOfClass(&drive, ANY_VALID, ENTRY_CLASS_USED, &used);
+    for (u = 0; u < num_used; ++u) {
+      i = used[u];
       entry = GetEntry(&drive.gpt, ANY_VALID, i);
 
-      if (GuidIsZero(&entry->type))
-        continue;
-
       if (!params->numeric && CGPT_OK == ResolveType(&entry->type, type, GUID_STRLEN)) {
       } else {
         GuidToStr(&entry->type, type, GUID_STRLEN);
@@ -297,6 +514,8 @@ int CgptShow(CgptShowParams *params) {
              i+1, type);
     }
   } else {                              // show all partitions
+    uint32_t entries_sectors = GptEntriesSectors(GptEntriesBytes(&drive.gpt),
+                                                 drive.gpt.sector_bytes);
     GptEntry *entries;
 
     if (CGPT_OK != ReadPMBR(&drive)) {
@@ -329,7 +548,7 @@ int CgptShow(CgptShowParams *params) {
     }
 
     printf(GPT_FMT, (uint64_t)(GPT_PMBR_SECTOR + GPT_HEADER_SECTOR),
-           (uint64_t)GPT_ENTRIES_SECTORS,
+           (uint64_t)entries_sectors,
            drive.gpt.valid_entries & MASK_PRIMARY ? "" : "INVALID",
            "Pri GPT table");
 
@@ -339,8 +558,8 @@ int CgptShow(CgptShowParams *params) {
 
     /****************************** Secondary *************************/
     printf(GPT_FMT, (drive.gpt.drive_sectors - GPT_HEADER_SECTOR -
-                          GPT_ENTRIES_SECTORS),
-           (uint64_t)GPT_ENTRIES_SECTORS,
+                          entries_sectors),
+           (uint64_t)entries_sectors,
            drive.gpt.valid_entries & MASK_SECONDARY ? "" : "INVALID",
            "Sec GPT table");
     /* We show secondary table details if any of following is true.
@@ -352,7 +571,7 @@ int CgptShow(CgptShowParams *params) {
         ((drive.gpt.valid_entries & MASK_SECONDARY) &&
          (!(drive.gpt.valid_entries & MASK_PRIMARY) ||
           memcmp(drive.gpt.primary_entries, drive.gpt.secondary_entries,
-                 TOTAL_ENTRIES_SIZE)))) {
+                 GptEntriesBytes(&drive.gpt))))) {
       EntriesDetails(&drive, SECONDARY, params->numeric);
     }
 
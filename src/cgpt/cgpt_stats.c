@@ -0,0 +1,99 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Where a command spends its time and I/O, for CGPT_STATS.  Everything is
+// a no-op until StatsEnable(), and the counters are only ever added to, so
+// the scan threads can share them without a lock.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "cgpt.h"
+
+static int stats_enabled;
+static uint64_t stats_start;
+static uint64_t counters[STATS_COUNTERS];
+
+static const char *const counter_names[STATS_COUNTERS] = {
+  [STATS_SCAN_US] = "scan_us",
+  [STATS_OPEN_US] = "open_us",
+  [STATS_LOAD_US] = "load_us",
+  [STATS_CHECK_US] = "check_us",
+  [STATS_CLOSE_US] = "close_us",
+  [STATS_SYNC_US] = "sync_us",
+  [STATS_DEVICES_LISTED] = "devices_listed",
+  [STATS_DEVICES_PROBED] = "devices_probed",
+  [STATS_DRIVES_OPENED] = "drives_opened",
+  [STATS_BUFFERS_ALLOCATED] = "buffers_allocated",
+  [STATS_DRIVES_CACHED] = "drives_cached",
+  [STATS_GPTS_CACHED] = "gpts_cached",
+  [STATS_HEADER_CHECKS] = "header_checks",
+  [STATS_ENTRIES_CHECKS] = "entries_checks",
+  [STATS_ENTRIES_CHECKS_SKIPPED] = "entries_checks_skipped",
+  [STATS_OPEN_CALLS] = "open_calls",
+  [STATS_IOCTL_CALLS] = "ioctl_calls",
+  [STATS_READ_CALLS] = "read_calls",
+  [STATS_MMAP_CALLS] = "mmap_calls",
+  [STATS_WRITE_CALLS] = "write_calls",
+  [STATS_SYNC_CALLS] = "sync_calls",
+  [STATS_URING_CALLS] = "uring_calls",
+  [STATS_READ_PRIMARY] = "read_primary_bytes",
+  [STATS_READ_SECONDARY] = "read_secondary_bytes",
+  [STATS_READ_OTHER] = "read_other_bytes",
+  [STATS_MAPPED] = "mapped_bytes",
+  [STATS_WRITE_PMBR] = "write_pmbr_bytes",
+  [STATS_WRITE_PRIMARY] = "write_primary_bytes",
+  [STATS_WRITE_SECONDARY] = "write_secondary_bytes",
+};
+
+static uint64_t NowUs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void StatsEnable(void) {
+  stats_enabled = 1;
+  stats_start = NowUs();
+}
+
+uint64_t StatsClock(void) {
+  return stats_enabled ? NowUs() : 0;
+}
+
+void StatsAdd(int counter, uint64_t n) {
+  if (stats_enabled)
+    __atomic_fetch_add(&counters[counter], n, __ATOMIC_RELAXED);
+}
+
+void StatsAddTime(int counter, uint64_t start) {
+  if (start)
+    StatsAdd(counter, NowUs() - start);
+}
+
+void StatsAddChecks(const GptCheckStats *check) {
+  StatsAdd(STATS_HEADER_CHECKS, check->header_checks);
+  StatsAdd(STATS_ENTRIES_CHECKS, check->entries_checks);
+  StatsAdd(STATS_ENTRIES_CHECKS_SKIPPED, check->entries_checks_skipped);
+  // VbExGetTimer() counts microseconds too.
+  StatsAdd(STATS_CHECK_US,
+           check->header_check_time + check->entries_check_time);
+}
+
+void StatsPrint(FILE *fp) {
+  int i;
+
+  if (!stats_enabled)
+    return;
+  fprintf(fp, "stats=%s command=%s wall_us=%llu", progname,
+          command ? command : "none",
+          (unsigned long long)(NowUs() - stats_start));
+  for (i = 0; i < STATS_COUNTERS; i++) {
+    fprintf(fp, " %s=%llu", counter_names[i], (unsigned long long)
+            __atomic_load_n(&counters[i], __ATOMIC_RELAXED));
+  }
+  fputc('\n', fp);
+}
@@ -0,0 +1,280 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// The partition types cgpt knows by name: the built in ones below, then any
+// a site adds in CGPT_TYPES (default /etc/cgpt/types, none if empty), one
+// per line as
+//
+//   NAME GUID [DESCRIPTION]
+//
+// Both are hashed by GUID and by name the first time a type is looked up,
+// so resolving the type of every partition on every drive costs the same
+// however many types there are.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cgpt.h"
+#include "vboot_host.h"
+
+#define DEFAULT_TYPES_FILE "/etc/cgpt/types"
+
+struct type_info {
+  const Guid *type;
+  const char *name;
+  const char *description;
+};
+
+static const struct type_info supported_types[] = {
+  // ChromeOS (prefix-less names for backwards compatibility)
+  {&guid_chromeos_firmware, "firmware", "ChromeOS firmware"},
+  {&guid_chromeos_kernel, "kernel", "ChromeOS kernel"},
+  {&guid_chromeos_rootfs, "rootfs", "ChromeOS rootfs"},
+  {&guid_linux_data, "data", "Alias for linux-data"},
+  {&guid_mswin_data, "chromeos-data", "Alias for mswin-data"},
+  {&guid_chromeos_reserved, "reserved", "ChromeOS reserved"},
+
+  // MS Windows (data used to use this GUID instead of linux-data)
+  {&guid_mswin_data, "mswin-data", "MS Windows data"},
+
+  // GPT/UEFI standard types
+  {&guid_efi, "efi", "EFI System Partition"},
+  {&guid_bios, "bios", "BIOS Boot Partition"},
+  {&guid_unused, "unused", "Unused (nonexistent) partition"},
+
+  // General Linux
+  {&guid_linux_data, "linux-data", "Linux data"},
+  {&guid_linux_swap, "linux-swap", "Linux swap"},
+  {&guid_linux_boot, "linux-boot", "Linux /boot"},
+  {&guid_linux_home, "linux-home", "Linux /home"},
+  {&guid_linux_lvm, "linux-lvm", "Linux LVM"},
+  {&guid_linux_raid, "linux-raid", "Linux RAID"},
+  {&guid_linux_reserved, "linux-reserved", "Linux reserved"},
+
+  // CoreOS
+  {&guid_coreos_rootfs, "coreos-usr", "Alias for coreos-rootfs"},
+  {&guid_coreos_rootfs, "coreos-rootfs", "CoreOS rootfs"},
+  {&guid_coreos_resize, "coreos-resize", "CoreOS auto-resize"},
+  {&guid_coreos_reserved, "coreos-reserved", "CoreOS reserved"},
+  {&guid_coreos_root_raid, "coreos-root-raid", "CoreOS RAID containing root"},
+
+  // Flatcar
+  {&guid_flatcar_rootfs, "flatcar-usr", "Alias for flatcar-rootfs"},
+  {&guid_flatcar_rootfs, "flatcar-rootfs", "Flatcar Container Linux rootfs"},
+  {&guid_flatcar_resize, "flatcar-resize", "Flatcar Container Linux auto-resize"},
+  {&guid_flatcar_reserved, "flatcar-reserved", "Flatcar Container Linux reserved"},
+  {&guid_flatcar_root_raid, "flatcar-root-raid", "Flatcar Container Linux RAID containing root"},
+};
+
+static struct type_info *site_types;
+static uint32_t num_site_types;
+
+// Open addressing, each slot holding the index + 1 of the first type with
+// that GUID or name, so earlier types win just as a linear search would.
+static uint32_t *guid_slots;
+static uint32_t *name_slots;
+static uint32_t slots_mask;
+static pthread_once_t types_once = PTHREAD_ONCE_INIT;
+
+static const struct type_info *TypeAt(uint32_t i) {
+  if (i < ARRAY_COUNT(supported_types))
+    return &supported_types[i];
+  return &site_types[i - ARRAY_COUNT(supported_types)];
+}
+
+static uint32_t HashGuid(const Guid *type) {
+  uint64_t a, b;
+
+  // GUIDs are mostly random already, folding them is enough.
+  memcpy(&a, type->u.raw, sizeof(a));
+  memcpy(&b, type->u.raw + sizeof(a), sizeof(b));
+  a = (a ^ b) * 0x9e3779b97f4a7c15ULL;
+  return (uint32_t)(a >> 32);
+}
+
+static uint32_t HashName(const char *name) {
+  uint32_t h = 2166136261u;
+
+  while (*name) {
+    h ^= (uint8_t)*name++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void AddSiteType(const char *path, unsigned line, char *text) {
+  struct type_info *types;
+  char *name, *guid, *description;
+  Guid *type;
+
+  name = strtok(text, " \t\n");
+  if (!name || *name == '#')
+    return;
+  guid = strtok(NULL, " \t\n");
+  description = strtok(NULL, "\n");
+  while (description && (*description == ' ' || *description == '\t'))
+    description++;
+  if (!description || !*description)
+    description = name;
+
+  // StrToGuid() complains on stdout about anything but a GUID.
+  type = malloc(sizeof(*type));
+  if (!type || !guid || strlen(guid) != GUID_STRLEN - 1 ||
+      CGPT_OK != StrToGuid(guid, type)) {
+    fprintf(stderr, "WARNING: %s:%u: expected NAME GUID [DESCRIPTION]\n",
+            path, line);
+    free(type);
+    return;
+  }
+  types = realloc(site_types, (num_site_types + 1) * sizeof(*types));
+  if (!types) {
+    free(type);
+    return;
+  }
+  site_types = types;
+  name = strdup(name);
+  description = strdup(description);
+  if (!name || !description) {
+    free(name);
+    free(description);
+    free(type);
+    return;
+  }
+  site_types[num_site_types].type = type;
+  site_types[num_site_types].name = name;
+  site_types[num_site_types].description = description;
+  num_site_types++;
+}
+
+static void LoadSiteTypes(void) {
+  const char *path = getenv("CGPT_TYPES");
+  char *text = NULL;
+  size_t size = 0;
+  unsigned line = 0;
+  FILE *fp;
+
+  fp = fopen(path ? path : DEFAULT_TYPES_FILE, "r");
+  if (!fp) {
+    // Only a file asked for by name is missed.
+    if (path && *path)
+      fprintf(stderr, "WARNING: can't read partition types from %s\n", path);
+    return;
+  }
+  while (getline(&text, &size, fp) >= 0)
+    AddSiteType(path ? path : DEFAULT_TYPES_FILE, ++line, text);
+  free(text);
+  fclose(fp);
+}
+
+static void IndexTypes(void) {
+  uint32_t count, slots, i, h;
+
+  LoadSiteTypes();
+  count = ARRAY_COUNT(supported_types) + num_site_types;
+  for (slots = 16; slots < 2 * count; slots *= 2)
+    ;
+  guid_slots = calloc(slots, sizeof(*guid_slots));
+  name_slots = calloc(slots, sizeof(*name_slots));
+  if (!guid_slots || !name_slots) {
+    // Leaves every lookup failing rather than crashing.
+    free(guid_slots);
+    free(name_slots);
+    guid_slots = name_slots = NULL;
+    return;
+  }
+  slots_mask = slots - 1;
+
+  for (i = 0; i < count; i++) {
+    const struct type_info *t = TypeAt(i);
+
+    for (h = HashGuid(t->type) & slots_mask; guid_slots[h];
+         h = (h + 1) & slots_mask) {
+      if (!memcmp(TypeAt(guid_slots[h] - 1)->type, t->type, sizeof(Guid)))
+        break;
+    }
+    if (!guid_slots[h])
+      guid_slots[h] = i + 1;
+
+    for (h = HashName(t->name) & slots_mask; name_slots[h];
+         h = (h + 1) & slots_mask) {
+      if (!strcmp(TypeAt(name_slots[h] - 1)->name, t->name))
+        break;
+    }
+    if (!name_slots[h])
+      name_slots[h] = i + 1;
+    else if (i >= ARRAY_COUNT(supported_types))
+      fprintf(stderr, "WARNING: partition type %s is already defined\n",
+              t->name);
+  }
+}
+
+static const struct type_info *FindGuid(const Guid *type) {
+  uint32_t h;
+
+  pthread_once(&types_once, IndexTypes);
+  if (!guid_slots)
+    return NULL;
+  for (h = HashGuid(type) & slots_mask; guid_slots[h];
+       h = (h + 1) & slots_mask) {
+    const struct type_info *t = TypeAt(guid_slots[h] - 1);
+
+    if (!memcmp(t->type, type, sizeof(Guid)))
+      return t;
+  }
+  return NULL;
+}
+
+static const struct type_info *FindName(const char *name) {
+  uint32_t h;
+
+  pthread_once(&types_once, IndexTypes);
+  if (!name_slots)
+    return NULL;
+  for (h = HashName(name) & slots_mask; name_slots[h];
+       h = (h + 1) & slots_mask) {
+    const struct type_info *t = TypeAt(name_slots[h] - 1);
+
+    if (!strcmp(t->name, name))
+      return t;
+  }
+  return NULL;
+}
+
+/* Resolves human-readable GPT type.
+ * Returns CGPT_OK if found.
+ * Returns CGPT_FAILED if no known type found. */
+int ResolveType(const Guid *type, char *buf, size_t len) {
+  const struct type_info *t = FindGuid(type);
+
+  if (!t)
+    return CGPT_FAILED;
+  strncpy(buf, t->description, len);
+  if (len > 0) {
+    buf[len-1] = '\0';
+  }
+  return CGPT_OK;
+}
+
+int SupportedType(const char *name, Guid *type) {
+  const struct type_info *t = FindName(name);
+
+  if (!t)
+    return CGPT_FAILED;
+  memcpy(type, t->type, sizeof(Guid));
+  return CGPT_OK;
+}
+
+void PrintTypes(void) {
+  uint32_t i;
+
+  pthread_once(&types_once, IndexTypes);
+  printf("The partition type may also be given as one of these aliases:\n\n");
+  for (i = 0; i < ARRAY_COUNT(supported_types) + num_site_types; ++i) {
+    printf("    %-16s  %s\n", TypeAt(i)->name, TypeAt(i)->description);
+  }
+  printf("\n");
+}
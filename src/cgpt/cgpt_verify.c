@@ -0,0 +1,414 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Checking the data of a partition against the SHA-256 of each of its
+// blocks, given by a manifest or summed up by the root hash of a dm-verity
+// tree.  The partition is read in large aligned stripes from a pool of
+// threads, each hashing the blocks of the stripes it read.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cgpt.h"
+#include "cgptlib_internal.h"
+#include "vboot_host.h"
+
+#define DEFAULT_BLOCK_BYTES 4096
+// Read at once, and what a thread takes on at a time.
+#define STRIPE_BYTES (4 * 1024 * 1024)
+// Stripe buffers kept for reuse rather than freed.
+#define MAX_SPARE_BUFFERS 16
+
+// The partition found, in bytes.
+struct verify_part {
+  char *drive_name;
+  int partnum;
+  uint64_t offset;
+  uint64_t size;
+  int failed;                   // a match couldn't be kept
+};
+
+struct verify_job {
+  const char *drive_name;
+  int partnum;
+  int fd;
+  uint64_t offset;              // of the first block on the drive
+  uint64_t num_blocks;
+  uint32_t block_bytes;
+  uint32_t stripe_blocks;
+  const uint8_t *salt;
+  uint32_t salt_len;
+  const uint8_t *expected;      // digests from the manifest, or
+  uint8_t *digests;             // room for the leaves of the tree
+  uint64_t first_bad;           // lowest mismatching block, atomically
+  int failed;                   // set by any thread, atomically
+  pthread_mutex_t lock;         // for the spare buffers
+  uint8_t *spare[MAX_SPARE_BUFFERS];
+  int num_spare;
+};
+
+// Collects the matches CgptFind() reports; only one may be verified.
+static void CollectMatch(void *ctx, const char *drive_name, int partnum,
+                         const GptEntry *entry) {
+  struct verify_part *part = ctx;
+
+  if (part->drive_name) {
+    part->partnum = -1;         // more than one
+    return;
+  }
+  part->drive_name = strdup(drive_name);
+  if (!part->drive_name) {
+    Error("unable to allocate memory for matches\n");
+    part->failed = 1;
+    return;
+  }
+  part->partnum = partnum;
+  // In sectors for now, FindPart() knows their size.
+  part->offset = entry->starting_lba;
+  part->size = entry->ending_lba - entry->starting_lba + 1;
+}
+
+static int FindPart(CgptVerifyParams *params, struct verify_part *part) {
+  CgptFindParams find;
+  struct drive drive;
+  uint32_t sector_bytes;
+
+  memset(&find, 0, sizeof(find));
+  find.drive_name = params->drive_name;
+  find.set_unique = params->set_unique;
+  find.set_type = params->set_type;
+  find.set_label = params->set_label;
+  memcpy(&find.unique_guid, &params->unique_guid, sizeof(Guid));
+  memcpy(&find.type_guid, &params->type_guid, sizeof(Guid));
+  find.label = params->label;
+  find.match_fn = CollectMatch;
+  find.match_ctx = part;
+  CgptFind(&find);
+  if (part->failed)
+    return CGPT_FAILED;
+
+  if (!part->drive_name) {
+    Error("no matching partition\n");
+    return CGPT_FAILED;
+  }
+  if (part->partnum < 0) {
+    Error("more than one partition matches\n");
+    return CGPT_FAILED;
+  }
+
+  if (CGPT_OK != DriveOpen(part->drive_name, &drive, 0, O_RDONLY, 0))
+    return CGPT_FAILED;
+  sector_bytes = drive.gpt.sector_bytes;
+  part->offset *= sector_bytes;
+  part->size *= sector_bytes;
+  if (part->offset + part->size > drive.size) {
+    Error("partition %d runs past the end of %s\n", part->partnum,
+          part->drive_name);
+    (void) DriveClose(&drive, 0);
+    return CGPT_FAILED;
+  }
+  (void) DriveClose(&drive, 0);
+  return CGPT_OK;
+}
+
+// Reads a manifest of a hex SHA-256 per line, anything after it ignored as
+// in what sha256sum prints.  Returns the digests, to be freed, or NULL.
+static uint8_t *LoadManifest(const char *path, uint64_t *count) {
+  uint8_t *digests = NULL, *more;
+  uint64_t n = 0, room = 0;
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  FILE *fp;
+
+  fp = fopen(path, "r");
+  if (!fp) {
+    Error("Can't open %s: %s\n", path, strerror(errno));
+    return NULL;
+  }
+  while ((len = getline(&line, &line_size, fp)) >= 0) {
+    if (n == room) {
+      room = room ? 2 * room : 1024;
+      more = realloc(digests, room * SHA256_DIGEST_SIZE);
+      if (!more) {
+        Error("unable to allocate memory for %s\n", path);
+        free(digests);
+        digests = NULL;
+        break;
+      }
+      digests = more;
+    }
+    if (len < 2 * SHA256_DIGEST_SIZE ||
+        CGPT_OK != HexToBytes(line, digests + n * SHA256_DIGEST_SIZE,
+                              SHA256_DIGEST_SIZE) ||
+        (len > 2 * SHA256_DIGEST_SIZE &&
+         !strchr(" \t\r\n", line[2 * SHA256_DIGEST_SIZE]))) {
+      Error("%s:%" PRIu64 ": not a SHA-256 digest\n", path, n + 1);
+      free(digests);
+      digests = NULL;
+      break;
+    }
+    n++;
+  }
+  free(line);
+  fclose(fp);
+  *count = n;
+  return digests;
+}
+
+static void HashBlock(struct verify_job *job, const uint8_t *block,
+                      uint8_t digest[SHA256_DIGEST_SIZE]) {
+  struct sha256_ctx ctx;
+
+  Sha256Init(&ctx);
+  if (job->salt_len)
+    Sha256Update(&ctx, job->salt, job->salt_len);
+  Sha256Update(&ctx, block, job->block_bytes);
+  Sha256Final(&ctx, digest);
+}
+
+static uint8_t *TakeBuffer(struct verify_job *job) {
+  uint8_t *buf = NULL;
+
+  pthread_mutex_lock(&job->lock);
+  if (job->num_spare)
+    buf = job->spare[--job->num_spare];
+  pthread_mutex_unlock(&job->lock);
+  // Aligned for O_DIRECT.
+  if (!buf && posix_memalign((void **)&buf, GPT_MAX_SECTOR_BYTES,
+                             (size_t)job->stripe_blocks * job->block_bytes))
+    return NULL;
+  return buf;
+}
+
+static void GiveBuffer(struct verify_job *job, uint8_t *buf) {
+  pthread_mutex_lock(&job->lock);
+  if (job->num_spare < MAX_SPARE_BUFFERS) {
+    job->spare[job->num_spare++] = buf;
+    buf = NULL;
+  }
+  pthread_mutex_unlock(&job->lock);
+  free(buf);
+}
+
+static void NoteMismatch(struct verify_job *job, uint64_t block) {
+  uint64_t bad = __atomic_load_n(&job->first_bad, __ATOMIC_RELAXED);
+
+  while (block < bad &&
+         !__atomic_compare_exchange_n(&job->first_bad, &bad, block, 0,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static int ReadFull(struct verify_job *job, uint8_t *buf, uint64_t offset,
+                    size_t count) {
+  ssize_t n;
+
+  while (count) {
+    n = pread(job->fd, buf, count, offset);
+    StatsAdd(STATS_READ_CALLS, 1);
+    if (n <= 0) {
+      Error("Can't read %s: %s\n", job->drive_name,
+            n ? strerror(errno) : "unexpected end of file");
+      return CGPT_FAILED;
+    }
+    StatsAdd(STATS_READ_OTHER, n);
+    buf += n;
+    offset += n;
+    count -= n;
+  }
+  return CGPT_OK;
+}
+
+static void VerifyStripe(void *arg, int stripe) {
+  struct verify_job *job = arg;
+  uint64_t first = (uint64_t)stripe * job->stripe_blocks;
+  uint64_t count = job->num_blocks - first;
+  uint8_t digest[SHA256_DIGEST_SIZE], *out, *buf;
+  uint64_t b;
+
+  // Past a mismatch already found there is nothing left to learn.
+  if (first >= __atomic_load_n(&job->first_bad, __ATOMIC_RELAXED) ||
+      __atomic_load_n(&job->failed, __ATOMIC_RELAXED))
+    return;
+  if (count > job->stripe_blocks)
+    count = job->stripe_blocks;
+
+  buf = TakeBuffer(job);
+  if (!buf) {
+    Error("unable to allocate memory for blocks\n");
+    __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  if (CGPT_OK != ReadFull(job, buf, job->offset + first * job->block_bytes,
+                          count * job->block_bytes)) {
+    __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    goto done;
+  }
+  for (b = 0; b < count; b++) {
+    out = job->digests ? job->digests + (first + b) * SHA256_DIGEST_SIZE :
+                         digest;
+    HashBlock(job, buf + b * job->block_bytes, out);
+    if (job->expected &&
+        memcmp(out, job->expected + (first + b) * SHA256_DIGEST_SIZE,
+               SHA256_DIGEST_SIZE)) {
+      NoteMismatch(job, first + b);
+      break;
+    }
+  }
+
+done:
+  GiveBuffer(job, buf);
+}
+
+// Hashes the digests of one level of a dm-verity tree into those of the
+// next, in place: as many as fit go into each zero padded hash block,
+// which is hashed like a data block.  Returns how many are left.
+static uint64_t HashLevel(struct verify_job *job, uint8_t *digests,
+                          uint64_t count, uint8_t *block) {
+  uint64_t per_block = job->block_bytes / SHA256_DIGEST_SIZE;
+  uint64_t n = (count + per_block - 1) / per_block;
+  uint64_t i, m;
+
+  for (i = 0; i < n; i++) {
+    m = count - i * per_block;
+    if (m > per_block)
+      m = per_block;
+    memset(block, 0, job->block_bytes);
+    memcpy(block, digests + i * per_block * SHA256_DIGEST_SIZE,
+           m * SHA256_DIGEST_SIZE);
+    HashBlock(job, block, digests + i * SHA256_DIGEST_SIZE);
+  }
+  return n;
+}
+
+int CgptVerify(CgptVerifyParams *params) {
+  struct verify_part part;
+  struct verify_job job;
+  uint8_t *manifest = NULL, *block = NULL;
+  uint64_t num_digests = 0, count, num_stripes;
+  int i, r = CGPT_FAILED;
+
+  if (params == NULL)
+    return CGPT_FAILED;
+
+  memset(&part, 0, sizeof(part));
+  memset(&job, 0, sizeof(job));
+  job.fd = -1;
+  job.first_bad = UINT64_MAX;
+  job.block_bytes = params->block_bytes ? params->block_bytes :
+                                          DEFAULT_BLOCK_BYTES;
+  job.salt = params->salt;
+  job.salt_len = params->salt_len;
+  pthread_mutex_init(&job.lock, NULL);
+
+  if (!params->manifest == !params->set_root_hash) {
+    Error("either a manifest or a root hash is required\n");
+    goto done;
+  }
+  // Hash blocks have to hold a whole number of digests.
+  if (job.block_bytes < GPT_MIN_SECTOR_BYTES ||
+      job.block_bytes > STRIPE_BYTES ||
+      (job.block_bytes & (job.block_bytes - 1))) {
+    Error("block size must be a power of 2 from %d to %d\n",
+          GPT_MIN_SECTOR_BYTES, STRIPE_BYTES);
+    goto done;
+  }
+
+  if (CGPT_OK != FindPart(params, &part))
+    goto done;
+  job.drive_name = part.drive_name;
+  job.partnum = part.partnum;
+  job.offset = part.offset;
+  count = params->data_bytes ? params->data_bytes : part.size;
+  if (count > part.size || count % job.block_bytes) {
+    Error("%" PRIu64 " bytes aren't whole blocks of partition %d of %s\n",
+          count, part.partnum, part.drive_name);
+    goto done;
+  }
+  job.num_blocks = count / job.block_bytes;
+  if (!job.num_blocks) {
+    Error("nothing to verify\n");
+    goto done;
+  }
+
+  if (params->manifest) {
+    manifest = LoadManifest(params->manifest, &num_digests);
+    if (!manifest)
+      goto done;
+    if (num_digests != job.num_blocks) {
+      Error("%s has %" PRIu64 " digests for %" PRIu64 " blocks\n",
+            params->manifest, num_digests, job.num_blocks);
+      goto done;
+    }
+    job.expected = manifest;
+  } else {
+    job.digests = malloc(job.num_blocks * SHA256_DIGEST_SIZE);
+    block = malloc(job.block_bytes);
+    if (!job.digests || !block) {
+      Error("unable to allocate memory for the hash tree\n");
+      goto done;
+    }
+  }
+
+  // Stay out of the page cache where the alignment allows.
+  if (!(job.offset % GPT_MAX_SECTOR_BYTES) &&
+      !(job.block_bytes % GPT_MAX_SECTOR_BYTES))
+    job.fd = open(part.drive_name, O_RDONLY | O_DIRECT | O_CLOEXEC);
+  if (job.fd < 0)
+    job.fd = open(part.drive_name, O_RDONLY | O_CLOEXEC);
+  StatsAdd(STATS_OPEN_CALLS, 1);
+  if (job.fd < 0) {
+    Error("Can't open %s: %s\n", part.drive_name, strerror(errno));
+    goto done;
+  }
+
+  job.stripe_blocks = STRIPE_BYTES / job.block_bytes;
+  num_stripes = (job.num_blocks + job.stripe_blocks - 1) / job.stripe_blocks;
+  if (num_stripes > INT32_MAX) {
+    Error("partition too large\n");
+    goto done;
+  }
+  ParallelFor(num_stripes, VerifyStripe, &job);
+  if (job.failed)
+    goto done;
+
+  if (job.first_bad != UINT64_MAX) {
+    Error("block %" PRIu64 " of partition %d of %s doesn't match\n",
+          job.first_bad, part.partnum, part.drive_name);
+    goto done;
+  }
+  if (params->set_root_hash) {
+    // Over a single data block there is no tree, its hash is the root.
+    for (count = job.num_blocks; count > 1; )
+      count = HashLevel(&job, job.digests, count, block);
+    if (memcmp(job.digests, params->root_hash, SHA256_DIGEST_SIZE)) {
+      Error("partition %d of %s doesn't match the root hash\n",
+            part.partnum, part.drive_name);
+      goto done;
+    }
+  }
+
+  if (params->verbose)
+    printf("%s partition %d: %" PRIu64 " blocks verified\n",
+           part.drive_name, part.partnum, job.num_blocks);
+  r = CGPT_OK;
+
+done:
+  if (job.fd >= 0)
+    close(job.fd);
+  for (i = 0; i < job.num_spare; i++)
+    free(job.spare[i]);
+  pthread_mutex_destroy(&job.lock);
+  free(job.digests);
+  free(block);
+  free(manifest);
+  free(part.drive_name);
+  return r;
+}
@@ -25,9 +25,16 @@ static void Usage(void)
          "  -T NUM       set Tries flag (0-15)\n"
          "  -P NUM       set Priority flag (0-15)\n"
          "  -A NUM       set raw 64-bit attribute value\n"
+         "  -a NUM       Align the beginning of new partitions to NUM sectors\n"
+         "               (default 1 MiB or the device's optimal I/O size)\n"
+         "  -F FIT       Place new partitions in the first or best fitting\n"
+         "               free space (first|best, default first)\n"
+         "  -D MODE      Discard or zero the sectors the partition gains\n"
+         "               (discard|zero); image files get a hole either way\n"
          "\n"
          "Use the -i option to modify an existing partition.\n"
-         "The -b, -s, and -t options must be given for new partitions.\n"
+         "The -t option must be given for new partitions. Without -b they\n"
+         "are placed in free space, filling the largest gap without -s.\n"
          "\n", progname);
   PrintTypes();
 }
@@ -43,7 +50,7 @@ int cmd_add(int argc, char *argv[]) {
   char *e = 0;
 
   opterr = 0;                     // quiet, you
-  while ((c=getopt(argc, argv, ":hi:b:s:t:u:l:B:S:T:P:A:")) != -1)
+  while ((c=getopt(argc, argv, ":hi:b:s:t:u:l:B:S:T:P:A:a:F:D:")) != -1)
   {
     switch (c)
     {
@@ -153,6 +160,26 @@ int cmd_add(int argc, char *argv[]) {
         errorcnt++;
       }
       break;
+    case 'a':
+      params.align = strtoull(optarg, &e, 0);
+      if (!*optarg || (e && *e) || !params.align)
+      {
+        Error("invalid argument to -%c: \"%s\"\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 'F':
+      if (CGPT_OK != ParseExtentFit(optarg, &params.fit)) {
+        Error("invalid argument to -%c: %s\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 'D':
+      if (CGPT_OK != DriveParseProvision(optarg, &params.provision)) {
+        Error("invalid argument to -%c: %s\n", c, optarg);
+        errorcnt++;
+      }
+      break;
 
     case 'h':
       Usage();
@@ -0,0 +1,214 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Applying a list of edits to one drive, written out together.
+
+#include <errno.h>
+#include <getopt.h>
+#include <string.h>
+
+#include "blkid_utils.h"
+#include "cgpt.h"
+#include "vboot_host.h"
+
+// The commands that only work on the drive they're given.
+static const struct {
+  const char *name;
+  int (*fp)(int argc, char *argv[]);
+} batch_cmds[] = {
+  {"create", cmd_create},
+  {"add", cmd_add},
+  {"show", cmd_show},
+  {"repair", cmd_repair},
+  {"boot", cmd_boot},
+  {"prioritize", cmd_prioritize},
+  {"legacy", cmd_legacy},
+};
+
+#define MAX_BATCH_ARGS 64
+
+static void Usage(void)
+{
+  int i;
+
+  printf("\nUsage: %s batch [OPTIONS] DRIVE\n\n"
+         "Run a list of commands against DRIVE and write the result once.\n"
+         "Each line is a command and its options, without the drive, e.g.\n"
+         "\"add -i 1 -t data -l 'my data'\". Blank lines and lines starting\n"
+         "with # are skipped. If any command fails, nothing is written.\n"
+         "Commands:", progname);
+  for (i = 0; i < sizeof(batch_cmds)/sizeof(batch_cmds[0]); ++i)
+    printf(" %s", batch_cmds[i].name);
+  printf("\n\n"
+         "Options:\n"
+         "  -f FILE      Read the commands from FILE instead of stdin\n"
+         "\n");
+}
+
+// Splits line into argv in place, honouring quotes and backslashes like
+// the shell does. Returns the number of arguments, or -1 on error.
+static int SplitLine(char *line, char *argv[], int max_args) {
+  char *in = line, *out = line;
+  int argc = 0;
+
+  for (;;) {
+    char quote = 0;
+
+    while (*in == ' ' || *in == '\t' || *in == '\n' || *in == '\r')
+      in++;
+    if (!*in)
+      break;
+    if (argc == max_args - 1) {
+      Error("too many arguments\n");
+      return -1;
+    }
+    argv[argc++] = out;
+    for (; *in; in++) {
+      if (quote) {
+        if (*in == quote)
+          quote = 0;
+        else if (*in == '\\' && quote == '"' && in[1])
+          *out++ = *++in;
+        else
+          *out++ = *in;
+      } else if (*in == '\'' || *in == '"') {
+        quote = *in;
+      } else if (*in == '\\' && in[1]) {
+        *out++ = *++in;
+      } else if (*in == ' ' || *in == '\t' || *in == '\n' || *in == '\r') {
+        break;
+      } else {
+        *out++ = *in;
+      }
+    }
+    if (quote) {
+      Error("unterminated quote\n");
+      return -1;
+    }
+    if (*in)
+      in++;
+    *out++ = '\0';
+  }
+  argv[argc] = NULL;
+  return argc;
+}
+
+// Runs one line of the batch. Returns CGPT_OK for blank lines.
+static int RunLine(char *line, char *drive_name) {
+  char *argv[MAX_BATCH_ARGS + 1];
+  const char *batch_command = command;
+  int argc, i, r;
+
+  argc = SplitLine(line, argv, MAX_BATCH_ARGS);
+  if (argc < 0)
+    return CGPT_FAILED;
+  if (!argc || argv[0][0] == '#')
+    return CGPT_OK;
+
+  for (i = 0; i < sizeof(batch_cmds)/sizeof(batch_cmds[0]); ++i)
+    if (!strcmp(batch_cmds[i].name, argv[0]))
+      break;
+  if (i == sizeof(batch_cmds)/sizeof(batch_cmds[0])) {
+    Error("unknown or unsupported command: %s\n", argv[0]);
+    return CGPT_FAILED;
+  }
+
+  argv[argc++] = drive_name;
+  argv[argc] = NULL;
+
+  command = batch_cmds[i].name;
+  optind = 0;                     // start over, including getopt's state
+  r = batch_cmds[i].fp(argc, argv);
+  command = batch_command;
+  return r;
+}
+
+int cmd_batch(int argc, char *argv[]) {
+  char *drive_name = NULL;
+  const char *file_name = NULL;
+  FILE *input = stdin;
+  char *line = NULL;
+  size_t line_size = 0;
+  uint32_t partition = 0;
+  int lineno = 0;
+  int c;
+  int errorcnt = 0;
+  int r = CGPT_FAILED;
+
+  opterr = 0;                     // quiet, you
+  while ((c=getopt(argc, argv, ":hf:")) != -1)
+  {
+    switch (c)
+    {
+    case 'f':
+      file_name = optarg;
+      break;
+
+    case 'h':
+      Usage();
+      return CGPT_OK;
+    case '?':
+      Error("unrecognized option: -%c\n", optopt);
+      errorcnt++;
+      break;
+    case ':':
+      Error("missing argument to -%c\n", optopt);
+      errorcnt++;
+      break;
+    default:
+      errorcnt++;
+      break;
+    }
+  }
+  if (errorcnt)
+  {
+    Usage();
+    return CGPT_FAILED;
+  }
+
+  if (optind >= argc)
+  {
+    Error("missing drive argument\n");
+    return CGPT_FAILED;
+  }
+
+  drive_name = strdup(argv[optind]);
+
+  if (CGPT_OK != translate_partition_dev(&drive_name, &partition))
+    goto out;
+
+  if (file_name && strcmp(file_name, "-")) {
+    input = fopen(file_name, "r");
+    if (!input) {
+      Error("Can't open %s: %s\n", file_name, strerror(errno));
+      goto out;
+    }
+  }
+
+  if (CGPT_OK != DriveBatchBegin(drive_name))
+    goto out;
+
+  while (getline(&line, &line_size, input) != -1) {
+    lineno++;
+    if (CGPT_OK != RunLine(line, drive_name)) {
+      Error("line %d failed, %s left unchanged\n", lineno, drive_name);
+      DriveBatchAbort();
+      goto out;
+    }
+  }
+  if (ferror(input)) {
+    Error("Can't read commands: %s\n", strerror(errno));
+    DriveBatchAbort();
+    goto out;
+  }
+
+  r = DriveBatchCommit();
+
+out:
+  if (input && input != stdin)
+    fclose(input);
+  free(line);
+  free(drive_name);
+  return r;
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <getopt.h>
+#include <string.h>
+
+#include "cgpt.h"
+#include "vboot_host.h"
+
+static void Usage(void)
+{
+  printf("\nUsage: %s copy [OPTIONS] SRC_DRIVE DST_DRIVE\n\n"
+         "Copy the data of a partition of SRC_DRIVE to a partition of\n"
+         "DST_DRIVE, which may be the same drive. The destination must be\n"
+         "at least as large; anything past the size of the source is left\n"
+         "alone. Image files on a filesystem that supports reflinks share\n"
+         "the data, otherwise only the parts of the source holding data are\n"
+         "copied and its holes stay holes where the destination allows.\n\n"
+         "Options:\n"
+         "  -i NUM       Source partition number (required)\n"
+         "  -j NUM       Destination partition number, default the same\n"
+         "  -v           Say how much was copied\n"
+         "\n", progname);
+}
+
+int cmd_copy(int argc, char *argv[]) {
+  CgptCopyParams params;
+  memset(&params, 0, sizeof(params));
+
+  int c;
+  int errorcnt = 0;
+  char *e = 0;
+
+  opterr = 0;                     // quiet, you
+  while ((c=getopt(argc, argv, ":hi:j:v")) != -1)
+  {
+    switch (c)
+    {
+    case 'i':
+      params.src_partition = (uint32_t)strtoul(optarg, &e, 0);
+      if (!*optarg || (e && *e))
+      {
+        Error("invalid argument to -%c: \"%s\"\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 'j':
+      params.dst_partition = (uint32_t)strtoul(optarg, &e, 0);
+      if (!*optarg || (e && *e))
+      {
+        Error("invalid argument to -%c: \"%s\"\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 'v':
+      params.verbose++;
+      break;
+
+    case 'h':
+      Usage();
+      return CGPT_OK;
+    case '?':
+      Error("unrecognized option: -%c\n", optopt);
+      errorcnt++;
+      break;
+    case ':':
+      Error("missing argument to -%c\n", optopt);
+      errorcnt++;
+      break;
+    default:
+      errorcnt++;
+      break;
+    }
+  }
+  if (!params.src_partition)
+  {
+    Error("source partition (-i) is required\n");
+    errorcnt++;
+  }
+  if (errorcnt)
+  {
+    Usage();
+    return CGPT_FAILED;
+  }
+
+  if (optind + 2 != argc)
+  {
+    Usage();
+    return CGPT_FAILED;
+  }
+
+  params.src_drive_name = argv[optind];
+  params.dst_drive_name = argv[optind + 1];
+
+  return CgptCopy(&params);
+}
@@ -15,8 +15,12 @@ static void Usage(void)
          "Options:\n"
          "  -c           Create disk image file if needed. Requires -s\n"
          "  -s NUM       Minimum disk sectors, extends image files\n"
+         "  -b BYTES     Sector size of image files, 512 (default) or 4096\n"
+         "  -n NUM       Number of partition entries, 128 (default) to 1024\n"
          "  -z           Zero the sectors of the GPT table and entries\n"
          "  -g GUID      The desired disk GUID\n"
+         "  -D MODE      Discard or zero the area left for partitions\n"
+         "               (discard|zero); image files get a hole either way\n"
          "\n", progname);
 }
 
@@ -29,7 +33,7 @@ int cmd_create(int argc, char *argv[]) {
   char *e = 0;
 
   opterr = 0;                     // quiet, you
-  while ((c=getopt(argc, argv, ":hcs:zg:")) != -1)
+  while ((c=getopt(argc, argv, ":hcs:b:n:zg:D:")) != -1)
   {
     switch (c)
     {
@@ -46,9 +50,31 @@ int cmd_create(int argc, char *argv[]) {
         errorcnt++;
       }
       break;
+    case 'b':
+      params.sector_bytes = strtoul(optarg, &e, 0);
+      if (!*optarg || (e && *e) ||
+          (params.sector_bytes != 512 && params.sector_bytes != 4096)) {
+        Error("invalid argument to -%c: \"%s\"\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 'n':
+      params.num_entries = strtoul(optarg, &e, 0);
+      if (!*optarg || (e && *e) || params.num_entries < 128 ||
+          params.num_entries > GPT_MAX_TABLE_ENTRIES) {
+        Error("invalid argument to -%c: \"%s\"\n", c, optarg);
+        errorcnt++;
+      }
+      break;
     case 'g':
       params.drive_guid = optarg;
       break;
+    case 'D':
+      if (CGPT_OK != DriveParseProvision(optarg, &params.provision)) {
+        Error("invalid argument to -%c: %s\n", c, optarg);
+        errorcnt++;
+      }
+      break;
 
     case 'h':
       Usage();
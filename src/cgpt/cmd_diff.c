@@ -0,0 +1,98 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <getopt.h>
+#include <string.h>
+
+#include "cgpt.h"
+#include "vboot_host.h"
+
+static void Usage(void)
+{
+  printf("\nUsage: %s diff [OPTIONS] OLD_DRIVE NEW_DRIVE\n\n"
+         "List the parts of the partitions of NEW_DRIVE that differ from\n"
+         "the same partitions of OLD_DRIVE, one \"PARTITION OFFSET LENGTH\"\n"
+         "line per changed extent, in bytes from the start of the partition\n"
+         "of NEW_DRIVE. Partitions are paired up by label or type, in order.\n"
+         "Whatever a partition has past the end of its old one has changed.\n\n"
+         "Options:\n"
+         "  -l LABEL     Compare the partitions labeled LABEL\n"
+         "  -t GUID      Compare the partitions of type GUID\n"
+         "  -c BYTES     Compare BYTES at a time, a multiple of 512\n"
+         "               (default 1 MiB); extents are made of these\n"
+         "\n", progname);
+  PrintTypes();
+}
+
+int cmd_diff(int argc, char *argv[]) {
+  CgptDiffParams params;
+  memset(&params, 0, sizeof(params));
+
+  int c;
+  int errorcnt = 0;
+  char *e = 0;
+
+  opterr = 0;                     // quiet, you
+  while ((c=getopt(argc, argv, ":hl:t:c:")) != -1)
+  {
+    switch (c)
+    {
+    case 'l':
+      params.label = optarg;
+      break;
+    case 't':
+      params.set_type = 1;
+      if (CGPT_OK != SupportedType(optarg, &params.type_guid) &&
+          CGPT_OK != StrToGuid(optarg, &params.type_guid)) {
+        Error("invalid argument to -%c: %s\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 'c':
+      params.chunk_bytes = strtoull(optarg, &e, 0);
+      if (!*optarg || (e && *e) || !params.chunk_bytes ||
+          params.chunk_bytes % 512) {
+        Error("invalid argument to -%c: \"%s\"\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+
+    case 'h':
+      Usage();
+      return CGPT_OK;
+    case '?':
+      Error("unrecognized option: -%c\n", optopt);
+      errorcnt++;
+      break;
+    case ':':
+      Error("missing argument to -%c\n", optopt);
+      errorcnt++;
+      break;
+    default:
+      errorcnt++;
+      break;
+    }
+  }
+  if (!params.label && !params.set_type)
+  {
+    Error("a label (-l) or type (-t) is required\n");
+    errorcnt++;
+  }
+  if (errorcnt)
+  {
+    Usage();
+    return CGPT_FAILED;
+  }
+
+  if (optind + 2 != argc)
+  {
+    Usage();
+    return CGPT_FAILED;
+  }
+
+  params.old_drive_name = argv[optind];
+  params.new_drive_name = argv[optind + 1];
+
+  return CgptDiff(&params);
+}
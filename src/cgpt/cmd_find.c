@@ -2,8 +2,13 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <math.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "cgpt.h"
 #include "vboot_host.h"
@@ -20,21 +25,42 @@ static void Usage(void)
          "  -v           Be verbose in displaying matches (repeatable)\n"
          "  -n           Numeric output only\n"
          "  -1           Fail if more than one match is found\n"
+         "  -F, --first  Stop at the first match, checking the disk holding\n"
+         "               the root filesystem before the others\n"
+         "  --wait[=SECS]\n"
+         "               With no DRIVE, wait for a match to show up, for at\n"
+         "               most SECS seconds, searching disks as the kernel\n"
+         "               announces them\n"
          "  -M FILE"
          "      Matching partition data must also contain FILE content\n"
+         "               (repeatable, all of them must match)\n"
          "  -O NUM"
          "       Byte offset into partition to match content (default 0)\n"
+         "               of the -M before it, or the next one if none yet\n"
          "\n", progname);
   PrintTypes();
 }
 
 // read a file into a buffer, return buffer and update size
 static uint8_t *ReadFile(const char *filename, uint64_t *size) {
+  struct stat st;
   FILE *f;
   uint8_t *buf;
+  int fd;
 
-  f = fopen(filename, "rb");
+  // Not waiting for a writer on a FIFO; nothing but files and disks can be
+  // sized up front anyway.
+  fd = open(filename, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0 || !(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))) {
+    close(fd);
+    return NULL;
+  }
+  f = fdopen(fd, "rb");
   if (!f) {
+    close(fd);
     return NULL;
   }
 
@@ -67,9 +93,18 @@ int cmd_find(int argc, char *argv[]) {
   int errorcnt = 0;
   char *e = 0;
   int c;
+  uint64_t offset = 0;
+  double secs;
+
+  static const struct option long_options[] = {
+    { "first", no_argument, NULL, 'F' },
+    { "wait", optional_argument, NULL, 'w' },
+    { NULL, 0, NULL, 0 },
+  };
 
   opterr = 0;                     // quiet, you
-  while ((c=getopt(argc, argv, ":hv1nt:u:l:M:O:")) != -1)
+  while ((c=getopt_long(argc, argv, ":hv1Fnt:u:l:M:O:",
+                        long_options, NULL)) != -1)
   {
     switch (c)
     {
@@ -82,6 +117,23 @@ int cmd_find(int argc, char *argv[]) {
     case '1':
       params.oneonly = 1;
       break;
+    case 'F':
+      params.first = 1;
+      break;
+    case 'w':
+      params.wait = 1;
+      params.wait_ms = -1;
+      if (!optarg)
+        break;
+      secs = strtod(optarg, &e);
+      if (!*optarg || (e && *e) || isnan(secs) || secs < 0 ||
+          secs > INT_MAX / 1000) {
+        Error("invalid argument to --wait: \"%s\"\n", optarg);
+        errorcnt++;
+        break;
+      }
+      params.wait_ms = secs * 1000;
+      break;
     case 'l':
       params.set_label = 1;
       params.label = optarg;
@@ -101,26 +153,36 @@ int cmd_find(int argc, char *argv[]) {
         errorcnt++;
       }
       break;
-    case 'M':
-      params.matchbuf = ReadFile(optarg, &params.matchlen);
-      if (!params.matchbuf || !params.matchlen) {
-        Error("Unable to read from %s\n", optarg);
+    case 'M': {
+      CgptFindContent *content = realloc(params.content,
+          (params.num_content + 1) * sizeof(*content));
+      if (!content) {
+        Error("Unable to allocate memory for -%c\n", c);
         errorcnt++;
+        break;
       }
-      // Go ahead and allocate space for the comparison too
-      params.comparebuf = (uint8_t *)malloc(params.matchlen);
-      if (!params.comparebuf) {
-        Error("Unable to allocate %" PRIu64 "bytes for comparison buffer\n",
-              params.matchlen);
+      params.content = content;
+      content += params.num_content++;
+      content->matchoffset = offset;
+      offset = 0;
+      content->matchbuf = ReadFile(optarg, &content->matchlen);
+      if (!content->matchbuf || !content->matchlen) {
+        Error("Unable to read from %s\n", optarg);
         errorcnt++;
       }
       break;
+    }
     case 'O':
-      params.matchoffset = strtoull(optarg, &e, 0);
+      offset = strtoull(optarg, &e, 0);
       if (!*optarg || (e && *e)) {
         Error("invalid argument to -%c: \"%s\"\n", c, optarg);
         errorcnt++;
       }
+      // It belongs to the last -M, if there was one yet.
+      if (params.num_content) {
+        params.content[params.num_content - 1].matchoffset = offset;
+        offset = 0;
+      }
       break;
 
     case 'h':
@@ -143,6 +205,18 @@ int cmd_find(int argc, char *argv[]) {
     Error("You must specify at least one of -t, -u, or -l\n");
     errorcnt++;
   }
+  if (params.first && params.oneonly) {
+    Error("-F and -1 can't be used together\n");
+    errorcnt++;
+  }
+  if (params.wait && serving) {
+    Error("--wait would hold up every other query, run find directly\n");
+    errorcnt++;
+  }
+  if (params.wait && optind < argc) {
+    Error("--wait only applies to a scan of all drives\n");
+    errorcnt++;
+  }
   if (errorcnt)
   {
     Usage();
@@ -151,6 +225,8 @@ int cmd_find(int argc, char *argv[]) {
 
   if (optind < argc) {
     for (i=optind; i<argc; i++) {
+      if (params.first && params.hits)
+        break;
       params.drive_name = argv[i];
       CgptFind(&params);
       }
@@ -14,8 +14,9 @@
 
 static void Usage(void)
 {
-  printf("\nUsage: %s prioritize [OPTIONS] DRIVE\n\n"
-         "Reorder the priority of all active ChromeOS Kernel partitions.\n\n"
+  printf("\nUsage: %s prioritize [OPTIONS] DRIVE [DRIVE...]\n\n"
+         "Reorder the priority of all active ChromeOS Kernel partitions.\n"
+         "Those of several drives are ranked together, as one set.\n\n"
          "Options:\n"
          "  -P NUM       Highest priority to use in the new ordering. The\n"
          "                 other partitions will be ranked in decreasing\n"
@@ -27,9 +28,12 @@ static void Usage(void)
          "  -f           Friends of the given partition (those with the same\n"
          "                 starting priority) are also updated to the new\n"
          "                 highest priority.\n"
+         "  -a           Rank those of every drive with a GPT instead of the\n"
+         "                 drives given.\n"
          "\n"
          "With no options this will set the lowest active kernel to\n"
          "priority 1 while maintaining the original order.\n"
+         "With several drives, -i is a partition of the first one.\n"
          "\n", progname);
 }
 
@@ -41,9 +45,11 @@ int cmd_prioritize(int argc, char *argv[]) {
   int errorcnt = 0;
   int r = CGPT_FAILED;
   char *e = 0;
+  uint32_t partition;
+  int i;
 
   opterr = 0;                     // quiet, you
-  while ((c=getopt(argc, argv, ":hi:fP:")) != -1)
+  while ((c=getopt(argc, argv, ":hi:fP:a")) != -1)
   {
     switch (c)
     {
@@ -58,6 +64,9 @@ int cmd_prioritize(int argc, char *argv[]) {
     case 'f':
       params.set_friends = 1;
       break;
+    case 'a':
+      params.all_drives = 1;
+      break;
     case 'P':
       params.max_priority = (int)strtol(optarg, &e, 0);
       if (!*optarg || (e && *e))
@@ -99,20 +108,54 @@ int cmd_prioritize(int argc, char *argv[]) {
     return CGPT_FAILED;
   }
 
+  if (params.all_drives) {
+    if (optind < argc) {
+      Error("-a takes no drive arguments\n");
+      Usage();
+      return CGPT_FAILED;
+    }
+    return CgptPrioritize(&params);
+  }
+
   if (optind >= argc) {
     Error("missing drive argument\n");
     return CGPT_FAILED;
   }
 
   params.drive_name = strdup(argv[optind]);
+  require(params.drive_name);
 
   r = translate_partition_dev(&params.drive_name, &params.set_partition);
   if (r != CGPT_OK)
     goto out;
 
+  params.num_other_drives = argc - optind - 1;
+  if (params.num_other_drives) {
+    params.other_drives = calloc(params.num_other_drives,
+                                 sizeof(*params.other_drives));
+    require(params.other_drives);
+  }
+  for (i = 0; i < params.num_other_drives; i++) {
+    partition = 0;
+    params.other_drives[i] = strdup(argv[optind + 1 + i]);
+    require(params.other_drives[i]);
+    r = translate_partition_dev(&params.other_drives[i], &partition);
+    if (r != CGPT_OK)
+      goto out;
+    if (partition) {
+      Error("only the first drive may be given as a partition: %s\n",
+            argv[optind + 1 + i]);
+      r = CGPT_FAILED;
+      goto out;
+    }
+  }
+
   r = CgptPrioritize(&params);
 
 out:
   free(params.drive_name);
+  for (i = 0; i < params.num_other_drives; i++)
+    free(params.other_drives[i]);
+  free(params.other_drives);
   return r;
 }
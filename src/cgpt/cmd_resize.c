@@ -12,14 +12,64 @@
 
 static void Usage(void)
 {
-  printf("\nUsage: %s resize /dev/blk1\n\n"
-	 "Resize the given partition if it has free space to grow into.\n"
+  printf("\nUsage: %s resize [OPTIONS] /dev/blk1[=SIZE] [/dev/blk2...]\n\n"
+	 "Resize the given partitions if they have free space to grow into.\n"
+         "Each grows into the space right after it: all of it, or up to SIZE\n"
+         "bytes, or by SIZE%% of the space if it ends in %%. Partitions must\n"
+         "be on the same disk, whose table is then written once. Besides\n"
+         "devices, they may be given as PARTUUID=UUID or PARTLABEL=LABEL.\n"
          "The default minimum size to grow by is 2MB.\n\n"
          "Options:\n"
          "  -m NUM       Do nothing unless partition can grow by NUM bytes\n"
+         "  -f           Also grow the mounted ext4 filesystems on them\n"
          "\n", progname);
 }
 
+// True if the len bytes at s name a tag such as PARTLABEL, rather than a
+// device that a size follows.
+static int IsTagName(const char *s, size_t len) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    if ((s[i] < 'A' || s[i] > 'Z') && s[i] != '_')
+      return 0;
+  }
+  return len > 0;
+}
+
+// Splits "DEV=SIZE" or "DEV=PERCENT%" into target, editing arg.  DEV may
+// be a tag such as PARTLABEL=ROOT itself, which takes a size the same way.
+static int ParseTarget(char *arg, CgptResizeTarget *target) {
+  char *eq = strrchr(arg, '=');
+  char *e = 0;
+  unsigned long long value;
+
+  memset(target, 0, sizeof(*target));
+  target->partition_desc = arg;
+  if (!eq || IsTagName(arg, eq - arg))
+    return CGPT_OK;
+
+  *eq++ = '\0';
+  value = strtoull(eq, &e, 0);
+  if (!*eq || e == eq || !value) {
+    Error("invalid size for %s: \"%s\"\n", arg, eq);
+    return CGPT_FAILED;
+  }
+  if (*e == '%' && !e[1]) {
+    if (value > 100) {
+      Error("invalid size for %s: \"%s\"\n", arg, eq);
+      return CGPT_FAILED;
+    }
+    target->percent = value;
+  } else if (!*e) {
+    target->size = value;
+  } else {
+    Error("invalid size for %s: \"%s\"\n", arg, eq);
+    return CGPT_FAILED;
+  }
+  return CGPT_OK;
+}
+
 int cmd_resize(int argc, char *argv[]) {
   CgptResizeParams params;
   memset(&params, 0, sizeof(params));
@@ -27,12 +77,13 @@ int cmd_resize(int argc, char *argv[]) {
   // Default minimum is 2MB
   params.min_resize_bytes = 2 * 1024 * 1024;
 
-  int c;
+  int c, i;
   int errorcnt = 0;
+  int r;
   char *e = 0;
 
   opterr = 0;                     // quiet, you
-  while ((c=getopt(argc, argv, ":d:m:h")) != -1)
+  while ((c=getopt(argc, argv, ":d:m:fh")) != -1)
   {
     switch (c)
     {
@@ -44,6 +95,9 @@ int cmd_resize(int argc, char *argv[]) {
         errorcnt++;
       }
       break;
+    case 'f':
+      params.grow_fs = 1;
+      break;
 
     case 'h':
       Usage();
@@ -73,7 +127,20 @@ int cmd_resize(int argc, char *argv[]) {
     return CGPT_FAILED;
   }
 
-  params.partition_desc = strdup(argv[optind]);
+  params.num_targets = argc - optind;
+  params.targets = calloc(params.num_targets, sizeof(*params.targets));
+  if (!params.targets)
+    return CGPT_FAILED;
+  for (i = 0; i < params.num_targets; i++) {
+    if (CGPT_OK != ParseTarget(argv[optind + i], &params.targets[i])) {
+      r = CGPT_FAILED;
+      goto out;
+    }
+  }
+
+  r = CgptResize(&params);
 
-  return CgptResize(&params);
+out:
+  free(params.targets);
+  return r;
 }
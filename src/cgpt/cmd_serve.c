@@ -0,0 +1,441 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Answering show and find queries from a process that keeps every drive
+// it has read loaded, so polling them costs no I/O until the kernel says a
+// drive changed.
+//
+// A query is one SOCK_SEQPACKET message: the command and its arguments,
+// each terminated by a NUL, with the client's stdout, stderr and working
+// directory passed along as SCM_RIGHTS.  The command runs in that directory
+// and writes to those just like the CLI would, then the server replies with
+// a single byte, its exit status.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cgpt.h"
+#include "vboot_host.h"
+
+#define DEFAULT_SOCKET "/run/cgpt.sock"
+#define MAX_QUERY_BYTES 8192
+#define MAX_QUERY_ARGS 64
+// Queries are answered one at a time, so a client gets this long to send
+// its query before the next one's turn.
+#define QUERY_TIMEOUT_SECS 5
+// The descriptors a query passes: stdout, stderr and working directory.
+#define QUERY_FDS 3
+
+// The commands that only ever read.
+static const struct {
+  const char *name;
+  int (*fp)(int argc, char *argv[]);
+} serve_cmds[] = {
+  {"show", cmd_show},
+  {"find", cmd_find},
+};
+
+static void ServeUsage(void)
+{
+  int i;
+
+  printf("\nUsage: %s serve [OPTIONS]\n\n"
+         "Answer queries from \"%s query\", keeping each drive loaded until\n"
+         "a uevent reports it changed. Image files are checked for changes\n"
+         "on every query instead. Commands:", progname, progname);
+  for (i = 0; i < ARRAY_COUNT(serve_cmds); ++i)
+    printf(" %s", serve_cmds[i].name);
+  printf("\n\n"
+         "Options:\n"
+         "  -s SOCKET    Listen on SOCKET instead of " DEFAULT_SOCKET "\n"
+         "\n");
+}
+
+static void QueryUsage(void)
+{
+  printf("\nUsage: %s query [OPTIONS] COMMAND [ARGS...]\n\n"
+         "Run COMMAND, show or find, in \"%s serve\" and print what it\n"
+         "prints, exiting with its status.\n\n"
+         "Options:\n"
+         "  -s SOCKET    Connect to SOCKET instead of " DEFAULT_SOCKET "\n"
+         "\n", progname, progname);
+}
+
+static int SocketAddress(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    Error("socket path too long: %s\n", path);
+    return CGPT_FAILED;
+  }
+  strcpy(addr->sun_path, path);
+  return CGPT_OK;
+}
+
+static volatile sig_atomic_t stopping;
+
+static void Stop(int sig) {
+  stopping = 1;
+}
+
+// Drops the drives that the uevents waiting on 'fd' are about.
+static void ReadUevents(int fd) {
+  char buf[UEVENT_BYTES + 1];
+  struct uevent ev;
+  int r;
+
+  while ((r = UeventRecv(fd, buf, &ev))) {
+    // Events were lost, any drive may have changed.
+    if (r < 0) {
+      DriveCacheInvalidate(NULL);
+      continue;
+    }
+    if (!strcmp(ev.action, "add") || !strcmp(ev.action, "change") ||
+        !strcmp(ev.action, "remove") || !strcmp(ev.action, "move"))
+      DriveCacheInvalidate(ev.devpath);
+  }
+}
+
+// Runs the query waiting on 'conn' and sends back its status.
+static void AnswerQuery(int conn, int uevent_fd) {
+  char buf[MAX_QUERY_BYTES];
+  char control[CMSG_SPACE(QUERY_FDS * sizeof(int))];
+  char *argv[MAX_QUERY_ARGS + 1];
+  const char *serve_command = command;
+  struct iovec iov = { buf, sizeof(buf) };
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  int fds[QUERY_FDS] = { -1, -1, -1 };
+  int saved[QUERY_FDS] = { -1, -1, -1 };
+  int argc = 0, i;
+  uint8_t status = CGPT_FAILED;
+  ssize_t len;
+  char *p;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  len = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+  if (len <= 0)
+    return;
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    if (cmsg->cmsg_len == CMSG_LEN(sizeof(fds)) && fds[0] < 0) {
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+      continue;
+    }
+    // Not what a query passes, but ours to close all the same.
+    for (i = 0; CMSG_LEN((i + 1) * sizeof(int)) <= cmsg->cmsg_len; i++) {
+      int extra;
+
+      memcpy(&extra, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+      close(extra);
+    }
+  }
+  if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0 ||
+      (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || buf[len - 1] != '\0')
+    goto out;
+
+  // Whatever happened to the drives before the query was sent.
+  ReadUevents(uevent_fd);
+
+  fflush(stdout);
+  fflush(stderr);
+  saved[0] = dup(STDOUT_FILENO);
+  saved[1] = dup(STDERR_FILENO);
+  if (saved[0] < 0 || saved[1] < 0 ||
+      dup2(fds[0], STDOUT_FILENO) < 0 || dup2(fds[1], STDERR_FILENO) < 0)
+    goto out;
+  // Relative drive paths are the client's.
+  saved[2] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (saved[2] < 0 || fchdir(fds[2]) < 0) {
+    Error("Can't change to the client's directory: %s\n", strerror(errno));
+    goto out;
+  }
+
+  for (p = buf; p < buf + len && argc < MAX_QUERY_ARGS; p += strlen(p) + 1)
+    argv[argc++] = p;
+  argv[argc] = NULL;
+  if (p < buf + len) {
+    Error("too many arguments\n");
+    goto out;
+  }
+  for (i = 0; i < ARRAY_COUNT(serve_cmds); ++i)
+    if (!strcmp(serve_cmds[i].name, argv[0]))
+      break;
+  if (i == ARRAY_COUNT(serve_cmds)) {
+    Error("unknown or unsupported command: %s\n", argv[0]);
+    goto out;
+  }
+
+  command = serve_cmds[i].name;
+  optind = 0;                     // start over, including getopt's state
+  serving = 1;
+  status = serve_cmds[i].fp(argc, argv);
+  serving = 0;
+  command = serve_command;
+
+out:
+  fflush(stdout);
+  fflush(stderr);
+  if (saved[0] >= 0) {
+    dup2(saved[0], STDOUT_FILENO);
+    close(saved[0]);
+  }
+  if (saved[1] >= 0) {
+    dup2(saved[1], STDERR_FILENO);
+    close(saved[1]);
+  }
+  if (saved[2] >= 0) {
+    if (fchdir(saved[2]) < 0)
+      Error("Can't change back to %s's directory: %s\n", progname,
+            strerror(errno));
+    close(saved[2]);
+  }
+  for (i = 0; i < QUERY_FDS; i++) {
+    if (fds[i] >= 0)
+      close(fds[i]);
+  }
+  (void) send(conn, &status, 1, MSG_NOSIGNAL);
+}
+
+int cmd_serve(int argc, char *argv[]) {
+  const char *socket_path = DEFAULT_SOCKET;
+  struct sockaddr_un addr;
+  struct timeval timeout = { QUERY_TIMEOUT_SECS, 0 };
+  struct pollfd pfd[2];
+  struct sigaction sa;
+  struct stat st;
+  mode_t mask;
+  int listen_fd = -1, uevent_fd = -1, conn;
+  int c;
+  int errorcnt = 0;
+  int r = CGPT_FAILED;
+
+  opterr = 0;                     // quiet, you
+  while ((c=getopt(argc, argv, ":hs:")) != -1)
+  {
+    switch (c)
+    {
+    case 's':
+      socket_path = optarg;
+      break;
+
+    case 'h':
+      ServeUsage();
+      return CGPT_OK;
+    case '?':
+      Error("unrecognized option: -%c\n", optopt);
+      errorcnt++;
+      break;
+    case ':':
+      Error("missing argument to -%c\n", optopt);
+      errorcnt++;
+      break;
+    default:
+      errorcnt++;
+      break;
+    }
+  }
+  if (errorcnt || optind < argc)
+  {
+    ServeUsage();
+    return CGPT_FAILED;
+  }
+  if (CGPT_OK != SocketAddress(socket_path, &addr))
+    return CGPT_FAILED;
+
+  // Listen for uevents before anything is loaded, so none are missed.
+  uevent_fd = UeventOpen();
+  if (uevent_fd < 0) {
+    Error("Can't listen for uevents: %s\n", strerror(errno));
+    goto out;
+  }
+
+  // Replace a socket left behind by an earlier server, nothing else.
+  if (!lstat(socket_path, &st) && S_ISSOCK(st.st_mode))
+    unlink(socket_path);
+  listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    Error("Can't create socket: %s\n", strerror(errno));
+    goto out;
+  }
+  // Queries can read every disk, so only the owner may send them.
+  mask = umask(0177);
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    umask(mask);
+    Error("Can't bind %s: %s\n", socket_path, strerror(errno));
+    goto out;
+  }
+  umask(mask);
+  if (listen(listen_fd, 16)) {
+    Error("Can't listen on %s: %s\n", socket_path, strerror(errno));
+    goto unlink;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = Stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  // A client gone early must not take the server with it.
+  signal(SIGPIPE, SIG_IGN);
+
+  DriveCacheEnable();
+  pfd[0].fd = uevent_fd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = listen_fd;
+  pfd[1].events = POLLIN;
+  while (!stopping) {
+    if (poll(pfd, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      Error("poll failed: %s\n", strerror(errno));
+      goto unlink;
+    }
+    if (pfd[0].revents)
+      ReadUevents(uevent_fd);
+    if (pfd[1].revents) {
+      conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+      if (conn < 0)
+        continue;
+      // Nor may a client that never sends its query keep others waiting.
+      if (setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                     sizeof(timeout)) ||
+          setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                     sizeof(timeout))) {
+        close(conn);
+        continue;
+      }
+      AnswerQuery(conn, uevent_fd);
+      close(conn);
+    }
+  }
+  r = CGPT_OK;
+
+unlink:
+  unlink(socket_path);
+out:
+  DriveCacheInvalidate(NULL);
+  if (listen_fd >= 0)
+    close(listen_fd);
+  if (uevent_fd >= 0)
+    close(uevent_fd);
+  return r;
+}
+
+int cmd_query(int argc, char *argv[]) {
+  const char *socket_path = DEFAULT_SOCKET;
+  char buf[MAX_QUERY_BYTES];
+  char control[CMSG_SPACE(QUERY_FDS * sizeof(int))];
+  int fds[QUERY_FDS] = { STDOUT_FILENO, STDERR_FILENO, -1 };
+  struct sockaddr_un addr;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  size_t len = 0, n;
+  uint8_t status;
+  int fd, c, i;
+  int errorcnt = 0;
+  int r = CGPT_FAILED;
+
+  opterr = 0;                     // quiet, you
+  // Stop at COMMAND, its options are its own.
+  while ((c=getopt(argc, argv, "+:hs:")) != -1)
+  {
+    switch (c)
+    {
+    case 's':
+      socket_path = optarg;
+      break;
+
+    case 'h':
+      QueryUsage();
+      return CGPT_OK;
+    case '?':
+      Error("unrecognized option: -%c\n", optopt);
+      errorcnt++;
+      break;
+    case ':':
+      Error("missing argument to -%c\n", optopt);
+      errorcnt++;
+      break;
+    default:
+      errorcnt++;
+      break;
+    }
+  }
+  if (errorcnt || optind >= argc)
+  {
+    QueryUsage();
+    return CGPT_FAILED;
+  }
+  if (CGPT_OK != SocketAddress(socket_path, &addr))
+    return CGPT_FAILED;
+
+  for (i = optind; i < argc; i++) {
+    n = strlen(argv[i]) + 1;
+    if (len + n > sizeof(buf) || i - optind >= MAX_QUERY_ARGS) {
+      Error("query too long\n");
+      return CGPT_FAILED;
+    }
+    memcpy(buf + len, argv[i], n);
+    len += n;
+  }
+
+  fds[2] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fds[2] < 0) {
+    Error("Can't open the working directory: %s\n", strerror(errno));
+    return CGPT_FAILED;
+  }
+
+  fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    Error("Can't connect to %s: %s\n", socket_path, strerror(errno));
+    goto out;
+  }
+
+  // Anything we printed so far must come before the command's output.
+  fflush(stdout);
+  fflush(stderr);
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  if (sendmsg(fd, &msg, MSG_NOSIGNAL) != len) {
+    Error("Can't send query to %s: %s\n", socket_path, strerror(errno));
+    goto out;
+  }
+  if (recv(fd, &status, 1, 0) != 1) {
+    Error("No answer from %s\n", socket_path);
+    goto out;
+  }
+  r = status;
+
+out:
+  if (fd >= 0)
+    close(fd);
+  close(fds[2]);
+  return r;
+}
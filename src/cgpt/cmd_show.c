@@ -11,6 +11,38 @@
 #include "cgpt.h"
 #include "vboot_host.h"
 
+// Parses -i for query mode: "all", or a list like "1,3,4".
+static int ParsePartitionList(const char *arg, CgptShowParams *params) {
+  const char *p = arg;
+  char *e;
+  int n = 1;
+
+  if (!strcmp(arg, "all"))
+    return CGPT_OK;
+
+  for (p = arg; *p; p++)
+    if (*p == ',')
+      n++;
+  params->query_parts = malloc(n * sizeof(*params->query_parts));
+  if (!params->query_parts) {
+    Error("unable to allocate memory\n");
+    return CGPT_FAILED;
+  }
+
+  p = arg;
+  for (params->num_query_parts = 0; params->num_query_parts < n;
+       params->num_query_parts++) {
+    params->query_parts[params->num_query_parts] =
+        (uint32_t)strtoul(p, &e, 0);
+    if (e == p || (*e && *e != ',')) {
+      Error("invalid argument to -i: \"%s\"\n", arg);
+      return CGPT_FAILED;
+    }
+    p = e + 1;
+  }
+  return CGPT_OK;
+}
+
 static void Usage(void)
 {
   printf("\nUsage: %s show [OPTIONS] DRIVE\n\n"
@@ -29,6 +61,13 @@ static void Usage(void)
          "               -T  Tries flag\n"
          "               -P  Priority flag\n"
          "               -A  raw 64-bit attribute value\n"
+         "  -f FIELDS    Query mode: print FIELDS, a comma-separated list of\n"
+         "               partition, start, size, type, unique, label,\n"
+         "               successful, tries, priority and attr (or \"all\"),\n"
+         "               one tab-separated line per partition. -i then takes\n"
+         "               a comma-separated list of partitions or \"all\"; by\n"
+         "               default every partition in use is listed\n"
+         "  -j           Query mode: print JSON objects instead\n"
          "  -d           Debug output (including invalid headers)\n"
          "\n", progname);
 }
@@ -41,9 +80,10 @@ int cmd_show(int argc, char *argv[]) {
   int errorcnt = 0;
   int r = CGPT_FAILED;
   char *e = 0;
+  const char *partitions = NULL;
 
   opterr = 0;                     // quiet, you
-  while ((c=getopt(argc, argv, ":hnvqi:bstulSTPAd")) != -1)
+  while ((c=getopt(argc, argv, ":hnvqi:bstulSTPAf:jd")) != -1)
   {
     switch (c)
     {
@@ -57,12 +97,7 @@ int cmd_show(int argc, char *argv[]) {
       params.quick = 1;
       break;
     case 'i':
-      params.partition = (uint32_t)strtoul(optarg, &e, 0);
-      if (!*optarg || (e && *e))
-      {
-        Error("invalid argument to -%c: \"%s\"\n", c, optarg);
-        errorcnt++;
-      }
+      partitions = optarg;
       break;
     case 'b':
     case 's':
@@ -76,6 +111,15 @@ int cmd_show(int argc, char *argv[]) {
       params.single_item = c;
       break;
 
+    case 'f':
+      if (CGPT_OK != ParseShowFields(optarg, params.fields,
+                                     sizeof(params.fields)))
+        errorcnt++;
+      break;
+    case 'j':
+      params.json = 1;
+      break;
+
     case 'd':
       params.debug = 1;
       break;
@@ -96,9 +140,25 @@ int cmd_show(int argc, char *argv[]) {
       break;
     }
   }
+  if (partitions && params.fields[0]) {
+    if (CGPT_OK != ParsePartitionList(partitions, &params))
+      errorcnt++;
+  } else if (partitions) {
+    params.partition = (uint32_t)strtoul(partitions, &e, 0);
+    if (!*partitions || (e && *e))
+    {
+      Error("invalid argument to -i: \"%s\"\n", partitions);
+      errorcnt++;
+    }
+  }
+  if (params.json && !params.fields[0]) {
+    Error("-j requires -f\n");
+    errorcnt++;
+  }
   if (errorcnt)
   {
     Usage();
+    free(params.query_parts);
     return CGPT_FAILED;
   }
 
@@ -114,9 +174,22 @@ int cmd_show(int argc, char *argv[]) {
   if (r != CGPT_OK)
     goto out;
 
+  // A partition device names the only partition to query, unless -i did.
+  if (params.fields[0] && params.partition && !partitions) {
+    params.query_parts = malloc(sizeof(*params.query_parts));
+    if (!params.query_parts) {
+      Error("unable to allocate memory\n");
+      r = CGPT_FAILED;
+      goto out;
+    }
+    params.query_parts[0] = params.partition;
+    params.num_query_parts = 1;
+  }
+
   r = CgptShow(&params);
 
 out:
+  free(params.query_parts);
   free(params.drive_name);
   return r;
 }
@@ -0,0 +1,150 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <getopt.h>
+#include <string.h>
+
+#include "cgpt.h"
+#include "vboot_host.h"
+
+// dm-verity takes salts of up to this many bytes.
+#define MAX_SALT_BYTES 256
+
+static void Usage(void)
+{
+  printf("\nUsage: %s verify [OPTIONS] [DRIVE]\n\n"
+         "Check the data of the partition with the given UUID, type or\n"
+         "label against the SHA-256 of each of its blocks. With no DRIVE\n"
+         "it scans all physical drives; exactly one partition must match.\n"
+         "Stops at the first block that doesn't match.\n\n"
+         "Options:\n"
+         "  -t GUID      Partition Type GUID\n"
+         "  -u GUID      Partition Unique ID\n"
+         "  -l LABEL     Label\n"
+         "  -m FILE      Manifest of a hex SHA-256 per block and line, as\n"
+         "               split -b BYTES --filter=sha256sum prints them\n"
+         "  -r HEX       dm-verity root hash of the blocks instead\n"
+         "  -S HEX       dm-verity salt (default none)\n"
+         "  -B BYTES     Block size, a power of 2 (default 4096)\n"
+         "  -s BYTES     Bytes of data to verify (default the whole\n"
+         "               partition), e.g. those before a hash tree\n"
+         "  -v           Say how much was verified\n"
+         "\n", progname);
+  PrintTypes();
+}
+
+int cmd_verify(int argc, char *argv[]) {
+  CgptVerifyParams params;
+  memset(&params, 0, sizeof(params));
+  uint8_t salt[MAX_SALT_BYTES];
+
+  int c;
+  int errorcnt = 0;
+  char *e = 0;
+
+  opterr = 0;                     // quiet, you
+  while ((c=getopt(argc, argv, ":ht:u:l:m:r:S:B:s:v")) != -1)
+  {
+    switch (c)
+    {
+    case 't':
+      params.set_type = 1;
+      if (CGPT_OK != SupportedType(optarg, &params.type_guid) &&
+          CGPT_OK != StrToGuid(optarg, &params.type_guid)) {
+        Error("invalid argument to -%c: %s\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 'u':
+      params.set_unique = 1;
+      if (CGPT_OK != StrToGuid(optarg, &params.unique_guid)) {
+        Error("invalid argument to -%c: %s\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 'l':
+      params.set_label = 1;
+      params.label = optarg;
+      break;
+    case 'm':
+      params.manifest = optarg;
+      break;
+    case 'r':
+      params.set_root_hash = 1;
+      if (strlen(optarg) != 2 * sizeof(params.root_hash) ||
+          CGPT_OK != HexToBytes(optarg, params.root_hash,
+                                sizeof(params.root_hash))) {
+        Error("invalid argument to -%c: \"%s\"\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 'S':
+      params.salt = salt;
+      params.salt_len = strlen(optarg) / 2;
+      // "-" is no salt, as veritysetup prints it.
+      if (!strcmp(optarg, "-")) {
+        params.salt_len = 0;
+      } else if (strlen(optarg) % 2 || params.salt_len > sizeof(salt) ||
+                 CGPT_OK != HexToBytes(optarg, salt, params.salt_len)) {
+        Error("invalid argument to -%c: \"%s\"\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 'B':
+      params.block_bytes = (uint32_t)strtoul(optarg, &e, 0);
+      if (!*optarg || (e && *e) || !params.block_bytes)
+      {
+        Error("invalid argument to -%c: \"%s\"\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 's':
+      params.data_bytes = strtoull(optarg, &e, 0);
+      if (!*optarg || (e && *e) || !params.data_bytes)
+      {
+        Error("invalid argument to -%c: \"%s\"\n", c, optarg);
+        errorcnt++;
+      }
+      break;
+    case 'v':
+      params.verbose++;
+      break;
+
+    case 'h':
+      Usage();
+      return CGPT_OK;
+    case '?':
+      Error("unrecognized option: -%c\n", optopt);
+      errorcnt++;
+      break;
+    case ':':
+      Error("missing argument to -%c\n", optopt);
+      errorcnt++;
+      break;
+    default:
+      errorcnt++;
+      break;
+    }
+  }
+  if (!params.set_unique && !params.set_type && !params.set_label)
+  {
+    Error("a UUID (-u), type (-t) or label (-l) is required\n");
+    errorcnt++;
+  }
+  if (!params.manifest == !params.set_root_hash)
+  {
+    Error("either a manifest (-m) or a root hash (-r) is required\n");
+    errorcnt++;
+  }
+  if (errorcnt)
+  {
+    Usage();
+    return CGPT_FAILED;
+  }
+
+  if (optind < argc)
+    params.drive_name = argv[optind];
+
+  return CgptVerify(&params);
+}
@@ -0,0 +1,528 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Finding the drives worth searching when a command isn't given one.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/netlink.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "cgpt.h"
+#include "cgptlib_internal.h"
+#include "vboot_host.h"
+
+#define DEV_DIR "/dev"
+#define SYS_BLOCK_DIR "/sys/block"
+#define BUFSIZE 1024
+
+static const char *devdirs[] = { "/dev", "/devices", "/devfs", 0 };
+
+const char *SysRoot(void) {
+  const char *root = getenv("CGPT_SYSROOT");
+
+  return root ? root : "";
+}
+
+// Given basename "foo", see if we can find a whole, real device by that name.
+// This is copied from the logic in the linux utility 'findfs', although that
+// does more exhaustive searching.
+char *IsWholeDev(const char *basename, char *pathname, size_t size) {
+  int i,j,len;
+  struct stat statbuf;
+  char tmpname[PATH_MAX];
+  char tbasename[BUFSIZE];
+
+  // It should be a block device under /dev/,
+  for (i = 0; devdirs[i]; i++) {
+    if (snprintf(pathname, size, "%s%s/%s", SysRoot(), devdirs[i],
+                 basename) >= size)
+      continue;
+
+    if (0 != stat(pathname, &statbuf))
+      continue;
+
+    if (!S_ISBLK(statbuf.st_mode))
+      continue;
+
+    // It should have a symlink called /sys/block/*/device
+    // but devices containing '/' (like cciss ones) must
+    // be changed to use "!" instead
+    len = strlen(basename);
+    for (j = 0; j < len && j < BUFSIZE - 1; j++) {
+        tbasename[j] = basename[j] == '/' ? '!' : basename[j];
+    }
+    tbasename[j] = 0;
+    if (snprintf(tmpname, sizeof(tmpname), "%s%s/%s/device", SysRoot(),
+                 SYS_BLOCK_DIR, tbasename) >= sizeof(tmpname))
+      continue;
+
+    if (0 != lstat(tmpname, &statbuf))
+      continue;
+
+    if (!S_ISLNK(statbuf.st_mode))
+      continue;
+
+    // found it
+    return pathname;
+  }
+
+  return 0;
+}
+
+// Upper bound on concurrent device scans. Opening a drive is dominated by
+// waiting on the device, so this is about overlapping I/O, not CPU count.
+#define MAX_SCAN_WORKERS 8
+
+struct parallel_for {
+  void (*fn)(void *arg, int index);
+  void *arg;
+  int count;
+  int next;
+  pthread_mutex_t lock;
+};
+
+static void *ParallelForWorker(void *data) {
+  struct parallel_for *pf = data;
+  int index;
+
+  for (;;) {
+    pthread_mutex_lock(&pf->lock);
+    index = pf->next++;
+    pthread_mutex_unlock(&pf->lock);
+    if (index >= pf->count)
+      break;
+    pf->fn(pf->arg, index);
+  }
+  return NULL;
+}
+
+static void *ParallelForHelper(void *data) {
+  ParallelForWorker(data);
+  DriveFreeSpareBuffer();
+  return NULL;
+}
+
+void ParallelFor(int count, void (*fn)(void *arg, int index), void *arg) {
+  struct parallel_for pf = { fn, arg, count, 0, PTHREAD_MUTEX_INITIALIZER };
+  pthread_t threads[MAX_SCAN_WORKERS];
+  int nthreads = 0;
+
+  // The calling thread works too, so only start helpers for the remainder.
+  while (nthreads < MAX_SCAN_WORKERS - 1 && nthreads < count - 1) {
+    if (pthread_create(&threads[nthreads], NULL, ParallelForHelper, &pf))
+      break;
+    nthreads++;
+  }
+
+  ParallelForWorker(&pf);
+
+  while (nthreads--)
+    pthread_join(threads[nthreads], NULL);
+  pthread_mutex_destroy(&pf.lock);
+}
+
+// One read covering LBA 1 for both 512-byte and 4K sectors, aligned so it
+// also works with O_DIRECT.
+#define PROBE_BYTES (2 * GPT_MAX_SECTOR_BYTES)
+
+static int ProbeHeader(const uint8_t *buf, uint32_t sector_bytes) {
+  const GptHeader *h = (const GptHeader *)(buf + sector_bytes);
+
+  if (memcmp(h->signature, GPT_HEADER_SIGNATURE, GPT_HEADER_SIGNATURE_SIZE) &&
+      memcmp(h->signature, GPT_HEADER_SIGNATURE2, GPT_HEADER_SIGNATURE_SIZE))
+    return 0;
+  return h->size >= MIN_SIZE_OF_HEADER && h->size <= MAX_SIZE_OF_HEADER &&
+         h->my_lba == GPT_PRIMARY_HEADER_LBA;
+}
+
+// Opens pathname for a probe, staying out of the page cache like the full
+// scan does if we can.
+static int ProbeOpen(const char *pathname) {
+  int fd;
+
+  fd = open(pathname, O_RDONLY | O_DIRECT | O_CLOEXEC);
+  StatsAdd(STATS_OPEN_CALLS, 1);
+  if (fd < 0 && errno == EINVAL) {
+    fd = open(pathname, O_RDONLY | O_CLOEXEC);
+    StatsAdd(STATS_OPEN_CALLS, 1);
+  }
+  return fd;
+}
+
+// Looks for a header in what a probe read, remembering the answer.
+static int ProbeResult(const char *pathname, const uint8_t *buf,
+                       ssize_t nread) {
+  int found;
+
+  if (nread != PROBE_BYTES)
+    return 0;
+  StatsAdd(STATS_READ_OTHER, nread);
+
+  found = ProbeHeader(buf, GPT_MIN_SECTOR_BYTES) ||
+          ProbeHeader(buf, GPT_MAX_SECTOR_BYTES);
+  DriveCacheSetProbe(pathname, found);
+  return found;
+}
+
+int ProbeGpt(const char *pathname) {
+  uint8_t buf[PROBE_BYTES] __attribute__((aligned(GPT_MAX_SECTOR_BYTES)));
+  ssize_t nread;
+  int fd, found;
+
+  found = DriveCacheProbe(pathname);
+  if (found >= 0)
+    return found;
+
+  StatsAdd(STATS_DEVICES_PROBED, 1);
+  fd = ProbeOpen(pathname);
+  if (fd < 0)
+    return 0;
+
+  nread = pread(fd, buf, sizeof(buf), 0);
+  StatsAdd(STATS_READ_CALLS, 1);
+  close(fd);
+  return ProbeResult(pathname, buf, nread);
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+// Probe reads kept in flight at once by ProbeRing().
+#define PROBE_QUEUE_DEPTH 64
+
+// An io_uring set up by hand, which is little enough code not to need
+// liburing for.
+struct probe_ring {
+  int fd;
+  unsigned entries;
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_size, cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+static void RingFree(struct probe_ring *ring) {
+  if (ring->sqes && ring->sqes != MAP_FAILED)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring && ring->cq_ring != MAP_FAILED)
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  if (ring->fd >= 0)
+    close(ring->fd);
+}
+
+// Returns CGPT_FAILED if the kernel has no io_uring or won't let us use it.
+static int RingSetup(struct probe_ring *ring, unsigned entries) {
+  struct io_uring_params p;
+  uint8_t *sq, *cq;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&p, 0, sizeof(p));
+  ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (ring->fd < 0)
+    return CGPT_FAILED;
+  ring->entries = p.sq_entries < entries ? p.sq_entries : entries;
+
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = p.cq_off.cqes +
+                       p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd,
+                       IORING_OFF_SQ_RING);
+  ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd,
+                       IORING_OFF_CQ_RING);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  StatsAdd(STATS_MMAP_CALLS, 3);
+  if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+      ring->sqes == MAP_FAILED) {
+    RingFree(ring);
+    return CGPT_FAILED;
+  }
+
+  sq = ring->sq_ring;
+  cq = ring->cq_ring;
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+  ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return CGPT_OK;
+}
+
+// Queues a read of iov from fd, reported back with slot as user_data.
+static void RingQueueRead(struct probe_ring *ring, int fd,
+                          const struct iovec *iov, int slot) {
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)iov;
+  sqe->len = 1;
+  sqe->off = 0;
+  sqe->user_data = slot;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int RingEnter(struct probe_ring *ring, unsigned submit,
+                     unsigned wait) {
+  int r;
+
+  do {
+    r = syscall(__NR_io_uring_enter, ring->fd, submit, wait,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+    StatsAdd(STATS_URING_CALLS, 1);
+  } while (r < 0 && errno == EINTR);
+  return r;
+}
+
+// Probes devs from a single thread with all of their reads in flight at
+// once, PROBE_QUEUE_DEPTH at a time, checking each as it completes rather
+// than in order.  Frees and clears the ones without a GPT like ProbeOne().
+// Returns CGPT_NOOP if io_uring isn't available, leaving devs alone.
+static int ProbeRing(char **devs, int count) {
+  struct probe_ring ring;
+  struct iovec iov[PROBE_QUEUE_DEPTH];
+  int fds[PROBE_QUEUE_DEPTH], which[PROBE_QUEUE_DEPTH];
+  uint8_t *bufs;
+  int next = 0;
+
+  if (CGPT_OK != RingSetup(&ring, PROBE_QUEUE_DEPTH))
+    return CGPT_NOOP;
+  if (posix_memalign((void **)&bufs, GPT_MAX_SECTOR_BYTES,
+                     ring.entries * PROBE_BYTES)) {
+    RingFree(&ring);
+    return CGPT_NOOP;
+  }
+
+  while (next < count) {
+    unsigned queued = 0, done = 0, head;
+    int found, slot;
+
+    for (; next < count && queued < ring.entries; next++) {
+      found = DriveCacheProbe(devs[next]);
+      if (found < 0) {
+        StatsAdd(STATS_DEVICES_PROBED, 1);
+        fds[queued] = ProbeOpen(devs[next]);
+        if (fds[queued] >= 0) {
+          which[queued] = next;
+          iov[queued].iov_base = bufs + queued * PROBE_BYTES;
+          iov[queued].iov_len = PROBE_BYTES;
+          RingQueueRead(&ring, fds[queued], &iov[queued], queued);
+          queued++;
+          continue;
+        }
+        found = 0;
+      }
+      if (!found) {
+        free(devs[next]);
+        devs[next] = NULL;
+      }
+    }
+
+    while (done < queued) {
+      if (RingEnter(&ring, done ? 0 : queued, 1) < 0) {
+        // Probe what's left the slow way.  Reads of the ones before may
+        // still be in flight, until the ring is torn down below.
+        for (slot = 0; slot < queued; slot++) {
+          if (fds[slot] < 0)
+            continue;
+          close(fds[slot]);
+          fds[slot] = -1;
+          if (!ProbeGpt(devs[which[slot]])) {
+            free(devs[which[slot]]);
+            devs[which[slot]] = NULL;
+          }
+          done++;
+        }
+        break;
+      }
+      head = *ring.cq_head;
+      while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+
+        slot = cqe->user_data;
+        StatsAdd(STATS_READ_CALLS, 1);
+        close(fds[slot]);
+        fds[slot] = -1;
+        if (!ProbeResult(devs[which[slot]], iov[slot].iov_base, cqe->res)) {
+          free(devs[which[slot]]);
+          devs[which[slot]] = NULL;
+        }
+        done++;
+        head++;
+      }
+      __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+  }
+
+  // Tearing the ring down cancels what it still has in flight, before
+  // bufs goes.
+  RingFree(&ring);
+  free(bufs);
+  return CGPT_OK;
+}
+#else
+static int ProbeRing(char **devs, int count) {
+  return CGPT_NOOP;
+}
+#endif  /* HAVE_LINUX_IO_URING_H */
+
+#define PROC_PARTITIONS "/proc/partitions"
+
+static void ProbeOne(void *arg, int index) {
+  char **devs = arg;
+
+  if (!ProbeGpt(devs[index])) {
+    free(devs[index]);
+    devs[index] = NULL;
+  }
+}
+
+int ScanGptDrives(char ***devs) {
+  char line[BUFSIZE];
+  char partname[128];                   // max size for /proc/partition lines?
+  char pathname[BUFSIZE];
+  char proc_partitions[PATH_MAX];
+  FILE *fp;
+  char **list = NULL;
+  uint64_t start = StatsClock();
+  int count = 0;
+  int i, j;
+
+  *devs = NULL;
+
+  snprintf(proc_partitions, sizeof(proc_partitions), "%s" PROC_PARTITIONS,
+           SysRoot());
+  fp = fopen(proc_partitions, "r");
+  if (!fp) {
+    perror("can't read " PROC_PARTITIONS);
+    StatsAddTime(STATS_SCAN_US, start);
+    return 0;
+  }
+
+  while (fgets(line, sizeof(line), fp)) {
+    int ma, mi;
+    long long unsigned int sz;
+
+    if (sscanf(line, " %d %d %llu %127[^\n ]", &ma, &mi, &sz, partname) != 4)
+      continue;
+
+    if (IsWholeDev(partname, pathname, sizeof(pathname))) {
+      char **more = realloc(list, (count + 1) * sizeof(*list));
+      if (!more) {
+        Error("unable to allocate memory for device list\n");
+        break;
+      }
+      list = more;
+      if (!(list[count] = strdup(pathname))) {
+        Error("unable to allocate memory for device list\n");
+        break;
+      }
+      count++;
+    }
+  }
+
+  fclose(fp);
+  StatsAdd(STATS_DEVICES_LISTED, count);
+
+  // Drop the swap, RAID members and raw disks before anyone opens them.
+  if (count < 2 || CGPT_NOOP == ProbeRing(list, count))
+    ParallelFor(count, ProbeOne, list);
+  for (i = j = 0; i < count; i++) {
+    if (list[i])
+      list[j++] = list[i];
+  }
+
+  *devs = list;
+  StatsAddTime(STATS_SCAN_US, start);
+  return j;
+}
+
+void FreeDriveList(char **devs, int count) {
+  int i;
+
+  for (i = 0; i < count; i++)
+    free(devs[i]);
+  free(devs);
+}
+
+int UeventOpen(void) {
+  struct sockaddr_nl nl;
+  int fd;
+
+  fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+  if (fd < 0)
+    return -1;
+  memset(&nl, 0, sizeof(nl));
+  nl.nl_family = AF_NETLINK;
+  nl.nl_groups = 1;               // the kernel's, not udev's
+  if (bind(fd, (struct sockaddr *)&nl, sizeof(nl))) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+int UeventRecv(int fd, char *buf, struct uevent *ev) {
+  const char *subsystem;
+  ssize_t len;
+  char *p;
+
+  for (;;) {
+    len = recv(fd, buf, UEVENT_BYTES, MSG_DONTWAIT);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno == ENOBUFS ? -1 : 0;
+    }
+    buf[len] = '\0';
+
+    // "ACTION@DEVPATH" then KEY=VALUE strings, each NUL terminated.
+    memset(ev, 0, sizeof(*ev));
+    subsystem = NULL;
+    for (p = buf; p < buf + len; p += strlen(p) + 1) {
+      if (!strncmp(p, "ACTION=", 7))
+        ev->action = p + 7;
+      else if (!strncmp(p, "DEVPATH=", 8))
+        ev->devpath = p + 8;
+      else if (!strncmp(p, "DEVNAME=", 8))
+        ev->devname = p + 8;
+      else if (!strncmp(p, "DEVTYPE=", 8))
+        ev->devtype = p + 8;
+      else if (!strncmp(p, "SUBSYSTEM=", 10))
+        subsystem = p + 10;
+    }
+    if (ev->action && ev->devpath && subsystem && !strcmp(subsystem, "block"))
+      return 1;
+  }
+}
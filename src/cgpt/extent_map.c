@@ -0,0 +1,130 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Finding room on a drive for new partitions.
+
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "cgpt.h"
+#include "cgptlib_internal.h"
+#include "vboot_host.h"
+
+void BuildExtentMap(struct drive *drive, struct extent_map *map) {
+  GptHeader *h = (GptHeader *)drive->gpt.primary_header;
+  GptEntry *entries = (GptEntry *)drive->gpt.primary_entries;
+  uint16_t order[MAX_NUMBER_OF_ENTRIES];
+  uint64_t next = h->first_usable_lba;
+  uint32_t used, i;
+
+  require(h->number_of_entries <= GPT_MAX_TABLE_ENTRIES);
+  used = SortEntriesByStart(entries, h, order);
+
+  memset(map, 0, sizeof(*map));
+  for (i = 0; i < used; i++) {
+    GptEntry *entry = entries + order[i];
+
+    map->used[map->num_used].first = entry->starting_lba;
+    map->used[map->num_used].last = entry->ending_lba;
+    map->num_used++;
+
+    if (entry->starting_lba > next) {
+      map->free[map->num_free].first = next;
+      map->free[map->num_free].last = entry->starting_lba - 1;
+      map->num_free++;
+    }
+    // Entries may overlap (CheckEntries() is what rejects that), so only
+    // ever move forward.
+    if (entry->ending_lba >= next)
+      next = entry->ending_lba + 1;
+  }
+  if (next <= h->last_usable_lba) {
+    map->free[map->num_free].first = next;
+    map->free[map->num_free].last = h->last_usable_lba;
+    map->num_free++;
+  }
+}
+
+static uint64_t Gcd(uint64_t a, uint64_t b) {
+  while (b) {
+    uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+uint64_t DriveAlignment(struct drive *drive) {
+  uint32_t sector_bytes = drive->gpt.sector_bytes;
+  uint64_t align = EXTENT_DEFAULT_ALIGN_BYTES / sector_bytes;
+  unsigned int optimal = 0;
+
+  // Files have no optimal I/O size; neither do most disks, which say 0.
+  if (drive->is_file || ioctl(drive->fd, BLKIOOPT, &optimal) < 0)
+    return align;
+  if (optimal && !(optimal % sector_bytes)) {
+    uint64_t io_sectors = optimal / sector_bytes;
+    align = align / Gcd(align, io_sectors) * io_sectors;
+  }
+  return align;
+}
+
+int AllocateExtent(const struct extent_map *map, uint64_t size,
+                   uint64_t align, int fit, uint64_t *begin,
+                   uint64_t *found_size) {
+  uint64_t best_begin = 0, best_size = 0;
+  int found = 0;
+  uint32_t i;
+
+  if (!align)
+    align = 1;
+
+  for (i = 0; i < map->num_free; i++) {
+    const struct extent *gap = &map->free[i];
+    uint64_t first = (gap->first + align - 1) / align * align;
+    uint64_t room;
+
+    if (first < gap->first || first > gap->last)
+      continue;                   // no aligned sector in this gap
+    room = gap->last - first + 1;
+    if (room < size)
+      continue;
+
+    if (!size) {
+      // The whole of the largest gap.
+      if (room <= best_size)
+        continue;
+    } else if (found && (fit == EXTENT_FIRST_FIT || room >= best_size)) {
+      continue;
+    }
+    best_begin = first;
+    best_size = room;
+    found = 1;
+  }
+
+  if (!found) {
+    if (size)
+      Error("no free space for %llu sectors aligned to %llu\n",
+            (unsigned long long)size, (unsigned long long)align);
+    else
+      Error("no free space aligned to %llu sectors\n",
+            (unsigned long long)align);
+    return CGPT_FAILED;
+  }
+
+  *begin = best_begin;
+  *found_size = size ? size : best_size;
+  return CGPT_OK;
+}
+
+int ParseExtentFit(const char *name, int *fit) {
+  if (!strcmp(name, "first"))
+    *fit = EXTENT_FIRST_FIT;
+  else if (!strcmp(name, "best"))
+    *fit = EXTENT_BEST_FIT;
+  else
+    return CGPT_FAILED;
+  return CGPT_OK;
+}
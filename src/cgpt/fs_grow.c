@@ -0,0 +1,163 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Growing a mounted ext4 filesystem into its resized partition.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "cgpt.h"
+#include "endian.h"
+#include "vboot_host.h"
+
+#ifndef EXT4_IOC_RESIZE_FS
+# define EXT4_IOC_RESIZE_FS _IOW('f', 16, uint64_t)
+#endif
+
+// The few superblock fields e2size's blocks_count * blocksize needs.
+#define EXT2_SUPERBLOCK_OFFSET 1024
+#define EXT2_SUPERBLOCK_SIZE 1024
+#define EXT2_SB_BLOCKS_COUNT_LO 0x04
+#define EXT2_SB_LOG_BLOCK_SIZE 0x18
+#define EXT2_SB_MAGIC 0x38
+#define EXT2_SB_FEATURE_INCOMPAT 0x60
+#define EXT2_SB_BLOCKS_COUNT_HI 0x150
+#define EXT2_SUPER_MAGIC 0xEF53
+#define EXT4_FEATURE_INCOMPAT_64BIT 0x80
+
+static uint32_t Le32At(const uint8_t *sb, int offset) {
+  uint32_t v;
+  memcpy(&v, sb + offset, sizeof(v));
+  return le32toh(v);
+}
+
+// Reads the block size and count from the superblock alone, which is all
+// growing needs; ext2fs_open() would load every group descriptor as well.
+static int ReadExtSize(int fd, const char *devname, uint32_t *block_size,
+                       uint64_t *blocks) {
+  uint8_t sb[EXT2_SUPERBLOCK_SIZE];
+  uint16_t magic;
+  uint32_t log_block_size;
+
+  if (pread(fd, sb, sizeof(sb), EXT2_SUPERBLOCK_OFFSET) != sizeof(sb)) {
+    Error("Can't read superblock of %s: %s\n", devname, strerror(errno));
+    return CGPT_FAILED;
+  }
+  memcpy(&magic, sb + EXT2_SB_MAGIC, sizeof(magic));
+  log_block_size = Le32At(sb, EXT2_SB_LOG_BLOCK_SIZE);
+  if (le16toh(magic) != EXT2_SUPER_MAGIC || log_block_size > 6) {
+    Error("%s is not an ext2/3/4 filesystem\n", devname);
+    return CGPT_FAILED;
+  }
+
+  *block_size = 1024 << log_block_size;
+  *blocks = Le32At(sb, EXT2_SB_BLOCKS_COUNT_LO);
+  if (Le32At(sb, EXT2_SB_FEATURE_INCOMPAT) & EXT4_FEATURE_INCOMPAT_64BIT)
+    *blocks |= (uint64_t)Le32At(sb, EXT2_SB_BLOCKS_COUNT_HI) << 32;
+  return CGPT_OK;
+}
+
+// Undoes the octal escapes (\040 for a space and so on) of mountinfo.
+static void UnescapeMountPath(char *path) {
+  char *in = path, *out = path;
+
+  while (*in) {
+    if (in[0] == '\\' && in[1] >= '0' && in[1] <= '3' &&
+        in[2] >= '0' && in[2] <= '7' && in[3] >= '0' && in[3] <= '7') {
+      *out++ = (in[1] - '0') << 6 | (in[2] - '0') << 3 | (in[3] - '0');
+      in += 4;
+    } else {
+      *out++ = *in++;
+    }
+  }
+  *out = '\0';
+}
+
+// Returns where the filesystem on devno is mounted, or NULL.  The caller
+// frees the result.
+static char *FindMountPoint(dev_t devno) {
+  FILE *fp = fopen("/proc/self/mountinfo", "r");
+  char *line = NULL, *found = NULL;
+  size_t line_size = 0;
+
+  if (!fp)
+    return NULL;
+
+  while (!found && getline(&line, &line_size, fp) != -1) {
+    unsigned int major_num, minor_num;
+    char path[4096];
+
+    // mount ID, parent ID, major:minor, root, mount point, ...
+    if (sscanf(line, "%*u %*u %u:%u %*s %4095s",
+               &major_num, &minor_num, path) != 3)
+      continue;
+    if (makedev(major_num, minor_num) != devno)
+      continue;
+    UnescapeMountPath(path);
+    found = strdup(path);
+  }
+
+  free(line);
+  fclose(fp);
+  return found;
+}
+
+int GrowMountedExt4(const char *devname, uint64_t partition_bytes) {
+  struct stat st;
+  uint32_t block_size;
+  uint64_t blocks, new_blocks;
+  char *mount_point = NULL;
+  int fd, dir_fd = -1;
+  int r = CGPT_FAILED;
+
+  fd = open(devname, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    Error("Can't open %s: %s\n", devname, strerror(errno));
+    return CGPT_FAILED;
+  }
+  if (fstat(fd, &st) < 0 || !S_ISBLK(st.st_mode)) {
+    Error("%s is not a block device\n", devname);
+    goto out;
+  }
+  if (CGPT_OK != ReadExtSize(fd, devname, &block_size, &blocks))
+    goto out;
+
+  new_blocks = partition_bytes / block_size;
+  if (new_blocks <= blocks) {
+    r = CGPT_OK;                // already fills the partition
+    goto out;
+  }
+
+  mount_point = FindMountPoint(st.st_rdev);
+  if (!mount_point) {
+    Error("%s is not mounted, it can only be grown online\n", devname);
+    goto out;
+  }
+  dir_fd = open(mount_point, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    Error("Can't open %s: %s\n", mount_point, strerror(errno));
+    goto out;
+  }
+  if (ioctl(dir_fd, EXT4_IOC_RESIZE_FS, &new_blocks) < 0) {
+    Error("Failed to grow the filesystem on %s from %llu to %llu blocks: "
+          "%s\n", mount_point, (unsigned long long)blocks,
+          (unsigned long long)new_blocks, strerror(errno));
+    goto out;
+  }
+  r = CGPT_OK;
+
+out:
+  if (dir_fd >= 0)
+    close(dir_fd);
+  free(mount_point);
+  close(fd);
+  return r;
+}
@@ -0,0 +1,234 @@
+// Copyright (c) 2026 Flatcar Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// SHA-256 (FIPS 180-4), for cgpt verify.  Blocks go through the SHA
+// extensions where the CPU has them, like crc32.c picks its backend.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cgpt.h"
+#include "cgpt_params.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SHA256_HAVE_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t sha256_k[64] __attribute__((aligned(16))) = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void Sha256BlocksGeneric(uint32_t state[8], const uint8_t *data,
+                                size_t blocks) {
+  uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  while (blocks--) {
+    for (i = 0; i < 16; i++)
+      w[i] = (uint32_t)data[4 * i] << 24 | (uint32_t)data[4 * i + 1] << 16 |
+             (uint32_t)data[4 * i + 2] << 8 | data[4 * i + 3];
+    for (; i < 64; i++)
+      w[i] = (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10)) +
+             w[i - 7] +
+             (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+             w[i - 16];
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+    for (i = 0; i < 64; i++) {
+      t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) +
+           sha256_k[i] + w[i];
+      t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+           ((a & b) ^ (a & c) ^ (b & c));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    data += SHA256_BLOCK_SIZE;
+  }
+}
+
+#ifdef SHA256_HAVE_SHANI
+// Four rounds per step, two per sha256rnds2, with the message schedule kept
+// in four registers of four words each.
+__attribute__((target("sha,sse4.1")))
+static void Sha256BlocksShaNi(uint32_t state[8], const uint8_t *data,
+                              size_t blocks) {
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                       0x0405060700010203ULL);
+  __m128i state0, state1, abef, cdgh, msg, tmp, w[4];
+  int i;
+
+  // The instructions want the state as ABEF and CDGH.
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]),
+                             0x1b);
+  state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+  while (blocks--) {
+    abef = state0;
+    cdgh = state1;
+    for (i = 0; i < 16; i++) {
+      // w[i & 3] holds the words four steps back, w[(i + 3) & 3] the last.
+      if (i < 4)
+        w[i] = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i *)(data + 16 * i)), bswap);
+      else
+        w[i & 3] = _mm_sha256msg2_epu32(
+            _mm_add_epi32(_mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]),
+                          _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4)),
+            w[(i + 3) & 3]);
+      msg = _mm_add_epi32(w[i & 3],
+                          _mm_load_si128((const __m128i *)&sha256_k[4 * i]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      state0 = _mm_sha256rnds2_epu32(state0, state1,
+                                     _mm_shuffle_epi32(msg, 0x0e));
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+    data += SHA256_BLOCK_SIZE;
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, state1, 0xf0));
+  _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+static int Sha256HaveShaNi(void) {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_SHA))
+    return 0;
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.1");
+}
+#endif  // SHA256_HAVE_SHANI
+
+typedef void (*sha256_blocks_fn)(uint32_t state[8], const uint8_t *data,
+                                 size_t blocks);
+
+static const sha256_blocks_fn sha256_backends[SHA256_BACKEND_COUNT] = {
+  [SHA256_BACKEND_GENERIC] = Sha256BlocksGeneric,
+#ifdef SHA256_HAVE_SHANI
+  [SHA256_BACKEND_SHANI] = Sha256BlocksShaNi,
+#endif
+};
+
+static sha256_blocks_fn sha256_blocks = Sha256BlocksGeneric;
+
+int Sha256BackendSupported(int backend) {
+  if (backend < 0 || backend >= SHA256_BACKEND_COUNT ||
+      !sha256_backends[backend])
+    return 0;
+#ifdef SHA256_HAVE_SHANI
+  if (backend == SHA256_BACKEND_SHANI)
+    return Sha256HaveShaNi();
+#endif
+  return 1;
+}
+
+__attribute__((constructor))
+static void Sha256SelectBackend(void) {
+  if (Sha256BackendSupported(SHA256_BACKEND_SHANI))
+    sha256_blocks = sha256_backends[SHA256_BACKEND_SHANI];
+}
+
+void Sha256Init(struct sha256_ctx *ctx) {
+  static const uint32_t iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+
+  memcpy(ctx->state, iv, sizeof(iv));
+  ctx->bytes = 0;
+}
+
+static void Sha256UpdateWith(sha256_blocks_fn blocks, struct sha256_ctx *ctx,
+                             const void *data, size_t len) {
+  const uint8_t *p = data;
+  size_t fill = ctx->bytes % SHA256_BLOCK_SIZE;
+  size_t n;
+
+  ctx->bytes += len;
+  if (fill) {
+    n = SHA256_BLOCK_SIZE - fill;
+    if (n > len)
+      n = len;
+    memcpy(ctx->buf + fill, p, n);
+    p += n;
+    len -= n;
+    if (fill + n < SHA256_BLOCK_SIZE)
+      return;
+    blocks(ctx->state, ctx->buf, 1);
+  }
+  if (len >= SHA256_BLOCK_SIZE) {
+    n = len / SHA256_BLOCK_SIZE;
+    blocks(ctx->state, p, n);
+    p += n * SHA256_BLOCK_SIZE;
+    len -= n * SHA256_BLOCK_SIZE;
+  }
+  memcpy(ctx->buf, p, len);
+}
+
+static void Sha256FinalWith(sha256_blocks_fn blocks, struct sha256_ctx *ctx,
+                            uint8_t digest[SHA256_DIGEST_SIZE]) {
+  uint64_t bits = ctx->bytes * 8;
+  size_t fill = ctx->bytes % SHA256_BLOCK_SIZE;
+  int i;
+
+  ctx->buf[fill++] = 0x80;
+  if (fill > SHA256_BLOCK_SIZE - 8) {
+    memset(ctx->buf + fill, 0, SHA256_BLOCK_SIZE - fill);
+    blocks(ctx->state, ctx->buf, 1);
+    fill = 0;
+  }
+  memset(ctx->buf + fill, 0, SHA256_BLOCK_SIZE - 8 - fill);
+  for (i = 0; i < 8; i++)
+    ctx->buf[SHA256_BLOCK_SIZE - 1 - i] = bits >> (8 * i);
+  blocks(ctx->state, ctx->buf, 1);
+
+  for (i = 0; i < 8; i++) {
+    digest[4 * i] = ctx->state[i] >> 24;
+    digest[4 * i + 1] = ctx->state[i] >> 16;
+    digest[4 * i + 2] = ctx->state[i] >> 8;
+    digest[4 * i + 3] = ctx->state[i];
+  }
+}
+
+void Sha256Update(struct sha256_ctx *ctx, const void *data, size_t len) {
+  Sha256UpdateWith(sha256_blocks, ctx, data, len);
+}
+
+void Sha256Final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE]) {
+  Sha256FinalWith(sha256_blocks, ctx, digest);
+}
+
+int Sha256Backend(int backend, const void *data, size_t len,
+                  uint8_t digest[SHA256_DIGEST_SIZE]) {
+  struct sha256_ctx ctx;
+
+  if (!Sha256BackendSupported(backend))
+    return CGPT_FAILED;
+  Sha256Init(&ctx);
+  Sha256UpdateWith(sha256_backends[backend], &ctx, data, len);
+  Sha256FinalWith(sha256_backends[backend], &ctx, digest);
+  return CGPT_OK;
+}
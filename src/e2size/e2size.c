@@ -2,45 +2,711 @@
  * Use of this source code is governed by a BSD-style license that can be
  * found in the LICENSE file.
  *
- * Finds the size of an ext{2,3,4} filesystem located at the beginning of a given device.
+ * Finds the size of a filesystem located at the beginning of a given device,
+ * or in a partition of a disk image.  Only the superblock is read:
+ * ext{2,3,4}, btrfs, xfs, squashfs and erofs all record their size there.
  */
 
-#include <stdio.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
-#include <error.h>
-#include <ext2fs/ext2fs.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-static void usage() {
-	fprintf(stderr, "Usage: e2size <device>\n");
+#include "vboot_host.h"
+
+/* Everything but btrfs keeps its superblock in the first 4K. */
+#define HEAD_SIZE		4096
+#define BTRFS_SUPER_OFFSET	65536
+#define BTRFS_SUPER_SIZE	4096
+
+#define EXT2_SUPER_OFFSET	1024
+#define EXT2_SUPER_MAGIC	0xEF53
+#define EXT4_FEATURE_INCOMPAT_64BIT	0x80
+#define EROFS_SUPER_OFFSET	1024
+#define EROFS_SUPER_MAGIC	0xE0F5E1E2
+#define SQUASHFS_MAGIC		0x73717368
+#define XFS_SB_MAGIC		0x58465342
+#define BTRFS_MAGIC		"_BHRfS_M"
+
+static uint16_t le16_at(const uint8_t *buf, size_t offset) {
+	uint16_t v;
+	memcpy(&v, buf + offset, sizeof(v));
+	return le16toh(v);
 }
 
-int main(int argc, char *argv[]) {
-	ext2_filsys fs;
-	errcode_t err;
-	uint64_t fs_size = 0;
-	int retc = 1;
+static uint32_t le32_at(const uint8_t *buf, size_t offset) {
+	uint32_t v;
+	memcpy(&v, buf + offset, sizeof(v));
+	return le32toh(v);
+}
 
-	if (argc != 2) {
-		usage();
-		goto out;
+static uint64_t le64_at(const uint8_t *buf, size_t offset) {
+	uint64_t v;
+	memcpy(&v, buf + offset, sizeof(v));
+	return le64toh(v);
+}
+
+static uint32_t be32_at(const uint8_t *buf, size_t offset) {
+	uint32_t v;
+	memcpy(&v, buf + offset, sizeof(v));
+	return be32toh(v);
+}
+
+static uint64_t be64_at(const uint8_t *buf, size_t offset) {
+	uint64_t v;
+	memcpy(&v, buf + offset, sizeof(v));
+	return be64toh(v);
+}
+
+/* Each probe returns 1 and the size if buf holds its superblock. */
+
+static int probe_ext(const uint8_t *head, uint64_t *size) {
+	const uint8_t *sb = head + EXT2_SUPER_OFFSET;
+	uint32_t log_block_size = le32_at(sb, 0x18);
+	uint64_t blocks = le32_at(sb, 0x04);
+
+	if (le16_at(sb, 0x38) != EXT2_SUPER_MAGIC || log_block_size > 6)
+		return 0;
+	if (le32_at(sb, 0x60) & EXT4_FEATURE_INCOMPAT_64BIT)
+		blocks |= (uint64_t)le32_at(sb, 0x150) << 32;
+	*size = blocks << (10 + log_block_size);
+	return 1;
+}
+
+static int probe_erofs(const uint8_t *head, uint64_t *size) {
+	const uint8_t *sb = head + EROFS_SUPER_OFFSET;
+	uint8_t blkszbits = sb[12];
+
+	if (le32_at(sb, 0) != EROFS_SUPER_MAGIC || blkszbits < 9 ||
+	    blkszbits > 16)
+		return 0;
+	*size = (uint64_t)le32_at(sb, 36) << blkszbits;
+	return 1;
+}
+
+static int probe_squashfs(const uint8_t *head, uint64_t *size) {
+	if (le32_at(head, 0) != SQUASHFS_MAGIC)
+		return 0;
+	/* bytes_used; the image itself is usually padded past it to 4K. */
+	*size = le64_at(head, 40);
+	return 1;
+}
+
+static int probe_xfs(const uint8_t *head, uint64_t *size) {
+	uint32_t blocksize = be32_at(head, 4);
+
+	if (be32_at(head, 0) != XFS_SB_MAGIC || blocksize < 512 ||
+	    blocksize > 65536 || (blocksize & (blocksize - 1)))
+		return 0;
+	/* sb_dblocks, the data section; external logs aren't on the device. */
+	*size = be64_at(head, 8) * blocksize;
+	return 1;
+}
+
+static int probe_btrfs(const uint8_t *sb, uint64_t *size) {
+	if (memcmp(sb + 0x40, BTRFS_MAGIC, strlen(BTRFS_MAGIC)))
+		return 0;
+	/* dev_item.total_bytes, how much of this device the filesystem uses,
+	 * rather than the total over all of its devices. */
+	*size = le64_at(sb, 0xc9 + 8);
+	return 1;
+}
+
+/* Where a filesystem starts, and how much room it has (0 for all). */
+struct target {
+	int fd;
+	uint64_t offset;
+	uint64_t limit;
+};
+
+static int read_at(const struct target *t, uint8_t *buf, size_t len,
+		   uint64_t offset) {
+	ssize_t r = 0;
+
+	if (t->limit && offset + len > t->limit)
+		len = offset < t->limit ? t->limit - offset : 0;
+	if (len)
+		r = pread(t->fd, buf, len, t->offset + offset);
+	if (r < 0)
+		return -1;
+	return r;
+}
+
+/* Reads len bytes at offset, or zeroes where there's nothing to read:
+ * too short to hold a superblock there means nothing to find. */
+static int read_super(const struct target *t, uint8_t *buf, size_t len,
+		      uint64_t offset) {
+	int r = read_at(t, buf, len, offset);
+
+	if (r < 0)
+		return -1;
+	memset(buf + r, 0, len - r);
+	return 0;
+}
+
+static int fs_size(const struct target *t, uint64_t *size) {
+	static int (*const head_probes[])(const uint8_t *, uint64_t *) = {
+		probe_xfs, probe_squashfs, probe_erofs, probe_ext,
+	};
+	uint8_t buf[HEAD_SIZE];
+	int i;
+
+	if (read_super(t, buf, HEAD_SIZE, 0))
+		return -1;
+	for (i = 0; i < sizeof(head_probes) / sizeof(head_probes[0]); i++)
+		if (head_probes[i](buf, size))
+			return 0;
+
+	if (read_super(t, buf, BTRFS_SUPER_SIZE, BTRFS_SUPER_OFFSET))
+		return -1;
+	if (probe_btrfs(buf, size))
+		return 0;
+
+	errno = EINVAL;
+	return -1;
+}
+
+/* What the minimum size of an ext{2,3,4} filesystem is worked out from,
+ * read from its superblock and group descriptors. */
+struct ext_fs {
+	const struct target *t;
+	uint32_t block_size;
+	uint64_t blocks;
+	uint32_t first_data_block;
+	uint32_t blocks_per_group;
+	uint32_t inodes_per_group;
+	uint32_t groups;
+	uint32_t desc_size;
+	uint32_t gdt_blocks;
+	uint32_t reserved_gdt_blocks;
+	uint32_t inode_table_blocks;
+	uint32_t backup_bgs[2];
+	uint32_t groups_per_flex;
+	int is_64bit;
+	int has_extents;
+	int sparse_super;
+	int sparse_super2;
+	uint8_t *gdt;
+};
+
+#define EXT4_FEATURE_COMPAT_SPARSE_SUPER2	0x200
+#define EXT4_FEATURE_INCOMPAT_META_BG		0x10
+#define EXT4_FEATURE_INCOMPAT_EXTENTS		0x40
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG		0x200
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x1
+#define EXT4_FEATURE_RO_COMPAT_BIGALLOC		0x200
+#define EXT4_BG_INODE_UNINIT			0x1
+#define EXT4_BG_BLOCK_UNINIT			0x2
+
+/* Block groups are handed to the workers this many at a time. */
+#define GROUPS_PER_CLAIM	64
+#define MAX_WORKERS		16
+
+static int ext_open(const struct target *t, struct ext_fs *fs) {
+	uint8_t sb[1024];
+	uint32_t incompat, gdt_bytes;
+	int r;
+
+	memset(fs, 0, sizeof(*fs));
+	fs->t = t;
+	if (read_super(t, sb, sizeof(sb), EXT2_SUPER_OFFSET))
+		return -1;
+	if (le16_at(sb, 0x38) != EXT2_SUPER_MAGIC || le32_at(sb, 0x18) > 6) {
+		errno = EINVAL;
+		return -1;
+	}
+	incompat = le32_at(sb, 0x60);
+	/* Descriptors that aren't all after the superblock, or bitmaps of
+	 * clusters rather than blocks, would need more than this. */
+	if (incompat & EXT4_FEATURE_INCOMPAT_META_BG ||
+	    le32_at(sb, 0x64) & EXT4_FEATURE_RO_COMPAT_BIGALLOC) {
+		errno = ENOTSUP;
+		return -1;
 	}
 
-	err = ext2fs_open(argv[1], 0, 0, 0, unix_io_manager, &fs);
+	fs->block_size = 1024 << le32_at(sb, 0x18);
+	fs->blocks = le32_at(sb, 0x04);
+	fs->is_64bit = !!(incompat & EXT4_FEATURE_INCOMPAT_64BIT);
+	if (fs->is_64bit)
+		fs->blocks |= (uint64_t)le32_at(sb, 0x150) << 32;
+	fs->first_data_block = le32_at(sb, 0x14);
+	fs->blocks_per_group = le32_at(sb, 0x20);
+	fs->inodes_per_group = le32_at(sb, 0x28);
+	fs->desc_size = fs->is_64bit ? le16_at(sb, 0xfe) : 32;
+	fs->reserved_gdt_blocks = le16_at(sb, 0xce);
+	fs->sparse_super = !!(le32_at(sb, 0x64) &
+			      EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER);
+	fs->sparse_super2 = !!(le32_at(sb, 0x5c) &
+			       EXT4_FEATURE_COMPAT_SPARSE_SUPER2);
+	fs->backup_bgs[0] = le32_at(sb, 0x24c);
+	fs->backup_bgs[1] = le32_at(sb, 0x250);
+	fs->has_extents = !!(incompat & EXT4_FEATURE_INCOMPAT_EXTENTS);
+	if (incompat & EXT4_FEATURE_INCOMPAT_FLEX_BG && sb[0x174] < 31)
+		fs->groups_per_flex = 1 << sb[0x174];
+	if (!fs->blocks_per_group || !fs->inodes_per_group ||
+	    fs->desc_size < 32 || fs->blocks <= fs->first_data_block ||
+	    fs->blocks_per_group > fs->block_size * 8 ||
+	    fs->inodes_per_group > fs->block_size * 8) {
+		errno = EINVAL;
+		return -1;
+	}
+	fs->groups = (fs->blocks - fs->first_data_block +
+		      fs->blocks_per_group - 1) / fs->blocks_per_group;
+	fs->inode_table_blocks = ((uint64_t)fs->inodes_per_group *
+				  le16_at(sb, 0x58) + fs->block_size - 1) /
+				 fs->block_size;
 
-	if (err != 0) {
-		fprintf(stderr, "%s\n", strerror(errno));
-		goto out;
+	gdt_bytes = fs->groups * fs->desc_size;
+	fs->gdt_blocks = (gdt_bytes + fs->block_size - 1) / fs->block_size;
+	fs->gdt = malloc(gdt_bytes);
+	if (!fs->gdt)
+		return -1;
+	r = read_at(t, fs->gdt, gdt_bytes,
+		    (uint64_t)(fs->first_data_block + 1) * fs->block_size);
+	if (r != gdt_bytes) {
+		if (r >= 0)
+			errno = EINVAL;
+		free(fs->gdt);
+		return -1;
 	}
+	return 0;
+}
 
-	fs_size = ext2fs_blocks_count(fs->super) * fs->blocksize;
+static int is_power_of(uint32_t n, uint32_t base) {
+	while (n > 1 && !(n % base))
+		n /= base;
+	return n == 1;
+}
 
-	printf("%" PRIu64 "\n", fs_size);
+/* Whether group g holds a copy of the superblock and descriptors. */
+static int ext_group_has_super(const struct ext_fs *fs, uint32_t g) {
+	if (g == 0)
+		return 1;
+	if (fs->sparse_super2)
+		return g == fs->backup_bgs[0] || g == fs->backup_bgs[1];
+	if (!fs->sparse_super || g == 1)
+		return 1;
+	return is_power_of(g, 3) || is_power_of(g, 5) || is_power_of(g, 7);
+}
 
-	retc = 0;
+static uint32_t ext_group_blocks(const struct ext_fs *fs, uint32_t g) {
+	uint64_t first = fs->first_data_block +
+			 (uint64_t)g * fs->blocks_per_group;
 
-out:
-	if ( fs != NULL ) {
-		ext2fs_close(fs);
+	if (fs->blocks - first < fs->blocks_per_group)
+		return fs->blocks - first;
+	return fs->blocks_per_group;
+}
+
+/* The blocks a group's metadata takes, wherever flex_bg puts them. */
+static uint32_t ext_group_overhead(const struct ext_fs *fs, uint32_t g) {
+	uint32_t overhead = 2 + fs->inode_table_blocks;
+
+	if (ext_group_has_super(fs, g))
+		overhead += 1 + fs->gdt_blocks + fs->reserved_gdt_blocks;
+	return overhead;
+}
+
+static uint64_t ext_desc_field(const struct ext_fs *fs, uint32_t g,
+			       size_t lo, size_t hi, int is_16bit) {
+	const uint8_t *desc = fs->gdt + (size_t)g * fs->desc_size;
+	uint64_t v = is_16bit ? le16_at(desc, lo) : le32_at(desc, lo);
+	int has_hi = fs->is_64bit && fs->desc_size >= 64;
+
+	if (has_hi)
+		v |= (uint64_t)(is_16bit ? le16_at(desc, hi) :
+				le32_at(desc, hi)) << (is_16bit ? 16 : 32);
+	return v;
+}
+
+static uint64_t count_bits(const uint8_t *buf, uint32_t bits) {
+	uint64_t count = 0;
+	uint32_t i;
+
+	for (i = 0; i + 8 <= bits; i += 8)
+		count += __builtin_popcount(buf[i / 8]);
+	if (i < bits)
+		count += __builtin_popcount(buf[i / 8] & ((1 << (bits - i)) - 1));
+	return count;
+}
+
+struct ext_scan {
+	struct ext_fs *fs;
+	uint32_t next_group;
+	uint64_t used_blocks;
+	uint64_t used_inodes;
+	int error;
+};
+
+/* Counts the blocks and inodes in use in the groups it claims, from their
+ * bitmaps, or from the descriptor for groups whose bitmaps were never
+ * written. */
+static void *ext_scan_worker(void *arg) {
+	struct ext_scan *scan = arg;
+	struct ext_fs *fs = scan->fs;
+	uint64_t used_blocks = 0, used_inodes = 0;
+	uint8_t *bitmap = malloc(fs->block_size);
+	uint32_t first, g;
+
+	if (!bitmap) {
+		__atomic_store_n(&scan->error, ENOMEM, __ATOMIC_RELAXED);
+		return NULL;
 	}
+	while ((first = __atomic_fetch_add(&scan->next_group,
+					   GROUPS_PER_CLAIM,
+					   __ATOMIC_RELAXED)) < fs->groups) {
+		for (g = first; g < fs->groups && g < first + GROUPS_PER_CLAIM;
+		     g++) {
+			uint32_t flags = ext_desc_field(fs, g, 0x12, 0, 1) &
+					 0xffff;
+			uint32_t group_blocks = ext_group_blocks(fs, g);
+			uint64_t free_blocks;
+
+			if (flags & EXT4_BG_BLOCK_UNINIT) {
+				free_blocks = ext_desc_field(fs, g, 0x0c,
+							     0x2c, 1);
+				if (free_blocks < group_blocks)
+					used_blocks += group_blocks -
+						       free_blocks;
+			} else if (read_at(fs->t, bitmap, fs->block_size,
+					   ext_desc_field(fs, g, 0x00, 0x20, 0) *
+					   fs->block_size) != fs->block_size) {
+				goto read_error;
+			} else {
+				used_blocks += count_bits(bitmap, group_blocks);
+			}
+
+			if (flags & EXT4_BG_INODE_UNINIT)
+				continue;
+			if (read_at(fs->t, bitmap, fs->block_size,
+				    ext_desc_field(fs, g, 0x04, 0x24, 0) *
+				    fs->block_size) != fs->block_size)
+				goto read_error;
+			used_inodes += count_bits(bitmap, fs->inodes_per_group);
+		}
+	}
+	free(bitmap);
+	__atomic_fetch_add(&scan->used_blocks, used_blocks, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&scan->used_inodes, used_inodes, __ATOMIC_RELAXED);
+	return NULL;
+
+read_error:
+	__atomic_store_n(&scan->error, errno ? errno : EIO, __ATOMIC_RELAXED);
+	/* Stop the others from claiming more. */
+	__atomic_store_n(&scan->next_group, fs->groups, __ATOMIC_RELAXED);
+	free(bitmap);
+	return NULL;
+}
+
+/* Roughly what resize2fs -M would shrink the filesystem to, estimated the
+ * way resize2fs -P does: enough groups for the inodes in use, and enough
+ * room in them for the data blocks in use besides each group's own
+ * metadata, with the same slack for flex_bg and extents.  Returns it in
+ * blocks. */
+static uint64_t ext_min_blocks(const struct ext_fs *fs, uint64_t used_blocks,
+			       uint64_t used_inodes) {
+	uint64_t overhead = 0, data, room = 0, min = fs->blocks;
+	uint32_t groups_for_inodes, g;
+
+	for (g = 0; g < fs->groups; g++) {
+		uint32_t group_overhead = ext_group_overhead(fs, g);
+		uint32_t group_blocks = ext_group_blocks(fs, g);
+
+		overhead += group_overhead < group_blocks ?
+			    group_overhead : group_blocks;
+	}
+	data = used_blocks > overhead ? used_blocks - overhead : 0;
+	groups_for_inodes = (used_inodes + fs->inodes_per_group - 1) /
+			    fs->inodes_per_group;
+	/* Room for the rest of a flex group's bitmaps and inode tables, so
+	 * that resizing can always finish. */
+	if (fs->groups_per_flex) {
+		uint32_t flex_groups = groups_for_inodes + fs->groups_per_flex -
+			(groups_for_inodes & (fs->groups_per_flex - 1));
+
+		if (flex_groups > fs->groups)
+			flex_groups = fs->groups;
+		data += (uint64_t)(2 + fs->inode_table_blocks) *
+			(flex_groups - groups_for_inodes);
+	}
+
+	for (g = 0; g < fs->groups; g++) {
+		uint32_t group_overhead = ext_group_overhead(fs, g);
+		uint32_t group_room = fs->blocks_per_group > group_overhead ?
+				      fs->blocks_per_group - group_overhead : 0;
+		uint64_t start = fs->first_data_block +
+				 (uint64_t)g * fs->blocks_per_group;
+
+		if (g + 1 >= groups_for_inodes && room + group_room >= data) {
+			/* resize2fs won't make a last group of under 50. */
+			min = start + group_overhead + 50 +
+			      (data - room < 50 ? 50 : data - room);
+			break;
+		}
+		room += group_room;
+	}
+	if (min >= fs->blocks)
+		return fs->blocks;
+
+	/* Moving blocks out of the end may need new extent tree blocks, at
+	 * worst one per inode or per run of data. */
+	if (fs->has_extents) {
+		uint64_t margin = (fs->blocks - min) / 500;
+		uint64_t per_block = fs->block_size / 12 - 1;
+		uint64_t worst = (data + per_block - 1) / per_block;
+
+		if (worst < used_inodes)
+			worst = used_inodes;
+		min += margin < worst ? margin : worst;
+	}
+	return min < fs->blocks ? min : fs->blocks;
+}
+
+static int online_cpus(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (n < 1)
+		return 1;
+	return n > MAX_WORKERS ? MAX_WORKERS : n;
+}
+
+/* Finds the minimum size of the ext{2,3,4} filesystem at t, scanning its
+ * block groups with a worker per CPU. */
+static int ext_min_size(const struct target *t, uint64_t *min_size,
+			uint64_t *used_blocks, uint32_t *block_size) {
+	pthread_t workers[MAX_WORKERS];
+	struct ext_scan scan;
+	struct ext_fs fs;
+	int num_workers, started, i;
+
+	if (ext_open(t, &fs))
+		return -1;
+
+	memset(&scan, 0, sizeof(scan));
+	scan.fs = &fs;
+	num_workers = online_cpus();
+	if (num_workers > (fs.groups + GROUPS_PER_CLAIM - 1) / GROUPS_PER_CLAIM)
+		num_workers = (fs.groups + GROUPS_PER_CLAIM - 1) /
+			      GROUPS_PER_CLAIM;
+	/* This thread is a worker too. */
+	for (started = 0; started < num_workers - 1; started++)
+		if (pthread_create(&workers[started], NULL, ext_scan_worker,
+				   &scan))
+			break;
+	ext_scan_worker(&scan);
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i], NULL);
+
+	if (scan.error) {
+		free(fs.gdt);
+		errno = scan.error;
+		return -1;
+	}
+
+	/* With 1K blocks, block 0 comes before the first group. */
+	*used_blocks = fs.first_data_block + scan.used_blocks;
+	*block_size = fs.block_size;
+	*min_size = ext_min_blocks(&fs, *used_blocks, scan.used_inodes) *
+		    fs.block_size;
+	free(fs.gdt);
+	return 0;
+}
+
+/* The image the last targets were in, kept open for the next ones. */
+static struct {
+	char *path;
+	int fd;
+	CgptShowParams gpt;
+	int have_gpt;
+} image = { .fd = -1 };
+
+static void close_image(void) {
+	if (image.fd >= 0)
+		close(image.fd);
+	free(image.path);
+	free(image.gpt.partitions);
+	memset(&image, 0, sizeof(image));
+	image.fd = -1;
+}
+
+static int open_image(const char *path, size_t len) {
+	char *name;
+	int fd;
+
+	if (image.path && strlen(image.path) == len &&
+	    !strncmp(image.path, path, len))
+		return 0;
+
+	close_image();
+	name = strndup(path, len);
+	if (!name)
+		return -1;
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "e2size: %s: %s\n", name, strerror(errno));
+		free(name);
+		return -1;
+	}
+	/* Only an image that opened is kept for the targets after. */
+	image.path = name;
+	image.fd = fd;
+	return 0;
+}
+
+static void print_cgpt_error(void *ctx, const char *message) {
+	fprintf(stderr, "e2size: %s: %s", image.path, message);
+}
+
+/* Finds partition partnum of the image through its GPT. */
+static int find_partition(uint32_t partnum, struct target *t) {
+	int i;
+
+	if (!image.have_gpt) {
+		image.gpt.drive_name = image.path;
+		CgptSetErrorHandler(print_cgpt_error, NULL);
+		i = CgptGetPartitions(&image.gpt);
+		CgptSetErrorHandler(NULL, NULL);
+		if (i != CGPT_OK)
+			return -1;
+		image.have_gpt = 1;
+	}
+
+	for (i = 0; i < image.gpt.num_partitions; i++) {
+		const CgptPartitionInfo *info = &image.gpt.partitions[i];
+
+		if (info->partition != partnum)
+			continue;
+		t->offset = info->begin * image.gpt.sector_bytes;
+		t->limit = info->size * image.gpt.sector_bytes;
+		return 0;
+	}
+	fprintf(stderr, "e2size: %s: no partition %u\n", image.path, partnum);
+	return -1;
+}
+
+/* Parses a number, decimal or 0x hex, that is the whole of str. */
+static int parse_number(const char *str, uint64_t *value) {
+	char *end;
+
+	if (*str < '0' || *str > '9')
+		return -1;
+	errno = 0;
+	*value = strtoull(str, &end, 0);
+	return errno || *end ? -1 : 0;
+}
+
+/* Opens a target: a device or file, a partition of an image as
+ * image:partnum, or whatever lies at a byte offset of it as image@offset. */
+static int open_target(const char *arg, struct target *t) {
+	const char *sep = NULL;
+	uint64_t value = 0;
+	struct stat st;
+
+	memset(t, 0, sizeof(*t));
+	if (stat(arg, &st)) {
+		const char *at = strrchr(arg, '@');
+		const char *colon = strrchr(arg, ':');
+
+		sep = at > colon ? at : colon;
+		if (!sep || sep == arg || parse_number(sep + 1, &value) ||
+		    (*sep == ':' && (!value || value > UINT32_MAX))) {
+			fprintf(stderr, "e2size: %s: %s\n", arg,
+				strerror(errno = ENOENT));
+			return -1;
+		}
+	}
+
+	if (open_image(arg, sep ? sep - arg : strlen(arg)))
+		return -1;
+	t->fd = image.fd;
+	if (sep && *sep == '@')
+		t->offset = value;
+	else if (sep && find_partition(value, t))
+		return -1;
+	return 0;
+}
+
+static void usage() {
+	fprintf(stderr,
+		"Usage: e2size [-m] <target>...\n"
+		"Prints the size of the filesystem at each target, which is a\n"
+		"device or file, image:partnum for a partition inside a GPT\n"
+		"disk image, or image@offset for one at a byte offset into it.\n"
+		"With several targets, each size is followed by its target.\n"
+		"\n"
+		"  -m  print the size an ext2/3/4 filesystem could be shrunk\n"
+		"      to instead, followed by its used blocks and block size\n");
+}
+
+static void print_error(const char *target, const char *unsupported) {
+	if (errno == EINVAL)
+		fprintf(stderr, "e2size: %s: no %s filesystem found\n",
+			target, unsupported);
+	else if (errno == ENOTSUP)
+		fprintf(stderr, "e2size: %s: filesystem features not "
+			"supported\n", target);
+	else
+		fprintf(stderr, "e2size: %s: %s\n", target, strerror(errno));
+}
+
+int main(int argc, char *argv[]) {
+	uint64_t fs_size_bytes, used_blocks;
+	uint32_t block_size;
+	struct target t;
+	int min_size = 0;
+	int retc = 0;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "m")) != -1) {
+		switch (c) {
+		case 'm':
+			min_size = 1;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		return 1;
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (open_target(argv[i], &t)) {
+			retc = 1;
+			continue;
+		}
+
+		if (min_size) {
+			if (ext_min_size(&t, &fs_size_bytes, &used_blocks,
+					 &block_size)) {
+				print_error(argv[i], "ext2/3/4");
+				retc = 1;
+				continue;
+			}
+			printf("%" PRIu64 "\t%" PRIu64 "\t%u", fs_size_bytes,
+			       used_blocks, block_size);
+		} else {
+			if (fs_size(&t, &fs_size_bytes)) {
+				print_error(argv[i], "supported");
+				retc = 1;
+				continue;
+			}
+			printf("%" PRIu64, fs_size_bytes);
+		}
+
+		if (argc - optind > 1)
+			printf("\t%s", argv[i]);
+		printf("\n");
+	}
+
+	close_image();
 	return retc;
 }
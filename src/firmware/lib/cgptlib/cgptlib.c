@@ -12,6 +12,145 @@
 #include "utility.h"
 #include "vboot_api.h"
 
+/* Returns non-zero if GptNextKernelEntry() may pick entry e. */
+static int IsBootableKernel(const GptEntry *e)
+{
+	return IsKernelEntry(e) && GetEntryPriority(e) > 0 &&
+		(GetEntrySuccessful(e) || GetEntryTries(e));
+}
+
+static uint32_t KernelIndexEntries(GptData *gpt)
+{
+	GptHeader *header = (GptHeader *)gpt->primary_header;
+
+	if (header->number_of_entries > GPT_MAX_TABLE_ENTRIES)
+		return GPT_MAX_TABLE_ENTRIES;
+	return header->number_of_entries;
+}
+
+/*
+ * Build gpt->kernel_order.  Priorities only have 4 bits, so a counting sort
+ * over the entries (visited in index order) yields the final order directly.
+ */
+static void BuildKernelIndex(GptData *gpt)
+{
+	GptEntry *entries = (GptEntry *)gpt->primary_entries;
+	uint32_t start[CGPT_ATTRIBUTE_MAX_PRIORITY + 2];
+	uint32_t count = KernelIndexEntries(gpt);
+	uint32_t i;
+	int prio;
+
+	/* Before reading the entries, so changes made meanwhile are seen. */
+	gpt->kernel_index_generation = GetEntryAttributesGeneration();
+	Memset(start, 0, sizeof(start));
+	for (i = 0; i < count; i++) {
+		if (IsBootableKernel(entries + i))
+			start[GetEntryPriority(entries + i)]++;
+	}
+
+	/* Highest priority first. */
+	gpt->kernel_count = 0;
+	for (prio = CGPT_ATTRIBUTE_MAX_PRIORITY; prio > 0; prio--) {
+		uint32_t n = start[prio];
+
+		start[prio] = gpt->kernel_count;
+		gpt->kernel_count += n;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!IsBootableKernel(entries + i))
+			continue;
+		prio = GetEntryPriority(entries + i);
+		gpt->kernel_order[start[prio]] = i;
+		gpt->kernel_prio[start[prio]] = prio;
+		start[prio]++;
+	}
+
+	gpt->kernel_index_valid = 1;
+	gpt->cursor_kernel = 0;
+	gpt->cursor_priority = -1;
+}
+
+/* Returns non-zero if no entry attributes changed since the index was made. */
+static int KernelIndexFresh(GptData *gpt)
+{
+	return gpt->kernel_index_valid &&
+		gpt->kernel_index_generation == GetEntryAttributesGeneration();
+}
+
+/*
+ * Returns non-zero if position pos of the kernel index comes after the
+ * kernel described by (kernel, priority), following the rules of the
+ * original entries scan: a found kernel continues with later entries of the
+ * same priority, otherwise only lower priorities are eligible.
+ */
+static int KernelIndexAfter(GptData *gpt, uint32_t pos, int kernel,
+			    int priority)
+{
+	int prio = gpt->kernel_prio[pos];
+
+	if (prio != priority)
+		return prio < priority;
+	return kernel != CGPT_KERNEL_ENTRY_NOT_FOUND &&
+		gpt->kernel_order[pos] > kernel;
+}
+
+/* Binary search for the first position after (kernel, priority). */
+static uint32_t KernelIndexFind(GptData *gpt, int kernel, int priority)
+{
+	uint32_t lo = 0, hi = gpt->kernel_count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (KernelIndexAfter(gpt, mid, kernel, priority))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+/* Re-file entry i in the kernel index after its attributes changed. */
+static void UpdateKernelIndex(GptData *gpt, uint32_t i)
+{
+	GptEntry *e = (GptEntry *)gpt->primary_entries + i;
+	uint32_t pos, n;
+
+	if (!gpt->kernel_index_valid)
+		return;
+
+	for (pos = 0; pos < gpt->kernel_count; pos++) {
+		if (gpt->kernel_order[pos] == i)
+			break;
+	}
+	if (pos < gpt->kernel_count) {
+		for (n = pos + 1; n < gpt->kernel_count; n++) {
+			gpt->kernel_order[n - 1] = gpt->kernel_order[n];
+			gpt->kernel_prio[n - 1] = gpt->kernel_prio[n];
+		}
+		gpt->kernel_count--;
+	}
+
+	if (IsBootableKernel(e) && i < GPT_MAX_TABLE_ENTRIES) {
+		int prio = GetEntryPriority(e);
+
+		/* Insert before the first entry that sorts after it. */
+		pos = KernelIndexFind(gpt, i, prio);
+		for (n = gpt->kernel_count; n > pos; n--) {
+			gpt->kernel_order[n] = gpt->kernel_order[n - 1];
+			gpt->kernel_prio[n] = gpt->kernel_prio[n - 1];
+		}
+		gpt->kernel_order[pos] = i;
+		gpt->kernel_prio[pos] = prio;
+		gpt->kernel_count++;
+	}
+
+	/* Positions moved; make the next call search again. */
+	gpt->cursor_priority = -1;
+	gpt->kernel_index_generation = GetEntryAttributesGeneration();
+}
+
 int GptInit(GptData *gpt)
 {
 	int retval;
@@ -19,6 +158,7 @@ int GptInit(GptData *gpt)
 	gpt->modified = 0;
 	gpt->current_kernel = CGPT_KERNEL_ENTRY_NOT_FOUND;
 	gpt->current_priority = 999;
+	gpt->kernel_index_valid = 0;
 
 	retval = GptSanityCheck(gpt);
 	if (GPT_SUCCESS != retval) {
@@ -26,86 +166,53 @@ int GptInit(GptData *gpt)
 		return retval;
 	}
 
-	return GptRepair(gpt);
+	retval = GptRepair(gpt);
+	if (GPT_SUCCESS == retval)
+		BuildKernelIndex(gpt);
+
+	return retval;
 }
 
 int GptNextKernelEntry(GptData *gpt, uint64_t *start_sector, uint64_t *size)
 {
-	GptHeader *header = (GptHeader *)gpt->primary_header;
 	GptEntry *entries = (GptEntry *)gpt->primary_entries;
 	GptEntry *e;
-	int new_kernel = CGPT_KERNEL_ENTRY_NOT_FOUND;
-	int new_prio = 0;
-	uint32_t i;
+	uint32_t pos;
 
-	/*
-	 * If we already found a kernel, continue the scan at the current
-	 * kernel's priority, in case there is another kernel with the same
-	 * priority.
-	 */
-	if (gpt->current_kernel != CGPT_KERNEL_ENTRY_NOT_FOUND) {
-		for (i = gpt->current_kernel + 1;
-		     i < header->number_of_entries; i++) {
-			e = entries + i;
-			if (!IsKernelEntry(e))
-				continue;
-			VBDEBUG(("GptNextKernelEntry looking at same prio "
-				 "partition %d\n", i+1));
-			VBDEBUG(("GptNextKernelEntry s%d t%d p%d\n",
-				 GetEntrySuccessful(e), GetEntryTries(e),
-				 GetEntryPriority(e)));
-			if (!(GetEntrySuccessful(e) || GetEntryTries(e)))
-				continue;
-			if (GetEntryPriority(e) == gpt->current_priority) {
-				gpt->current_kernel = i;
-				*start_sector = e->starting_lba;
-				*size = e->ending_lba - e->starting_lba + 1;
-				VBDEBUG(("GptNextKernelEntry likes it\n"));
-				return GPT_SUCCESS;
-			}
-		}
-	}
+	if (!KernelIndexFresh(gpt))
+		BuildKernelIndex(gpt);
 
 	/*
-	 * We're still here, so scan for the remaining kernel with the highest
-	 * priority less than the previous attempt.
+	 * Continue right after the previous kernel, if this call follows the
+	 * previous one; otherwise look up where that kernel sits.
 	 */
-	for (i = 0, e = entries; i < header->number_of_entries; i++, e++) {
-		int current_prio = GetEntryPriority(e);
-		if (!IsKernelEntry(e))
-			continue;
-		VBDEBUG(("GptNextKernelEntry looking at new prio "
-			 "partition %d\n", i+1));
-		VBDEBUG(("GptNextKernelEntry s%d t%d p%d\n",
-			 GetEntrySuccessful(e), GetEntryTries(e),
-			 GetEntryPriority(e)));
-		if (!(GetEntrySuccessful(e) || GetEntryTries(e)))
-			continue;
-		if (current_prio >= gpt->current_priority) {
-			/* Already returned this kernel in a previous call */
-			continue;
-		}
-		if (current_prio > new_prio) {
-			new_kernel = i;
-			new_prio = current_prio;
-		}
-	}
-
-	/*
-	 * Save what we found.  Note that if we didn't find a new kernel,
-	 * new_prio will still be -1, so future calls to this function will
-	 * also fail.
-	 */
-	gpt->current_kernel = new_kernel;
-	gpt->current_priority = new_prio;
+	if (gpt->cursor_kernel == gpt->current_kernel &&
+	    gpt->cursor_priority == gpt->current_priority)
+		pos = gpt->kernel_cursor;
+	else
+		pos = KernelIndexFind(gpt, gpt->current_kernel,
+				      gpt->current_priority);
 
-	if (CGPT_KERNEL_ENTRY_NOT_FOUND == new_kernel) {
+	if (pos >= gpt->kernel_count) {
+		/*
+		 * With priority 0 no kernel sorts after this point, so future
+		 * calls to this function will also fail.
+		 */
+		gpt->current_kernel = CGPT_KERNEL_ENTRY_NOT_FOUND;
+		gpt->current_priority = 0;
 		VBDEBUG(("GptNextKernelEntry no more kernels\n"));
 		return GPT_ERROR_NO_VALID_KERNEL;
 	}
 
-	VBDEBUG(("GptNextKernelEntry likes partition %d\n", new_kernel + 1));
-	e = entries + new_kernel;
+	gpt->current_kernel = gpt->kernel_order[pos];
+	gpt->current_priority = gpt->kernel_prio[pos];
+	gpt->kernel_cursor = pos + 1;
+	gpt->cursor_kernel = gpt->current_kernel;
+	gpt->cursor_priority = gpt->current_priority;
+
+	VBDEBUG(("GptNextKernelEntry likes partition %d\n",
+		 gpt->current_kernel + 1));
+	e = entries + gpt->current_kernel;
 	*start_sector = e->starting_lba;
 	*size = e->ending_lba - e->starting_lba + 1;
 	return GPT_SUCCESS;
@@ -116,12 +223,16 @@ int GptUpdateKernelEntry(GptData *gpt, uint32_t update_type)
 	GptEntry *entries = (GptEntry *)gpt->primary_entries;
 	GptEntry *e = entries + gpt->current_kernel;
 	int modified = 0;
+	int index_fresh;
 
 	if (gpt->current_kernel == CGPT_KERNEL_ENTRY_NOT_FOUND)
 		return GPT_ERROR_INVALID_UPDATE_TYPE;
 	if (!IsKernelEntry(e))
 		return GPT_ERROR_INVALID_UPDATE_TYPE;
 
+	/* Only an index that was up to date can be patched for this entry. */
+	index_fresh = KernelIndexFresh(gpt);
+
 	switch (update_type) {
 	case GPT_UPDATE_ENTRY_TRY: {
 		/* Used up a try */
@@ -160,6 +271,10 @@ int GptUpdateKernelEntry(GptData *gpt, uint32_t update_type)
 	}
 
 	if (modified) {
+		if (index_fresh)
+			UpdateKernelIndex(gpt, gpt->current_kernel);
+		else
+			gpt->kernel_index_valid = 0;
 		return GptModified(gpt);
 	}
 
@@ -10,20 +10,44 @@
 #include "crc32.h"
 #include "gpt.h"
 #include "utility.h"
+#include "vboot_api.h"
 
 
+uint32_t GptEntriesSectors(uint32_t entries_bytes, uint32_t sector_bytes)
+{
+	return (entries_bytes + sector_bytes - 1) / sector_bytes;
+}
+
+uint32_t GptEntriesBytes(const GptData *gpt)
+{
+	return gpt->entries_bytes ? gpt->entries_bytes : TOTAL_ENTRIES_SIZE;
+}
+
+uint64_t GptHeaderEntriesBytes(const GptHeader *h)
+{
+	return (uint64_t)h->number_of_entries * h->size_of_entry;
+}
+
 int CheckParameters(GptData *gpt)
 {
-	/* Currently, we only support 512-byte sectors. */
-	if (gpt->sector_bytes != 512)
+	/* We support 512-byte and native 4K (4Kn) sectors. */
+	if (gpt->sector_bytes != GPT_MIN_SECTOR_BYTES &&
+	    gpt->sector_bytes != GPT_MAX_SECTOR_BYTES)
 		return GPT_ERROR_INVALID_SECTOR_SIZE;
 
+	if (gpt->entries_bytes && (gpt->entries_bytes < TOTAL_ENTRIES_SIZE ||
+				   gpt->entries_bytes > GPT_MAX_ENTRIES_SIZE ||
+				   gpt->entries_bytes % sizeof(GptEntry)))
+		return GPT_ERROR_INVALID_ENTRIES;
+
 	/*
 	 * Sector count of a drive should be reasonable. If the given value is
 	 * too small to contain basic GPT structure (PMBR + Headers + Entries),
 	 * the value is wrong.
 	 */
-	if (gpt->drive_sectors < (1 + 2 * (1 + GPT_ENTRIES_SECTORS)))
+	if (gpt->drive_sectors <
+	    (1 + 2 * (1 + GptEntriesSectors(GptEntriesBytes(gpt),
+					    gpt->sector_bytes))))
 		return GPT_ERROR_INVALID_SECTOR_NUMBER;
 
 	return GPT_SUCCESS;
@@ -42,8 +66,12 @@ uint32_t HeaderCrc(GptHeader *h)
 	return crc32;
 }
 
-int CheckHeader(GptHeader *h, int is_secondary, uint64_t drive_sectors)
+int CheckHeader(GptHeader *h, int is_secondary, uint64_t drive_sectors,
+		uint32_t sector_bytes)
 {
+	uint64_t entries_bytes;
+	uint32_t entries_sectors;
+
 	if (!h)
 		return 1;
 
@@ -77,10 +105,13 @@ int CheckHeader(GptHeader *h, int is_secondary, uint64_t drive_sectors)
 	 */
 	if (h->size_of_entry != sizeof(GptEntry))
 		return 1;
+	entries_bytes = GptHeaderEntriesBytes(h);
 	if ((h->number_of_entries < MIN_NUMBER_OF_ENTRIES) ||
 	    (h->number_of_entries > MAX_NUMBER_OF_ENTRIES) ||
-	    (h->number_of_entries * h->size_of_entry != TOTAL_ENTRIES_SIZE))
+	    (entries_bytes < TOTAL_ENTRIES_SIZE) ||
+	    (entries_bytes > GPT_MAX_ENTRIES_SIZE))
 		return 1;
+	entries_sectors = GptEntriesSectors(entries_bytes, sector_bytes);
 
 	/*
 	 * Check locations for the header and its entries.  The primary
@@ -90,7 +121,7 @@ int CheckHeader(GptHeader *h, int is_secondary, uint64_t drive_sectors)
 	if (is_secondary) {
 		if (h->my_lba != drive_sectors - 1)
 			return 1;
-		if (h->entries_lba != h->my_lba - GPT_ENTRIES_SECTORS)
+		if (h->entries_lba != h->my_lba - entries_sectors)
 			return 1;
 	} else {
 		if (h->my_lba != 1)
@@ -104,9 +135,9 @@ int CheckHeader(GptHeader *h, int is_secondary, uint64_t drive_sectors)
 	 * LastUsableLBA must be before the start of the secondary GPT table
 	 * array.  FirstUsableLBA <= LastUsableLBA.
 	 */
-	if (h->first_usable_lba < 2 + GPT_ENTRIES_SECTORS)
+	if (h->first_usable_lba < 2 + entries_sectors)
 		return 1;
-	if (h->last_usable_lba >= drive_sectors - 1 - GPT_ENTRIES_SECTORS)
+	if (h->last_usable_lba >= drive_sectors - 1 - entries_sectors)
 		return 1;
 	if (h->first_usable_lba > h->last_usable_lba)
 		return 1;
@@ -127,19 +158,16 @@ int IsKernelEntry(const GptEntry *e)
 	return !Memcmp(&e->type, &chromeos_kernel, sizeof(Guid));
 }
 
-int CheckEntries(GptEntry *entries, GptHeader *h)
+/*
+ * Original pairwise validation.  Only used once CheckUsedEntries() has found
+ * a problem, so the error reported for a bad table (and which entry it is
+ * reported against) stays exactly what it has always been.
+ */
+static int CheckEntriesPairwise(GptEntry *entries, GptHeader *h)
 {
 	GptEntry *entry;
-	uint32_t crc32;
 	uint32_t i;
 
-	/* Check CRC before examining entries. */
-	crc32 = Crc32((const uint8_t *)entries,
-		      h->size_of_entry * h->number_of_entries);
-	if (crc32 != h->entries_crc32)
-		return GPT_ERROR_CRC_CORRUPTED;
-
-	/* Check all entries. */
 	for (i = 0, entry = entries; i < h->number_of_entries; i++, entry++) {
 		GptEntry *e2;
 		uint32_t i2;
@@ -173,6 +201,141 @@ int CheckEntries(GptEntry *entries, GptHeader *h)
 		}
 	}
 
+	return 0;
+}
+
+typedef int (*EntryCompare)(const GptEntry *a, const GptEntry *b);
+
+static int CompareStartLba(const GptEntry *a, const GptEntry *b)
+{
+	if (a->starting_lba != b->starting_lba)
+		return a->starting_lba < b->starting_lba ? -1 : 1;
+	return 0;
+}
+
+static int CompareUniqueGuid(const GptEntry *a, const GptEntry *b)
+{
+	return Memcmp(&a->unique, &b->unique, sizeof(Guid));
+}
+
+/* Heapsort 'order', a list of n indexes into 'entries'. */
+static void SortEntryIndexes(GptEntry *entries, uint16_t *order, uint32_t n,
+			     EntryCompare cmp)
+{
+	uint32_t start, end, root, child;
+	uint16_t tmp;
+
+	if (n < 2)
+		return;
+
+	for (start = n / 2; start-- > 0; ) {
+		for (root = start; (child = 2 * root + 1) < n; root = child) {
+			if (child + 1 < n && cmp(&entries[order[child]],
+						 &entries[order[child + 1]]) < 0)
+				child++;
+			if (cmp(&entries[order[root]],
+				&entries[order[child]]) >= 0)
+				break;
+			tmp = order[root];
+			order[root] = order[child];
+			order[child] = tmp;
+		}
+	}
+
+	for (end = n - 1; end > 0; end--) {
+		tmp = order[0];
+		order[0] = order[end];
+		order[end] = tmp;
+		for (root = 0; (child = 2 * root + 1) < end; root = child) {
+			if (child + 1 < end && cmp(&entries[order[child]],
+						   &entries[order[child + 1]]) < 0)
+				child++;
+			if (cmp(&entries[order[root]],
+				&entries[order[child]]) >= 0)
+				break;
+			tmp = order[root];
+			order[root] = order[child];
+			order[child] = tmp;
+		}
+	}
+}
+
+uint32_t SortEntriesByStart(GptEntry *entries, GptHeader *h, uint16_t *order)
+{
+	uint32_t used = 0;
+	uint32_t i;
+
+	for (i = 0; i < h->number_of_entries; i++) {
+		if (!IsUnusedEntry(entries + i))
+			order[used++] = i;
+	}
+	SortEntryIndexes(entries, order, used, CompareStartLba);
+	return used;
+}
+
+/*
+ * O(n log n) check of the used entries.  Returns 0 if the pairwise check
+ * would pass, non-zero if it would fail.
+ */
+static int CheckUsedEntries(GptEntry *entries, GptHeader *h)
+{
+	uint16_t order[MAX_NUMBER_OF_ENTRIES];
+	uint64_t max_end;
+	uint32_t used;
+	uint32_t i;
+
+	if (h->number_of_entries > MAX_NUMBER_OF_ENTRIES)
+		return 1;
+
+	used = SortEntriesByStart(entries, h, order);
+	for (i = 0; i < used; i++) {
+		GptEntry *entry = entries + order[i];
+
+		if ((entry->starting_lba < h->first_usable_lba) ||
+		    (entry->ending_lba > h->last_usable_lba) ||
+		    (entry->ending_lba < entry->starting_lba))
+			return 1;
+	}
+
+	/*
+	 * With every range well formed, two entries fail the endpoint checks
+	 * exactly when their ranges intersect, which after sorting by start
+	 * shows up as a start at or before the furthest end seen so far.
+	 */
+	for (i = 1, max_end = 0; i < used; i++) {
+		GptEntry *prev = entries + order[i - 1];
+
+		if (prev->ending_lba > max_end)
+			max_end = prev->ending_lba;
+		if (entries[order[i]].starting_lba <= max_end)
+			return 1;
+	}
+
+	/* Equal UniqueGuids end up next to each other. */
+	SortEntryIndexes(entries, order, used, CompareUniqueGuid);
+	for (i = 1; i < used; i++) {
+		if (!CompareUniqueGuid(entries + order[i - 1],
+				       entries + order[i]))
+			return 1;
+	}
+
+	return 0;
+}
+
+int CheckEntries(GptEntry *entries, GptHeader *h)
+{
+	uint32_t crc32;
+
+	/* Check CRC before examining entries. */
+	crc32 = Crc32((const uint8_t *)entries,
+		      h->size_of_entry * h->number_of_entries);
+	if (crc32 != h->entries_crc32)
+		return GPT_ERROR_CRC_CORRUPTED;
+
+	/* Check all entries. */
+	if (CheckUsedEntries(entries, h))
+		return CheckEntriesPairwise(entries, h);
+
 	/* Success */
 	return 0;
 }
@@ -203,13 +366,69 @@ int HeaderFieldsSame(GptHeader *h1, GptHeader *h2)
 	return 0;
 }
 
+static int TimedCheckHeader(GptData *gpt, GptHeader *h, int is_secondary)
+{
+	uint64_t start = VbExGetTimer();
+	int retval = CheckHeader(h, is_secondary, gpt->drive_sectors,
+				 gpt->sector_bytes);
+
+	/* The tables we have are all of one size; others can't be checked. */
+	if (!retval && GptHeaderEntriesBytes(h) != GptEntriesBytes(gpt))
+		retval = 1;
+
+	gpt->stats.header_checks++;
+	gpt->stats.header_check_time += VbExGetTimer() - start;
+	return retval;
+}
+
+static int TimedCheckEntries(GptData *gpt, GptEntry *entries, GptHeader *h)
+{
+	uint64_t start = VbExGetTimer();
+	int retval = CheckEntries(entries, h);
+
+	gpt->stats.entries_checks++;
+	gpt->stats.entries_check_time += VbExGetTimer() - start;
+	return retval;
+}
+
+/*
+ * Check both entries tables against header h, setting the matching bits of
+ * gpt->valid_entries.  In the common case where the tables are byte for byte
+ * identical the verdict for the primary table holds for the secondary too.
+ */
+static void CheckBothEntries(GptData *gpt, GptHeader *h)
+{
+	GptEntry *entries1 = (GptEntry *)(gpt->primary_entries);
+	GptEntry *entries2 = (GptEntry *)(gpt->secondary_entries);
+	GptHeader *header1 = (GptHeader *)(gpt->primary_header);
+	GptHeader *header2 = (GptHeader *)(gpt->secondary_header);
+	int valid1;
+
+	valid1 = (0 == TimedCheckEntries(gpt, entries1, h));
+	if (valid1)
+		gpt->valid_entries |= MASK_PRIMARY;
+
+	if (gpt->unverified & MASK_SECONDARY)
+		return;
+
+	if (header1->entries_crc32 == header2->entries_crc32 &&
+	    0 == Memcmp(entries1, entries2,
+			(uint64_t)h->size_of_entry * h->number_of_entries)) {
+		gpt->stats.entries_checks_skipped++;
+		if (valid1)
+			gpt->valid_entries |= MASK_SECONDARY;
+		return;
+	}
+
+	if (0 == TimedCheckEntries(gpt, entries2, h))
+		gpt->valid_entries |= MASK_SECONDARY;
+}
+
 int GptSanityCheck(GptData *gpt)
 {
 	int retval;
 	GptHeader *header1 = (GptHeader *)(gpt->primary_header);
 	GptHeader *header2 = (GptHeader *)(gpt->secondary_header);
-	GptEntry *entries1 = (GptEntry *)(gpt->primary_entries);
-	GptEntry *entries2 = (GptEntry *)(gpt->secondary_entries);
 	GptHeader *goodhdr = NULL;
 
 	gpt->valid_headers = 0;
@@ -220,11 +439,12 @@ int GptSanityCheck(GptData *gpt)
 		return retval;
 
 	/* Check both headers; we need at least one valid header. */
-	if (0 == CheckHeader(header1, 0, gpt->drive_sectors)) {
+	if (0 == TimedCheckHeader(gpt, header1, 0)) {
 		gpt->valid_headers |= MASK_PRIMARY;
 		goodhdr = header1;
 	}
-	if (0 == CheckHeader(header2, 1, gpt->drive_sectors)) {
+	if (!(gpt->unverified & MASK_SECONDARY) &&
+	    0 == TimedCheckHeader(gpt, header2, 1)) {
 		gpt->valid_headers |= MASK_SECONDARY;
 		if (!goodhdr)
 			goodhdr = header2;
@@ -240,20 +460,14 @@ int GptSanityCheck(GptData *gpt)
 	 * catch the case where (header1,entries1) and (header2,entries2) are
 	 * both valid, but (entries1 != entries2).
 	 */
-	if (0 == CheckEntries(entries1, goodhdr))
-		gpt->valid_entries |= MASK_PRIMARY;
-	if (0 == CheckEntries(entries2, goodhdr))
-		gpt->valid_entries |= MASK_SECONDARY;
+	CheckBothEntries(gpt, goodhdr);
 
 	/*
 	 * If both headers are good but neither entries were good, check the
 	 * entries with the secondary header.
 	 */
 	if (MASK_BOTH == gpt->valid_headers && !gpt->valid_entries) {
-		if (0 == CheckEntries(entries1, header2))
-			gpt->valid_entries |= MASK_PRIMARY;
-		if (0 == CheckEntries(entries2, header2))
-			gpt->valid_entries |= MASK_SECONDARY;
+		CheckBothEntries(gpt, header2);
 		if (gpt->valid_entries) {
 			/*
 			 * Sure enough, header2 had a good CRC for one of the
@@ -286,7 +500,8 @@ static int GptRecomputeSize(GptData *gpt)
 	uint32_t was_valid;
 
 	alt_lba = gpt->drive_sectors - 1;
-	alt_entries_lba = alt_lba - GPT_ENTRIES_SECTORS;
+	alt_entries_lba = alt_lba - GptEntriesSectors(GptEntriesBytes(gpt),
+						      gpt->sector_bytes);
 	last_usable_lba = alt_entries_lba - 1;
 
 	/* If the preferred header matches the above values based on the
@@ -363,14 +578,16 @@ int GptRepair(GptData *gpt)
 		Memcpy(header2, header1, sizeof(GptHeader));
 		header2->my_lba = gpt->drive_sectors - 1;
 		header2->alternate_lba = 1;
-		header2->entries_lba = header2->my_lba - GPT_ENTRIES_SECTORS;
+		header2->entries_lba = header2->my_lba -
+			GptEntriesSectors(GptEntriesBytes(gpt),
+					  gpt->sector_bytes);
 		header2->header_crc32 = HeaderCrc(header2);
 		gpt->modified |= GPT_MODIFIED_HEADER2;
 	}
 	else if (MASK_SECONDARY == gpt->valid_headers) {
 		/* Secondary is good, primary is bad */
 		Memcpy(header1, header2, sizeof(GptHeader));
-		header1->my_lba = 1;
+		header1->my_lba = GPT_PRIMARY_HEADER_LBA;
 		header1->alternate_lba = gpt->drive_sectors - 1;
 		header1->entries_lba = header1->my_lba + 1;
 		header1->header_crc32 = HeaderCrc(header1);
@@ -383,11 +600,13 @@ int GptRepair(GptData *gpt)
 	if (MASK_PRIMARY == gpt->valid_entries) {
 		/* Primary is good, secondary is bad */
 		Memcpy(entries2, entries1, entries_size);
+		GptEntriesUntrackCrc(gpt, MASK_SECONDARY);
 		gpt->modified |= GPT_MODIFIED_ENTRIES2;
 	}
 	else if (MASK_SECONDARY == gpt->valid_entries) {
 		/* Secondary is good, primary is bad */
 		Memcpy(entries1, entries2, entries_size);
+		GptEntriesUntrackCrc(gpt, MASK_PRIMARY);
 		gpt->modified |= GPT_MODIFIED_ENTRIES1;
 	}
 	gpt->valid_entries = MASK_BOTH;
@@ -395,6 +614,23 @@ int GptRepair(GptData *gpt)
 	return GPT_SUCCESS;
 }
 
+/*
+ * Bumped by every change to the partition attributes, so a GptData can tell
+ * whether its kernel index may have gone stale whichever table the changed
+ * entry belongs to.
+ */
+static uint32_t entry_attributes_generation;
+
+uint32_t GetEntryAttributesGeneration(void)
+{
+	return __atomic_load_n(&entry_attributes_generation, __ATOMIC_RELAXED);
+}
+
+void EntryAttributesChanged(void)
+{
+	__atomic_fetch_add(&entry_attributes_generation, 1, __ATOMIC_RELAXED);
+}
+
 int GetEntryLegacyBootable(const GptEntry *e)
 {
 	return !!(e->attrs.whole & CGPT_ATTRIBUTE_LEGACY_BOOTABLE);
@@ -432,6 +668,7 @@ void SetEntrySuccessful(GptEntry *e, int successful)
 		e->attrs.fields.gpt_att |= CGPT_ATTRIBUTE_SUCCESSFUL_MASK;
 	else
 		e->attrs.fields.gpt_att &= ~CGPT_ATTRIBUTE_SUCCESSFUL_MASK;
+	EntryAttributesChanged();
 }
 
 void SetEntryPriority(GptEntry *e, int priority)
@@ -440,6 +677,7 @@ void SetEntryPriority(GptEntry *e, int priority)
 	e->attrs.fields.gpt_att |=
 		(priority << CGPT_ATTRIBUTE_PRIORITY_OFFSET) &
 		CGPT_ATTRIBUTE_PRIORITY_MASK;
+	EntryAttributesChanged();
 }
 
 void SetEntryTries(GptEntry *e, int tries)
@@ -447,6 +685,7 @@ void SetEntryTries(GptEntry *e, int tries)
 	e->attrs.fields.gpt_att &= ~CGPT_ATTRIBUTE_TRIES_MASK;
 	e->attrs.fields.gpt_att |= (tries << CGPT_ATTRIBUTE_TRIES_OFFSET) &
 		CGPT_ATTRIBUTE_TRIES_MASK;
+	EntryAttributesChanged();
 }
 
 void GetCurrentKernelUniqueGuid(GptData *gpt, void *dest)
@@ -460,6 +699,7 @@ int GptModified(GptData *gpt) {
 	GptHeader *header = (GptHeader *)gpt->primary_header;
 
 	/* Update the CRCs */
+	GptEntriesUntrackCrc(gpt, MASK_BOTH);
 	header->entries_crc32 = Crc32(gpt->primary_entries,
 				      header->size_of_entry *
 				      header->number_of_entries);
@@ -527,3 +767,152 @@ const char *GptErrorText(int error_code)
 	};
 	return "Unknown";
 }
+
+static uint8_t *GptEntriesTable(GptData *gpt, int table)
+{
+	return table ? gpt->secondary_entries : gpt->primary_entries;
+}
+
+static GptHeader *GptEntriesHeader(GptData *gpt, int table)
+{
+	return (GptHeader *)(table ? gpt->secondary_header :
+			     gpt->primary_header);
+}
+
+void GptEntriesTrackCrc(GptData *gpt, uint32_t mask)
+{
+	int table;
+
+	for (table = 0; table < 2; table++) {
+		uint32_t bit = table ? MASK_SECONDARY : MASK_PRIMARY;
+		GptHeader *h = GptEntriesHeader(gpt, table);
+
+		if (!(mask & bit) || !(gpt->valid_headers & bit) ||
+		    !(gpt->valid_entries & bit) || (gpt->crc_tracked & bit))
+			continue;
+		if (GptHeaderEntriesBytes(h) != GptEntriesBytes(gpt))
+			continue;
+		Memset(gpt->crc_dirty[table], 0, sizeof(gpt->crc_dirty[table]));
+		Memset(gpt->write_dirty[table], 0,
+		       sizeof(gpt->write_dirty[table]));
+		gpt->crc_tracked |= bit;
+	}
+}
+
+void GptEntriesUntrackCrc(GptData *gpt, uint32_t mask)
+{
+	gpt->crc_tracked &= ~mask;
+}
+
+void GptEntriesModified(GptData *gpt, uint32_t mask, uint32_t offset,
+			uint32_t size)
+{
+	uint32_t entries_bytes = GptEntriesBytes(gpt);
+	uint32_t slot, last;
+	int table;
+
+	if (!size)
+		return;
+
+	for (table = 0; table < 2; table++) {
+		uint32_t bit = table ? MASK_SECONDARY : MASK_PRIMARY;
+		uint8_t *entries = GptEntriesTable(gpt, table);
+
+		if (!(mask & bit & gpt->crc_tracked))
+			continue;
+		if (offset >= entries_bytes || size > entries_bytes - offset) {
+			GptEntriesUntrackCrc(gpt, bit);
+			continue;
+		}
+
+		last = (offset + size - 1) / GPT_CRC_SLOT_SIZE;
+		for (slot = offset / GPT_CRC_SLOT_SIZE; slot <= last; slot++) {
+			uint8_t *dirty = &gpt->crc_dirty[table][slot / 8];
+
+			gpt->write_dirty[table][slot / 8] |= 1 << (slot % 8);
+			if (*dirty & (1 << (slot % 8)))
+				continue;
+			gpt->slot_crc32[table][slot] =
+				Crc32(entries + slot * GPT_CRC_SLOT_SIZE,
+				      GPT_CRC_SLOT_SIZE);
+			*dirty |= 1 << (slot % 8);
+		}
+	}
+}
+
+void GptCopyEntries(GptData *gpt, uint32_t dst)
+{
+	int table = (dst == MASK_SECONDARY);
+	uint8_t *to = GptEntriesTable(gpt, table);
+	uint8_t *from = GptEntriesTable(gpt, !table);
+	uint32_t entries_bytes = GptEntriesBytes(gpt);
+	uint32_t offset;
+
+	if (!(gpt->crc_tracked & dst)) {
+		Memcpy(to, from, entries_bytes);
+		return;
+	}
+
+	for (offset = 0; offset < entries_bytes; offset += GPT_CRC_SLOT_SIZE) {
+		if (!Memcmp(to + offset, from + offset, GPT_CRC_SLOT_SIZE))
+			continue;
+		GptEntriesModified(gpt, dst, offset, GPT_CRC_SLOT_SIZE);
+		Memcpy(to + offset, from + offset, GPT_CRC_SLOT_SIZE);
+	}
+}
+
+/*
+ * CRC32 is affine, so for equal length inputs A and A' the difference
+ * Crc32(A) ^ Crc32(A') depends only on A ^ A'.  Changing one slot therefore
+ * changes the table CRC by the slot's CRC difference shifted past the rest
+ * of the table, which is what Crc32Combine() with a zero crc2 computes.
+ */
+static uint32_t GptTrackedEntriesCrc(GptData *gpt, int table)
+{
+	uint8_t *entries = GptEntriesTable(gpt, table);
+	uint32_t crc = GptEntriesHeader(gpt, table)->entries_crc32;
+	uint32_t entries_bytes = GptEntriesBytes(gpt);
+	uint32_t slot;
+
+	for (slot = 0; slot < entries_bytes / GPT_CRC_SLOT_SIZE; slot++) {
+		uint32_t delta;
+
+		if (!(gpt->crc_dirty[table][slot / 8] & (1 << (slot % 8))))
+			continue;
+		delta = Crc32(entries + slot * GPT_CRC_SLOT_SIZE,
+			      GPT_CRC_SLOT_SIZE) ^ gpt->slot_crc32[table][slot];
+		crc ^= Crc32Combine(delta, 0, entries_bytes -
+				    (slot + 1) * GPT_CRC_SLOT_SIZE);
+	}
+	Memset(gpt->crc_dirty[table], 0, sizeof(gpt->crc_dirty[table]));
+	return crc;
+}
+
+static uint32_t GptEntriesCrc(GptData *gpt, int table)
+{
+	uint32_t bit = table ? MASK_SECONDARY : MASK_PRIMARY;
+
+	if (gpt->crc_tracked & bit)
+		return GptTrackedEntriesCrc(gpt, table);
+	return Crc32(GptEntriesTable(gpt, table), GptEntriesBytes(gpt));
+}
+
+void GptUpdateEntriesCrc(GptData *gpt, uint32_t mask)
+{
+	GptHeader *header1 = (GptHeader *)gpt->primary_header;
+	GptHeader *header2 = (GptHeader *)gpt->secondary_header;
+
+	if (mask & MASK_PRIMARY)
+		header1->entries_crc32 = GptEntriesCrc(gpt, 0);
+
+	if (mask & MASK_SECONDARY) {
+		if ((mask & MASK_PRIMARY) &&
+		    !Memcmp(gpt->primary_entries, gpt->secondary_entries,
+			    GptEntriesBytes(gpt))) {
+			header2->entries_crc32 = header1->entries_crc32;
+			Memset(gpt->crc_dirty[1], 0, sizeof(gpt->crc_dirty[1]));
+		} else {
+			header2->entries_crc32 = GptEntriesCrc(gpt, 1);
+		}
+	}
+}
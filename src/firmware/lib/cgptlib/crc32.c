@@ -43,6 +43,16 @@
 
 #include "crc32.h"
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32_HAVE_PCLMUL
+#endif
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#define CRC32_HAVE_ARMV8
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
 static uint32_t crc32_tab[] = {
 	0x00000000U, 0x77073096U, 0xee0e612cU, 0x990951baU, 0x076dc419U,
 	0x706af48fU, 0xe963a535U, 0x9e6495a3U, 0x0edb8832U, 0x79dcb8a4U,
@@ -99,13 +109,360 @@ static uint32_t crc32_tab[] = {
 };
 
 
-uint32_t Crc32(const void *buffer, uint32_t len)
+/*
+ * Slice-by-8 tables.  crc32_slice[0] is crc32_tab; crc32_slice[k][n] is the
+ * CRC register after feeding byte n followed by k zero bytes.  Filled in by
+ * Crc32InitTables() before any backend that needs them is selected.
+ */
+static uint32_t crc32_slice[8][256];
+
+typedef uint32_t (*crc32_update_fn)(uint32_t value, const uint8_t *byte,
+				    uint32_t len);
+
+static uint32_t Crc32UpdateByte(uint32_t value, const uint8_t *byte,
+				uint32_t len)
 {
-	uint8_t *byte = (uint8_t *)buffer;
 	uint32_t i;
-	uint32_t value = ~0U;
 
 	for (i = 0; i < len; ++i)
 		value = crc32_tab[(value ^ byte[i]) & 0xff] ^ (value >> 8);
-	return value ^ ~0U;
+	return value;
+}
+
+/*
+ * crc32_x2n[k] is x^(2^k) modulo the CRC polynomial, used by Crc32Combine()
+ * to shift a CRC past a run of zero bytes.
+ */
+static uint32_t crc32_x2n[32];
+
+/* Multiplies a and b modulo the (bit-reflected) CRC polynomial.  a != 0. */
+static uint32_t Crc32MultModP(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1U << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ 0xedb88320U : b >> 1;
+	}
+	return p;
+}
+
+/* Returns x^(n * 2^k) modulo the CRC polynomial. */
+static uint32_t Crc32X2nModP(uint64_t n, uint32_t k)
+{
+	uint32_t p = 1U << 31;		/* x^0 == 1 */
+
+	while (n) {
+		if (n & 1)
+			p = Crc32MultModP(crc32_x2n[k & 31], p);
+		n >>= 1;
+		k++;
+	}
+	return p;
+}
+
+static void Crc32InitTables(void)
+{
+	uint32_t n, k;
+
+	if (crc32_slice[1][1])
+		return;
+
+	crc32_x2n[0] = 1U << 30;	/* x^1 */
+	for (k = 1; k < 32; k++)
+		crc32_x2n[k] = Crc32MultModP(crc32_x2n[k - 1],
+					     crc32_x2n[k - 1]);
+
+	for (n = 0; n < 256; n++)
+		crc32_slice[0][n] = crc32_tab[n];
+	for (k = 1; k < 8; k++) {
+		for (n = 0; n < 256; n++) {
+			uint32_t prev = crc32_slice[k - 1][n];
+			crc32_slice[k][n] = crc32_tab[prev & 0xff] ^ (prev >> 8);
+		}
+	}
+}
+
+static uint32_t Crc32UpdateSlice8(uint32_t value, const uint8_t *byte,
+				  uint32_t len)
+{
+	/*
+	 * Assemble the words a byte at a time so this is independent of host
+	 * endianness and alignment; compilers turn it into plain loads.
+	 */
+	while (len >= 8) {
+		uint32_t lo = value ^ ((uint32_t)byte[0] |
+				       ((uint32_t)byte[1] << 8) |
+				       ((uint32_t)byte[2] << 16) |
+				       ((uint32_t)byte[3] << 24));
+		uint32_t hi = ((uint32_t)byte[4] |
+			       ((uint32_t)byte[5] << 8) |
+			       ((uint32_t)byte[6] << 16) |
+			       ((uint32_t)byte[7] << 24));
+
+		value = crc32_slice[7][lo & 0xff] ^
+			crc32_slice[6][(lo >> 8) & 0xff] ^
+			crc32_slice[5][(lo >> 16) & 0xff] ^
+			crc32_slice[4][lo >> 24] ^
+			crc32_slice[3][hi & 0xff] ^
+			crc32_slice[2][(hi >> 8) & 0xff] ^
+			crc32_slice[1][(hi >> 16) & 0xff] ^
+			crc32_slice[0][hi >> 24];
+		byte += 8;
+		len -= 8;
+	}
+	return Crc32UpdateByte(value, byte, len);
+}
+
+#ifdef CRC32_HAVE_PCLMUL
+/*
+ * Carry-less multiply folding, following Intel's "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction".  The constants are the
+ * bit-reflected x^n mod P(x) values for the gzip polynomial.
+ */
+#define CRC32_PCLMUL_MIN_LEN 64
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t Crc32FoldPclmul(uint32_t value, const uint8_t *byte,
+				uint32_t len)
+{
+	static const uint64_t k1k2[2] __attribute__((aligned(16))) =
+		{ 0x0154442bd4ULL, 0x01c6e41596ULL };
+	static const uint64_t k3k4[2] __attribute__((aligned(16))) =
+		{ 0x01751997d0ULL, 0x00ccaa009eULL };
+	static const uint64_t k5k0[2] __attribute__((aligned(16))) =
+		{ 0x0163cd6124ULL, 0x0000000000ULL };
+	static const uint64_t poly[2] __attribute__((aligned(16))) =
+		{ 0x01db710641ULL, 0x01f7011641ULL };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	/* Caller guarantees len >= 64 and a multiple of 16. */
+	x1 = _mm_loadu_si128((const __m128i *)(byte + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(byte + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(byte + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(byte + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(value));
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+	byte += 64;
+	len -= 64;
+
+	/* Fold four lanes in parallel, 64 bytes per iteration. */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128((const __m128i *)(byte + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(byte + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(byte + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(byte + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		byte += 64;
+		len -= 64;
+	}
+
+	/* Fold the four lanes into one. */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* Remaining 16 byte blocks. */
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)byte);
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		byte += 16;
+		len -= 16;
+	}
+
+	/* Fold 128 bits down to 64. */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_set_epi32(0, ~0, 0, ~0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits. */
+	x0 = _mm_load_si128((const __m128i *)poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t Crc32UpdatePclmul(uint32_t value, const uint8_t *byte,
+				  uint32_t len)
+{
+	if (len >= CRC32_PCLMUL_MIN_LEN) {
+		uint32_t chunk = len & ~15U;
+
+		value = Crc32FoldPclmul(value, byte, chunk);
+		byte += chunk;
+		len -= chunk;
+	}
+	return Crc32UpdateSlice8(value, byte, len);
+}
+
+static int Crc32HavePclmul(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") &&
+		__builtin_cpu_supports("sse4.1");
+}
+#endif  /* CRC32_HAVE_PCLMUL */
+
+#ifdef CRC32_HAVE_ARMV8
+__attribute__((target("arch=armv8-a+crc")))
+static uint32_t Crc32UpdateArmv8(uint32_t value, const uint8_t *byte,
+				 uint32_t len)
+{
+	while (len && ((uintptr_t)byte & 7)) {
+		value = __crc32b(value, *byte++);
+		len--;
+	}
+	while (len >= 8) {
+		value = __crc32d(value, *(const uint64_t *)byte);
+		byte += 8;
+		len -= 8;
+	}
+	while (len--)
+		value = __crc32b(value, *byte++);
+	return value;
+}
+
+static int Crc32HaveArmv8(void)
+{
+	return !!(getauxval(AT_HWCAP) & HWCAP_CRC32);
+}
+#endif  /* CRC32_HAVE_ARMV8 */
+
+static const struct {
+	const char *name;
+	crc32_update_fn update;
+} crc32_backends[CRC32_BACKEND_COUNT] = {
+	[CRC32_BACKEND_BYTE] = { "byte", Crc32UpdateByte },
+	[CRC32_BACKEND_SLICE8] = { "slice8", Crc32UpdateSlice8 },
+#ifdef CRC32_HAVE_PCLMUL
+	[CRC32_BACKEND_PCLMUL] = { "pclmul", Crc32UpdatePclmul },
+#else
+	[CRC32_BACKEND_PCLMUL] = { "pclmul", NULL },
+#endif
+#ifdef CRC32_HAVE_ARMV8
+	[CRC32_BACKEND_ARMV8] = { "armv8", Crc32UpdateArmv8 },
+#else
+	[CRC32_BACKEND_ARMV8] = { "armv8", NULL },
+#endif
+};
+
+static int crc32_active_backend = -1;
+
+int Crc32BackendSupported(int backend)
+{
+	if (backend < 0 || backend >= CRC32_BACKEND_COUNT ||
+	    !crc32_backends[backend].update)
+		return 0;
+#ifdef CRC32_HAVE_PCLMUL
+	if (backend == CRC32_BACKEND_PCLMUL)
+		return Crc32HavePclmul();
+#endif
+#ifdef CRC32_HAVE_ARMV8
+	if (backend == CRC32_BACKEND_ARMV8)
+		return Crc32HaveArmv8();
+#endif
+	return 1;
+}
+
+const char *Crc32BackendName(int backend)
+{
+	if (backend < 0 || backend >= CRC32_BACKEND_COUNT)
+		return "unknown";
+	return crc32_backends[backend].name;
+}
+
+/*
+ * Pick the fastest supported backend.  Runs as a constructor so the choice
+ * is made once at startup, but Crc32() also calls it if it has not run yet.
+ */
+__attribute__((constructor))
+static void Crc32SelectBackend(void)
+{
+	Crc32InitTables();
+
+	if (Crc32BackendSupported(CRC32_BACKEND_ARMV8))
+		crc32_active_backend = CRC32_BACKEND_ARMV8;
+	else if (Crc32BackendSupported(CRC32_BACKEND_PCLMUL))
+		crc32_active_backend = CRC32_BACKEND_PCLMUL;
+	else
+		crc32_active_backend = CRC32_BACKEND_SLICE8;
+}
+
+int Crc32ActiveBackend(void)
+{
+	if (crc32_active_backend < 0)
+		Crc32SelectBackend();
+	return crc32_active_backend;
+}
+
+uint32_t Crc32Backend(int backend, const void *buffer, uint32_t len)
+{
+	if (!Crc32BackendSupported(backend))
+		return 0;
+	Crc32InitTables();
+	return crc32_backends[backend].update(~0U, buffer, len) ^ ~0U;
+}
+
+uint32_t Crc32Init(void)
+{
+	return ~0U;
+}
+
+uint32_t Crc32Update(uint32_t crc, const void *buffer, uint32_t len)
+{
+	int backend = Crc32ActiveBackend();
+
+	return crc32_backends[backend].update(crc, buffer, len);
+}
+
+uint32_t Crc32Final(uint32_t crc)
+{
+	return crc ^ ~0U;
+}
+
+uint32_t Crc32(const void *buffer, uint32_t len)
+{
+	return Crc32Final(Crc32Update(Crc32Init(), buffer, len));
+}
+
+uint32_t Crc32Combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+	Crc32InitTables();
+	return Crc32MultModP(Crc32X2nModP(len2, 3), crc1) ^ crc2;
 }
@@ -34,11 +34,24 @@ enum {
 #define GPT_MODIFIED_ENTRIES2 0x08
 
 /*
- * Size of GptData.primary_entries and secondary_entries: 128 bytes/entry * 128
- * entries.
+ * Default, and smallest, size of an entries table: 128 bytes/entry * 128
+ * entries.  This is also the space the UEFI spec reserves for one.
  */
 #define TOTAL_ENTRIES_SIZE 16384
 
+/* Largest entries table supported: 128 bytes/entry * 1024 entries. */
+#define GPT_MAX_ENTRIES_SIZE 131072
+
+/*
+ * Granularity of the per-entry CRC cache in GptData: one slot per 128 byte
+ * entry of the largest table.
+ */
+#define GPT_CRC_SLOT_SIZE 128
+#define GPT_CRC_SLOTS (GPT_MAX_ENTRIES_SIZE / GPT_CRC_SLOT_SIZE)
+
+/* Most entries a table holds (128 bytes per entry). */
+#define GPT_MAX_TABLE_ENTRIES (GPT_MAX_ENTRIES_SIZE / 128)
+
 /*
  * The 'update_type' of GptUpdateKernelEntry().  We expose TRY and BAD only
  * because those are what verified boot needs.  For more precise control on GPT
@@ -57,20 +70,48 @@ enum {
 	GPT_UPDATE_ENTRY_BAD = 2,
 };
 
+/*
+ * Counters for the work done by GptSanityCheck().  Times are in VbExGetTimer()
+ * units.
+ */
+typedef struct {
+	/* CheckHeader() calls and time spent in them */
+	uint32_t header_checks;
+	uint64_t header_check_time;
+	/* CheckEntries() calls and time spent in them */
+	uint32_t entries_checks;
+	uint64_t entries_check_time;
+	/* CheckEntries() calls avoided because both tables were identical */
+	uint32_t entries_checks_skipped;
+} GptCheckStats;
+
 typedef struct {
 	/* Fill in the following fields before calling GptInit() */
-	/* GPT primary header, from sector 1 of disk (size: 512 bytes) */
+	/* GPT primary header, from sector 1 of disk (size: one sector) */
 	uint8_t *primary_header;
-	/* GPT secondary header, from last sector of disk (size: 512 bytes) */
+	/* GPT secondary header, from last sector of disk (size: one sector) */
 	uint8_t *secondary_header;
-	/* Primary GPT table, follows primary header (size: 16 KB) */
+	/* Primary GPT table, follows primary header (size: entries_bytes) */
 	uint8_t *primary_entries;
-	/* Secondary GPT table, precedes secondary header (size: 16 KB) */
+	/* Secondary GPT table, precedes secondary header (same size) */
 	uint8_t *secondary_entries;
 	/* Size of a LBA sector, in bytes */
 	uint32_t sector_bytes;
 	/* Size of drive in LBA sectors, in sectors */
 	uint64_t drive_sectors;
+	/*
+	 * Optional: size of each GPT table, number_of_entries * size_of_entry
+	 * of the headers, from TOTAL_ENTRIES_SIZE (the default, if 0) up to
+	 * GPT_MAX_ENTRIES_SIZE.  A header describing a table of any other
+	 * size is invalid.
+	 */
+	uint32_t entries_bytes;
+	/*
+	 * Optional: MASK_SECONDARY if the secondary header and entries were
+	 * not read from disk.  GptSanityCheck() then leaves the secondary
+	 * copy out of valid_headers and valid_entries without checking it.
+	 */
+	uint32_t unverified;
 
 	/* Outputs */
 	/* Which inputs have been modified?  GPT_MODIFIED_* */
@@ -85,6 +126,43 @@ typedef struct {
 	/* Internal variables */
 	uint32_t valid_headers, valid_entries;
 	int current_priority;
+
+	/*
+	 * Incremental entries CRC state, see GptEntriesTrackCrc().  A table
+	 * whose MASK_* bit is set in crc_tracked has a header entries_crc32
+	 * that is correct except for the slots flagged in crc_dirty, whose
+	 * CRCs before modification are kept in slot_crc32.  Such a table
+	 * also still matches the disk except for the slots flagged in
+	 * write_dirty, which are only cleared by the caller once written.
+	 */
+	uint32_t crc_tracked;
+	uint8_t crc_dirty[2][GPT_CRC_SLOTS / 8];
+	uint32_t slot_crc32[2][GPT_CRC_SLOTS];
+	uint8_t write_dirty[2][GPT_CRC_SLOTS / 8];
+
+	/* Check counters, accumulated by every GptSanityCheck() call. */
+	GptCheckStats stats;
+
+	/*
+	 * Bootable kernel entries in the order GptNextKernelEntry() returns
+	 * them (priority high to low, then lowest index first), with their
+	 * priorities.  Built by GptInit() and kept up to date by
+	 * GptUpdateKernelEntry(); rebuilt by GptNextKernelEntry() once the
+	 * attributes of any entry changed some other way, which moves the
+	 * attributes generation away from kernel_index_generation.
+	 */
+	uint16_t kernel_order[GPT_MAX_TABLE_ENTRIES];
+	uint8_t kernel_prio[GPT_MAX_TABLE_ENTRIES];
+	uint32_t kernel_count;
+	int kernel_index_valid;
+	uint32_t kernel_index_generation;
+	/*
+	 * Position in kernel_order of the entry following the one described
+	 * by cursor_kernel/cursor_priority, so the common sequence of calls
+	 * does not need to search for it.
+	 */
+	uint32_t kernel_cursor;
+	int cursor_kernel, cursor_priority;
 } GptData;
 
 /**
@@ -57,17 +57,24 @@
 #define MAX_SIZE_OF_ENTRY 512
 #define SIZE_OF_ENTRY_MULTIPLE 8
 #define MIN_NUMBER_OF_ENTRIES 32
-#define MAX_NUMBER_OF_ENTRIES 512
+#define MAX_NUMBER_OF_ENTRIES GPT_MAX_TABLE_ENTRIES
 
 /* Defines GPT sizes */
 #define GPT_PMBR_SECTOR 1  /* size (in sectors) of PMBR */
 #define GPT_HEADER_SECTOR 1
+/* LBA of the primary header, right after the PMBR */
+#define GPT_PRIMARY_HEADER_LBA 1
 /*
- * Entries sectors assumes sector size if 512 bytes; then (TOTAL_ENTRIES_SIZE /
- * 512) = 32
+ * Entries sectors of a default table for 512-byte sectors:
+ * (TOTAL_ENTRIES_SIZE / 512) = 32.  Use GptEntriesSectors() for the drive's
+ * actual table and sector size.
  */
 #define GPT_ENTRIES_SECTORS 32
 
+/* Supported sector sizes, in bytes */
+#define GPT_MIN_SECTOR_BYTES 512
+#define GPT_MAX_SECTOR_BYTES 4096
+
 /*
  * Alias name of index in internal array for primary and secondary header and
  * entries.
@@ -85,23 +92,50 @@ enum {
 	MASK_BOTH = 3,
 };
 
+/**
+ * Return the number of sectors of 'sector_bytes' bytes taken by an entries
+ * array of 'entries_bytes' bytes.
+ */
+uint32_t GptEntriesSectors(uint32_t entries_bytes, uint32_t sector_bytes);
+
+/**
+ * Return the size of the entries tables of gpt, GptData.entries_bytes or its
+ * default.
+ */
+uint32_t GptEntriesBytes(const GptData *gpt);
+
+/**
+ * Return the size of the entries table header h describes.
+ */
+uint64_t GptHeaderEntriesBytes(const GptHeader *h);
+
 /**
  * Verify GptData parameters are sane.
  */
 int CheckParameters(GptData* gpt);
 
 /**
- * Check header fields.
+ * Check header fields.  The table it describes may be of any size from
+ * TOTAL_ENTRIES_SIZE to GPT_MAX_ENTRIES_SIZE; GptSanityCheck() also holds
+ * it to GptEntriesBytes().
  *
  * Returns 0 if header is valid, 1 if invalid.
  */
-int CheckHeader(GptHeader *h, int is_secondary, uint64_t drive_sectors);
+int CheckHeader(GptHeader *h, int is_secondary, uint64_t drive_sectors,
+		uint32_t sector_bytes);
 
 /**
  * Calculate and return the header CRC.
  */
 uint32_t HeaderCrc(GptHeader *h);
 
+/**
+ * Fill 'order' with the indexes of the used entries, sorted by starting LBA,
+ * and return how many there are.  'order' needs room for
+ * h->number_of_entries indexes.
+ */
+uint32_t SortEntriesByStart(GptEntry *entries, GptHeader *h, uint16_t *order);
+
 /**
  * Check entries.
  *
@@ -123,7 +157,8 @@ int HeaderFieldsSame(GptHeader *h1, GptHeader *h2);
  * Check GptData, headers, entries.
  *
  * If successful, sets gpt->valid_headers and gpt->valid_entries and returns
- * GPT_SUCCESS.
+ * GPT_SUCCESS.  Copies flagged in gpt->unverified are not checked and are
+ * never reported valid.
  *
  * On error, returns a GPT_ERROR_* return code.
  */
@@ -132,7 +167,9 @@ int GptSanityCheck(GptData *gpt);
 /**
  * Repair GPT data by copying from one set of valid headers/entries to the
  * other.  Assumes GptSanityCheck() has been run to determine which headers
- * and/or entries are already valid.
+ * and/or entries are already valid.  An unverified copy (see
+ * GptData.unverified) counts as invalid and is overwritten, so callers that
+ * write the result back must have loaded both copies.
  *
  * On error, returns a GPT_ERROR_* return code.
  */
@@ -146,6 +183,47 @@ int GptRepair(GptData *gpt);
  */
 int GptModified(GptData *gpt);
 
+/**
+ * Start incremental CRC tracking of the entries tables in 'mask' (MASK_*).
+ * Only tables that passed GptSanityCheck() are tracked; others are ignored.
+ *
+ * While a table is tracked, every change to it must be announced with
+ * GptEntriesModified() before it is made, or the table untracked with
+ * GptEntriesUntrackCrc().  The changed slots are also flagged in
+ * gpt->write_dirty so callers can write back only those, which is why
+ * tracking must start while the tables still match the disk.  Tables
+ * already tracked are left alone.
+ */
+void GptEntriesTrackCrc(GptData *gpt, uint32_t mask);
+
+/**
+ * Stop incremental CRC tracking of the entries tables in 'mask'.  The next
+ * GptUpdateEntriesCrc() for them rehashes the whole table.
+ */
+void GptEntriesUntrackCrc(GptData *gpt, uint32_t mask);
+
+/**
+ * Note that bytes [offset, offset + size) of the entries tables in 'mask' are
+ * about to change.  Must be called before the change is made.
+ */
+void GptEntriesModified(GptData *gpt, uint32_t mask, uint32_t offset,
+			uint32_t size);
+
+/**
+ * Copy the entries table of the other copy over the one in 'dst' (MASK_PRIMARY
+ * or MASK_SECONDARY).  A tracked destination stays tracked, with only the
+ * slots that actually differ marked modified.
+ */
+void GptCopyEntries(GptData *gpt, uint32_t dst);
+
+/**
+ * Recompute the entries_crc32 field in the headers of the tables in 'mask'
+ * over GptEntriesBytes() bytes.  Tracked tables only rehash the slots that
+ * changed.  The secondary CRC is copied from the primary one if both are
+ * requested and the tables are identical.
+ */
+void GptUpdateEntriesCrc(GptData *gpt, uint32_t mask);
+
 /* Getters and setters for partition attribute fields. */
 
 int GetEntryLegacyBootable(const GptEntry *e);
@@ -157,6 +235,14 @@ void SetEntrySuccessful(GptEntry *e, int successful);
 void SetEntryPriority(GptEntry *e, int priority);
 void SetEntryTries(GptEntry *e, int tries);
 
+/*
+ * The setters above call EntryAttributesChanged(); code writing the
+ * attributes directly must call it too.  GetEntryAttributesGeneration()
+ * changes after each such call.
+ */
+void EntryAttributesChanged(void);
+uint32_t GetEntryAttributesGeneration(void);
+
 /**
  * Return 1 if the entry is unused, 0 if it is used.
  */
@@ -7,6 +7,49 @@
 
 #include "sysincludes.h"
 
+/* CRC32 implementations, in order of preference from slowest to fastest. */
+enum {
+	CRC32_BACKEND_BYTE = 0,		/* One table lookup per byte. */
+	CRC32_BACKEND_SLICE8,		/* Slice-by-8 table lookups. */
+	CRC32_BACKEND_PCLMUL,		/* x86-64 carry-less multiply folding. */
+	CRC32_BACKEND_ARMV8,		/* ARMv8 CRC32 instructions. */
+	CRC32_BACKEND_COUNT,
+};
+
+/*
+ * Computes the CRC32 of [buffer, buffer + len) using the fastest backend the
+ * CPU supports.  All backends return identical results.
+ */
 uint32_t Crc32(const void *buffer, uint32_t len);
 
+/*
+ * Streaming interface.  Crc32Final(Crc32Update(Crc32Init(), buf, len)) is
+ * Crc32(buf, len), and Crc32Update() may be called any number of times in
+ * between to hash a buffer in pieces.
+ */
+uint32_t Crc32Init(void);
+uint32_t Crc32Update(uint32_t crc, const void *buffer, uint32_t len);
+uint32_t Crc32Final(uint32_t crc);
+
+/*
+ * Given crc1 = Crc32(A, len1) and crc2 = Crc32(B, len2), returns the CRC32 of
+ * A followed by B without touching either buffer.  Runs in O(log len2).
+ */
+uint32_t Crc32Combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+/* Returns non-zero if the given backend was built and the CPU supports it. */
+int Crc32BackendSupported(int backend);
+
+/* Returns a short human readable name for the backend. */
+const char *Crc32BackendName(int backend);
+
+/* Returns the backend Crc32() dispatches to. */
+int Crc32ActiveBackend(void);
+
+/*
+ * Computes the CRC32 with a specific backend, for testing and benchmarking.
+ * Returns 0 if the backend is not supported.
+ */
+uint32_t Crc32Backend(int backend, const void *buffer, uint32_t len);
+
 #endif  /* VBOOT_REFERENCE_GPT_CRC32_H_ */
@@ -25,4 +25,13 @@
 #include <memory.h>
 #endif
 
+/* Intrinsics and CPU feature probes used by the accelerated CRC32 code. */
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
 #endif  /* VBOOT_REFERENCE_SYSINCLUDES_H_ */
@@ -10,6 +10,7 @@
 
 #define _STUB_IMPLEMENTATION_
 #include "utility.h"
+#include "vboot_api.h"
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -32,4 +33,10 @@ void *Memset(void *d, const uint8_t c, uint64_t n)
 	return memset(d, c, n);
 }
 
+uint64_t VbExGetTimer(void)
+{
+	struct timeval tv;
 
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
@@ -14,14 +14,31 @@ enum {
   CGPT_NOOP,
 };
 
+// What CgptCreate() and CgptAdd() do to the sectors they newly allocate,
+// so that they needn't be discarded or zeroed before mkfs.
+enum {
+  PROVISION_NONE,     // leave them as they are
+  PROVISION_DISCARD,  // discard them; image files get a hole
+  PROVISION_ZERO,     // make them read back as zeros
+};
+
 typedef struct CgptCreateParams {
   char *drive_name;
   char *drive_guid;
   int zap;
   int create;
   uint64_t min_size;
+  uint32_t sector_bytes;
+  uint32_t num_entries;  // 0 for the default 128
+  int provision;         // PROVISION_* for the usable area
 } CgptCreateParams;
 
+// Where CgptAdd() puts a new partition when not told.
+enum {
+  EXTENT_FIRST_FIT,  // the first gap it fits in
+  EXTENT_BEST_FIT,   // the smallest gap it fits in
+};
+
 typedef struct CgptAddParams {
   char *drive_name;
   uint32_t partition;
@@ -44,8 +61,31 @@ typedef struct CgptAddParams {
   int set_tries;
   int set_priority;
   int set_raw;
+  // New partitions without set_begin are placed in free space, starting at
+  // a multiple of align sectors (0 for DriveAlignment()) and filling the
+  // largest gap when size isn't set either.  fit is an EXTENT_*_FIT.
+  uint64_t align;
+  int fit;
+  int provision;  // PROVISION_* for the sectors the partition gains
 } CgptAddParams;
 
+// One partition as described by CgptGetPartitions().
+typedef struct CgptPartitionInfo {
+  uint32_t partition;       // 1-based
+  uint64_t begin;
+  uint64_t size;
+  Guid type_guid;
+  Guid unique_guid;
+  char label[145];          // UTF-8, up to four bytes per UTF-16 unit
+  int legacy_bootable;
+  int successful;
+  int tries;
+  int priority;
+  uint64_t raw_value;
+} CgptPartitionInfo;
+
+#define CGPT_SHOW_MAX_FIELDS 32
+
 typedef struct CgptShowParams {
   char *drive_name;
   int numeric;
@@ -55,6 +95,15 @@ typedef struct CgptShowParams {
   int single_item;
   int debug;
   int num_partitions;
+  // Query mode: the single_item letters (plus 'i' for the partition number)
+  // to report, in order, one record per partition.  Empty otherwise.
+  char fields[CGPT_SHOW_MAX_FIELDS + 1];
+  uint32_t *query_parts;  // partitions to report; NULL for all in use
+  int num_query_parts;
+  int json;               // JSON records rather than tab-separated values
+  // CgptGetPartitions(): the num_partitions partitions in use; free() it.
+  CgptPartitionInfo *partitions;
+  uint32_t sector_bytes;  // and the size of the sectors they're counted in
 } CgptShowParams;
 
 typedef struct CgptRepairParams {
@@ -71,7 +120,10 @@ typedef struct CgptBootParams {
 
 typedef struct CgptPrioritizeParams {
   char *drive_name;
-  uint32_t set_partition;
+  char **other_drives;         // ranked along with drive_name, or
+  int num_other_drives;
+  int all_drives;              // every drive with a GPT instead
+  uint32_t set_partition;      // on drive_name
   int set_friends;
   int max_priority;
   int orig_priority;
@@ -80,13 +132,76 @@ typedef struct CgptPrioritizeParams {
 typedef struct CgptNextParams {
   char *drive_name;
   char *drive_type;
+  int quiet;                   // don't print the unique GUID chosen
+  Guid unique_guid;            // out: the partition chosen
+  uint32_t partition;          // out: its 1-based number
 } CgptNextParams;
 
-typedef struct CgptResizeParams {
+// One partition for CgptResize() to grow into the free space after it.
+typedef struct CgptResizeTarget {
   char *partition_desc;
+  uint64_t size;    // grow to this many bytes; 0 to use percent
+  int percent;      // grow by this much of the free space; 0 for all
+} CgptResizeTarget;
+
+typedef struct CgptResizeParams {
+  char *partition_desc;        // a single partition to fill the space after
+  CgptResizeTarget *targets;   // or: num_targets on the same disk
+  int num_targets;
   uint64_t min_resize_bytes;
+  int grow_fs;  // grow the mounted ext4 filesystems on them to match
 } CgptResizeParams;
 
+// Copies the data of a partition into one of the same or a larger size,
+// on the same drive or another one.
+typedef struct CgptCopyParams {
+  char *src_drive_name;
+  uint32_t src_partition;      // 1-based
+  char *dst_drive_name;
+  uint32_t dst_partition;      // 1-based; 0 for the same as src_partition
+  int verbose;                 // say how the data was moved
+} CgptCopyParams;
+
+// Lists what changed between the partitions of two images that match the
+// same label or type, the nth match of one going with the nth of the other.
+typedef struct CgptDiffParams {
+  char *old_drive_name;
+  char *new_drive_name;
+  char *label;
+  int set_type;
+  Guid type_guid;
+  uint64_t chunk_bytes;        // compared at a time; 0 for 1 MiB
+} CgptDiffParams;
+
+// Checks the data of the one partition with the given unique GUID, type or
+// label, found as CgptFind() does, block by block against a manifest of
+// their SHA-256 digests or against the root hash of a dm-verity tree.
+typedef struct CgptVerifyParams {
+  char *drive_name;            // NULL to search every drive
+  int set_unique;
+  int set_type;
+  int set_label;
+  Guid unique_guid;
+  Guid type_guid;
+  char *label;
+  char *manifest;              // a hex SHA-256 per block and line, or
+  int set_root_hash;
+  uint8_t root_hash[32];       // SHA-256 of the top of the tree
+  uint8_t *salt;               // prefixed to every block hashed for it
+  uint32_t salt_len;
+  uint32_t block_bytes;        // 0 for 4096, also the hash block size
+  uint64_t data_bytes;         // 0 for the whole partition
+  int verbose;
+} CgptVerifyParams;
+
+/* One -M pattern: matchlen bytes that must be at matchoffset into a
+ * partition. */
+typedef struct CgptFindContent {
+  uint8_t *matchbuf;
+  uint64_t matchlen;
+  uint64_t matchoffset;
+} CgptFindContent;
+
 typedef struct CgptFindParams {
   char *drive_name;
   int verbose;
@@ -94,16 +209,21 @@ typedef struct CgptFindParams {
   int set_type;
   int set_label;
   int oneonly;
+  int first;
   int numeric;
-  uint8_t *matchbuf;
-  uint64_t matchlen;
-  uint64_t matchoffset;
-  uint8_t *comparebuf;
+  int wait;                    /* scanning all drives, wait for a match */
+  int wait_ms;                 /* for at most this long; -1 means forever */
+  CgptFindContent *content;    /* every one of these must match */
+  int num_content;
   Guid unique_guid;
   Guid type_guid;
   char *label;
   int hits;
   int match_partnum;           /* 1-based; 0 means no match */
+  /* If set, called for each match in place of printing it. */
+  void (*match_fn)(void *ctx, const char *drive_name, int partnum,
+                   const GptEntry *entry);
+  void *match_ctx;
 } CgptFindParams;
 
 typedef struct CgptLegacyParams {
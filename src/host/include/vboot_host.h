@@ -26,11 +26,20 @@ int CgptNext(CgptNextParams *params);
 int CgptGetBootPartitionNumber(CgptBootParams *params);
 int CgptShow(CgptShowParams *params);
 int CgptGetNumNonEmptyPartitions(CgptShowParams *params);
+int CgptGetPartitions(CgptShowParams *params);
 int CgptRepair(CgptRepairParams *params);
 int CgptResize(CgptResizeParams *params);
 int CgptPrioritize(CgptPrioritizeParams *params);
 void CgptFind(CgptFindParams *params);
 int CgptLegacy(CgptLegacyParams *params);
+int CgptCopy(CgptCopyParams *params);
+int CgptDiff(CgptDiffParams *params);
+int CgptVerify(CgptVerifyParams *params);
+
+/* Errors are printed to stderr unless the calling thread sets a handler,
+ * which then gets each message instead.  NULL restores printing. */
+typedef void (*CgptErrorHandler)(void *ctx, const char *message);
+void CgptSetErrorHandler(CgptErrorHandler handler, void *ctx);
 
 /* GUID conversion functions. Accepted format:
  *
@@ -3,40 +3,379 @@
  * found in the LICENSE file.
  */
 
+#include <sys/ioctl.h>
 #include <sys/mount.h>
+#include <linux/fs.h>
 #include <linux/loop.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <libmount/libmount.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-static int get_node(const char *image_path, char **loopdev, int *loop) {
+#include "vboot_host.h"
+
+#ifndef LOOP_CONFIGURE
+/* Linux 5.8 and later; older headers don't have it. */
+#define LOOP_CONFIGURE	0x4C0A
+struct loop_config {
+	__u32 fd;
+	__u32 block_size;
+	struct loop_info64 info;
+	__u64 __reserved[8];
+};
+#endif
+
+static int flag_read_only = 0;
+static int flag_partscan = 0;
+static int flag_pool = 0;
+
+/* The loop devices set aside with --pool-add, one number per line. */
+static const char kDefaultPoolPath[] = "/run/loopy/pool";
+#define MAX_POOL 256
+
+/* The sector size to give the loop device: the backing device's own, or
+ * for an image file, the one its GPT was written for. */
+static unsigned int image_sector_size(int fd) {
+	static const unsigned int sizes[] = { 512, 4096 };
+	unsigned int sector_size;
+	struct stat st;
+	char sig[8];
+	int i;
+
+	if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode) &&
+	    ioctl(fd, BLKSSZGET, &sector_size) == 0)
+		return sector_size;
+
+	/* The GPT header is in the second sector. */
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (pread(fd, sig, sizeof(sig), sizes[i]) == sizeof(sig) &&
+		    !memcmp(sig, "EFI PART", sizeof(sig)))
+			return sizes[i];
+	}
+	return 512;
+}
+
+/* Attaches fd to loop in one go, with direct I/O so the image's pages are
+ * only cached once, by the backing file.  Returns -1 with errno EINVAL or
+ * ENOTTY if the kernel predates LOOP_CONFIGURE. */
+static int configure_loop(int loop, int fd, const struct loop_info64 *info) {
+	struct loop_config config = {
+		.fd = fd,
+		.block_size = image_sector_size(fd),
+		.info = *info,
+	};
+
+	config.info.lo_flags |= LO_FLAGS_DIRECT_IO;
+	return ioctl(loop, LOOP_CONFIGURE, &config);
+}
+
+/* What attaching took before LOOP_CONFIGURE.  Direct I/O and the block size
+ * are only nice to have here: older kernels may not take them. */
+static int set_fd_and_status(int loop, int fd, const struct loop_info64 *info) {
+	if (ioctl(loop, LOOP_SET_FD, fd) < 0) {
+		perror("Failed to set loopback file descriptor fd on loopdev");
+		return -1;
+	}
+
+	if (ioctl(loop, LOOP_SET_STATUS64, info) < 0) {
+		perror("Failed to set loop device status on new node");
+		ioctl(loop, LOOP_CLR_FD, 0);
+		return -1;
+	}
+
+	ioctl(loop, LOOP_SET_BLOCK_SIZE, (unsigned long)image_sector_size(fd));
+	ioctl(loop, LOOP_SET_DIRECT_IO, 1UL);
+	return 0;
+}
+
+static const char *pool_path(void) {
+	const char *path = getenv("LOOPY_POOL");
+
+	return path && *path ? path : kDefaultPoolPath;
+}
+
+/* Opens the pool file, locked so that only one loopy changes it at a
+ * time, and reads the device numbers in it.  Returns the fd, or -1. */
+static int pool_open(int create, int *nrs, int *num) {
+	char buf[MAX_POOL * 8];
+	const char *path = pool_path();
+	char *p, *end;
+	ssize_t len;
+	int fd;
+
+	*num = 0;
+	fd = open(path, O_RDWR|O_CLOEXEC|(create ? O_CREAT : 0), 0644);
+	if (fd < 0 && create && errno == ENOENT) {
+		/* Likely just /run/loopy missing. */
+		char *dir = strdup(path), *slash = dir ? strrchr(dir, '/') : NULL;
+
+		if (slash && slash != dir) {
+			*slash = '\0';
+			mkdir(dir, 0755);
+		}
+		free(dir);
+		fd = open(path, O_RDWR|O_CLOEXEC|O_CREAT, 0644);
+	}
+	if (fd < 0) {
+		if (errno != ENOENT)
+			perror("Failed to open loop device pool");
+		return -1;
+	}
+	if (flock(fd, LOCK_EX) < 0) {
+		perror("Failed to lock loop device pool");
+		close(fd);
+		return -1;
+	}
+
+	len = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (len < 0) {
+		perror("Failed to read loop device pool");
+		close(fd);
+		return -1;
+	}
+	buf[len] = '\0';
+	for (p = buf; *num < MAX_POOL; p = end) {
+		long nr = strtol(p, &end, 10);
+
+		if (end == p)
+			break;
+		if (nr >= 0)
+			nrs[(*num)++] = nr;
+	}
+	return fd;
+}
+
+static int pool_write(int fd, const int *nrs, int num) {
+	char buf[MAX_POOL * 8];
+	int len = 0, i;
+
+	for (i = 0; i < num; i++)
+		len += snprintf(buf + len, sizeof(buf) - len, "%d\n", nrs[i]);
+	if (ftruncate(fd, 0) < 0 || pwrite(fd, buf, len, 0) != len) {
+		perror("Failed to write loop device pool");
+		return -1;
+	}
+	return 0;
+}
+
+/* Takes an unbound device from the pool, open and locked against other
+ * loopy runs until it is bound.  Returns its number, or -1 if none is
+ * free. */
+static int pool_claim(int *loop) {
+	int nrs[MAX_POOL], num, i;
+	int pool = pool_open(0, nrs, &num);
+
+	if (pool < 0)
+		return -1;
+	close(pool);
+
+	for (i = 0; i < num; i++) {
+		struct loop_info64 status;
+		char path[32];
+
+		snprintf(path, sizeof(path), "/dev/loop%d", nrs[i]);
+		*loop = open(path, O_CLOEXEC|O_RDWR);
+		if (*loop < 0)
+			continue;
+		/* Unbound devices have no status. */
+		if (flock(*loop, LOCK_EX|LOCK_NB) == 0 &&
+		    ioctl(*loop, LOOP_GET_STATUS64, &status) < 0 &&
+		    errno == ENXIO)
+			return nrs[i];
+		close(*loop);
+		*loop = -1;
+	}
+	return -1;
+}
+
+/* Creates num new loop devices and adds them to the pool. */
+static int pool_add(int num) {
+	int nrs[MAX_POOL], pooled, control, rc = 0;
+	int pool = pool_open(1, nrs, &pooled);
+
+	if (pool < 0)
+		return -1;
+	control = open("/dev/loop-control", O_RDWR|O_CLOEXEC);
+	if (control < 0) {
+		perror("Failed to open /dev/loop-control");
+		close(pool);
+		return -1;
+	}
+
+	while (num-- > 0) {
+		int nr;
+
+		if (pooled == MAX_POOL) {
+			fprintf(stderr, "Loop device pool is full\n");
+			rc = -1;
+			break;
+		}
+		/* -1 for the first number not in use. */
+		nr = ioctl(control, LOOP_CTL_ADD, -1);
+		if (nr < 0) {
+			perror("Failed to create loop device");
+			rc = -1;
+			break;
+		}
+		nrs[pooled++] = nr;
+		printf("/dev/loop%d\n", nr);
+	}
+
+	if (pool_write(pool, nrs, pooled) < 0)
+		rc = -1;
+	close(control);
+	close(pool);
+	return rc;
+}
+
+static int pool_list(void) {
+	int nrs[MAX_POOL], num, i;
+	int pool = pool_open(0, nrs, &num);
+
+	if (pool < 0)
+		return errno == ENOENT ? 0 : -1;
+	close(pool);
+
+	for (i = 0; i < num; i++) {
+		char path[64], backing[4096] = "-";
+		FILE *fp;
+
+		snprintf(path, sizeof(path), "/sys/block/loop%d/loop/backing_file",
+			 nrs[i]);
+		fp = fopen(path, "re");
+		if (fp) {
+			if (fgets(backing, sizeof(backing), fp))
+				backing[strcspn(backing, "\n")] = '\0';
+			fclose(fp);
+		}
+		printf("/dev/loop%d\t%s\n", nrs[i], backing);
+	}
+	return 0;
+}
+
+/* Removes the given devices, or all of them, from the pool and the
+ * system.  Devices still mounted are left alone. */
+static int pool_release(char *devices[], int num_devices) {
+	int nrs[MAX_POOL], num, kept = 0, control, rc = 0;
+	int pool = pool_open(0, nrs, &num);
+	int i, j;
+
+	if (pool < 0)
+		return errno == ENOENT && !num_devices ? 0 : -1;
+	control = open("/dev/loop-control", O_RDWR|O_CLOEXEC);
+	if (control < 0) {
+		perror("Failed to open /dev/loop-control");
+		close(pool);
+		return -1;
+	}
+
+	for (j = 0; j < num_devices; j++) {
+		for (i = 0; i < num; i++) {
+			char path[32];
+
+			snprintf(path, sizeof(path), "/dev/loop%d", nrs[i]);
+			if (!strcmp(devices[j], path))
+				break;
+		}
+		if (i == num) {
+			fprintf(stderr, "%s is not in the pool\n", devices[j]);
+			rc = -1;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		char path[32];
+		int loop;
+
+		snprintf(path, sizeof(path), "/dev/loop%d", nrs[i]);
+		for (j = 0; j < num_devices; j++)
+			if (!strcmp(devices[j], path))
+				break;
+		if (num_devices && j == num_devices) {
+			nrs[kept++] = nrs[i];
+			continue;
+		}
+
+		/* Detach whatever a run without autoclear left behind. */
+		loop = open(path, O_CLOEXEC|O_RDWR);
+		if (loop >= 0) {
+			if (ioctl(loop, LOOP_CLR_FD, 0) < 0 && errno != ENXIO) {
+				fprintf(stderr, "%s is busy, keeping it\n", path);
+				close(loop);
+				nrs[kept++] = nrs[i];
+				rc = -1;
+				continue;
+			}
+			close(loop);
+		}
+		if (ioctl(control, LOOP_CTL_REMOVE, nrs[i]) < 0 &&
+		    errno != ENODEV) {
+			fprintf(stderr, "Failed to remove %s: %s\n", path,
+				strerror(errno));
+			nrs[kept++] = nrs[i];
+			rc = -1;
+		}
+	}
+
+	if (pool_write(pool, nrs, kept) < 0)
+		rc = -1;
+	close(control);
+	close(pool);
+	return rc;
+}
+
+/* Attaches size bytes of the image from offset on to a free loop device;
+ * a size of 0 goes to the end of the image. */
+static int get_node(const char *image_path, uint64_t offset, uint64_t size,
+		    char **loopdev, int *loop) {
 	
 
         struct loop_info64 info = {
+                .lo_offset = offset,
+                .lo_sizelimit = size,
                 .lo_flags = LO_FLAGS_AUTOCLEAR
         };
 
-	int nr = -1, fd = -1, control = -1, success = -1;
+	int nr = -1, fd = -1, control = -1, success = -1, pooled = 0;
+
+	if (flag_read_only)
+		info.lo_flags |= LO_FLAGS_READ_ONLY;
+	if (flag_partscan)
+		info.lo_flags |= LO_FLAGS_PARTSCAN;
 
-        fd = open(image_path, O_CLOEXEC|O_RDWR);
+        fd = open(image_path, O_CLOEXEC|(flag_read_only ? O_RDONLY : O_RDWR));
         if (fd < 0) {
                 perror("Failed to open file descriptor for provided image");
                 goto out;
         }
 
-        control = open("/dev/loop-control", O_RDWR|O_CLOEXEC);
-        if (control < 0) {
-                perror("Failed to open /dev/loop-control");
-                goto out;
-        }
+	if (flag_pool) {
+		nr = pool_claim(loop);
+		pooled = nr >= 0;
+		if (!pooled)
+			fprintf(stderr, "No free loop device in the pool\n");
+	}
 
-        nr = ioctl(control, LOOP_CTL_GET_FREE);
-        if (nr < 0) {
-                perror("Failed to allocate loop device node");
-                goto out;
-        }
+	if (!pooled) {
+		control = open("/dev/loop-control", O_RDWR|O_CLOEXEC);
+		if (control < 0) {
+			perror("Failed to open /dev/loop-control");
+			goto out;
+		}
+
+		nr = ioctl(control, LOOP_CTL_GET_FREE);
+		if (nr < 0) {
+			perror("Failed to allocate loop device node");
+			goto out;
+		}
+	}
 
          if (asprintf(loopdev, "/dev/loop%i", nr) < 0) {
                 perror("Failed to retrieve path of loop device node");
@@ -45,20 +384,20 @@ static int get_node(const char *image_path, char **loopdev, int *loop) {
 
         printf("initializing loop device node at /dev/loop%d \n", nr);
 
-        *loop = open(*loopdev, O_CLOEXEC|O_RDWR);
+	if (!pooled)
+		*loop = open(*loopdev, O_CLOEXEC|O_RDWR);
         if (*loop < 0) {
                 perror("Failed to open loop device loopdev");
                 goto out;
         }
 
-        if (ioctl(*loop, LOOP_SET_FD, fd) < 0) {
-                perror("Failed to set loopback file descriptor fd on loopdev");
-                goto out;
-        }
-
-	if (ioctl(*loop, LOOP_SET_STATUS64, &info) < 0) {
-		perror("Failed to set loop device status on new node");
-		goto out;
+	if (configure_loop(*loop, fd, &info) < 0) {
+		if (errno != EINVAL && errno != ENOTTY) {
+			perror("Failed to configure loop device");
+			goto out;
+		}
+		if (set_fd_and_status(*loop, fd, &info) < 0)
+			goto out;
 	}
 
         success = 1;
@@ -78,18 +417,16 @@ static int get_node(const char *image_path, char **loopdev, int *loop) {
 
 }
 
-static int single_mount(const char *image_path, const char *target) {
+static int mount_node(const char *source, const char *target) {
 
 
         int rc = -1;
-	int loop = -1;
         struct libmnt_context *cxt;
         cxt = mnt_new_context();
-        char *source = NULL;
 
-        if ( get_node(image_path, &source, &loop) < 0 ) {
-                printf("Failed to get node for mounting");
-                goto out;
+        if (!cxt) {
+                perror("Failed to allocate mount context");
+                return -1;
         }
 
         if ( mnt_context_set_source(cxt, source) < 0 ) {
@@ -102,6 +439,11 @@ static int single_mount(const char *image_path, const char *target) {
                 goto out;
         }
 
+	if (flag_read_only && mnt_context_set_mflags(cxt, MS_RDONLY) < 0) {
+		perror("Failed to set mount read-only");
+		goto out;
+	}
+
         rc = mnt_context_mount(cxt);
         if (rc) {
                 if (rc > 0) {
@@ -120,7 +462,25 @@ static int single_mount(const char *image_path, const char *target) {
 			rc = -1;
 		
 		mnt_free_context(cxt);
-        
+
+        return rc;
+}
+
+static int single_mount(const char *image_path, const char *target) {
+
+
+        int rc = -1;
+	int loop = -1;
+        char *source = NULL;
+
+        if ( get_node(image_path, 0, 0, &source, &loop) < 0 ) {
+                printf("Failed to get node for mounting");
+                goto out;
+        }
+
+        rc = mount_node(source, target);
+
+        out:
 	       	free(source);
 
 		if (loop >= 0)
@@ -129,17 +489,249 @@ static int single_mount(const char *image_path, const char *target) {
         return rc;
 }
 
+/* One PART=TARGET of a multi_mount(). */
+struct part_mount {
+	const char *part;
+	const char *target;
+	uint64_t offset;
+	uint64_t size;
+	char *loopdev;
+	int loop;
+	int rc;
+	pthread_t thread;
+};
+
+/* Finds a partition by number or, failing that, by label. */
+static const CgptPartitionInfo *find_partition(const CgptShowParams *gpt,
+					       const char *part) {
+	char *end;
+	unsigned long nr = strtoul(part, &end, 10);
+	int i;
+
+	for (i = 0; i < gpt->num_partitions; i++) {
+		const CgptPartitionInfo *info = &gpt->partitions[i];
+
+		if (*part && !*end ? info->partition == nr :
+		    !strcmp(info->label, part))
+			return info;
+	}
+	return NULL;
+}
+
+static void *mount_thread(void *arg) {
+	struct part_mount *m = arg;
+
+	m->rc = mount_node(m->loopdev, m->target);
+	return NULL;
+}
+
+/* Mounts several partitions of one image, each on its own loop device,
+ * all at the same time.  Either all of them end up mounted or none. */
+static int multi_mount(const char *image_path, char *specs[], int num_specs) {
+	CgptShowParams gpt = { .drive_name = (char *)image_path };
+	struct part_mount *mounts;
+	int rc = -1, started = 0;
+	int i;
+
+	mounts = calloc(num_specs, sizeof(*mounts));
+	if (!mounts) {
+		perror("Failed to allocate mounts");
+		return -1;
+	}
+	for (i = 0; i < num_specs; i++)
+		mounts[i].loop = -1;
+
+	if (CgptGetPartitions(&gpt) != CGPT_OK) {
+		fprintf(stderr, "Failed to read the partition table of %s\n",
+			image_path);
+		goto out;
+	}
+
+	for (i = 0; i < num_specs; i++) {
+		const CgptPartitionInfo *info;
+		char *eq = strchr(specs[i], '=');
+
+		if (!eq || eq == specs[i] || !eq[1]) {
+			fprintf(stderr, "Expected PART=TARGET, not %s\n",
+				specs[i]);
+			goto out;
+		}
+		*eq = '\0';
+		mounts[i].part = specs[i];
+		mounts[i].target = eq + 1;
+		info = find_partition(&gpt, mounts[i].part);
+		if (!info) {
+			fprintf(stderr, "No partition %s in %s\n",
+				mounts[i].part, image_path);
+			goto out;
+		}
+		mounts[i].offset = info->begin * gpt.sector_bytes;
+		mounts[i].size = info->size * gpt.sector_bytes;
+	}
+
+	/* Attaching is quick, mounting may replay journals: only the latter
+	 * is worth doing in parallel. */
+	for (i = 0; i < num_specs; i++) {
+		if (get_node(image_path, mounts[i].offset, mounts[i].size,
+			     &mounts[i].loopdev, &mounts[i].loop) < 0) {
+			fprintf(stderr, "Failed to get node for partition %s\n",
+				mounts[i].part);
+			goto out;
+		}
+	}
+
+	for (started = 0; started < num_specs; started++) {
+		if (pthread_create(&mounts[started].thread, NULL, mount_thread,
+				   &mounts[started])) {
+			fprintf(stderr, "Failed to start mounting %s\n",
+				mounts[started].part);
+			break;
+		}
+	}
+	for (i = 0; i < started; i++)
+		pthread_join(mounts[i].thread, NULL);
+
+	rc = started == num_specs ? 0 : -1;
+	for (i = 0; i < started; i++) {
+		if (mounts[i].rc < 0) {
+			fprintf(stderr, "Failed to mount partition %s at %s\n",
+				mounts[i].part, mounts[i].target);
+			rc = -1;
+		}
+	}
+	if (rc < 0) {
+		for (i = 0; i < started; i++) {
+			if (!mounts[i].rc && umount(mounts[i].target) < 0)
+				perror("Failed to unmount after failure");
+		}
+	}
+
+out:
+	for (i = 0; i < num_specs; i++) {
+		free(mounts[i].loopdev);
+		if (mounts[i].loop >= 0)
+			close(mounts[i].loop);
+	}
+	free(mounts);
+	free(gpt.partitions);
+	return rc;
+}
+
+static void ignore_cgpt_error(void *ctx, const char *message) {
+}
+
+/* Tells whether a lone TARGET is PART=TARGET rather than a mount point
+ * with a '=' in its name: the image must have a partition PART. */
+static int is_part_spec(const char *image_path, const char *target) {
+	CgptShowParams gpt = { .drive_name = (char *)image_path };
+	const char *eq = strchr(target, '=');
+	char *part;
+	int found;
+
+	if (!eq || eq == target || !eq[1])
+		return 0;
+	part = strndup(target, eq - target);
+	if (!part) {
+		perror("Failed to allocate partition");
+		return 0;
+	}
+	/* An image without a GPT just isn't partitioned. */
+	CgptSetErrorHandler(ignore_cgpt_error, NULL);
+	found = CgptGetPartitions(&gpt) == CGPT_OK &&
+		find_partition(&gpt, part);
+	CgptSetErrorHandler(NULL, NULL);
+	free(gpt.partitions);
+	free(part);
+	return found;
+}
+
+static void usage(void) {
+	fprintf(stderr,
+		"Usage: loopy [-r] [-P] <SOURCE> <TARGET>\n"
+		"       loopy [-r] <IMAGE> <PART>=<TARGET>...\n"
+		"Mounts the image SOURCE at TARGET through a loop device.\n"
+		"The second form mounts partitions of a GPT disk image, each\n"
+		"PART given by number or label, at once.\n"
+		"\n"
+		"  -r  attach and mount read-only\n"
+		"  -P  scan the image for partitions too\n"
+		"  -p, --pool  use a free loop device from the pool\n"
+		"\n"
+		"       loopy --pool-add <N>\n"
+		"       loopy --pool-list\n"
+		"       loopy --pool-release [<DEVICE>...]\n"
+		"Creates N loop devices for the pool, lists the pool with what\n"
+		"each device is bound to, or removes devices from it, all of\n"
+		"them if none are given.  The pool is kept in %s, or\n"
+		"$LOOPY_POOL.\n", kDefaultPoolPath);
+}
+
 int main(int argc, char *argv[]) {
 
         const char *path, *target;
-        
-	if (!(argc == 3)) {
-                perror("Invalid usage of loop_util. Please input <SOURCE> <TARGET>");
-                return -1;
-        }
+	static const struct option long_options[] = {
+		{"pool", no_argument, NULL, 'p'},
+		{"pool-add", required_argument, NULL, 'A'},
+		{"pool-list", no_argument, NULL, 'L'},
+		{"pool-release", no_argument, NULL, 'R'},
+		{0, 0, 0, 0}
+	};
+	int pool_command = 0, pool_count = 0;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "rPp", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'r':
+			flag_read_only = 1;
+			break;
+		case 'P':
+			flag_partscan = 1;
+			break;
+		case 'p':
+			flag_pool = 1;
+			break;
+		case 'A':
+			pool_count = atoi(optarg);
+			if (pool_count <= 0) {
+				usage();
+				return -1;
+			}
+			/* fall through */
+		case 'L':
+		case 'R':
+			if (pool_command) {
+				usage();
+				return -1;
+			}
+			pool_command = c;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (pool_command == 'R')
+		return pool_release(argv + optind, argc - optind);
+	if (pool_command && optind != argc) {
+		usage();
+		return -1;
+	}
+	if (pool_command == 'A')
+		return pool_add(pool_count);
+	if (pool_command == 'L')
+		return pool_list();
+
+	if (argc - optind < 2) {
+		usage();
+		return -1;
+	}
+
+        path = argv[optind];
+        target = argv[optind + 1];
 
-        path = argv[1];
-        target = argv[2];
+	if (argc - optind > 2 || is_part_spec(path, target))
+		return multi_mount(path, argv + optind + 1, argc - optind - 1);
 
         int p = single_mount(path, target);
         if (p < 0)
@@ -147,5 +739,3 @@ int main(int argc, char *argv[]) {
         return p;
 
 }
-
-
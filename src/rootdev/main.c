@@ -32,6 +32,7 @@ static void print_help(const char *progname) {
     "  -d\treturn the block device only if possible\n"
     "  -i\treturn path even if the node doesn't exist\n"
     "  -s\tif possible, return the first slave of the root device\n"
+    "  -a\treturn every device the root device is built on, one per line\n"
     "\n"
     "  --block [path]\tset the path to block under the sys mount point\n"
     "  --dev [path]\tset the path to dev mount point\n"
@@ -42,6 +43,7 @@ static void print_help(const char *progname) {
 
 static int flag_help = 0;
 static int flag_use_slave = 0;
+static int flag_all_slaves = 0;
 static int flag_strip_partition = 0;
 static int flag_ignore = 0;
 static int flag_create = 0;
@@ -61,6 +63,7 @@ static void parse_args(int argc, char **argv) {
       {"h", no_argument, &flag_help, 1},
       {"i", no_argument, &flag_ignore, 1},
       {"s", no_argument, &flag_use_slave, 1},
+      {"a", no_argument, &flag_all_slaves, 1},
       /* Long arguments for testing. */
       {"block", required_argument, NULL, 'b'},
       {"dev", required_argument, NULL, 'd'},
@@ -101,6 +104,12 @@ static void parse_args(int argc, char **argv) {
     return;
   }
 
+  if (flag_all_slaves && (flag_use_slave || flag_create)) {
+    flag_help = 1;
+    warnx("-a is incompatible with -s and -c.");
+    return;
+  }
+
   if (optind < argc) {
     flag_path = argv[optind++];
   }
@@ -111,6 +120,64 @@ static void parse_args(int argc, char **argv) {
    }
 }
 
+/* Prints the bottom of every branch of the stack under root_dev, or with
+ * -d the disks they're on, each once. */
+static int print_all_slaves(dev_t root_dev) {
+  struct rootdev_node nodes[64];
+  struct rootdev_ctx *ctx;
+  char path[PATH_MAX];
+  char *printed[64];
+  int num_printed = 0;
+  int count, i, j;
+  int ret = 0;
+
+  if (!(ctx = rootdev_ctx_new(flag_block_path, flag_dev_path)))
+    err(1, "rootdev_ctx_new");
+  count = rootdev_ctx_get_topology(ctx, root_dev, nodes, 64);
+  if (count < 0) {
+    warn("unable to walk the devices under %u:%u", major(root_dev),
+         minor(root_dev));
+    rootdev_ctx_free(ctx);
+    return 1;
+  }
+
+  for (i = 0; i < count; i++) {
+    char name[sizeof(nodes[i].name)];
+    dev_t dev = nodes[i].dev;
+    int res;
+
+    if (nodes[i].num_slaves)
+      continue;
+    strcpy(name, nodes[i].name);
+    if (flag_strip_partition) {
+      dev = 0;
+      if (nodes[i].disk[0])
+        strcpy(name, nodes[i].disk);
+      else
+        rootdev_strip_partition(name, sizeof(name));
+    }
+    res = rootdev_ctx_get_path(ctx, path, sizeof(path), name, dev);
+    if (res < 0)
+      continue;
+    for (j = 0; j < num_printed; j++) {
+      if (!strcmp(printed[j], path))
+        break;
+    }
+    if (j < num_printed)
+      continue;
+    if (!(printed[num_printed++] = strdup(path)))
+      err(1, "strdup");
+    printf("%s\n", path);
+    if (res > 0 && !ret)
+      ret = res;
+  }
+
+  for (j = 0; j < num_printed; j++)
+    free(printed[j]);
+  rootdev_ctx_free(ctx);
+  return ret;
+}
+
 int main(int argc, char **argv) {
   struct stat path_stat;
   char path[PATH_MAX];
@@ -132,6 +199,13 @@ int main(int argc, char **argv) {
     root_dev = path_stat.st_dev;
   }
 
+  if (flag_all_slaves) {
+    ret = print_all_slaves(root_dev);
+    if (flag_ignore && ret > 0)
+      ret = 0;
+    return ret;
+  }
+
   path[0] = '\0';
   ret = rootdev_wrapper(path, sizeof(path),
                         flag_use_slave,
@@ -12,6 +12,7 @@
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -55,8 +56,33 @@ static const struct part_config kSecondaryPart[] = { { kRootB,    0 },
 /* The number of entries in a part_config so we could add RootC easily. */
 static const int kPartitionEntries = 3;
 
+/* Names cached per context; a root device and its slaves need a handful. */
+#define ROOTDEV_CACHE_SIZE 8
+
+struct rootdev_name_cache {
+  dev_t dev;
+  char name[NAME_MAX + 1];
+};
+
+struct rootdev_slave_cache {
+  char device[NAME_MAX + 1];
+  char slave[NAME_MAX + 1];
+  dev_t dev;
+};
+
+struct rootdev_ctx {
+  char *dev_path;
+  int block_fd;      /* search, e.g. /sys/block */
+  int dev_block_fd;  /* its <major>:<minor> links, e.g. /sys/dev/block */
+  int dev_fd;        /* dev_path */
+  struct rootdev_name_cache names[ROOTDEV_CACHE_SIZE];
+  int num_names, next_name;
+  struct rootdev_slave_cache slaves[ROOTDEV_CACHE_SIZE];
+  int num_slaves, next_slave;
+};
+
 /* Converts a file of %u:%u -> dev_t. */
-static dev_t devt_from_file(const char *file) {
+static dev_t devt_from_fileat(int dirfd, const char *file) {
   char candidate[10];  /* TODO(wad) system-provided constant? */
   ssize_t bytes = 0;
   unsigned int major_num = 0;
@@ -65,10 +91,10 @@ static dev_t devt_from_file(const char *file) {
   int fd = -1;
 
   /* Never hang. Either get the data or return 0. */
-  fd = open(file, O_NONBLOCK | O_RDONLY);
+  fd = openat(dirfd, file, O_NONBLOCK | O_RDONLY | O_CLOEXEC);
   if (fd < 0)
     return 0;
-  bytes = read(fd, candidate, sizeof(candidate));
+  bytes = read(fd, candidate, sizeof(candidate) - 1);
   close(fd);
 
   /* 0:0 should be considered the minimum size. */
@@ -86,52 +112,41 @@ static dev_t devt_from_file(const char *file) {
 /* Walks sysfs and recurses into any directory/link that represents
  * a block device to find sub-devices (partitions) for dev.
  * If dev == 0, the name fo the first device in the directory will be returned.
+ * The directory is dir relative to dirfd.
  * Returns the device's name in "name" */
 static int match_sysfs_device(char *name, size_t name_len,
-                              const char *basedir, dev_t *dev, int depth) {
+                              int dirfd, const char *dir, dev_t *dev,
+                              int depth) {
   int found = -1;
-  size_t basedir_len;
+  int fd;
   DIR *dirp = NULL;
   struct dirent *entry = NULL;
-  char *working_path = NULL;
-  long working_path_size = 0;
+  char dev_file[NAME_MAX + sizeof("/dev")];
 
-  if (!name || !name_len || !basedir || !dev) {
+  if (!name || !name_len || !dir || !dev) {
     warnx("match_sysfs_device: invalid arguments supplied");
     return -1;
   }
-  basedir_len = strlen(basedir);
-  if (!basedir_len) {
+  if (!*dir) {
     warnx("match_sysfs_device: basedir must not be empty");
     return -1;
   }
+  if (dirfd < 0)
+    return found;
 
   errno = 0;
-  dirp = opendir(basedir);
-  if (!dirp) {
+  fd = openat(dirfd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0 || !(dirp = fdopendir(fd))) {
      /* Don't complain if the directory doesn't exist. */
      if (errno != ENOENT)
-       warn("match_sysfs_device:opendir(%s)", basedir);
+       warn("match_sysfs_device:opendir(%s)", dir);
+     if (fd >= 0)
+       close(fd);
      return found;
   }
 
-  /* Grab a platform appropriate path to work with.
-   * Ideally, this won't vary under sys/block. */
-  working_path_size = pathconf(basedir, _PC_NAME_MAX) + 1;
-  /* Fallback to PATH_MAX on any pathconf error. */
-  if (working_path_size < 0)
-    working_path_size = PATH_MAX;
-
-  working_path = malloc(working_path_size);
-  if (!working_path) {
-    warn("malloc(dirent)");
-    closedir(dirp);
-    return found;
-  }
-
   while ((entry = readdir(dirp)) != NULL) {
     size_t candidate_len = strlen(entry->d_name);
-    size_t path_len = 0;
     dev_t found_devt = 0;
     /* Ignore the usual */
     if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
@@ -149,13 +164,9 @@ static int match_sysfs_device(char *name, size_t name_len,
       continue;
     }
     /* Determine path to block device number */
-    path_len = snprintf(working_path, working_path_size, "%s/%s/dev",
-                        basedir, entry->d_name);
-    /* Ignore if truncation occurs. */
-    if (path_len != candidate_len + basedir_len + 5)
-      continue;
+    snprintf(dev_file, sizeof(dev_file), "%s/dev", entry->d_name);
 
-    found_devt = devt_from_file(working_path);
+    found_devt = devt_from_fileat(fd, dev_file);
     /* *dev == 0 is a wildcard. */
     if (!*dev || found_devt == *dev) {
       snprintf(name, name_len, "%s", entry->d_name);
@@ -170,18 +181,124 @@ static int match_sysfs_device(char *name, size_t name_len,
 
     /* Recurse one level for devices that may have a matching partition. */
     if (major(found_devt) == major(*dev) && minor(*dev) > minor(found_devt)) {
-      sprintf(working_path, "%s/%s", basedir, entry->d_name);
-      found = match_sysfs_device(name, name_len, working_path, dev, depth + 1);
+      found = match_sysfs_device(name, name_len, fd, entry->d_name, dev,
+                                 depth + 1);
       if (found > 0)
         break;
     }
   }
 
-  free(working_path);
   closedir(dirp);
   return found;
 }
 
+/* Looks dev up in the <major>:<minor> links sysfs keeps next to the
+ * search directory, e.g. /sys/dev/block for /sys/block, with a single
+ * readlink() rather than a walk over every device and partition.
+ * Returns 1 and the device's name in "name" if found, 0 if not. */
+static int lookup_sysfs_devno(struct rootdev_ctx *ctx, char *name,
+                              size_t name_len, dev_t dev) {
+  char link_name[32];
+  char target[PATH_MAX];
+  const char *base;
+  ssize_t len;
+
+  /* A wildcard needs the walk. */
+  if (!dev || ctx->dev_block_fd < 0)
+    return 0;
+
+  snprintf(link_name, sizeof(link_name), "%u:%u", major(dev), minor(dev));
+  len = readlinkat(ctx->dev_block_fd, link_name, target, sizeof(target) - 1);
+  if (len <= 0)
+    return 0;
+  target[len] = 0;
+
+  base = strrchr(target, '/');
+  base = base ? base + 1 : target;
+  if (!*base || strlen(base) >= name_len)
+    return 0;
+  strcpy(name, base);
+  return 1;
+}
+
+/* Opens the sibling of search that holds the <major>:<minor> links. */
+static int open_dev_block(const char *search) {
+  size_t search_len = strlen(search);
+  char path[PATH_MAX];
+
+  while (search_len > 1 && search[search_len - 1] == '/')
+    search_len--;
+  if (search_len < 6 || strncmp(search + search_len - 6, "/block", 6))
+    return -1;
+  if (snprintf(path, sizeof(path), "%.*s/dev/block",
+               (int)(search_len - 6), search) >= sizeof(path))
+    return -1;
+  return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+struct rootdev_ctx *rootdev_ctx_new(const char *search, const char *dev_path) {
+  struct rootdev_ctx *ctx;
+
+  if (!search)
+    search = kDefaultSearchPath;
+  if (!dev_path)
+    dev_path = kDefaultDevPath;
+
+  ctx = calloc(1, sizeof(*ctx));
+  if (!ctx)
+    return NULL;
+  ctx->dev_path = strdup(dev_path);
+  if (!ctx->dev_path) {
+    free(ctx);
+    return NULL;
+  }
+  /* Missing trees are not an error here, only nothing will be found. */
+  ctx->block_fd = open(search, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  ctx->dev_block_fd = open_dev_block(search);
+  ctx->dev_fd = open(dev_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  return ctx;
+}
+
+void rootdev_ctx_free(struct rootdev_ctx *ctx) {
+  if (!ctx)
+    return;
+  if (ctx->block_fd >= 0)
+    close(ctx->block_fd);
+  if (ctx->dev_block_fd >= 0)
+    close(ctx->dev_block_fd);
+  if (ctx->dev_fd >= 0)
+    close(ctx->dev_fd);
+  free(ctx->dev_path);
+  free(ctx);
+}
+
+void rootdev_ctx_flush(struct rootdev_ctx *ctx) {
+  ctx->num_names = ctx->next_name = 0;
+  ctx->num_slaves = ctx->next_slave = 0;
+}
+
+static const char *cached_name(struct rootdev_ctx *ctx, dev_t dev) {
+  int i;
+
+  for (i = 0; i < ctx->num_names; i++) {
+    if (ctx->names[i].dev == dev)
+      return ctx->names[i].name;
+  }
+  return NULL;
+}
+
+static void cache_name(struct rootdev_ctx *ctx, dev_t dev, const char *name) {
+  struct rootdev_name_cache *entry = &ctx->names[ctx->next_name];
+
+  if (!dev || strlen(name) >= sizeof(entry->name))
+    return;
+  entry->dev = dev;
+  strcpy(entry->name, name);
+  ctx->next_name = (ctx->next_name + 1) % ROOTDEV_CACHE_SIZE;
+  if (ctx->num_names < ROOTDEV_CACHE_SIZE)
+    ctx->num_names++;
+}
+
 const char *rootdev_get_partition(const char *dst, size_t len) {
   const char *end = dst + strnlen(dst, len);
   const char *part = end - 1;
@@ -230,19 +347,17 @@ int rootdev_symlink_active(const char *path) {
   return ret;
 }
 
-int rootdev_get_device(char *dst, size_t size, dev_t dev,
-                       const char *search) {
+int rootdev_ctx_get_device(struct rootdev_ctx *ctx, char *dst, size_t size,
+                           dev_t dev) {
   struct stat active_root_statbuf;
-
-  if (search == NULL)
-    search = kDefaultSearchPath;
+  const char *name;
 
   /* Check if the -s symlink exists. */
   if ((stat(kActiveRoot, &active_root_statbuf) == 0) &&
       active_root_statbuf.st_rdev == dev) {
     /* Note, if the link is not fully qualified, this won't be
      * either. */
-    ssize_t len = readlink(kActiveRoot, dst, PATH_MAX);
+    ssize_t len = readlink(kActiveRoot, dst, size - 1);
     if (len > 0) {
       dst[len] = 0;
       return 0;
@@ -250,31 +365,66 @@ int rootdev_get_device(char *dst, size_t size, dev_t dev,
     /* If readlink fails or is empty, fall through */
   }
 
-  snprintf(dst, size, "%s", search);
-  if (match_sysfs_device(dst, size, dst, &dev, 0) <= 0) {
+  if ((name = cached_name(ctx, dev)) != NULL) {
+    if (strlen(name) >= size)
+      return 1;
+    strcpy(dst, name);
+    return 0;
+  }
+
+  if (!lookup_sysfs_devno(ctx, dst, size, dev) &&
+      /* Older or partial trees: walk them. */
+      match_sysfs_device(dst, size, ctx->block_fd, ".", &dev, 0) <= 0) {
     fprintf (stderr, "unable to find match\n");
     return 1;
   }
 
+  cache_name(ctx, dev, dst);
   return 0;
 }
 
+int rootdev_get_device(char *dst, size_t size, dev_t dev,
+                       const char *search) {
+  struct rootdev_ctx *ctx = rootdev_ctx_new(search, NULL);
+  int ret;
+
+  if (!ctx)
+    return -1;
+  ret = rootdev_ctx_get_device(ctx, dst, size, dev);
+  rootdev_ctx_free(ctx);
+  return ret;
+}
+
 /*
- * rootdev_get_device_slave returns results in slave which
+ * rootdev_ctx_get_device_slave returns results in slave which
  * may be the original device or the name of the slave.
  *
  * Because slave and device may point to the same data,
  * must be careful how they are handled because slave
  * is modified (can't use snprintf).
  */
-void rootdev_get_device_slave(char *slave, size_t size, dev_t *dev,
-                              const char *device, const char *search) {
-  char dst[PATH_MAX];
-  int len = 0;
+void rootdev_ctx_get_device_slave(struct rootdev_ctx *ctx, char *slave,
+                                  size_t size, dev_t *dev,
+                                  const char *device) {
+  char dst[NAME_MAX + sizeof("/slaves")];
+  struct rootdev_slave_cache *entry;
+  char original[NAME_MAX + 1];
   int i;
 
-  if (search == NULL)
-    search = kDefaultSearchPath;
+  if (strlen(device) >= sizeof(original)) {
+    warnx("rootdev_get_device_slave: device name too long");
+    return;
+  }
+  strcpy(original, device);
+
+  for (i = 0; i < ctx->num_slaves; i++) {
+    entry = &ctx->slaves[i];
+    if (!strcmp(entry->device, original) && strlen(entry->slave) < size) {
+      strcpy(slave, entry->slave);
+      *dev = entry->dev;
+      return;
+    }
+  }
 
   /*
    * With stacked device mappers, we have to chain through all the levels
@@ -285,17 +435,195 @@ void rootdev_get_device_slave(char *slave, size_t size, dev_t *dev,
     strncpy(slave, device, size);
   slave[size - 1] = '\0';
   for (i = 0; i < MAX_SLAVE_DEPTH; i++) {
-    len = snprintf(dst, sizeof(dst), "%s/%s/slaves", search, slave);
-    if (len != strlen(device) + strlen(search) + 8) {
+    if (snprintf(dst, sizeof(dst), "%s/slaves", slave) >= sizeof(dst)) {
       warnx("rootdev_get_device_slave: device name too long");
       return;
     }
     *dev = 0;
-    if (match_sysfs_device(slave, size, dst, dev, 0) <= 0) {
-      return;
+    if (match_sysfs_device(slave, size, ctx->block_fd, dst, dev, 0) <= 0)
+      break;
+  }
+  if (i == MAX_SLAVE_DEPTH)
+    warnx("slave depth greater than %d at %s", i, slave);
+
+  if (strlen(slave) >= sizeof(entry->slave))
+    return;
+  entry = &ctx->slaves[ctx->next_slave];
+  strcpy(entry->device, original);
+  strcpy(entry->slave, slave);
+  entry->dev = *dev;
+  ctx->next_slave = (ctx->next_slave + 1) % ROOTDEV_CACHE_SIZE;
+  if (ctx->num_slaves < ROOTDEV_CACHE_SIZE)
+    ctx->num_slaves++;
+}
+
+void rootdev_get_device_slave(char *slave, size_t size, dev_t *dev,
+                              const char *device, const char *search) {
+  struct rootdev_ctx *ctx = rootdev_ctx_new(search, NULL);
+
+  if (!ctx)
+    return;
+  rootdev_ctx_get_device_slave(ctx, slave, size, dev, device);
+  rootdev_ctx_free(ctx);
+}
+
+/* Reads a small decimal number from file under dirfd, or returns 0. */
+static int int_from_fileat(int dirfd, const char *file) {
+  char buf[16];
+  ssize_t bytes;
+  int fd;
+
+  fd = openat(dirfd, file, O_NONBLOCK | O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+  bytes = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (bytes <= 0)
+    return 0;
+  buf[bytes] = 0;
+  return atoi(buf);
+}
+
+/* Fills node from the sysfs directory entry under dirfd: its dev_t,
+ * partition number and, for partitions reached through a link, the disk
+ * holding it. */
+static void fill_node(int dirfd, const char *entry, struct rootdev_node *node) {
+  char file[NAME_MAX + sizeof("/partition")];
+  char target[PATH_MAX];
+  ssize_t len;
+
+  snprintf(file, sizeof(file), "%s/dev", entry);
+  node->dev = devt_from_fileat(dirfd, file);
+  snprintf(file, sizeof(file), "%s/partition", entry);
+  node->partition = int_from_fileat(dirfd, file);
+  node->disk[0] = 0;
+  if (!node->partition)
+    return;
+
+  /* .../block/sda/sda1: the disk is the directory above. */
+  len = readlinkat(dirfd, entry, target, sizeof(target) - 1);
+  if (len > 0) {
+    char *base, *disk;
+
+    target[len] = 0;
+    if ((base = strrchr(target, '/')) != NULL) {
+      *base = 0;
+      disk = strrchr(target, '/');
+      disk = disk ? disk + 1 : target;
+      if (strlen(disk) < sizeof(node->disk))
+        strcpy(node->disk, disk);
+    }
+  }
+}
+
+/* Opens the slaves directory of node. */
+static int open_slaves(struct rootdev_ctx *ctx,
+                       const struct rootdev_node *node) {
+  char dir[NAME_MAX + sizeof("/slaves")];
+
+  /* Partitions only have a directory of their own inside their disk's, so
+   * go by dev_t where the links exist. */
+  if (ctx->dev_block_fd >= 0) {
+    snprintf(dir, sizeof(dir), "%u:%u/slaves", major(node->dev),
+             minor(node->dev));
+    return openat(ctx->dev_block_fd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  snprintf(dir, sizeof(dir), "%s/slaves", node->name);
+  return openat(ctx->block_fd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static int seen_dev(const struct rootdev_node *nodes, int count, dev_t dev) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (nodes[i].dev == dev)
+      return 1;
+  }
+  return 0;
+}
+
+int rootdev_ctx_get_topology(struct rootdev_ctx *ctx, dev_t dev,
+                             struct rootdev_node *nodes, int max_nodes) {
+  struct rootdev_node *top = &nodes[0];
+  char link_name[32];
+  int count = 1;
+  int i;
+
+  if (!ctx || !nodes || max_nodes < 1) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(top, 0, sizeof(*top));
+  if (!lookup_sysfs_devno(ctx, top->name, sizeof(top->name), dev) &&
+      match_sysfs_device(top->name, sizeof(top->name), ctx->block_fd, ".",
+                         &dev, 0) <= 0) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (ctx->dev_block_fd >= 0) {
+    snprintf(link_name, sizeof(link_name), "%u:%u", major(dev), minor(dev));
+    fill_node(ctx->dev_block_fd, link_name, top);
+  } else {
+    fill_node(ctx->block_fd, top->name, top);
+  }
+  top->dev = dev;
+  top->parent = -1;
+
+  /* Breadth first, so every device is visited once however the levels
+   * fan out and back in. */
+  for (i = 0; i < count; i++) {
+    struct dirent *entry;
+    DIR *dirp;
+    int fd;
+
+    nodes[i].num_slaves = 0;
+    if (nodes[i].depth >= MAX_SLAVE_DEPTH)
+      continue;
+    if ((fd = open_slaves(ctx, &nodes[i])) < 0)
+      continue;
+    if (!(dirp = fdopendir(fd))) {
+      close(fd);
+      continue;
+    }
+    while ((entry = readdir(dirp)) != NULL) {
+      struct rootdev_node node;
+
+      if (entry->d_name[0] == '.' ||
+          strlen(entry->d_name) >= sizeof(node.name))
+        continue;
+      memset(&node, 0, sizeof(node));
+      strcpy(node.name, entry->d_name);
+      fill_node(fd, entry->d_name, &node);
+      if (!node.dev)
+        continue;
+      nodes[i].num_slaves++;
+      if (seen_dev(nodes, count, node.dev))
+        continue;
+      if (count == max_nodes) {
+        closedir(dirp);
+        errno = ENOBUFS;
+        return -1;
+      }
+      node.parent = i;
+      node.depth = nodes[i].depth + 1;
+      nodes[count++] = node;
     }
+    closedir(dirp);
   }
-  warnx("slave depth greater than %d at %s", i, slave);
+  return count;
+}
+
+int rootdev_get_topology(dev_t dev, struct rootdev_node *nodes, int max_nodes,
+                         const char *search) {
+  struct rootdev_ctx *ctx = rootdev_ctx_new(search, NULL);
+  int ret;
+
+  if (!ctx)
+    return -1;
+  ret = rootdev_ctx_get_topology(ctx, dev, nodes, max_nodes);
+  rootdev_ctx_free(ctx);
+  return ret;
 }
 
 int rootdev_create_devices(const char *name, dev_t dev, bool symlink) {
@@ -340,22 +668,19 @@ int rootdev_create_devices(const char *name, dev_t dev, bool symlink) {
   return ret;
 }
 
-int rootdev_get_path(char *path, size_t size, const char *device,
-                     dev_t dev, const char *dev_path) {
+int rootdev_ctx_get_path(struct rootdev_ctx *ctx, char *path, size_t size,
+                         const char *device, dev_t dev) {
   int path_len;
   struct stat dev_statbuf;
 
-  if (!dev_path)
-    dev_path = kDefaultDevPath;
-
   if (!path || !size || !device)
     return -1;
 
-  path_len = snprintf(path, size, "%s/%s", dev_path, device);
-  if (path_len != strlen(dev_path) + 1 + strlen(device))
+  path_len = snprintf(path, size, "%s/%s", ctx->dev_path, device);
+  if (path_len != strlen(ctx->dev_path) + 1 + strlen(device))
     return -1;
 
-  if (stat(path, &dev_statbuf) != 0)
+  if (ctx->dev_fd < 0 || fstatat(ctx->dev_fd, device, &dev_statbuf, 0) != 0)
     return 1;
 
   if (dev && dev != dev_statbuf.st_rdev)
@@ -364,30 +689,34 @@ int rootdev_get_path(char *path, size_t size, const char *device,
   return 0;
 }
 
-int rootdev_wrapper(char *path, size_t size,
-                    bool full, bool strip,
-                    dev_t *dev,
-                    const char *search, const char *dev_path) {
+int rootdev_get_path(char *path, size_t size, const char *device,
+                     dev_t dev, const char *dev_path) {
+  struct rootdev_ctx *ctx;
+  int ret;
+
+  if (!path || !size || !device)
+    return -1;
+  if (!(ctx = rootdev_ctx_new(NULL, dev_path)))
+    return -1;
+  ret = rootdev_ctx_get_path(ctx, path, size, device, dev);
+  rootdev_ctx_free(ctx);
+  return ret;
+}
+
+int rootdev_ctx_wrapper(struct rootdev_ctx *ctx, char *path, size_t size,
+                        bool full, bool strip, dev_t *dev) {
   int res = 0;
   char devname[PATH_MAX];
-  if (!search)
-    search = kDefaultSearchPath;
-  if (!dev_path)
-   dev_path = kDefaultDevPath;
   if (!dev)
     return -1;
 
-  res = rootdev_get_device(devname, sizeof(devname), *dev, search);
+  res = rootdev_ctx_get_device(ctx, devname, sizeof(devname), *dev);
   if (res != 0)
     return res;
 
   if (full)
-    rootdev_get_device_slave(devname, sizeof(devname), dev, devname,
-                             search);
+    rootdev_ctx_get_device_slave(ctx, devname, sizeof(devname), dev, devname);
 
-  /* TODO(wad) we should really just track the block dev, partition number, and
-   *           dev path.  When we rewrite this, we can track all the sysfs info
-   *           in the class. */
   if (strip) {
     /* When we strip the partition, we don't want get_path to return non-zero
      * because of dev mismatch.  Passing in 0 tells it to not test. */
@@ -395,8 +724,24 @@ int rootdev_wrapper(char *path, size_t size,
     rootdev_strip_partition(devname, size);
   }
 
-  res = rootdev_get_path(path, size, devname, *dev, dev_path);
+  res = rootdev_ctx_get_path(ctx, path, size, devname, *dev);
+
+  return res;
+}
+
+int rootdev_wrapper(char *path, size_t size,
+                    bool full, bool strip,
+                    dev_t *dev,
+                    const char *search, const char *dev_path) {
+  struct rootdev_ctx *ctx;
+  int res;
 
+  if (!dev)
+    return -1;
+  if (!(ctx = rootdev_ctx_new(search, dev_path)))
+    return -1;
+  res = rootdev_ctx_wrapper(ctx, path, size, full, strip, dev);
+  rootdev_ctx_free(ctx);
   return res;
 }
 
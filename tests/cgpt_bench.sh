@@ -0,0 +1,82 @@
+#!/bin/bash
+# Copyright (c) 2026 Flatcar Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+#
+# Times whole cgpt commands against IMAGES synthetic disk images laid out
+# like a Flatcar disk. Each result is one line of key=value pairs, like
+# the micro-benchmarks print:
+#   bench=cgpt_show images=16 iterations=20 ns_per_op=...
+# resize needs a loop device, so it is only timed when run as root.
+
+set -u
+
+CGPT=$(readlink -f "${1:-./cgpt}")
+IMAGES=${IMAGES:-16}
+ITERATIONS=${ITERATIONS:-20}
+
+if [[ ! -x ${CGPT} ]]; then
+  echo "ERROR: could not find cgpt '${CGPT}'" 1>&2
+  exit 1
+fi
+
+WORKDIR=$(mktemp -d cgpt_bench.XXXXXXX) || exit 1
+LOOP=
+cleanup () {
+  [ -n "$LOOP" ] && losetup -d "$LOOP"
+  rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+
+# make_image FILE: 9 partitions in 4 GiB, much like a Flatcar disk.
+make_image () {
+  local img=$1
+  "$CGPT" create -c -s $((8 * 1024 * 1024)) "$img" || return 1
+  "$CGPT" batch "$img" <<'EOT' || return 1
+add -i 1 -b 4096 -s 262144 -t efi -l EFI-SYSTEM
+add -i 2 -b 266240 -s 4096 -t bios -l BIOS-BOOT
+add -i 3 -b 270336 -s 2097152 -t flatcar-usr -l USR-A -S 1 -P 1
+add -i 4 -b 2367488 -s 2097152 -t flatcar-usr -l USR-B -P 2
+add -i 6 -b 4464640 -s 262144 -t data -l OEM
+add -i 7 -b 4726784 -s 131072 -t flatcar-reserved -l OEM-CONFIG
+add -i 9 -b 4857856 -s 3145728 -t flatcar-resize -l ROOT
+EOT
+}
+
+# bench NAME COMMAND...: runs COMMAND ITERATIONS times.
+bench () {
+  local name=$1 start end i
+  shift
+  "$@" >/dev/null || { echo "ERROR: $name failed" 1>&2; exit 1; }
+  start=$(date +%s%N)
+  for ((i = 0; i < ITERATIONS; i++)); do
+    "$@" >/dev/null
+  done
+  end=$(date +%s%N)
+  echo "bench=$name images=$IMAGES iterations=$ITERATIONS" \
+       "ns_per_op=$(((end - start) / ITERATIONS))"
+}
+
+images=()
+for ((n = 0; n < IMAGES; n++)); do
+  make_image "$WORKDIR/disk$n.img" || exit 1
+  images+=("$WORKDIR/disk$n.img")
+done
+
+bench cgpt_create "$CGPT" create -c -s $((8 * 1024 * 1024)) \
+  "$WORKDIR/scratch.img"
+bench cgpt_show "$CGPT" show "${images[0]}"
+bench cgpt_find_label_all "$CGPT" find -l ROOT "${images[@]}"
+bench cgpt_find_type_first "$CGPT" find -F -t flatcar-usr "${images[@]}"
+bench cgpt_next "$CGPT" next "${images[0]}"
+bench cgpt_prioritize "$CGPT" prioritize -i 4 "${images[0]}"
+
+if [ "$(id -u)" -ne 0 ]; then
+  echo "Skipping cgpt_resize (requires root)" 1>&2
+else
+  # ROOT stops short of the end of the disk: the first resize grows it,
+  # the timed ones check there's nothing left to grow into.
+  LOOP=$(losetup -f --show -P "${images[0]}") || exit 1
+  partx -a "$LOOP" 2>/dev/null
+  bench cgpt_resize "$CGPT" resize "${LOOP}p9"
+fi
@@ -0,0 +1,172 @@
+/* Copyright (c) 2026 Flatcar Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Micro-benchmarks of the GPT code cgpt spends its time in.  Prints one
+ * line per benchmark:
+ *   bench=<name> iterations=<n> ns_per_op=<ns>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cgpt.h"
+#include "cgptlib_internal.h"
+#include "crc32.h"
+#include "gpt.h"
+
+#define SECTOR_SIZE 512
+#define ENTRIES_SECTORS (TOTAL_ENTRIES_SIZE / SECTOR_SIZE)
+#define PARTITION_SECTORS 2048
+
+static uint8_t primary_header[SECTOR_SIZE];
+static uint8_t secondary_header[SECTOR_SIZE];
+static uint8_t primary_entries[TOTAL_ENTRIES_SIZE];
+static uint8_t secondary_entries[TOTAL_ENTRIES_SIZE];
+
+static uint64_t NowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void Report(const char *bench, int iterations, uint64_t start)
+{
+	printf("bench=%s iterations=%d ns_per_op=%llu\n", bench, iterations,
+	       (unsigned long long)((NowNs() - start) / iterations));
+}
+
+/*
+ * A valid GPT with all of its entries in use, one after the other, the
+ * way the slowest tables cgpt handles look.
+ */
+static void BuildGpt(GptData *gpt, uint32_t used_entries)
+{
+	GptHeader *h = (GptHeader *)primary_header;
+	GptHeader *h2 = (GptHeader *)secondary_header;
+	GptEntry *e = (GptEntry *)primary_entries;
+	Guid data = GPT_ENT_TYPE_LINUX_DATA;
+	uint64_t first_usable = 2 + ENTRIES_SECTORS;
+	uint64_t drive_sectors = first_usable +
+		(uint64_t)used_entries * PARTITION_SECTORS +
+		ENTRIES_SECTORS + 1;
+	uint32_t i;
+
+	memset(gpt, 0, sizeof(*gpt));
+	memset(primary_header, 0, sizeof(primary_header));
+	memset(primary_entries, 0, sizeof(primary_entries));
+	gpt->primary_header = primary_header;
+	gpt->secondary_header = secondary_header;
+	gpt->primary_entries = primary_entries;
+	gpt->secondary_entries = secondary_entries;
+	gpt->sector_bytes = SECTOR_SIZE;
+	gpt->drive_sectors = drive_sectors;
+	gpt->current_kernel = CGPT_KERNEL_ENTRY_NOT_FOUND;
+
+	memcpy(h->signature, GPT_HEADER_SIGNATURE, sizeof(h->signature));
+	h->revision = GPT_HEADER_REVISION;
+	h->size = sizeof(GptHeader);
+	h->my_lba = 1;
+	h->alternate_lba = drive_sectors - 1;
+	h->first_usable_lba = first_usable;
+	h->last_usable_lba = drive_sectors - 1 - ENTRIES_SECTORS - 1;
+	h->entries_lba = 2;
+	h->number_of_entries = TOTAL_ENTRIES_SIZE / sizeof(GptEntry);
+	h->size_of_entry = sizeof(GptEntry);
+
+	for (i = 0; i < used_entries; i++) {
+		memcpy(&e[i].type, &data, sizeof(data));
+		memset(&e[i].unique, 0, sizeof(e[i].unique));
+		memcpy(&e[i].unique, &i, sizeof(i));
+		e[i].unique.u.raw[15] = 1;
+		e[i].starting_lba = first_usable +
+			(uint64_t)i * PARTITION_SECTORS;
+		e[i].ending_lba = e[i].starting_lba + PARTITION_SECTORS - 1;
+	}
+	h->entries_crc32 = Crc32(primary_entries, TOTAL_ENTRIES_SIZE);
+	h->header_crc32 = Crc32(h, h->size);
+
+	memcpy(h2, h, sizeof(GptHeader));
+	h2->my_lba = drive_sectors - 1;
+	h2->alternate_lba = 1;
+	h2->entries_lba = drive_sectors - 1 - ENTRIES_SECTORS;
+	h2->header_crc32 = 0;
+	h2->header_crc32 = Crc32(h2, h2->size);
+	memcpy(secondary_entries, primary_entries, TOTAL_ENTRIES_SIZE);
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = 10000;
+	uint32_t used = TOTAL_ENTRIES_SIZE / sizeof(GptEntry);
+	uint16_t utf16[36];
+	uint8_t utf8[128];
+	volatile uint32_t sink = 0;
+	uint64_t start;
+	GptData gpt, pristine;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n ITERATIONS]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (iterations <= 0)
+		iterations = 1;
+
+	BuildGpt(&gpt, used);
+	if (GptSanityCheck(&gpt) != GPT_SUCCESS ||
+	    gpt.valid_headers != MASK_BOTH || gpt.valid_entries != MASK_BOTH) {
+		fprintf(stderr, "benchmark GPT is not valid\n");
+		return 1;
+	}
+
+	start = NowNs();
+	for (i = 0; i < iterations; i++)
+		sink += Crc32(primary_entries, TOTAL_ENTRIES_SIZE);
+	Report("Crc32_16K", iterations, start);
+
+	start = NowNs();
+	for (i = 0; i < iterations; i++)
+		sink += CheckEntries((GptEntry *)primary_entries,
+				     (GptHeader *)primary_header);
+	Report("CheckEntries_128", iterations, start);
+
+	/* Only the GptData fields change, the tables are left alone. */
+	pristine = gpt;
+	start = NowNs();
+	for (i = 0; i < iterations; i++) {
+		gpt = pristine;
+		sink += GptSanityCheck(&gpt);
+	}
+	Report("GptSanityCheck", iterations, start);
+
+	/* Repair a lost secondary header every time. */
+	start = NowNs();
+	for (i = 0; i < iterations; i++) {
+		gpt = pristine;
+		memset(secondary_header, 0, sizeof(secondary_header));
+		GptSanityCheck(&gpt);
+		sink += GptRepair(&gpt);
+	}
+	Report("GptSanityCheck+GptRepair", iterations, start);
+
+	for (i = 0; i < 36; i++)
+		utf16[i] = "Flatcar Container Linux usr partition"[i];
+	start = NowNs();
+	for (i = 0; i < iterations; i++)
+		sink += UTF16ToUTF8(utf16, 36, utf8, sizeof(utf8));
+	Report("UTF16ToUTF8_36", iterations, start);
+
+	return sink == 0xdeadbeef;
+}
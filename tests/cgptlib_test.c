@@ -9,6 +9,7 @@
 #include "cgptlib_test.h"
 #include "crc32.h"
 #include "crc32_test.h"
+#include "sha256_test.h"
 #include "gpt.h"
 #include "test_common.h"
 #include "utility.h"
@@ -222,8 +223,8 @@ static int TestBuildTestGptData(void)
 
 /*
  * Test if wrong sector_bytes or drive_sectors is detected by GptInit().
- * Currently we only support 512 bytes per sector.  In the future, we may
- * support other sizes.  A too small drive_sectors should be rejected by
+ * We support 512 and 4096 bytes per sector.  A too small drive_sectors
+ * (which depends on the sector size) should be rejected by
  * GptInit().
  */
 static int ParameterTests(void)
@@ -240,7 +241,12 @@ static int ParameterTests(void)
 		{512, 66, GPT_ERROR_INVALID_SECTOR_NUMBER},
 		{512, GPT_PMBR_SECTOR + GPT_HEADER_SECTOR * 2 +
 		 GPT_ENTRIES_SECTORS * 2, GPT_SUCCESS},
-		{4096, DEFAULT_DRIVE_SECTORS, GPT_ERROR_INVALID_SECTOR_SIZE},
+		{4096, DEFAULT_DRIVE_SECTORS, GPT_SUCCESS},
+		{4096, GPT_PMBR_SECTOR + GPT_HEADER_SECTOR * 2 + 4 * 2,
+		 GPT_SUCCESS},
+		{4096, GPT_PMBR_SECTOR + GPT_HEADER_SECTOR * 2 + 4 * 2 - 1,
+		 GPT_ERROR_INVALID_SECTOR_NUMBER},
+		{1024, DEFAULT_DRIVE_SECTORS, GPT_ERROR_INVALID_SECTOR_SIZE},
 	};
 	int i;
 
@@ -343,15 +349,18 @@ static int SignatureTest(void)
 	GptHeader *h2 = (GptHeader *)gpt->secondary_header;
 	int i;
 
-	EXPECT(1 == CheckHeader(NULL, 0, gpt->drive_sectors));
+	EXPECT(1 == CheckHeader(NULL, 0, gpt->drive_sectors,
+				gpt->sector_bytes));
 
 	for (i = 0; i < 8; ++i) {
 		BuildTestGptData(gpt);
 		h1->signature[i] ^= 0xff;
 		h2->signature[i] ^= 0xff;
 		RefreshCrc32(gpt);
-		EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors));
-		EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors));
+		EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors,
+					gpt->sector_bytes));
+		EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors,
+					gpt->sector_bytes));
 	}
 
 	return TEST_OK;
@@ -385,9 +394,11 @@ static int RevisionTest(void)
 		h2->revision = cases[i].value_to_test;
 		RefreshCrc32(gpt);
 
-		EXPECT(CheckHeader(h1, 0, gpt->drive_sectors) ==
+		EXPECT(CheckHeader(h1, 0, gpt->drive_sectors,
+				   gpt->sector_bytes) ==
 		       cases[i].expect_rv);
-		EXPECT(CheckHeader(h2, 1, gpt->drive_sectors) ==
+		EXPECT(CheckHeader(h2, 1, gpt->drive_sectors,
+				   gpt->sector_bytes) ==
 		       cases[i].expect_rv);
 	}
 	return TEST_OK;
@@ -418,9 +429,11 @@ static int SizeTest(void)
 		h2->size = cases[i].value_to_test;
 		RefreshCrc32(gpt);
 
-		EXPECT(CheckHeader(h1, 0, gpt->drive_sectors) ==
+		EXPECT(CheckHeader(h1, 0, gpt->drive_sectors,
+				   gpt->sector_bytes) ==
 		       cases[i].expect_rv);
-		EXPECT(CheckHeader(h2, 1, gpt->drive_sectors) ==
+		EXPECT(CheckHeader(h2, 1, gpt->drive_sectors,
+				   gpt->sector_bytes) ==
 		       cases[i].expect_rv);
 	}
 	return TEST_OK;
@@ -437,12 +450,12 @@ static int CrcFieldTest(void)
 	/* Modify a field that the header verification doesn't care about */
 	h1->entries_crc32++;
 	h2->entries_crc32++;
-	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors));
-	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors));
+	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
 	/* Refresh the CRC; should pass now */
 	RefreshCrc32(gpt);
-	EXPECT(0 == CheckHeader(h1, 0, gpt->drive_sectors));
-	EXPECT(0 == CheckHeader(h2, 1, gpt->drive_sectors));
+	EXPECT(0 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(0 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
 
 	return TEST_OK;
 }
@@ -458,8 +471,8 @@ static int ReservedFieldsTest(void)
 	h1->reserved_zero ^= 0x12345678;  /* whatever random */
 	h2->reserved_zero ^= 0x12345678;  /* whatever random */
 	RefreshCrc32(gpt);
-	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors));
-	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors));
+	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
 
 #ifdef PADDING_CHECKED
 	/* TODO: padding check is currently disabled */
@@ -467,8 +480,8 @@ static int ReservedFieldsTest(void)
 	h1->padding[12] ^= 0x34;  /* whatever random */
 	h2->padding[56] ^= 0x78;  /* whatever random */
 	RefreshCrc32(gpt);
-	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors));
-	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors));
+	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
 #endif
 
 	return TEST_OK;
@@ -506,9 +519,11 @@ static int SizeOfPartitionEntryTest(void) {
 			cases[i].value_to_test;
 		RefreshCrc32(gpt);
 
-		EXPECT(CheckHeader(h1, 0, gpt->drive_sectors) ==
+		EXPECT(CheckHeader(h1, 0, gpt->drive_sectors,
+				   gpt->sector_bytes) ==
 		       cases[i].expect_rv);
-		EXPECT(CheckHeader(h2, 1, gpt->drive_sectors) ==
+		EXPECT(CheckHeader(h2, 1, gpt->drive_sectors,
+				   gpt->sector_bytes) ==
 		       cases[i].expect_rv);
 	}
 
@@ -529,8 +544,8 @@ static int NumberOfPartitionEntriesTest(void)
 	h1->number_of_entries--;
 	h2->number_of_entries /= 2;
 	RefreshCrc32(gpt);
-	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors));
-	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors));
+	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
 
 	return TEST_OK;
 }
@@ -545,51 +560,88 @@ static int MyLbaTest(void)
 
 	/* myLBA depends on primary vs secondary flag */
 	BuildTestGptData(gpt);
-	EXPECT(1 == CheckHeader(h1, 1, gpt->drive_sectors));
-	EXPECT(1 == CheckHeader(h2, 0, gpt->drive_sectors));
+	EXPECT(1 == CheckHeader(h1, 1, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(1 == CheckHeader(h2, 0, gpt->drive_sectors, gpt->sector_bytes));
 
 	BuildTestGptData(gpt);
 	h1->my_lba--;
 	h2->my_lba--;
 	RefreshCrc32(gpt);
-	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors));
-	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors));
+	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
 
 	BuildTestGptData(gpt);
 	h1->my_lba = 2;
 	h2->my_lba--;
 	RefreshCrc32(gpt);
-	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors));
-	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors));
+	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
 
 	/* We should ignore the alternate_lba field entirely */
 	BuildTestGptData(gpt);
 	h1->alternate_lba++;
 	h2->alternate_lba++;
 	RefreshCrc32(gpt);
-	EXPECT(0 == CheckHeader(h1, 0, gpt->drive_sectors));
-	EXPECT(0 == CheckHeader(h2, 1, gpt->drive_sectors));
+	EXPECT(0 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(0 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
 
 	BuildTestGptData(gpt);
 	h1->alternate_lba--;
 	h2->alternate_lba--;
 	RefreshCrc32(gpt);
-	EXPECT(0 == CheckHeader(h1, 0, gpt->drive_sectors));
-	EXPECT(0 == CheckHeader(h2, 1, gpt->drive_sectors));
+	EXPECT(0 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(0 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
 
 	BuildTestGptData(gpt);
 	h1->entries_lba++;
 	h2->entries_lba++;
 	RefreshCrc32(gpt);
-	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors));
-	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors));
+	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
 
 	BuildTestGptData(gpt);
 	h1->entries_lba--;
 	h2->entries_lba--;
 	RefreshCrc32(gpt);
-	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors));
-	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors));
+	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
+
+	return TEST_OK;
+}
+
+/* Test that the entries array locations follow the sector size. */
+static int SectorSizeTest(void)
+{
+	GptData *gpt = GetEmptyGptData();
+	GptHeader *h1 = (GptHeader *)gpt->primary_header;
+	GptHeader *h2 = (GptHeader *)gpt->secondary_header;
+
+	EXPECT(32 == GptEntriesSectors(TOTAL_ENTRIES_SIZE, 512));
+	EXPECT(4 == GptEntriesSectors(TOTAL_ENTRIES_SIZE, 4096));
+
+	/* The 512-byte layout puts the secondary entries too far back. */
+	BuildTestGptData(gpt);
+	gpt->sector_bytes = 4096;
+	EXPECT(0 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
+
+	h2->entries_lba = h2->my_lba - 4;
+	RefreshCrc32(gpt);
+	EXPECT(0 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
+
+	/* The usable area may now start right after the primary entries. */
+	h1->first_usable_lba = 6;
+	h2->first_usable_lba = 6;
+	h1->last_usable_lba = gpt->drive_sectors - 6;
+	h2->last_usable_lba = gpt->drive_sectors - 6;
+	RefreshCrc32(gpt);
+	EXPECT(0 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(0 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
+	h1->first_usable_lba = 5;
+	h2->last_usable_lba = gpt->drive_sectors - 5;
+	RefreshCrc32(gpt);
+	EXPECT(1 == CheckHeader(h1, 0, gpt->drive_sectors, gpt->sector_bytes));
+	EXPECT(1 == CheckHeader(h2, 1, gpt->drive_sectors, gpt->sector_bytes));
 
 	return TEST_OK;
 }
@@ -637,9 +689,11 @@ static int FirstUsableLbaAndLastUsableLbaTest(void)
 		h2->last_usable_lba = cases[i].secondary_last_usable_lba;
 		RefreshCrc32(gpt);
 
-		EXPECT(CheckHeader(h1, 0, gpt->drive_sectors) ==
+		EXPECT(CheckHeader(h1, 0, gpt->drive_sectors,
+				   gpt->sector_bytes) ==
 		       cases[i].primary_rv);
-		EXPECT(CheckHeader(h2, 1, gpt->drive_sectors) ==
+		EXPECT(CheckHeader(h2, 1, gpt->drive_sectors,
+				   gpt->sector_bytes) ==
 		       cases[i].secondary_rv);
 	}
 
@@ -787,6 +841,140 @@ static int OverlappedPartitionTest(void) {
 	return TEST_OK;
 }
 
+/* Test overlap and duplicate detection on a full, unsorted table. */
+static int FullTableEntriesTest(void)
+{
+	GptData *gpt = GetEmptyGptData();
+	GptHeader *h = (GptHeader *)gpt->primary_header;
+	GptEntry *e = (GptEntry *)gpt->primary_entries;
+	int i;
+
+	/* 128 two-sector partitions, placed in a scrambled order. */
+	BuildTestGptData(gpt);
+	ZeroEntries(gpt);
+	for (i = 0; i < 128; i++) {
+		int slot = (i * 37) % 128;
+
+		Memcpy(&e[i].type, &guid_rootfs, sizeof(Guid));
+		SetGuid(&e[i].unique, i);
+		e[i].starting_lba = 34 + 2 * slot;
+		e[i].ending_lba = e[i].starting_lba + 1;
+	}
+	RefreshCrc32(gpt);
+	EXPECT(0 == CheckEntries(e, h));
+
+	/*
+	 * Last entry grows into its neighbours on disk.  The error is the one
+	 * seen from the lowest numbered entry involved.
+	 */
+	e[127].starting_lba--;
+	RefreshCrc32(gpt);
+	EXPECT(GPT_ERROR_END_LBA_OVERLAP == CheckEntries(e, h));
+	e[127].starting_lba++;
+	e[127].ending_lba++;
+	RefreshCrc32(gpt);
+	EXPECT(GPT_ERROR_START_LBA_OVERLAP == CheckEntries(e, h));
+	e[127].ending_lba--;
+
+	/* Entry starting inside a far away one. */
+	e[3].starting_lba = e[100].ending_lba;
+	e[3].ending_lba = e[100].ending_lba;
+	RefreshCrc32(gpt);
+	EXPECT(GPT_ERROR_START_LBA_OVERLAP == CheckEntries(e, h));
+
+	/* Duplicate UniqueGuid in the first and last entries. */
+	BuildTestGptData(gpt);
+	ZeroEntries(gpt);
+	for (i = 0; i < 128; i++) {
+		Memcpy(&e[i].type, &guid_rootfs, sizeof(Guid));
+		SetGuid(&e[i].unique, i);
+		e[i].starting_lba = 34 + 3 * (127 - i);
+		e[i].ending_lba = e[i].starting_lba;
+	}
+	SetGuid(&e[127].unique, 0);
+	RefreshCrc32(gpt);
+	EXPECT(GPT_ERROR_DUP_GUID == CheckEntries(e, h));
+
+	return TEST_OK;
+}
+
+/* Test identical entries tables are only checked once. */
+static int SanityCheckStatsTest(void)
+{
+	GptData *gpt = GetEmptyGptData();
+	GptEntry *e1 = (GptEntry *)gpt->primary_entries;
+	GptEntry *e2 = (GptEntry *)gpt->secondary_entries;
+
+	BuildTestGptData(gpt);
+	EXPECT(GPT_SUCCESS == GptSanityCheck(gpt));
+	EXPECT(MASK_BOTH == gpt->valid_entries);
+	EXPECT(2 == gpt->stats.header_checks);
+	EXPECT(1 == gpt->stats.entries_checks);
+	EXPECT(1 == gpt->stats.entries_checks_skipped);
+
+	/* Counters accumulate across calls. */
+	EXPECT(GPT_SUCCESS == GptSanityCheck(gpt));
+	EXPECT(4 == gpt->stats.header_checks);
+	EXPECT(2 == gpt->stats.entries_checks);
+	EXPECT(2 == gpt->stats.entries_checks_skipped);
+
+	/* Differing tables are both checked. */
+	BuildTestGptData(gpt);
+	Memset(&gpt->stats, 0, sizeof(gpt->stats));
+	e2[KERNEL_A].attrs.fields.gpt_att ^= 1;
+	EXPECT(GPT_SUCCESS == GptSanityCheck(gpt));
+	EXPECT(MASK_PRIMARY == gpt->valid_entries);
+	EXPECT(2 == gpt->stats.entries_checks);
+	EXPECT(0 == gpt->stats.entries_checks_skipped);
+
+	/* Identical but bad tables share the verdict too. */
+	BuildTestGptData(gpt);
+	Memset(&gpt->stats, 0, sizeof(gpt->stats));
+	e1[KERNEL_B].ending_lba = e1[KERNEL_A].ending_lba;
+	e2[KERNEL_B].ending_lba = e2[KERNEL_A].ending_lba;
+	EXPECT(GPT_ERROR_INVALID_ENTRIES == GptSanityCheck(gpt));
+	EXPECT(0 == gpt->valid_entries);
+	EXPECT(2 == gpt->stats.entries_checks);
+	EXPECT(2 == gpt->stats.entries_checks_skipped);
+
+	return TEST_OK;
+}
+
+/* Test GptSanityCheck() with a secondary GPT that was never loaded. */
+static int UnverifiedSecondaryTest(void)
+{
+	GptData *gpt = GetEmptyGptData();
+	GptHeader *h1 = (GptHeader *)gpt->primary_header;
+
+	/* The secondary copy is neither checked nor reported valid. */
+	BuildTestGptData(gpt);
+	Memset(gpt->secondary_header, 0, MAX_SECTOR_SIZE);
+	Memset(gpt->secondary_entries, 0, PARTITION_ENTRIES_SIZE);
+	gpt->unverified = MASK_SECONDARY;
+	EXPECT(GPT_SUCCESS == GptSanityCheck(gpt));
+	EXPECT(MASK_PRIMARY == gpt->valid_headers);
+	EXPECT(MASK_PRIMARY == gpt->valid_entries);
+	EXPECT(1 == gpt->stats.header_checks);
+	EXPECT(1 == gpt->stats.entries_checks);
+	EXPECT(0 == gpt->stats.entries_checks_skipped);
+
+	/* Even if it would have been valid. */
+	BuildTestGptData(gpt);
+	gpt->unverified = MASK_SECONDARY;
+	EXPECT(GPT_SUCCESS == GptSanityCheck(gpt));
+	EXPECT(MASK_PRIMARY == gpt->valid_headers);
+	EXPECT(MASK_PRIMARY == gpt->valid_entries);
+
+	/* Nothing to fall back on if the primary is bad. */
+	BuildTestGptData(gpt);
+	gpt->unverified = MASK_SECONDARY;
+	h1->my_lba++;
+	RefreshCrc32(gpt);
+	EXPECT(GPT_ERROR_INVALID_HEADERS == GptSanityCheck(gpt));
+
+	return TEST_OK;
+}
+
 /* Test both sanity checking and repair. */
 static int SanityCheckTest(void)
 {
@@ -1271,6 +1459,126 @@ static int GetNextTriesTest(void)
 	return TEST_OK;
 }
 
+static int GetNextManyKernelsTest(void)
+{
+	GptData *gpt = GetEmptyGptData();
+	GptEntry *e1 = (GptEntry *)(gpt->primary_entries);
+	uint64_t start, size;
+	int i, prev, prev_prio, found, bootable = 0;
+
+	/* Every entry a one-sector kernel with a scrambled priority. */
+	BuildTestGptData(gpt);
+	ZeroEntries(gpt);
+	for (i = 0; i < 128; i++) {
+		FillEntry(e1 + i, 1, (i * 7) % 16, i % 3 != 0, i % 5);
+		SetGuid(&e1[i].unique, i);
+		e1[i].starting_lba = 34 + i;
+		e1[i].ending_lba = 34 + i;
+		if (GetEntryPriority(e1 + i) &&
+		    (GetEntrySuccessful(e1 + i) || GetEntryTries(e1 + i)))
+			bootable++;
+	}
+	RefreshCrc32(gpt);
+	EXPECT(GPT_SUCCESS == GptInit(gpt));
+
+	/* Priority high to low, then index low to high. */
+	prev = -1;
+	prev_prio = 16;
+	for (found = 0;
+	     GPT_SUCCESS == GptNextKernelEntry(gpt, &start, &size); found++) {
+		i = gpt->current_kernel;
+		EXPECT(34 + i == start);
+		EXPECT(GetEntryPriority(e1 + i) == gpt->current_priority);
+		EXPECT(gpt->current_priority < prev_prio ||
+		       (gpt->current_priority == prev_prio && i > prev));
+		prev = i;
+		prev_prio = gpt->current_priority;
+	}
+	EXPECT(bootable == found);
+	EXPECT(-1 == gpt->current_kernel);
+
+	/* Restarting the scan, marking kernels bad along the way. */
+	gpt->current_kernel = CGPT_KERNEL_ENTRY_NOT_FOUND;
+	gpt->current_priority = 999;
+	for (found = 0;
+	     GPT_SUCCESS == GptNextKernelEntry(gpt, &start, &size); found++) {
+		if (found % 2)
+			GptUpdateKernelEntry(gpt, GPT_UPDATE_ENTRY_BAD);
+		else
+			GptUpdateKernelEntry(gpt, GPT_UPDATE_ENTRY_TRY);
+	}
+	EXPECT(bootable == found);
+
+	/* Whatever survived is found again, with nothing else. */
+	bootable = 0;
+	for (i = 0; i < 128; i++) {
+		if (GetEntryPriority(e1 + i) &&
+		    (GetEntrySuccessful(e1 + i) || GetEntryTries(e1 + i)))
+			bootable++;
+	}
+	gpt->current_kernel = CGPT_KERNEL_ENTRY_NOT_FOUND;
+	gpt->current_priority = 999;
+	for (found = 0;
+	     GPT_SUCCESS == GptNextKernelEntry(gpt, &start, &size); found++) {
+		i = gpt->current_kernel;
+		EXPECT(GetEntryPriority(e1 + i) > 0);
+		EXPECT(GetEntrySuccessful(e1 + i) || GetEntryTries(e1 + i));
+	}
+	EXPECT(bootable == found);
+
+	return TEST_OK;
+}
+
+static int GetNextAfterSetAttributesTest(void)
+{
+	GptData *gpt = GetEmptyGptData();
+	GptEntry *e1 = (GptEntry *)(gpt->primary_entries);
+	uint64_t start, size;
+
+	BuildTestGptData(gpt);
+	FillEntry(e1 + KERNEL_A, 1, 2, 1, 0);
+	FillEntry(e1 + KERNEL_B, 1, 1, 1, 0);
+	FillEntry(e1 + KERNEL_X, 1, 0, 0, 0);
+	RefreshCrc32(gpt);
+	EXPECT(GPT_SUCCESS == GptInit(gpt));
+
+	/* Raising B's priority after GptInit() puts it first. */
+	SetEntryPriority(e1 + KERNEL_B, 3);
+	EXPECT(GPT_SUCCESS == GptNextKernelEntry(gpt, &start, &size));
+	EXPECT(KERNEL_B == gpt->current_kernel);
+	EXPECT(3 == gpt->current_priority);
+
+	/* X becoming bootable in the middle of the scan is found next. */
+	SetEntryPriority(e1 + KERNEL_X, 2);
+	SetEntryTries(e1 + KERNEL_X, 1);
+	EXPECT(GPT_SUCCESS == GptNextKernelEntry(gpt, &start, &size));
+	EXPECT(KERNEL_A == gpt->current_kernel);
+	EXPECT(GPT_SUCCESS == GptNextKernelEntry(gpt, &start, &size));
+	EXPECT(KERNEL_X == gpt->current_kernel);
+	EXPECT(GPT_ERROR_NO_VALID_KERNEL ==
+	       GptNextKernelEntry(gpt, &start, &size));
+
+	/* A that no longer booted successfully, with no tries, is skipped. */
+	gpt->current_kernel = CGPT_KERNEL_ENTRY_NOT_FOUND;
+	gpt->current_priority = 999;
+	SetEntrySuccessful(e1 + KERNEL_A, 0);
+	EXPECT(GPT_SUCCESS == GptNextKernelEntry(gpt, &start, &size));
+	EXPECT(KERNEL_B == gpt->current_kernel);
+
+	/* Changes right before GptUpdateKernelEntry() aren't lost either. */
+	SetEntryTries(e1 + KERNEL_A, 2);
+	SetEntrySuccessful(e1 + KERNEL_B, 0);
+	EXPECT(GPT_SUCCESS == GptUpdateKernelEntry(gpt, GPT_UPDATE_ENTRY_BAD));
+	EXPECT(GPT_SUCCESS == GptNextKernelEntry(gpt, &start, &size));
+	EXPECT(KERNEL_A == gpt->current_kernel);
+	EXPECT(GPT_SUCCESS == GptNextKernelEntry(gpt, &start, &size));
+	EXPECT(KERNEL_X == gpt->current_kernel);
+	EXPECT(GPT_ERROR_NO_VALID_KERNEL ==
+	       GptNextKernelEntry(gpt, &start, &size));
+
+	return TEST_OK;
+}
+
 static int GptUpdateTest(void)
 {
 	GptData *gpt = GetEmptyGptData();
@@ -1436,6 +1744,155 @@ static int DuplicateUniqueGuidTest(void)
 	return TEST_OK;
 }
 
+/* Test the used entries come out in the order they are on the disk. */
+static int SortEntriesByStartTest(void)
+{
+	GptData *gpt = GetEmptyGptData();
+	GptHeader *h = (GptHeader *)gpt->primary_header;
+	GptEntry *e = (GptEntry *)gpt->primary_entries;
+	uint16_t order[MAX_NUMBER_OF_ENTRIES];
+	static const uint64_t starts[] = {300, 0, 100, 400, 0, 200, 34};
+	static const uint16_t expected[] = {6, 2, 5, 0, 3};
+	int i;
+
+	BuildTestGptData(gpt);
+	ZeroEntries(gpt);
+	for (i = 0; i < ARRAY_SIZE(starts); ++i) {
+		if (!starts[i])
+			continue;
+		e[i].starting_lba = starts[i];
+		e[i].ending_lba = starts[i] + 9;
+		SetGuid(&e[i].type, 1);
+		SetGuid(&e[i].unique, i);
+	}
+
+	EXPECT(ARRAY_SIZE(expected) == SortEntriesByStart(e, h, order));
+	for (i = 0; i < ARRAY_SIZE(expected); ++i)
+		EXPECT(expected[i] == order[i]);
+
+	ZeroEntries(gpt);
+	EXPECT(0 == SortEntriesByStart(e, h, order));
+
+	return TEST_OK;
+}
+
+/* Test incremental entries CRC updates match a full rehash. */
+static int EntriesCrcTrackTest(void)
+{
+	GptData *gpt = GetEmptyGptData();
+	GptHeader *h1 = (GptHeader *)gpt->primary_header;
+	GptHeader *h2 = (GptHeader *)gpt->secondary_header;
+	GptEntry *e1 = (GptEntry *)gpt->primary_entries;
+	GptEntry *e2 = (GptEntry *)gpt->secondary_entries;
+	uint32_t slot;
+
+	BuildTestGptData(gpt);
+	EXPECT(GPT_SUCCESS == GptSanityCheck(gpt));
+	GptEntriesTrackCrc(gpt, MASK_BOTH);
+	EXPECT(MASK_BOTH == gpt->crc_tracked);
+
+	/* Attribute flips in the first, middle and last slot. */
+	GptEntriesModified(gpt, MASK_PRIMARY, 0, sizeof(GptEntry));
+	SetEntryTries(e1 + 0, 5);
+	GptEntriesModified(gpt, MASK_PRIMARY, 3 * sizeof(GptEntry),
+			   sizeof(GptEntry));
+	SetEntryPriority(e1 + 3, 7);
+	GptEntriesModified(gpt, MASK_PRIMARY, 127 * sizeof(GptEntry),
+			   sizeof(GptEntry));
+	SetGuid(&e1[127].unique, 127);
+	/* Announcing the same slot again must not lose its old CRC. */
+	GptEntriesModified(gpt, MASK_PRIMARY, 0, 8);
+	SetEntryTries(e1 + 0, 6);
+	GptUpdateEntriesCrc(gpt, MASK_PRIMARY);
+	EXPECT(h1->entries_crc32 ==
+	       Crc32(gpt->primary_entries, TOTAL_ENTRIES_SIZE));
+	for (slot = 0; slot < GPT_CRC_SLOTS / 8; slot++)
+		EXPECT(0 == gpt->crc_dirty[0][slot]);
+
+	/* A second round builds on the first. */
+	GptEntriesModified(gpt, MASK_PRIMARY, 64, 128);
+	SetEntryTries(e1 + 0, 1);
+	SetEntryTries(e1 + 1, 1);
+	GptUpdateEntriesCrc(gpt, MASK_PRIMARY);
+	EXPECT(h1->entries_crc32 ==
+	       Crc32(gpt->primary_entries, TOTAL_ENTRIES_SIZE));
+
+	/* Identical secondary reuses the primary CRC. */
+	Memcpy(e2, e1, TOTAL_ENTRIES_SIZE);
+	GptEntriesUntrackCrc(gpt, MASK_SECONDARY);
+	GptUpdateEntriesCrc(gpt, MASK_BOTH);
+	EXPECT(h2->entries_crc32 == h1->entries_crc32);
+	EXPECT(h2->entries_crc32 ==
+	       Crc32(gpt->secondary_entries, TOTAL_ENTRIES_SIZE));
+
+	/* Out of range modifications stop tracking. */
+	GptEntriesModified(gpt, MASK_PRIMARY, TOTAL_ENTRIES_SIZE - 8, 16);
+	EXPECT(0 == (gpt->crc_tracked & MASK_PRIMARY));
+	e1[10].attrs.whole = 0x1234;
+	GptUpdateEntriesCrc(gpt, MASK_PRIMARY);
+	EXPECT(h1->entries_crc32 ==
+	       Crc32(gpt->primary_entries, TOTAL_ENTRIES_SIZE));
+
+	/* Tables not covering the whole buffer are never tracked. */
+	BuildTestGptData(gpt);
+	h1->number_of_entries = 64;
+	h2->number_of_entries = 64;
+	RefreshCrc32(gpt);
+	GptEntriesTrackCrc(gpt, MASK_BOTH);
+	EXPECT(0 == gpt->crc_tracked);
+
+	return TEST_OK;
+}
+
+/* Test that copying into a tracked table only dirties the changed slots. */
+static int EntriesCopyTest(void)
+{
+	GptData *gpt = GetEmptyGptData();
+	GptHeader *h1 = (GptHeader *)gpt->primary_header;
+	GptHeader *h2 = (GptHeader *)gpt->secondary_header;
+	GptEntry *e1 = (GptEntry *)gpt->primary_entries;
+	GptEntry *e2 = (GptEntry *)gpt->secondary_entries;
+	uint32_t slot;
+
+	BuildTestGptData(gpt);
+	EXPECT(GPT_SUCCESS == GptSanityCheck(gpt));
+	GptEntriesTrackCrc(gpt, MASK_BOTH);
+
+	GptEntriesModified(gpt, MASK_PRIMARY, 5 * sizeof(GptEntry),
+			   sizeof(GptEntry));
+	SetEntryTries(e1 + 5, 3);
+	EXPECT(0x20 == gpt->write_dirty[0][0]);
+
+	GptCopyEntries(gpt, MASK_SECONDARY);
+	EXPECT(0 == Memcmp(e1, e2, TOTAL_ENTRIES_SIZE));
+	EXPECT(MASK_BOTH == gpt->crc_tracked);
+	EXPECT(0x20 == gpt->write_dirty[1][0]);
+	for (slot = 1; slot < GPT_CRC_SLOTS / 8; slot++)
+		EXPECT(0 == gpt->write_dirty[1][slot]);
+
+	/* CRC updates leave the write bitmap for the caller. */
+	GptUpdateEntriesCrc(gpt, MASK_BOTH);
+	EXPECT(h1->entries_crc32 ==
+	       Crc32(gpt->primary_entries, TOTAL_ENTRIES_SIZE));
+	EXPECT(h2->entries_crc32 == h1->entries_crc32);
+	EXPECT(0x20 == gpt->write_dirty[0][0]);
+	EXPECT(0x20 == gpt->write_dirty[1][0]);
+
+	/* Tracking again must not forget pending writes. */
+	GptEntriesTrackCrc(gpt, MASK_BOTH);
+	EXPECT(0x20 == gpt->write_dirty[1][0]);
+
+	/* An untracked destination is copied wholesale. */
+	GptEntriesUntrackCrc(gpt, MASK_PRIMARY);
+	GptEntriesModified(gpt, MASK_SECONDARY, 0, sizeof(GptEntry));
+	SetEntryTries(e2 + 0, 1);
+	GptCopyEntries(gpt, MASK_PRIMARY);
+	EXPECT(0 == Memcmp(e1, e2, TOTAL_ENTRIES_SIZE));
+	EXPECT(MASK_SECONDARY == gpt->crc_tracked);
+
+	return TEST_OK;
+}
+
 /* Test getting the current kernel GUID */
 static int GetKernelGuidTest(void)
 {
@@ -1454,6 +1911,107 @@ static int GetKernelGuidTest(void)
 	return TEST_OK;
 }
 
+/* Test tables larger than the default 128 entries */
+static int LargeEntriesTableTest(void)
+{
+	static uint8_t primary_header[MAX_SECTOR_SIZE];
+	static uint8_t primary_entries[GPT_MAX_ENTRIES_SIZE];
+	static uint8_t secondary_header[MAX_SECTOR_SIZE];
+	static uint8_t secondary_entries[GPT_MAX_ENTRIES_SIZE];
+	const uint32_t bytes = 256 * sizeof(GptEntry);
+	const uint64_t sectors = bytes / DEFAULT_SECTOR_SIZE;  /* 64 */
+	const uint64_t drive_sectors = DEFAULT_DRIVE_SECTORS + 64;
+	Guid chromeos_kernel = GPT_ENT_TYPE_CHROMEOS_KERNEL;
+	GptData gpt;
+	GptHeader *h1 = (GptHeader *)primary_header;
+	GptHeader *h2 = (GptHeader *)secondary_header;
+	GptEntry *e1 = (GptEntry *)primary_entries;
+
+	Memset(&gpt, 0, sizeof(gpt));
+	Memset(primary_header, 0, sizeof(primary_header));
+	Memset(primary_entries, 0, sizeof(primary_entries));
+	gpt.primary_header = primary_header;
+	gpt.primary_entries = primary_entries;
+	gpt.secondary_header = secondary_header;
+	gpt.secondary_entries = secondary_entries;
+	gpt.sector_bytes = DEFAULT_SECTOR_SIZE;
+	gpt.drive_sectors = drive_sectors;
+	gpt.entries_bytes = bytes;
+	gpt.current_kernel = CGPT_KERNEL_ENTRY_NOT_FOUND;
+
+	Memcpy(h1->signature, GPT_HEADER_SIGNATURE,
+	       sizeof(GPT_HEADER_SIGNATURE));
+	h1->revision = GPT_HEADER_REVISION;
+	h1->size = sizeof(GptHeader);
+	h1->my_lba = 1;
+	h1->alternate_lba = drive_sectors - 1;
+	h1->first_usable_lba = 2 + sectors;
+	h1->last_usable_lba = drive_sectors - 1 - sectors - 1;
+	h1->entries_lba = 2;
+	h1->number_of_entries = 256;
+	h1->size_of_entry = sizeof(GptEntry);
+	/* One entry past the default table, one in the last slot. */
+	Memcpy(&e1[200].type, &chromeos_kernel, sizeof(chromeos_kernel));
+	SetGuid(&e1[200].unique, 200);
+	e1[200].starting_lba = 66;
+	e1[200].ending_lba = 165;
+	Memcpy(&e1[255].type, &chromeos_kernel, sizeof(chromeos_kernel));
+	SetGuid(&e1[255].unique, 255);
+	e1[255].starting_lba = 166;
+	e1[255].ending_lba = 265;
+	Memcpy(h2, h1, sizeof(GptHeader));
+	Memcpy(secondary_entries, primary_entries, bytes);
+	h2->my_lba = drive_sectors - 1;
+	h2->alternate_lba = 1;
+	h2->entries_lba = drive_sectors - 1 - sectors;
+	RefreshCrc32(&gpt);
+
+	EXPECT(GPT_SUCCESS == GptSanityCheck(&gpt));
+	EXPECT(MASK_BOTH == gpt.valid_headers);
+	EXPECT(MASK_BOTH == gpt.valid_entries);
+
+	/* The headers have to describe the table in the buffers. */
+	gpt.entries_bytes = 0;
+	EXPECT(GPT_ERROR_INVALID_HEADERS == GptSanityCheck(&gpt));
+	EXPECT(0 == gpt.valid_headers);
+	EXPECT(0 == CheckHeader(h1, 0, drive_sectors, DEFAULT_SECTOR_SIZE));
+	gpt.entries_bytes = bytes;
+
+	/* Nor may a table outgrow the largest buffers. */
+	h1->number_of_entries = GPT_MAX_TABLE_ENTRIES + 1;
+	RefreshCrc32(&gpt);
+	EXPECT(1 == CheckHeader(h1, 0, drive_sectors + 1024,
+				DEFAULT_SECTOR_SIZE));
+	h1->number_of_entries = 256;
+	RefreshCrc32(&gpt);
+
+	/* Tracked CRCs cover the whole table. */
+	EXPECT(GPT_SUCCESS == GptSanityCheck(&gpt));
+	GptEntriesTrackCrc(&gpt, MASK_BOTH);
+	EXPECT(MASK_BOTH == gpt.crc_tracked);
+	GptEntriesModified(&gpt, MASK_PRIMARY, 255 * sizeof(GptEntry),
+			   sizeof(GptEntry));
+	SetEntryPriority(e1 + 255, 3);
+	GptUpdateEntriesCrc(&gpt, MASK_PRIMARY);
+	EXPECT(h1->entries_crc32 == Crc32(primary_entries, bytes));
+
+	/* Repair puts the secondary table below a header it rebuilds. */
+	h1->header_crc32 = 0;
+	h1->header_crc32 = Crc32((uint8_t *)h1, h1->size);
+	Memset(secondary_header, 0, sizeof(secondary_header));
+	EXPECT(GPT_SUCCESS == GptSanityCheck(&gpt));
+	EXPECT(MASK_PRIMARY == gpt.valid_headers);
+	GptRepair(&gpt);
+	EXPECT(h2->entries_lba == drive_sectors - 1 - sectors);
+	EXPECT(256 == h2->number_of_entries);
+	EXPECT(0 == Memcmp(primary_entries, secondary_entries, bytes));
+	EXPECT(GPT_SUCCESS == GptSanityCheck(&gpt));
+	EXPECT(MASK_BOTH == gpt.valid_headers);
+	EXPECT(MASK_BOTH == gpt.valid_entries);
+
+	return TEST_OK;
+}
+
 /* Test getting GPT error text strings */
 static int ErrorTextTest(void)
 {
@@ -1493,21 +2051,35 @@ int main(int argc, char *argv[])
 		{ TEST_CASE(SizeOfPartitionEntryTest), },
 		{ TEST_CASE(NumberOfPartitionEntriesTest), },
 		{ TEST_CASE(MyLbaTest), },
+		{ TEST_CASE(SectorSizeTest), },
 		{ TEST_CASE(FirstUsableLbaAndLastUsableLbaTest), },
 		{ TEST_CASE(EntriesCrcTest), },
 		{ TEST_CASE(ValidEntryTest), },
 		{ TEST_CASE(OverlappedPartitionTest), },
+		{ TEST_CASE(FullTableEntriesTest), },
 		{ TEST_CASE(SanityCheckTest), },
+		{ TEST_CASE(SanityCheckStatsTest), },
+		{ TEST_CASE(UnverifiedSecondaryTest), },
 		{ TEST_CASE(NoValidKernelEntryTest), },
 		{ TEST_CASE(EntryAttributeGetSetTest), },
 		{ TEST_CASE(EntryTypeTest), },
 		{ TEST_CASE(GetNextNormalTest), },
 		{ TEST_CASE(GetNextPrioTest), },
 		{ TEST_CASE(GetNextTriesTest), },
+		{ TEST_CASE(GetNextManyKernelsTest), },
+		{ TEST_CASE(GetNextAfterSetAttributesTest), },
 		{ TEST_CASE(GptUpdateTest), },
 		{ TEST_CASE(UpdateInvalidKernelTypeTest), },
 		{ TEST_CASE(DuplicateUniqueGuidTest), },
+		{ TEST_CASE(SortEntriesByStartTest), },
 		{ TEST_CASE(TestCrc32TestVectors), },
+		{ TEST_CASE(TestCrc32Backends), },
+		{ TEST_CASE(TestCrc32Streaming), },
+		{ TEST_CASE(TestSha256TestVectors), },
+		{ TEST_CASE(TestSha256Backends), },
+		{ TEST_CASE(EntriesCrcTrackTest), },
+		{ TEST_CASE(EntriesCopyTest), },
+		{ TEST_CASE(LargeEntriesTableTest), },
 		{ TEST_CASE(GetKernelGuidTest), },
 		{ TEST_CASE(ErrorTextTest), },
 		{ TEST_CASE(DriveResizeTest), },
@@ -36,13 +36,89 @@ int TestCrc32TestVectors() {
       0x1f,0x20,0x21,0x22,0x23,0x24,0x25,0x26,0x27,0x28,
       0x00,0x00,0x00,0x28,0xbf,0x67,0x1e,0xd0}, 48, 0x688B3BFA},
   };
-  int i;
+  int i, backend;
 
   for (i = 0; i < ARRAY_SIZE(cases); ++i) {
     uint32_t crc32;
 
     crc32 = Crc32(cases[i].vector, cases[i].len);
     EXPECT(crc32 == cases[i].crc32);
+    for (backend = 0; backend < CRC32_BACKEND_COUNT; ++backend) {
+      if (!Crc32BackendSupported(backend))
+        continue;
+      crc32 = Crc32Backend(backend, cases[i].vector, cases[i].len);
+      EXPECT(crc32 == cases[i].crc32);
+    }
+  }
+  return TEST_OK;
+}
+
+/* Compares every supported backend against the bytewise reference over a
+ * range of lengths and alignments, including a full GPT entries array. */
+int TestCrc32Backends() {
+  static uint8_t buf[16384 + 16];
+  uint32_t seed = 0x12345678;
+  uint32_t len, offset;
+  int i, backend;
+
+  EXPECT(Crc32BackendSupported(CRC32_BACKEND_BYTE));
+  EXPECT(Crc32BackendSupported(CRC32_BACKEND_SLICE8));
+  EXPECT(Crc32BackendSupported(Crc32ActiveBackend()));
+
+  for (i = 0; i < sizeof(buf); ++i) {
+    seed = seed * 1103515245 + 12345;
+    buf[i] = seed >> 16;
+  }
+
+  for (backend = 0; backend < CRC32_BACKEND_COUNT; ++backend) {
+    if (!Crc32BackendSupported(backend))
+      continue;
+    for (offset = 0; offset < 16; offset += 3) {
+      for (len = 0; len <= 300; ++len) {
+        EXPECT(Crc32Backend(backend, buf + offset, len) ==
+               Crc32Backend(CRC32_BACKEND_BYTE, buf + offset, len));
+      }
+      EXPECT(Crc32Backend(backend, buf + offset, 16384) ==
+             Crc32Backend(CRC32_BACKEND_BYTE, buf + offset, 16384));
+    }
+  }
+  EXPECT(Crc32(buf, 16384) == Crc32Backend(CRC32_BACKEND_BYTE, buf, 16384));
+  return TEST_OK;
+}
+
+/* Checks that hashing in pieces and combining CRCs match one-shot Crc32(). */
+int TestCrc32Streaming() {
+  static uint8_t buf[16384];
+  uint32_t lens[] = {0, 1, 7, 8, 63, 64, 128, 129, 512, 4096};
+  uint32_t seed = 0x9e3779b9;
+  int i, j;
+
+  for (i = 0; i < sizeof(buf); ++i) {
+    seed = seed * 1103515245 + 12345;
+    buf[i] = seed >> 16;
+  }
+
+  EXPECT(Crc32Final(Crc32Init()) == Crc32(buf, 0));
+  for (i = 0; i < ARRAY_SIZE(lens); ++i) {
+    for (j = 0; j < ARRAY_SIZE(lens); ++j) {
+      uint32_t a = lens[i], b = lens[j];
+      uint32_t crc = Crc32Init();
+
+      crc = Crc32Update(crc, buf, a);
+      crc = Crc32Update(crc, buf + a, b);
+      EXPECT(Crc32Final(crc) == Crc32(buf, a + b));
+      EXPECT(Crc32Combine(Crc32(buf, a), Crc32(buf + a, b), b) ==
+             Crc32(buf, a + b));
+    }
+  }
+
+  /* Rebuild a full entries table CRC from per-entry CRCs. */
+  {
+    uint32_t crc = Crc32(buf, 128);
+
+    for (i = 128; i < sizeof(buf); i += 128)
+      crc = Crc32Combine(crc, Crc32(buf + i, 128), 128);
+    EXPECT(crc == Crc32(buf, sizeof(buf)));
   }
   return TEST_OK;
 }
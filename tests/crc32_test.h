@@ -6,5 +6,7 @@
 #define VBOOT_REFERENCE_CRC32_TEST_H_
 
 int TestCrc32TestVectors();
+int TestCrc32Backends();
+int TestCrc32Streaming();
 
 #endif  /* VBOOT_REFERENCE_CRC32_TEST_H_ */
@@ -0,0 +1,75 @@
+#!/bin/bash
+# Copyright (c) 2026 Flatcar Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+#
+# Builds a synthetic sysfs for rootdev: DIR/sys/block with WIDTH disks of
+# PARTS partitions each and, on the first partition of the last disk, a
+# stack of DEPTH dm devices. Disks are numbered like sd is, all on one
+# major with PARTS + 1 minors each, so finding a partition by walking
+# has to look into every disk before its own.
+#
+# With -l, DIR/sys/dev/block gets the <major>:<minor> links too.
+
+set -u
+
+MAJOR=8
+DM_MAJOR=254
+
+usage () {
+  echo "Usage: $0 [-l] DIR WIDTH PARTS DEPTH" 1>&2
+  exit 1
+}
+
+links=0
+if [ "${1:-}" = "-l" ]; then
+  links=1
+  shift
+fi
+[ $# -eq 4 ] || usage
+[ $2 -gt 0 ] || usage
+dir=$1
+width=$2
+parts=$3
+depth=$4
+
+block=$dir/sys/block
+devblock=$dir/sys/dev/block
+mkdir -p $block || exit 1
+if [ $links -eq 1 ]; then
+  mkdir -p $devblock || exit 1
+fi
+
+# link_dev MAJOR:MINOR PATH_UNDER_BLOCK
+link_dev () {
+  if [ $links -eq 1 ]; then
+    ln -s ../../block/$2 $devblock/$1
+  fi
+}
+
+for ((d = 0; d < width; d++)); do
+  disk=bd$d
+  minor=$((d * (parts + 1)))
+  mkdir $block/$disk
+  echo "$MAJOR:$minor" > $block/$disk/dev
+  link_dev $MAJOR:$minor $disk
+  for ((p = 1; p <= parts; p++)); do
+    mkdir $block/$disk/${disk}p$p
+    echo "$MAJOR:$((minor + p))" > $block/$disk/${disk}p$p/dev
+    echo "$p" > $block/$disk/${disk}p$p/partition
+    link_dev $MAJOR:$((minor + p)) $disk/${disk}p$p
+  done
+done
+
+# Like the kernel's, slaves entries are links to their device.
+lower=bd$((width - 1))
+if [ $parts -gt 0 ]; then
+  lower=$lower/${lower}p1
+fi
+for ((i = 0; i < depth; i++)); do
+  mkdir -p $block/dm-$i/slaves
+  echo "$DM_MAJOR:$i" > $block/dm-$i/dev
+  ln -s ../../$lower $block/dm-$i/slaves/${lower##*/}
+  link_dev $DM_MAJOR:$i dm-$i
+  lower=dm-$i
+done
@@ -0,0 +1,106 @@
+/* Copyright (c) 2026 Flatcar Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Times librootdev's lookups against a sysfs tree, such as one made by
+ * tests/gen_sysfs_tree.sh.  Prints one line per lookup:
+ *   bench=<function> iterations=<n> ns_per_op=<ns>
+ */
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rootdev/rootdev.h"
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char *bench, int iterations, uint64_t start) {
+  printf("bench=%s iterations=%d ns_per_op=%llu\n", bench, iterations,
+         (unsigned long long)((now_ns() - start) / iterations));
+}
+
+static void usage(const char *progname) {
+  fprintf(stderr,
+    "%s [-n ITERATIONS] SEARCH MAJOR:MINOR [DEVICE]\n"
+    "Times looking MAJOR:MINOR up under SEARCH (e.g. DIR/sys/block) and,\n"
+    "if given, following the slaves of DEVICE to the bottom.\n",
+    progname);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  struct rootdev_ctx *ctx;
+  const char *search, *device = NULL;
+  char name[256];
+  unsigned int major_num, minor_num;
+  int iterations = 1000;
+  uint64_t start;
+  dev_t dev, slave_dev;
+  int c, i;
+
+  while ((c = getopt(argc, argv, "n:")) != -1) {
+    switch (c) {
+    case 'n':
+      iterations = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (iterations <= 0 || argc - optind < 2 || argc - optind > 3)
+    usage(argv[0]);
+  search = argv[optind];
+  if (sscanf(argv[optind + 1], "%u:%u", &major_num, &minor_num) != 2)
+    usage(argv[0]);
+  dev = makedev(major_num, minor_num);
+  if (argc - optind == 3)
+    device = argv[optind + 2];
+
+  /* Everything below assumes the lookups work, so check once. */
+  if (rootdev_get_device(name, sizeof(name), dev, search))
+    errx(1, "%u:%u not found under %s", major_num, minor_num, search);
+
+  start = now_ns();
+  for (i = 0; i < iterations; i++)
+    rootdev_get_device(name, sizeof(name), dev, search);
+  report("rootdev_get_device", iterations, start);
+
+  /* Without the open()s of the sysfs tree, and with nothing cached. */
+  if (!(ctx = rootdev_ctx_new(search, NULL)))
+    err(1, "rootdev_ctx_new");
+  start = now_ns();
+  for (i = 0; i < iterations; i++) {
+    rootdev_ctx_flush(ctx);
+    rootdev_ctx_get_device(ctx, name, sizeof(name), dev);
+  }
+  report("rootdev_ctx_get_device", iterations, start);
+
+  if (device) {
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+      rootdev_get_device_slave(name, sizeof(name), &slave_dev, device,
+                               search);
+    report("rootdev_get_device_slave", iterations, start);
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+      rootdev_ctx_flush(ctx);
+      rootdev_ctx_get_device_slave(ctx, name, sizeof(name), &slave_dev,
+                                   device);
+    }
+    report("rootdev_ctx_get_device_slave", iterations, start);
+  }
+
+  rootdev_ctx_free(ctx);
+  return 0;
+}
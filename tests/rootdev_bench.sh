@@ -0,0 +1,44 @@
+#!/bin/bash
+# Copyright (c) 2026 Flatcar Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+#
+# Runs rootdev_bench against synthetic sysfs trees of a few sizes, with and
+# without the /sys/dev/block links. Each result is one line of key=value
+# pairs, e.g.
+#   width=256 parts=16 depth=4 links=1 bench=rootdev_get_device ...
+# averaged over $ITERATIONS lookups.
+
+set -u
+
+BENCH=${1:-./rootdev_bench}
+ITERATIONS=${ITERATIONS:-100}
+SCRIPT_DIR=$(dirname "$0")
+
+if [[ ! -x ${BENCH} ]]; then
+  echo "ERROR: could not find rootdev_bench '${BENCH}'" 1>&2
+  exit 1
+fi
+
+WORKDIR=$(mktemp -d rootdev_bench.XXXXXXX) || exit 1
+trap 'rm -rf "$WORKDIR"' EXIT
+
+for width in 16 256; do
+  for parts in 4 16; do
+    for depth in 1 4; do
+      for links in 0 1; do
+        tree=$WORKDIR/w${width}p${parts}d${depth}l${links}
+        flag=
+        [ $links -eq 1 ] && flag=-l
+        "$SCRIPT_DIR"/gen_sysfs_tree.sh $flag $tree $width $parts $depth ||
+          exit 1
+        # The last partition of the last disk, the furthest for a walk.
+        minor=$(((width - 1) * (parts + 1) + parts))
+        "${BENCH}" -n $ITERATIONS $tree/sys/block 8:$minor dm-$((depth - 1)) |
+          sed "s/^/width=$width parts=$parts depth=$depth links=$links /"
+        [ ${PIPESTATUS[0]} -eq 0 ] || exit 1
+        rm -rf $tree
+      done
+    done
+  done
+done
@@ -345,6 +345,104 @@ t15_dm_strip() {
 }
 run_test t15_dm_strip
 
+# Set up a /sys/dev/block link for a device that the /sys/block walk can't
+# find, so only the direct lookup knows its name.
+h05_setup_sys_dev_tree() {
+  local sys=$1
+  local dev=$2
+  mkdir -p $sys/block
+  mkdir -p $sys/devices/virtual/block/fast0
+  mkdir -p $sys/dev/block
+  mkdir -p $dev
+  echo "13:0" > $sys/devices/virtual/block/fast0/dev
+  ln -s ../../devices/virtual/block/fast0 $sys/dev/block/13:0
+  mknod $dev/fast0 b 13 0
+}
+
+t16_sys_dev_block_lookup() {
+  local sys=$WORKDIR/sys
+  local dev=$WORKDIR/dev
+  h05_setup_sys_dev_tree $sys $dev
+  out=$("${ROOTDEV}" --dev $dev --block $sys/block --major 13 --minor 0 \
+        2>/dev/null)
+  expect "$? -eq 0" || return 1
+  expect "'$dev/fast0' = '$out'" || return 1
+}
+run_test t16_sys_dev_block_lookup
+
+# Devices without a link still turn up through the walk.
+t17_sys_dev_block_fallback() {
+  local sys=$WORKDIR/sys
+  local dev=$WORKDIR/dev
+  h05_setup_sys_dev_tree $sys $dev
+  h00_setup_sda_tree $sys/block $dev
+  out=$("${ROOTDEV}" --dev $dev --block $sys/block --major 10 --minor 2 \
+        2>/dev/null)
+  expect "$? -eq 0" || return 1
+  expect "'$dev/sda2' = '$out'" || return 1
+}
+run_test t17_sys_dev_block_fallback
+
+# Set up an md device mirrored over a partition on each of two disks, with
+# dm-1 on top of it.
+h06_setup_md_tree() {
+  local block=$1
+  local dev=$2
+  mkdir -p $block/sdb/sdb1
+  echo "12:0" > $block/sdb/dev
+  echo "12:1" > $block/sdb/sdb1/dev
+  mknod $dev/sdb b 12 0
+  mknod $dev/sdb1 b 12 1
+  mkdir -p $block/md0/slaves/sda1 $block/md0/slaves/sdb1
+  echo "9:0" > $block/md0/dev
+  echo "10:1" > $block/md0/slaves/sda1/dev
+  echo "1" > $block/md0/slaves/sda1/partition
+  echo "12:1" > $block/md0/slaves/sdb1/dev
+  echo "1" > $block/md0/slaves/sdb1/partition
+  mknod $dev/md0 b 9 0
+  mkdir -p $block/dm-1/slaves/md0
+  echo "254:1" > $block/dm-1/dev
+  echo "9:0" > $block/dm-1/slaves/md0/dev
+  mknod $dev/dm-1 b 254 1
+}
+
+t18_all_slaves() {
+  local block=$WORKDIR/sys/block
+  local dev=$WORKDIR/dev
+  h00_setup_sda_tree $block $dev
+  h06_setup_md_tree $block $dev
+  out=$("${ROOTDEV}" -a --dev $dev --block $block --major 254 --minor 1 \
+        2>/dev/null)
+  expect "$? -eq 0" || return 1
+  # slaves/ is read in directory order.
+  expect "'$dev/sda1 $dev/sdb1' = '$(echo "$out" | sort | xargs)'" || return 1
+}
+run_test t18_all_slaves
+
+t19_all_slaves_strip() {
+  local block=$WORKDIR/sys/block
+  local dev=$WORKDIR/dev
+  h00_setup_sda_tree $block $dev
+  h06_setup_md_tree $block $dev
+  out=$("${ROOTDEV}" -a -d --dev $dev --block $block --major 254 --minor 1 \
+        2>/dev/null)
+  expect "$? -eq 0" || return 1
+  expect "'$dev/sda $dev/sdb' = '$(echo "$out" | sort | xargs)'" || return 1
+}
+run_test t19_all_slaves_strip
+
+# Without slaves, the device itself is all there is.
+t20_all_slaves_none() {
+  local block=$WORKDIR/sys/block
+  local dev=$WORKDIR/dev
+  h00_setup_sda_tree $block $dev
+  out=$("${ROOTDEV}" -a --dev $dev --block $block --major 10 --minor 0 \
+        2>/dev/null)
+  expect "$? -eq 0" || return 1
+  expect "'$dev/sda' = '$out'" || return 1
+}
+run_test t20_all_slaves_none
+
 # TODO(wad) add node creation tests
 
 TEST_COUNT=$((PASS_COUNT + FAIL_COUNT))
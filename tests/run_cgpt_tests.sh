@@ -34,6 +34,56 @@ $CGPT create -s 200 ${DEV} || error
 
 # test argument requirements
 $CGPT create -c ${DEV} &>/dev/null && error
+$CGPT create -b 1024 ${DEV} &>/dev/null && error
+
+# test 4Kn images, whose sector size is picked up again after create
+rm -f ${DEV}
+$CGPT create -c -b 4096 -s 100 ${DEV} || error
+[ $(stat --format=%s ${DEV}) -eq $((100*4096)) ] || error
+$CGPT add -b 6 -s 10 -t data -l 4kn ${DEV} || error
+[ $($CGPT show -i 1 -b ${DEV}) -eq 6 ] || error
+$CGPT show ${DEV} | grep -q "95 *4 *Sec GPT table" || error
+echo 4kn > fake_content.bin
+dd if=fake_content.bin of=${DEV} bs=4096 seek=6 conv=notrunc 2>/dev/null
+$CGPT find -l 4kn -M fake_content.bin ${DEV} >/dev/null || error
+# several -M patterns must all match, each at its own -O
+echo magic > fake_magic.bin
+dd if=fake_magic.bin of=${DEV} bs=1 seek=$((6 * 4096 + 6000)) conv=notrunc \
+  2>/dev/null
+$CGPT find -l 4kn -M fake_content.bin -M fake_magic.bin -O 6000 ${DEV} \
+  >/dev/null || error
+$CGPT find -l 4kn -O 6000 -M fake_magic.bin -M fake_content.bin ${DEV} \
+  >/dev/null || error
+$CGPT find -l 4kn -M fake_content.bin -M fake_magic.bin -O 6001 ${DEV} \
+  >/dev/null && error
+$CGPT find -l 4kn -M fake_content.bin -O 6000 -M fake_magic.bin ${DEV} \
+  >/dev/null && error
+rm -f ${DEV} fake_content.bin fake_magic.bin
+
+# test larger entries tables, whose size is taken from the headers later
+rm -f ${DEV}
+$CGPT create -c -n 100 -s 2000 ${DEV} &>/dev/null && error
+$CGPT create -c -n 1025 -s 2000 ${DEV} &>/dev/null && error
+$CGPT create -c -n 1024 -s 2000 ${DEV} || error
+$CGPT show ${DEV} | grep -q "1743 *256 *Sec GPT table" || error
+$CGPT add -i 1000 -b 300 -s 10 -t data -l big ${DEV} || error
+[ $($CGPT show -i 1000 -b ${DEV}) -eq 300 ] || error
+[ $($CGPT find -n -l big ${DEV}) -eq 1000 ] || error
+# the secondary table alone is enough to restore the primary one
+dd if=/dev/zero of=${DEV} bs=512 seek=1 count=1 conv=notrunc 2>/dev/null
+$CGPT repair ${DEV} || error
+$CGPT show ${DEV} | grep -q "2 *256 *Pri GPT table" || error
+[ $($CGPT show -i 1000 -b ${DEV}) -eq 300 ] || error
+# zapping clears the whole table, a plain create goes back to the default
+sector() {
+  dd if=${DEV} bs=512 skip=$1 count=1 2>/dev/null | tr -d '\0'
+}
+[ -n "$(sector 251)" ] && [ -n "$(sector 1992)" ] || error
+$CGPT create -z ${DEV} || error
+[ -z "$(sector 251)" ] && [ -z "$(sector 1992)" ] || error
+$CGPT create ${DEV} || error
+$CGPT show ${DEV} | grep -q "1967 *32 *Sec GPT table" || error
+rm -f ${DEV}
 
 # boy it'd be nice if dealing with block devices didn't always require root
 if [ "$(id -u)" -ne 0 ]; then
@@ -95,6 +145,35 @@ verify
 cmp --bytes=446 ${DEV}.mbr ${DEV} || error
 
 
+echo "Test placing new partitions in free space"
+rm -f ${DEV}
+$CGPT create -c -s 20480 ${DEV} || error
+$CGPT add -t data -s 100 ${DEV} || error
+[ "$($CGPT show -i 1 -b ${DEV})" = "2048" ] || error
+$CGPT add -t data -b 3000 -s 100 ${DEV} || error
+$CGPT add -t data -a 1024 -s 100 ${DEV} || error
+[ "$($CGPT show -i 3 -b ${DEV})" = "1024" ] || error
+# aligned to 4096, the gap at 4096 is the first to fit, the one at 8192
+# the tightest
+$CGPT add -t data -b 4200 -s 100 ${DEV} || error
+$CGPT add -t data -b 8292 -s 100 ${DEV} || error
+$CGPT add -t data -a 4096 -s 100 ${DEV} || error
+[ "$($CGPT show -i 6 -b ${DEV})" = "4096" ] || error
+$CGPT add -i 6 -t unused ${DEV} || error
+$CGPT add -t data -a 4096 -F best -s 100 ${DEV} || error
+[ "$($CGPT show -i 6 -b ${DEV})" = "8192" ] || error
+$CGPT add -t data -a 1 -s 10 ${DEV} || error
+[ "$($CGPT show -i 7 -b ${DEV})" = "34" ] || error
+# without -s, the whole of the largest gap
+$CGPT add -t data ${DEV} || error
+[ "$($CGPT show -i 8 -b ${DEV})" = "10240" ] || error
+[ "$($CGPT show -i 8 -s ${DEV})" = "$((20447 - 10240))" ] || error
+$CGPT add -t data -s 100000 ${DEV} 2>/dev/null && error
+$CGPT add -t data -b 9000 ${DEV} 2>/dev/null && error
+$CGPT add -t data -F worst -s 1 ${DEV} 2>/dev/null && error
+verify
+
+
 # resize requires a partitioned block device
 if [ "$(id -u)" -ne 0 ]; then
   echo "Skipping cgpt resize tests w/ block devices (requires root)"
@@ -133,6 +212,93 @@ else
 fi
 
 
+if [ "$(id -u)" -ne 0 ]; then
+  echo "Skipping cgpt resize tests w/ several partitions (requires root)"
+else
+  echo "Test cgpt resize w/ several partitions."
+  rm -f ${DEV}
+  $CGPT create -c -s 8192 ${DEV} || error
+  $CGPT add -i 1 -b 40 -s 400 -t data ${DEV} || error
+  $CGPT add -i 2 -b 2048 -s 400 -t data ${DEV} || error
+  $CGPT add -i 3 -b 4096 -s 400 -t data ${DEV} || error
+  $CGPT boot -p ${DEV} || error
+  loop=$(losetup -f --show --partscan ${DEV}) || error
+  trap "losetup -d ${loop}" EXIT
+  sleep 1
+  $CGPT resize -m 0 ${loop}p1 ${loop}p2=50% ${loop}p3=$((2048 * 512)) || error
+  [ $(blockdev --getsz ${loop}p1) -eq $((2048 - 40)) ] || error
+  [ $(blockdev --getsz ${loop}p2) -eq $((400 + (4096 - 2448) / 2)) ] || error
+  [ $(blockdev --getsz ${loop}p3) -eq 2048 ] || error
+  [ $($CGPT show -i 3 -s ${DEV}) -eq 2048 ] || error
+  # too big, or twice: nothing changes
+  $CGPT resize ${loop}p3=$((8192 * 512)) 2>/dev/null && error
+  $CGPT resize ${loop}p2 ${loop}p2 2>/dev/null && error
+  [ $($CGPT show -i 2 -s ${DEV}) -eq $((400 + (4096 - 2448) / 2)) ] || error
+  losetup -d ${loop}
+  trap - EXIT
+fi
+
+
+# partitions can be named by tag too, sizes and all; a tag alone is no size
+$CGPT resize PARTLABEL=no-such-label 2>&1 | grep -q "invalid size" && error
+if [ "$(id -u)" -ne 0 ]; then
+  echo "Skipping cgpt resize tests w/ PARTUUID and PARTLABEL (requires root)"
+else
+  echo "Test cgpt resize w/ PARTUUID and PARTLABEL."
+  rm -f ${DEV}
+  RESIZE_UUID=5e1bd5e2-3e5b-4f4e-9c36-2f3c3d6a7b01
+  $CGPT create -c -s 8192 ${DEV} || error
+  $CGPT add -i 1 -b 40 -s 400 -t data -u ${RESIZE_UUID} ${DEV} || error
+  $CGPT add -i 2 -b 2048 -s 400 -t data -l cgpt-resize-test ${DEV} || error
+  $CGPT boot -p ${DEV} || error
+  loop=$(losetup -f --show --partscan ${DEV}) || error
+  trap "losetup -d ${loop}" EXIT
+  udevadm settle 2>/dev/null || sleep 1
+  if [ -e /dev/disk/by-partuuid/${RESIZE_UUID} ] &&
+     [ -e /dev/disk/by-partlabel/cgpt-resize-test ]; then
+    $CGPT resize -m 0 PARTUUID=${RESIZE_UUID}=$((1024 * 512)) \
+      PARTLABEL=cgpt-resize-test || error
+    [ $($CGPT show -i 1 -s ${DEV}) -eq 1024 ] || error
+    [ $($CGPT show -i 2 -s ${DEV}) -gt 6000 ] || error
+  else
+    echo "Skipping them, udev made no links for ${loop}"
+  fi
+  losetup -d ${loop}
+  trap - EXIT
+fi
+
+
+# growing the filesystem online needs it mounted too
+if [ "$(id -u)" -ne 0 ]; then
+  echo "Skipping cgpt resize -f tests (requires root)"
+else
+  echo "Test cgpt resize -f w/ mounted ext4 filesystem."
+  rm -f ${DEV}
+  $CGPT create -c -s 16384 ${DEV} || error
+  $CGPT add -i 1 -b 2048 -s 8192 -t data ${DEV} || error
+  $CGPT boot -p ${DEV} || error
+  loop=$(losetup -f --show --partscan ${DEV}) || error
+  mnt=$(mktemp -d) || error
+  trap "umount ${mnt}; rmdir ${mnt}; losetup -d ${loop}" EXIT
+  sleep 1
+  loopp1=${loop}p1
+  mkfs.ext4 -q -b 4096 $loopp1 || error
+  mount $loopp1 ${mnt} || error
+  $CGPT resize -f $loopp1 || error
+  [ $(blockdev --getsz $loopp1) -eq 8192 ] || error
+  [ $(stat -f -c %b ${mnt}) -lt 1024 ] || error
+  truncate --size=$((65536 * 512)) ${DEV} || error
+  losetup --set-capacity ${loop} || error
+  $CGPT resize -f $loopp1 || error
+  [ $(blockdev --getsz $loopp1) -gt 60000 ] || error
+  [ $(stat -f -c %b ${mnt}) -gt 7000 ] || error
+  umount ${mnt}
+  rmdir ${mnt}
+  losetup -d ${loop}
+  trap - EXIT
+fi
+
+
 # test passing partition devices to cgpt
 if [ "$(id -u)" -ne 0 ]; then
   echo "Skipping cgpt tests w/ partition block devices (requires root)"
@@ -159,6 +325,102 @@ else
 fi
 
 
+# writes tell the kernel about just the partitions that changed
+if [ "$(id -u)" -ne 0 ]; then
+  echo "Skipping cgpt BLKPG tests (requires root)"
+else
+  echo "Test cgpt updating the kernel's partitions"
+  rm -f ${DEV}
+  $CGPT create -c -s 65536 ${DEV} || error
+  $CGPT add -i 1 -b 2048 -s 8192 -t data ${DEV} || error
+  $CGPT add -i 2 -b 20480 -s 8192 -t data ${DEV} || error
+  $CGPT boot -p ${DEV} || error
+  loop=$(losetup -f --show --partscan ${DEV}) || error
+  trap "losetup -d ${loop}" EXIT
+  kernel_part() {
+    echo $(cat /sys/class/block/$(basename ${loop})p$1/{start,size})
+  }
+  $CGPT add -i 1 -s 4096 ${loop} || error
+  $CGPT add -i 2 -b 40960 -s 16384 ${loop} || error
+  $CGPT add -i 3 -b 10240 -s 1024 -t data ${loop} || error
+  [ "$(kernel_part 1)" = "2048 4096" ] || error
+  [ "$(kernel_part 2)" = "40960 16384" ] || error
+  [ "$(kernel_part 3)" = "10240 1024" ] || error
+  $CGPT add -i 3 -t unused ${loop} || error
+  [ -e /sys/class/block/$(basename ${loop})p3 ] && error
+  # one in use stays as it was
+  exec 3<${loop}p1
+  $CGPT add -i 1 -b 4096 ${loop} 2>/dev/null || error
+  exec 3<&-
+  [ "$(kernel_part 1)" = "2048 4096" ] || error
+  losetup -d ${loop}
+  trap - EXIT
+fi
+
+
+# find -l and -u without a drive only trust what sysfs and libblkid say when
+# that settles the answer; a fake CGPT_SYSROOT lists two loop devices as disks
+if [ "$(id -u)" -ne 0 ]; then
+  echo "Skipping cgpt find tests w/ partition metadata (requires root)"
+else
+  echo "Test cgpt find answering from partition metadata"
+  SHARED_GUID=01234567-89ab-cdef-0123-456789abcdef
+  for disk in fakea fakeb; do
+    rm -f ${disk}.bin
+    $CGPT create -c -s 1000 ${disk}.bin || error
+    $CGPT add -b 100 -s 10 -t data -l shared -u ${SHARED_GUID} ${disk}.bin \
+      || error
+  done
+  loopa=$(losetup -f --show fakea.bin) || error
+  trap "losetup -d ${loopa}" EXIT
+  loopb=$(losetup -f --show fakeb.bin) || error
+  trap "losetup -d ${loopa} ${loopb}" EXIT
+  ROOT="${DIR}/fake_sysroot"
+  rm -rf "${ROOT}"
+  mkdir -p "${ROOT}/proc" "${ROOT}/dev" "${ROOT}/sys/class/block"
+  fake_partitions() {
+    echo "major minor  #blocks  name"
+    echo
+    for disk in fakea fakeb; do
+      echo "   7 0 500 ${disk}"
+      [ ${disk} = "${1:-}" ] || echo "   7 1 5 ${disk}1"
+    done
+  }
+  for disk in fakea fakeb; do
+    mkdir -p "${ROOT}/sys/block/${disk}/${disk}1"
+    ln -s /sys/devices/virtual "${ROOT}/sys/block/${disk}/device"
+    ln -s ../../block/${disk} "${ROOT}/sys/class/block/${disk}"
+    ln -s ../../block/${disk}/${disk}1 "${ROOT}/sys/class/block/${disk}1"
+    echo "DEVTYPE=disk" > "${ROOT}/sys/block/${disk}/uevent"
+    printf 'DEVTYPE=partition\nPARTN=1\nPARTNAME=shared\n' > \
+      "${ROOT}/sys/block/${disk}/${disk}1/uevent"
+  done
+  ln -s ${loopa} "${ROOT}/dev/fakea"
+  ln -s ${loopb} "${ROOT}/dev/fakeb"
+  export CGPT_SYSROOT="${ROOT}"
+  BOTH="$(printf '%s\n' "${ROOT}/dev/fakea1" "${ROOT}/dev/fakeb1")"
+  # a label on two disks is reported for both
+  fake_partitions > "${ROOT}/proc/partitions"
+  [ "$($CGPT find -l shared)" = "${BOTH}" ] || error
+  [ "$($CGPT find --first -l shared)" = "${ROOT}/dev/fakea1" ] || error
+  # also when the kernel hasn't read the second disk's partitions
+  fake_partitions fakeb > "${ROOT}/proc/partitions"
+  [ "$($CGPT find -l shared)" = "${BOTH}" ] || error
+  # and libblkid naming one partition doesn't hide the other GUID
+  [ "$($CGPT find -u ${SHARED_GUID})" = "${BOTH}" ] || error
+  # a name that only sysfs knows shows a unique label is answered from it
+  fake_partitions > "${ROOT}/proc/partitions"
+  printf 'DEVTYPE=partition\nPARTN=1\nPARTNAME=sysfs-only\n' > \
+    "${ROOT}/sys/block/fakeb/fakeb1/uevent"
+  [ "$($CGPT find -l sysfs-only)" = "${ROOT}/dev/fakeb1" ] || error
+  [ "$($CGPT find -l shared)" = "${ROOT}/dev/fakea1" ] || error
+  unset CGPT_SYSROOT
+  rm -rf "${ROOT}" fakea.bin fakeb.bin
+  losetup -d ${loopa} ${loopb}
+  trap - EXIT
+fi
+
+
 if [[ -n "$SGDISK" ]]; then
     echo "Test cgpt disk GUID"
     GUID='01234567-89AB-CDEF-0123-456789ABCDEF'
@@ -278,6 +540,21 @@ $CGPT add -i 1 -t data ${DEV} || error
 X=$($CGPT show -t -i 1 ${DEV} | tr 'A-Z' 'a-z')
 [ "$X" = "$DATA_GUID" ] || error
 
+echo "Query several fields at once..."
+X=$($CGPT show -f partition,start,size -i 1,${KERN_NUM} ${DEV})
+Y=$(printf '1\t%s\t%s\n%s\t%s\t%s' \
+    "$DATA_START" "$DATA_SIZE" "$KERN_NUM" \
+    "$($CGPT show -b -i $KERN_NUM ${DEV})" \
+    "$($CGPT show -s -i $KERN_NUM ${DEV})")
+[ "$X" = "$Y" ] || error
+X=$($CGPT show -f label,priority -j -i ${KERN_NUM} ${DEV})
+[ "$X" = "{\"label\":\"$($CGPT show -l -i $KERN_NUM ${DEV})\",\"priority\":$($CGPT show -P -i $KERN_NUM ${DEV})}" ] || error
+[ $($CGPT show -f partition ${DEV} | wc -l) -eq \
+  $($CGPT show -q ${DEV} | wc -l) ] || error
+$CGPT show -f bogus ${DEV} &>/dev/null && error
+$CGPT show -f size -i 1,x ${DEV} &>/dev/null && error
+$CGPT show -j ${DEV} &>/dev/null && error
+
 
 echo "Set the boot partition.."
 $CGPT boot -i ${KERN_NUM} ${DEV} >/dev/null
@@ -372,6 +649,32 @@ else
     echo "Skipping GUID tests because sgdisk wasn't found"
 fi
 
+echo "Test site-local partition types..."
+cat > fake_types <<EOF
+# comments and blank lines are skipped
+
+site-data 0F6C3A2E-1B8D-4F47-9C2B-7A1D5E3F8B90 Our data
+site-raw  5C1D3E0A-2F44-4B6E-A1C7-3D9E8F0B2A61
+linux-data 0FC63DAF-8483-4772-8E79-3D69D8477DE4 Not the built in one
+EOF
+export CGPT_TYPES=fake_types
+$CGPT create ${DEV} || error
+$CGPT add -t site-data -b 100 -s 1 ${DEV} || error
+$CGPT add -t site-raw -b 101 -s 1 ${DEV} || error
+$CGPT add -t linux-data -b 102 -s 1 ${DEV} 2>/dev/null || error
+[ "$($CGPT show -i 1 -t ${DEV})" = "0F6C3A2E-1B8D-4F47-9C2B-7A1D5E3F8B90" ] \
+  || error
+$CGPT show -q ${DEV} | grep -q " 1  Our data" || error
+$CGPT show -q ${DEV} | grep -q " 2  site-raw" || error
+# built in types keep their names and descriptions
+$CGPT show -q ${DEV} | grep -q " 3  Alias for linux-data" || error
+$CGPT add -h 2>/dev/null | grep -q "site-data *Our data" || error
+[ "$($CGPT find -t site-raw -n ${DEV})" = "2" ] || error
+CGPT_TYPES=missing_types $CGPT add -t site-data -b 103 -s 1 ${DEV} \
+  &>/dev/null && error
+unset CGPT_TYPES
+rm -f fake_types
+
 echo "Test the cgpt prioritize command..."
 
 # Input: sequence of priorities
@@ -423,6 +726,20 @@ assert_pri 1 2 0
 
 # lots of flatcar-rootfs, all same starting priority, should go to priority 1
 make_pri   8 8 8 8 8 8 8 8 8 8 8 0 0 8
+
+# find --first stops at the first of them
+[ "$($CGPT find --first -n -t flatcar-rootfs ${DEV})" = "1" ] || error
+[ "$($CGPT find -F -n -t flatcar-rootfs ${DEV} ${DEV})" = "1" ] || error
+$CGPT find -F -1 -t flatcar-rootfs ${DEV} >/dev/null 2>&1 && error
+# find --wait is only for scans, and gives up once its time is out
+$CGPT find --wait -t flatcar-rootfs ${DEV} >/dev/null 2>&1 && error
+$CGPT find --wait=-1 -l no-such-label >/dev/null 2>&1 && error
+timeout 10 $CGPT find --wait=nan -l no-such-label 2>&1 | \
+  grep -q "invalid argument" || error
+WAIT_STATUS=0
+timeout 10 $CGPT find --wait=0.5 -l no-such-label >/dev/null 2>&1 || \
+  WAIT_STATUS=$?
+[ ${WAIT_STATUS} = 1 ] || error
 $CGPT prioritize ${DEV}
 assert_pri 1 1 1 1 1 1 1 1 1 1 1 0 0 1
 
@@ -491,6 +808,315 @@ assert_pri 13 13 14 12 15 11 10 10  9  9  8  8 7 7 6 6 5 5 4 4 3 3 2 2 1 1 1 1 1
 $CGPT prioritize -i 1 -f ${DEV}
 assert_pri 15 15 13 12 14 11 10 10  9  9  8  8 7 7 6 6 5 5 4 4 3 3 2 2 1 1 1 1 1 1 0
 
+# several drives are ranked as one set: mirrored roots of two disks
+MIRROR_DEV=fake_mirror.bin
+rm -f ${MIRROR_DEV}
+make_pri   2 1
+$CGPT create -c -s 1000 ${MIRROR_DEV} || error
+$CGPT add -t flatcar-rootfs -l root1 -b 102 -s 1 -P 2 ${MIRROR_DEV} || error
+$CGPT add -t flatcar-rootfs -l root2 -b 104 -s 1 -P 1 ${MIRROR_DEV} || error
+$CGPT add -t data -l data -b 200 -s 1 ${MIRROR_DEV} || error
+$CGPT prioritize -i 2 ${DEV} ${MIRROR_DEV} || error
+assert_pri 2 3
+[ "$($CGPT show -i 1 -P ${MIRROR_DEV}) $($CGPT show -i 2 -P ${MIRROR_DEV})" \
+  = "2 1" ] || error
+$CGPT prioritize -i 2 -f ${MIRROR_DEV} ${DEV} || error
+[ "$($CGPT show -i 1 -P ${MIRROR_DEV}) $($CGPT show -i 2 -P ${MIRROR_DEV})" \
+  = "1 3" ] || error
+assert_pri 1 2
+# nothing is written unless every drive checks out
+$CGPT prioritize -i 1 ${DEV} ${MIRROR_DEV}.missing 2>/dev/null && error
+assert_pri 1 2
+$CGPT prioritize -a ${DEV} 2>/dev/null && error
+$CGPT prioritize -a -i 1 2>/dev/null && error
+rm -f ${MIRROR_DEV}
+
+echo "Test the CGPT_SYNC durability modes..."
+CGPT_SYNC=defer $CGPT add -i 1 -P 3 ${DEV} || error
+[ $($CGPT show -i 1 -P ${DEV}) -eq 3 ] || error
+CGPT_SYNC=none $CGPT add -i 1 -P 4 ${DEV} || error
+[ $($CGPT show -i 1 -P ${DEV}) -eq 4 ] || error
+CGPT_SYNC=bogus $CGPT show ${DEV} &>/dev/null && error
+
+echo "Test the CGPT_STATS counters..."
+stats=$(CGPT_STATS=1 $CGPT add -i 1 -P 5 ${DEV} 2>&1) || error
+echo "$stats" | grep -q "^stats=cgpt command=add .* drives_opened=1 " || error
+echo "$stats" | grep -q " sync_calls=1 " || error
+echo "$stats" | grep -q " write_primary_bytes=0 " && error
+[ -z "$(CGPT_STATS=0 $CGPT show ${DEV} 2>&1 >/dev/null)" ] || error
+
+echo "Test the CGPT_CACHE metadata cache..."
+CACHE_DIR=fake_cache
+rm -rf ${CACHE_DIR}
+want=$($CGPT show ${DEV}) || error
+[ "$(CGPT_CACHE=${CACHE_DIR} $CGPT show ${DEV})" = "$want" ] || error
+[ -n "$(ls ${CACHE_DIR})" ] || error
+stats=$(CGPT_CACHE=${CACHE_DIR} CGPT_STATS=1 $CGPT show ${DEV} 2>&1 \
+  >/dev/null) || error
+echo "$stats" | grep -q " gpts_cached=1 " || error
+# a write drops the copy, and a stale one isn't used
+CGPT_CACHE=${CACHE_DIR} $CGPT add -i 1 -P 6 ${DEV} || error
+[ -z "$(ls ${CACHE_DIR})" ] || error
+CGPT_CACHE=${CACHE_DIR} $CGPT show ${DEV} >/dev/null || error
+$CGPT add -i 1 -P 7 ${DEV} || error
+[ $(CGPT_CACHE=${CACHE_DIR} $CGPT show -i 1 -P ${DEV}) -eq 7 ] || error
+rm -rf ${CACHE_DIR}
+
+echo "Test the cgpt batch command..."
+BATCH_DEV=fake_batch.bin
+rm -f ${BATCH_DEV}
+dd if=/dev/zero of=${BATCH_DEV} bs=512 count=1000 2>/dev/null || error
+cat > fake_batch.txt <<EOF
+# a blank table, then two roots
+create
+add -i 1 -b 100 -s 100 -t flatcar-rootfs -l "root a" -P 1
+add -i 2 -b 200 -s 100 -t flatcar-rootfs -l 'root b' -P 1
+
+prioritize -i 2
+boot -p -i 2
+EOF
+$CGPT batch -f fake_batch.txt ${BATCH_DEV} || error
+[ "$($CGPT show -f label,priority -i 1,2 ${BATCH_DEV})" = \
+  "$(printf 'root a\t1\nroot b\t2')" ] || error
+[ "$($CGPT boot ${BATCH_DEV})" = "$($CGPT show -u -i 2 ${BATCH_DEV})" ] || error
+# a failing step leaves the drive as it was
+cp ${BATCH_DEV} fake_batch_orig.bin
+printf 'add -i 1 -l changed\nadd -i 1 -t bogus\n' |
+  $CGPT batch ${BATCH_DEV} &>/dev/null && error
+cmp -s ${BATCH_DEV} fake_batch_orig.bin || error
+echo "next" | $CGPT batch ${BATCH_DEV} &>/dev/null && error
+echo "add -i 1 -l 'open" | $CGPT batch ${BATCH_DEV} &>/dev/null && error
+cmp -s ${BATCH_DEV} fake_batch_orig.bin || error
+# later steps see the earlier ones
+[ "$(printf 'add -i 1 -l changed\nshow -i 1 -l\n' |
+     $CGPT batch ${BATCH_DEV})" = "changed" ] || error
+[ "$($CGPT show -i 1 -l ${BATCH_DEV})" = "changed" ] || error
+
+echo "Test the cgpt copy command..."
+COPY_SRC=fake_copy_src.bin
+COPY_DST=fake_copy_dst.bin
+rm -f ${COPY_SRC} ${COPY_DST}
+$CGPT create -c -s 4096 ${COPY_SRC} || error
+$CGPT add -b 2048 -s 1024 -t data -l usr ${COPY_SRC} || error
+$CGPT create -c -s 8192 ${COPY_DST} || error
+$CGPT add -b 2048 -s 2048 -t data -l usr ${COPY_DST} || error
+$CGPT add -b 4096 -s 512 -t data -l small ${COPY_DST} || error
+# data, a hole, data at the very end
+dd if=/dev/urandom of=${COPY_SRC} bs=512 seek=2048 count=64 conv=notrunc \
+  2>/dev/null || error
+dd if=/dev/urandom of=${COPY_SRC} bs=512 seek=3070 count=2 conv=notrunc \
+  2>/dev/null || error
+dd if=/dev/urandom of=${COPY_DST} bs=512 seek=2048 count=1024 conv=notrunc \
+  2>/dev/null || error
+$CGPT copy -i 1 ${COPY_SRC} ${COPY_DST} || error
+cmp -s <(dd if=${COPY_SRC} bs=512 skip=2048 count=1024 2>/dev/null) \
+  <(dd if=${COPY_DST} bs=512 skip=2048 count=1024 2>/dev/null) || error
+# too small, and overlapping
+$CGPT copy -i 1 -j 2 ${COPY_SRC} ${COPY_DST} 2>/dev/null && error
+$CGPT copy -i 1 -j 1 ${COPY_SRC} ${COPY_SRC} 2>/dev/null && error
+$CGPT copy -i 3 ${COPY_SRC} ${COPY_DST} 2>/dev/null && error
+$CGPT copy ${COPY_SRC} ${COPY_DST} >/dev/null 2>&1 && error
+# the GPTs are left alone
+[ "$($CGPT show -i 1 -s ${COPY_DST})" = "2048" ] || error
+$CGPT show -q ${COPY_DST} >/dev/null || error
+rm -f ${COPY_SRC} ${COPY_DST}
+
+echo "Test the cgpt diff command..."
+OLD_IMG=fake_diff_old.bin
+NEW_IMG=fake_diff_new.bin
+rm -f ${OLD_IMG} ${NEW_IMG}
+$CGPT create -c -s 8192 ${OLD_IMG} || error
+$CGPT add -b 2048 -s 2048 -t coreos-rootfs -l USR-A ${OLD_IMG} || error
+dd if=/dev/urandom of=${OLD_IMG} bs=512 seek=2048 count=1024 conv=notrunc \
+  2>/dev/null || error
+$CGPT create -c -s 8192 ${NEW_IMG} || error
+$CGPT add -b 4096 -s 3072 -t coreos-rootfs -l USR-A ${NEW_IMG} || error
+# the same data elsewhere on the new image is no change, only the growth is
+dd if=${OLD_IMG} of=${NEW_IMG} bs=512 skip=2048 seek=4096 count=1024 \
+  conv=notrunc 2>/dev/null || error
+[ "$($CGPT diff -l USR-A -c 65536 ${OLD_IMG} ${NEW_IMG})" = \
+  "1 1048576 524288" ] || error
+# one changed sector, one written into a hole of the old partition, and
+# whatever the new partition has past the end of the old one
+dd if=/dev/urandom of=${NEW_IMG} bs=512 seek=$((4096 + 300)) count=1 \
+  conv=notrunc 2>/dev/null || error
+dd if=/dev/urandom of=${NEW_IMG} bs=512 seek=$((4096 + 1500)) count=1 \
+  conv=notrunc 2>/dev/null || error
+[ "$($CGPT diff -l USR-A -c 65536 ${OLD_IMG} ${NEW_IMG} | tr '\n' ' ')" = \
+  "1 131072 65536 1 720896 65536 1 1048576 524288 " ] || error
+[ "$($CGPT diff -t coreos-rootfs -c 65536 ${OLD_IMG} ${NEW_IMG} | wc -l)" = \
+  "3" ] || error
+$CGPT diff -l USR-B ${OLD_IMG} ${NEW_IMG} 2>/dev/null && error
+$CGPT diff ${OLD_IMG} ${NEW_IMG} >/dev/null 2>&1 && error
+rm -f ${OLD_IMG} ${NEW_IMG}
+
+echo "Test the cgpt verify command..."
+VERIFY_IMG=fake_verify.bin
+rm -f ${VERIFY_IMG} ${VERIFY_IMG}.sums
+$CGPT create -c -s 8192 ${VERIFY_IMG} || error
+$CGPT add -b 2048 -s 2048 -t coreos-rootfs -l USR-A ${VERIFY_IMG} || error
+dd if=/dev/urandom of=${VERIFY_IMG} bs=512 seek=2048 count=2048 conv=notrunc \
+  2>/dev/null || error
+dd if=${VERIFY_IMG} bs=512 skip=2048 count=2048 2>/dev/null | \
+  split -b 4096 --filter=sha256sum > ${VERIFY_IMG}.sums || error
+[ "$($CGPT verify -v -l USR-A -m ${VERIFY_IMG}.sums ${VERIFY_IMG})" = \
+  "${VERIFY_IMG} partition 1: 256 blocks verified" ] || error
+$CGPT verify -l USR-A -s 409600 -m ${VERIFY_IMG}.sums ${VERIFY_IMG} \
+  2>/dev/null && error
+VERITYSETUP=$(type -p veritysetup || echo /usr/sbin/veritysetup)
+if [ -x "${VERITYSETUP}" ]; then
+  dd if=${VERIFY_IMG} of=${VERIFY_IMG}.data bs=512 skip=2048 count=2048 \
+    2>/dev/null || error
+  ROOT_HASH=$("${VERITYSETUP}" format --salt=abcd ${VERIFY_IMG}.data \
+    ${VERIFY_IMG}.tree | sed -n 's/^Root hash:[[:space:]]*//p')
+  $CGPT verify -l USR-A -S abcd -r "${ROOT_HASH}" ${VERIFY_IMG} || error
+  $CGPT verify -l USR-A -r "${ROOT_HASH}" ${VERIFY_IMG} 2>/dev/null && error
+  rm -f ${VERIFY_IMG}.data ${VERIFY_IMG}.tree
+else
+  echo "Skipping root hash tests because veritysetup wasn't found"
+fi
+# one changed sector, and only the blocks before it still match
+dd if=/dev/urandom of=${VERIFY_IMG} bs=512 seek=$((2048 + 800)) count=1 \
+  conv=notrunc 2>/dev/null || error
+$CGPT verify -l USR-A -m ${VERIFY_IMG}.sums ${VERIFY_IMG} 2>&1 | \
+  grep -q "block 100 of" || error
+head -n 100 ${VERIFY_IMG}.sums > ${VERIFY_IMG}.head
+$CGPT verify -l USR-A -s 409600 -m ${VERIFY_IMG}.head ${VERIFY_IMG} || error
+$CGPT verify -l USR-B -m ${VERIFY_IMG}.sums ${VERIFY_IMG} 2>/dev/null && error
+$CGPT verify -l USR-A ${VERIFY_IMG} >/dev/null 2>&1 && error
+# known root hashes of fixed data, one, two and three levels up
+seq 200000 | head -c $((2048 * 512)) | \
+  dd of=${VERIFY_IMG} bs=512 seek=2048 conv=notrunc 2>/dev/null || error
+ONE_BLOCK=$(seq 200000 | head -c 4096 | sha256sum | cut -d' ' -f1)
+[ "${ONE_BLOCK}" = \
+  5d45b6510efbba88e03ce800c858b4a3a7a8a458e9708595f3665c78ea0713f8 ] || error
+$CGPT verify -l USR-A -s 4096 -r ${ONE_BLOCK} ${VERIFY_IMG} || error
+$CGPT verify -l USR-A -s 8192 -r ${ONE_BLOCK} ${VERIFY_IMG} 2>/dev/null && \
+  error
+$CGPT verify -l USR-A -s $((128 * 4096)) \
+  -r 63ad693d1318f89faa3672bd3b61d192692091e80068e071ef4dc8c694113fc8 \
+  ${VERIFY_IMG} || error
+$CGPT verify -l USR-A -s $((129 * 4096)) -S abcd \
+  -r 21e54c8f0c8943c0f3f972b8313e37aaace932f8bb1d52e2cd555638ccc992b5 \
+  ${VERIFY_IMG} || error
+$CGPT verify -l USR-A -S abcd \
+  -r fbc671fa03e14a4b06691dccdcbf60afa4316ee524f88b1b522a81fcf5350ce6 \
+  ${VERIFY_IMG} || error
+$CGPT verify -l USR-A \
+  -r fbc671fa03e14a4b06691dccdcbf60afa4316ee524f88b1b522a81fcf5350ce6 \
+  ${VERIFY_IMG} 2>/dev/null && error
+rm -f ${VERIFY_IMG} ${VERIFY_IMG}.sums ${VERIFY_IMG}.head
+
+echo "Test discarding and zeroing new partitions..."
+PROV_DEV=fake_provision.bin
+rm -f ${PROV_DEV}
+dd if=/dev/urandom of=${PROV_DEV} bs=512 count=4096 2>/dev/null || error
+zeroed() {
+  cmp -s <(dd if=${PROV_DEV} bs=512 skip=$1 count=$2 2>/dev/null) \
+    <(head -c $(($2 * 512)) /dev/zero)
+}
+$CGPT create -D bogus ${PROV_DEV} 2>/dev/null && error
+$CGPT create ${PROV_DEV} || error
+zeroed 2048 64 && error
+$CGPT create -D zero ${PROV_DEV} || error
+zeroed 34 $((4096 - 67)) || error
+# the tables are intact
+$CGPT show -q ${PROV_DEV} >/dev/null || error
+dd if=/dev/urandom of=${PROV_DEV} bs=512 seek=2048 count=1024 conv=notrunc \
+  2>/dev/null || error
+$CGPT add -b 2048 -s 512 -t data ${PROV_DEV} || error
+zeroed 2048 512 && error
+# growing only touches what the partition gains
+$CGPT add -i 1 -s 1024 -D discard ${PROV_DEV} || error
+zeroed 2048 512 && error
+zeroed 2560 512 || error
+$CGPT add -b 3072 -s 64 -t data -D zero ${PROV_DEV} || error
+zeroed 3072 64 || error
+rm -f ${PROV_DEV}
+
+echo "Test the cgpt serve and query commands..."
+SERVE_DEV=fake_serve.bin
+SOCK="${DIR}/fake_cgpt.sock"
+$CGPT create -c -s 1000 ${SERVE_DEV} || error
+$CGPT add -b 100 -s 10 -t data -l served ${SERVE_DEV} || error
+$CGPT serve -s "${SOCK}" 2>/dev/null &
+SERVE_PID=$!
+for i in $(seq 50); do
+  [ -S "${SOCK}" ] || ! kill -0 ${SERVE_PID} 2>/dev/null && break
+  sleep 0.1
+done
+if [ ! -S "${SOCK}" ]; then
+  # No uevents without a netlink socket, as in some containers.
+  echo "Skipping serve tests (cgpt serve didn't start)"
+else
+  [ "$($CGPT query -s "${SOCK}" show ${SERVE_DEV})" = "$($CGPT show ${SERVE_DEV})" ] \
+    || error
+  [ "$($CGPT query -s "${SOCK}" show -q ${SERVE_DEV})" = \
+    "$($CGPT show -q ${SERVE_DEV})" ] || error
+  [ "$($CGPT query -s "${SOCK}" find -l served ${SERVE_DEV})" = "${SERVE_DEV}1" ] || error
+  $CGPT query -s "${SOCK}" find -l unserved ${SERVE_DEV} && error
+  $CGPT query -s "${SOCK}" show missing_dev.bin 2>/dev/null && error
+  # only commands that read are run
+  $CGPT query -s "${SOCK}" add -i 1 -l changed ${SERVE_DEV} 2>/dev/null && error
+  [ "$($CGPT show -i 1 -l ${SERVE_DEV})" = "served" ] || error
+  # a changed image is read again
+  $CGPT add -i 1 -l changed ${SERVE_DEV} || error
+  [ "$($CGPT query -s "${SOCK}" show -i 1 -l ${SERVE_DEV})" = "changed" ] || error
+  [ "$($CGPT query -s "${SOCK}" find -l changed -n ${SERVE_DEV})" = "1" ] || error
+  # relative paths are the client's, wherever the server runs
+  mkdir -p serve_cwd || error
+  $CGPT create -c -s 1000 serve_cwd/${SERVE_DEV} || error
+  $CGPT add -b 100 -s 10 -t data -l elsewhere serve_cwd/${SERVE_DEV} || error
+  [ "$(cd serve_cwd && $CGPT query -s "${SOCK}" show -i 1 -l ${SERVE_DEV})" = \
+    "elsewhere" ] || error
+  [ "$($CGPT query -s "${SOCK}" show -i 1 -l ${SERVE_DEV})" = "changed" ] || error
+  rm -rf serve_cwd
+  # nothing a query runs may wait, the others would wait with it
+  $CGPT query -s "${SOCK}" find --wait=6 -l nowhere >/dev/null 2>&1 &
+  WAIT_PID=$!
+  [ "$(timeout 3 $CGPT query -s "${SOCK}" find -l changed -n ${SERVE_DEV})" = \
+    "1" ] || error
+  wait ${WAIT_PID} && error
+  $CGPT query -s "${SOCK}" find --wait -l nowhere 2>&1 | grep -q -- "--wait" \
+    || error
+  mkfifo serve_fifo || error
+  WAIT_STATUS=0
+  timeout 3 $CGPT query -s "${SOCK}" find -l changed -M serve_fifo \
+    ${SERVE_DEV} >/dev/null 2>&1 || WAIT_STATUS=$?
+  [ ${WAIT_STATUS} = 1 ] || error
+  rm -f serve_fifo
+  kill ${SERVE_PID}
+  wait ${SERVE_PID} || error
+  [ -e "${SOCK}" ] && error
+fi
+$CGPT query -s "${SOCK}" show ${SERVE_DEV} 2>/dev/null && error
+rm -f ${SERVE_DEV}
+
+# cgpt-mini is only built with --enable-cgpt-mini.
+CGPT_MINI="$(dirname "$CGPT")/cgpt-mini"
+if [ ! -x "${CGPT_MINI}" ]; then
+  echo "Skipping cgpt-mini tests (not built)"
+else
+  echo "Test cgpt-mini..."
+  MINI_DEV=fake_mini.bin
+  $CGPT create -c -s 1000 ${MINI_DEV} || error
+  $CGPT add -b 100 -s 10 -t coreos-rootfs -l USR-A -P 1 ${MINI_DEV} || error
+  $CGPT add -b 110 -s 10 -t coreos-rootfs -l USR-B -P 2 ${MINI_DEV} || error
+  [ "$($CGPT_MINI show ${MINI_DEV})" = "$($CGPT show ${MINI_DEV})" ] || error
+  [ "$($CGPT_MINI find -l USR-B ${MINI_DEV})" = "${MINI_DEV}2" ] || error
+  $CGPT_MINI prioritize -i 1 ${MINI_DEV} || error
+  [ "$($CGPT show -i 1 -P ${MINI_DEV})" = "2" ] || error
+  $CGPT_MINI add -i 2 -S 1 ${MINI_DEV} || error
+  [ "$($CGPT show -i 2 -S ${MINI_DEV})" = "1" ] || error
+  # new GUIDs need libuuid, given ones don't
+  $CGPT_MINI add -b 120 -s 10 -t data ${MINI_DEV} 2>/dev/null && error
+  $CGPT_MINI add -b 120 -s 10 -t data \
+    -u 12345678-0000-0000-0000-000000000001 \
+    ${MINI_DEV} || error
+  $CGPT_MINI create ${MINI_DEV} >/dev/null 2>&1 && error
+  rm -f ${MINI_DEV}
+fi
+
 # Now make sure that we don't need write access if we're just looking.
 if [ "$(id -u)" -eq 0 ]; then
   echo "Skipping read vs read-write access tests (doesn't work as root)"
@@ -503,6 +1129,7 @@ else
   $CGPT add -i 2 -P 3 ${DEV} 2>/dev/null && error
   $CGPT repair ${DEV} 2>/dev/null && error
   $CGPT prioritize -i 3 ${DEV} 2>/dev/null && error
+  echo "show" | $CGPT batch ${DEV} &>/dev/null && error
 
   # Most 'boot' usage should fail too.
   $CGPT boot -p ${DEV} 2>/dev/null && error
@@ -0,0 +1,123 @@
+#!/bin/bash -eu
+
+# Copyright (c) 2026 Flatcar Authors. All rights reserved.
+# Use of this source code is governed by a BSD-style license that can be
+# found in the LICENSE file.
+#
+# Run tests for the e2size utility on small images made by the mkfs tools
+# found, skipping the filesystems whose tools aren't there.
+
+# Load common constants and variables.
+. "$(dirname "$0")/common.sh"
+
+E2SIZE=$(readlink -f "${1:-./e2size}")
+[ -x "$E2SIZE" ] || error "Can't execute $E2SIZE"
+CGPT=$(readlink -f "${2:-./cgpt}")
+[ -x "$CGPT" ] || error "Can't execute $CGPT"
+
+# Run tests in a dedicated directory for easy cleanup or debugging.
+DIR="${TEST_DIR}/e2size_test_dir"
+[ -d "$DIR" ] || mkdir -p "$DIR"
+warning "testing $E2SIZE in $DIR"
+cd "$DIR"
+
+PATH="${PATH}:/sbin:/usr/sbin"
+have() {
+  type -p "$1" >/dev/null || { echo "Skipping $2 because $1 wasn't found"; \
+                               return 1; }
+}
+
+rm -rf files
+mkdir files
+for i in $(seq 40); do
+  head -c $((i * 3000)) /dev/urandom > files/file$i
+done
+
+echo "Test the sizes of filesystems in images..."
+# each made smaller than its image, which e2size must not report
+if have mkfs.ext4 ext4; then
+  truncate -s 32M fake_ext4.img
+  mkfs.ext4 -q -F -d files fake_ext4.img 16M || error
+  [ "$("$E2SIZE" fake_ext4.img)" = $((16 * 1024 * 1024)) ] || error
+fi
+if have mkfs.xfs xfs; then
+  truncate -s 512M fake_xfs.img
+  mkfs.xfs -q -f -d size=300m fake_xfs.img || error
+  [ "$("$E2SIZE" fake_xfs.img)" = $((300 * 1024 * 1024)) ] || error
+fi
+if have mksquashfs squashfs; then
+  rm -f fake_squashfs.img
+  mksquashfs files fake_squashfs.img -nopad -quiet -no-progress \
+    >/dev/null || error
+  [ "$("$E2SIZE" fake_squashfs.img)" = \
+    $(stat --format=%s fake_squashfs.img) ] || error
+fi
+if have mkfs.erofs erofs; then
+  rm -f fake_erofs.img
+  mkfs.erofs -q fake_erofs.img files >/dev/null || error
+  [ "$("$E2SIZE" fake_erofs.img)" = \
+    $(stat --format=%s fake_erofs.img) ] || error
+fi
+if have mkfs.btrfs btrfs; then
+  truncate -s 512M fake_btrfs.img
+  mkfs.btrfs -q -f -b 256M fake_btrfs.img >/dev/null || error
+  [ "$("$E2SIZE" fake_btrfs.img)" = $((256 * 1024 * 1024)) ] || error
+fi
+head -c $((1024 * 1024)) /dev/zero > fake_none.img
+"$E2SIZE" fake_none.img 2>&1 | grep -q "no supported filesystem" || error
+"$E2SIZE" fake_missing.img 2>/dev/null && error
+# an image that can't be opened fails the same for each of its targets
+if [ "$(id -u)" -ne 0 ]; then
+  cp fake_none.img fake_unreadable.img
+  chmod 0 fake_unreadable.img
+  [ "$("$E2SIZE" fake_unreadable.img@0 fake_unreadable.img@512 2>&1 | \
+       grep -c "Permission denied")" = 2 ] || error
+fi
+
+echo "Test filesystems inside GPT disk images..."
+if have mkfs.ext4 "partitions in images"; then
+  rm -f fake_disk.img
+  $CGPT create -c -s $((2048 + 16 * 2048 + 2048)) fake_disk.img || error
+  $CGPT add -b 2048 -s $((16 * 2048)) -t data fake_disk.img || error
+  mkfs.ext4 -q -F -E offset=$((2048 * 512)) fake_disk.img 8M || error
+  [ "$("$E2SIZE" fake_disk.img:1)" = $((8 * 1024 * 1024)) ] || error
+  [ "$("$E2SIZE" fake_disk.img@$((2048 * 512)))" = $((8 * 1024 * 1024)) ] \
+    || error
+  [ "$("$E2SIZE" fake_disk.img:1 fake_disk.img@0x100000)" = \
+    "$(printf '%s\t%s\n' $((8 * 1024 * 1024)) fake_disk.img:1 \
+                         $((8 * 1024 * 1024)) fake_disk.img@0x100000)" ] || \
+    error
+  "$E2SIZE" fake_disk.img:2 2>&1 | grep -q "no partition 2" || error
+  "$E2SIZE" fake_disk.img@0 2>/dev/null && error
+  "$E2SIZE" fake_disk.img:0 2>/dev/null && error
+fi
+
+echo "Test the minimum sizes of ext4 filesystems..."
+if have resize2fs "minimum sizes"; then
+  for blocks in 1024 4096; do
+    truncate -s 64M fake_min.img
+    mkfs.ext4 -q -F -b ${blocks} -d files fake_min.img || error
+    read MIN_BYTES USED BLOCK_SIZE < <("$E2SIZE" -m fake_min.img) || error
+    [ "${BLOCK_SIZE}" = ${blocks} ] || error
+    [ $((MIN_BYTES % BLOCK_SIZE)) = 0 ] || error
+    MIN=$((MIN_BYTES / BLOCK_SIZE))
+    # at most a little over what resize2fs estimates, which often errs on
+    # the large side
+    ESTIMATE=$(resize2fs -P fake_min.img 2>/dev/null | \
+               sed -n 's/^Estimated minimum size of the filesystem: //p')
+    [ -n "${ESTIMATE}" ] || error
+    [ $((MIN * 20)) -le $((ESTIMATE * 21)) ] || error
+    [ ${USED} -le $((64 * 1024 * 1024 / BLOCK_SIZE)) ] || error
+    # and the filesystem really can be shrunk that far
+    resize2fs -f fake_min.img ${MIN} >/dev/null 2>&1 || error
+    [ "$("$E2SIZE" fake_min.img)" = ${MIN_BYTES} ] || error
+    if type -p e2fsck >/dev/null; then
+      e2fsck -fn fake_min.img >/dev/null 2>&1 || error
+    fi
+  done
+  "$E2SIZE" -m fake_none.img 2>&1 | grep -q "no ext2/3/4 filesystem" || \
+    error
+fi
+
+rm -rf files fake_*.img
+happy "All tests passed."
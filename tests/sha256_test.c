@@ -0,0 +1,112 @@
+/* Copyright (c) 2026 Flatcar Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <string.h>
+
+#include "sha256_test.h"
+#include "cgptlib_test.h"
+#include "cgpt.h"
+#include "cgpt_params.h"
+#include "test_common.h"
+
+static void ToHex(const uint8_t digest[SHA256_DIGEST_SIZE], char *hex) {
+  int i;
+
+  for (i = 0; i < SHA256_DIGEST_SIZE; ++i)
+    sprintf(hex + 2 * i, "%02x", digest[i]);
+}
+
+/* The examples of FIPS 180-4, and the long message of FIPS 180-2. */
+int TestSha256TestVectors() {
+  static char million[1000000];
+  struct {
+    const char *message;
+    size_t len;
+    const char *digest;
+  } cases[] = {
+    {"", 0,
+     "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abc", 3,
+     "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56,
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+     "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 112,
+     "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+    {million, sizeof(million),
+     "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+  };
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  char hex[2 * SHA256_DIGEST_SIZE + 1];
+  struct sha256_ctx ctx;
+  int i, backend;
+
+  memset(million, 'a', sizeof(million));
+  EXPECT(Sha256BackendSupported(SHA256_BACKEND_GENERIC));
+  EXPECT(!Sha256BackendSupported(SHA256_BACKEND_COUNT));
+  EXPECT(Sha256Backend(SHA256_BACKEND_COUNT, "", 0, digest) == CGPT_FAILED);
+
+  for (i = 0; i < ARRAY_SIZE(cases); ++i) {
+    Sha256Init(&ctx);
+    Sha256Update(&ctx, cases[i].message, cases[i].len);
+    Sha256Final(&ctx, digest);
+    ToHex(digest, hex);
+    EXPECT(!strcmp(hex, cases[i].digest));
+    for (backend = 0; backend < SHA256_BACKEND_COUNT; ++backend) {
+      if (!Sha256BackendSupported(backend))
+        continue;
+      EXPECT(Sha256Backend(backend, cases[i].message, cases[i].len,
+                           digest) == CGPT_OK);
+      ToHex(digest, hex);
+      EXPECT(!strcmp(hex, cases[i].digest));
+    }
+  }
+  return TEST_OK;
+}
+
+/* Compares every supported backend with the generic one over lengths
+ * around the block and padding boundaries, at odd alignments, and checks
+ * that hashing in pieces matches hashing at once. */
+int TestSha256Backends() {
+  static uint8_t buf[4096 + 16];
+  uint8_t want[SHA256_DIGEST_SIZE], got[SHA256_DIGEST_SIZE];
+  uint32_t lens[] = {1, 55, 56, 63, 64, 65, 119, 120, 128, 1000};
+  uint32_t seed = 0x12345678;
+  struct sha256_ctx ctx;
+  uint32_t len, offset;
+  int i, j, backend;
+
+  for (i = 0; i < sizeof(buf); ++i) {
+    seed = seed * 1103515245 + 12345;
+    buf[i] = seed >> 16;
+  }
+
+  for (backend = 0; backend < SHA256_BACKEND_COUNT; ++backend) {
+    if (!Sha256BackendSupported(backend))
+      continue;
+    for (offset = 0; offset < 16; offset += 3) {
+      for (len = 0; len <= 200; ++len) {
+        Sha256Backend(SHA256_BACKEND_GENERIC, buf + offset, len, want);
+        Sha256Backend(backend, buf + offset, len, got);
+        EXPECT(!memcmp(want, got, sizeof(want)));
+      }
+      Sha256Backend(SHA256_BACKEND_GENERIC, buf + offset, 4096, want);
+      Sha256Backend(backend, buf + offset, 4096, got);
+      EXPECT(!memcmp(want, got, sizeof(want)));
+    }
+  }
+
+  for (i = 0; i < ARRAY_SIZE(lens); ++i) {
+    for (j = 0; j < ARRAY_SIZE(lens); ++j) {
+      Sha256Init(&ctx);
+      Sha256Update(&ctx, buf, lens[i]);
+      Sha256Update(&ctx, buf + lens[i], lens[j]);
+      Sha256Final(&ctx, got);
+      Sha256Backend(SHA256_BACKEND_GENERIC, buf, lens[i] + lens[j], want);
+      EXPECT(!memcmp(want, got, sizeof(want)));
+    }
+  }
+  return TEST_OK;
+}
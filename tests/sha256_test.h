@@ -0,0 +1,11 @@
+/* Copyright (c) 2026 Flatcar Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+#ifndef VBOOT_REFERENCE_SHA256_TEST_H_
+#define VBOOT_REFERENCE_SHA256_TEST_H_
+
+int TestSha256TestVectors();
+int TestSha256Backends();
+
+#endif  /* VBOOT_REFERENCE_SHA256_TEST_H_ */